@@ -2,7 +2,12 @@
 
 #include "dllimport.h"
 #include "usvfsparameters.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <shared_memory.h>
+#include <skip_rules.h>
+#include <string_view>
 
 namespace usvfs
 {
@@ -21,6 +26,42 @@ private:
   shared::StringT m_libraryPath;
 };
 
+/**
+ * process local copy of the lists in SharedParameters, reading from it neither locks
+ * the shared memory nor allocates
+ */
+class DLLEXPORT ParametersSnapshot
+{
+public:
+  // version of the shared parameters this was copied from
+  uint32_t version() const { return m_version; }
+
+  bool executableBlacklisted(std::string_view app, std::string_view cmd) const;
+  const shared::SuffixRules& skipFileSuffixes() const { return m_fileSuffixSkipList; }
+  const shared::NameRules& skipDirectories() const { return m_directorySkipList; }
+  // libraries to load into the given process, empty if there are none
+  const std::vector<std::string>& forcedLibraries(std::string_view processName) const;
+
+private:
+  friend class SharedParameters;
+
+  struct ForcedLibraries
+  {
+    std::string processName;
+    std::vector<std::string> libraries;
+  };
+
+  uint32_t m_version{0};
+  // the blacklisted names with a leading backslash, matching the end of the
+  // application and anywhere in the command line
+  shared::SuffixRules m_applicationBlacklist;
+  shared::SubstringRules m_commandLineBlacklist;
+  shared::SuffixRules m_fileSuffixSkipList;
+  shared::NameRules m_directorySkipList;
+  // sorted case insensitively by process name
+  std::vector<ForcedLibraries> m_forcedLibraries;
+};
+
 class DLLEXPORT SharedParameters
 {
 public:
@@ -33,6 +74,12 @@ public:
 
   usvfsParameters makeLocal() const;
 
+  // incremented whenever one of the lists in the snapshot changes. Processes come
+  // and go much more often, so the process list has a version of its own
+  uint32_t version() const;
+  uint32_t processListVersion() const;
+  ParametersSnapshot snapshot() const;
+
   std::string instanceName() const;
   std::string currentSHMName() const;
   std::string currentInverseSHMName() const;
@@ -92,6 +139,8 @@ private:
   using ForcedLibraries =
       boost::container::slist<ForcedLibrary, ForcedLibraryAllocatorT>;
 
+  void changed();
+
   mutable bi::interprocess_mutex m_mutex;
   shared::StringT m_instanceName;
   shared::StringT m_currentSHMName;
@@ -101,6 +150,10 @@ private:
   CrashDumpsType m_crashDumpsType;
   shared::StringT m_crashDumpsPath;
   std::chrono::milliseconds m_delayProcess;
+  shared::StringT m_tracePath;
+  bool m_profileCache;
+  std::atomic<uint32_t> m_version;
+  std::atomic<uint32_t> m_processListVersion;
   uint32_t m_userCount;
   ProcessBlacklist m_processBlacklist;
   ProcessList m_processList;
@@ -109,4 +162,27 @@ private:
   ForcedLibraries m_forcedLibraries;
 };
 
+/**
+ * process local ParametersSnapshot of a SharedParameters, only copied again after
+ * the lists have changed
+ */
+class DLLEXPORT ParametersSnapshotCache
+{
+public:
+  std::shared_ptr<const ParametersSnapshot>
+  get(const SharedParameters& parameters) const;
+
+private:
+  struct Entry
+  {
+    const SharedParameters* parameters;
+    ParametersSnapshot snapshot;
+  };
+
+  bool current(const Entry* entry, const SharedParameters& parameters) const;
+
+  mutable std::atomic<std::shared_ptr<const Entry>> m_entry;
+  mutable std::mutex m_mutex;
+};
+
 }  // namespace usvfs
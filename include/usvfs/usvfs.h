@@ -59,9 +59,87 @@ static const unsigned int LINKFLAG_FAILIFSKIPPED =
                  // the sharedparameters class, those lists are checked during virtual
                  // linking
 
+// flags of the nodes returned by usvfsReadTreeCursor
+static const unsigned int TREEFLAG_DIRECTORY = 0x00000001;
+static const unsigned int TREEFLAG_DUMMY =
+    0x00000002;  // the node only exists because there are nodes below it
+static const unsigned int TREEFLAG_CREATETARGET =
+    0x00000004;  // new files below the node are created in its link target
+static const unsigned int TREEFLAG_METADATASTALE =
+    0x00000008;  // the file was opened for writing after it was linked
+
 extern "C"
 {
 
+  /**
+   * statistics of a single hook, totals of all processes connected to the vfs
+   */
+  struct usvfsHookStatistics
+  {
+    char name[64];
+    uint64_t calls;
+    // lookups in the redirection tree that rerouted the path
+    uint64_t reroutes;
+    // lookups in the redirection tree that didn't
+    uint64_t misses;
+    // exceptions caught in the hook
+    uint64_t errors;
+    // total time spent in the hook, including the call to the original function
+    uint64_t nanoseconds;
+    // latency[0] counts calls that took no measurable time, latency[i] calls that
+    // took at least 2^(i-1) and less than 2^i nanoseconds, the last entry also counts
+    // all longer calls
+    uint64_t latency[32];
+  };
+
+  /**
+   * wait times of a lock shared between the processes connected to the vfs
+   */
+  struct usvfsLockStatistics
+  {
+    // the lock and how it is acquired, "context read", "context write", "parameters"
+    // or "tree meta"
+    char name[32];
+    // function that acquired the lock last
+    char lastHolder[64];
+    // function that held the lock when the longest wait started
+    char maxWaitHolder[64];
+    uint64_t acquisitions;
+    // acquisitions that couldn't get the lock right away
+    uint64_t contended;
+    // total time spent waiting for the lock
+    uint64_t waitNanoseconds;
+    uint64_t maxWaitNanoseconds;
+    // waits longer than 200 ms
+    uint64_t timeouts;
+  };
+
+  /**
+   * a node of the virtual directory tree as returned by usvfsReadTreeCursor
+   */
+  struct usvfsTreeRecord
+  {
+    // nodes are numbered in the order they are read, starting with 1 for the root,
+    // so the parent of a node is always read before it
+    uint32_t id;
+    // 0 for the root
+    uint32_t parentId;
+    // 0 for the root, 1 for the nodes directly below it and so on
+    uint32_t depth;
+    // combination of TREEFLAG_* values
+    uint32_t flags;
+    // length of the link target in characters, it has been truncated if this isn't
+    // less than the size of linkTarget
+    uint32_t linkTargetLength;
+    wchar_t name[256];
+    wchar_t linkTarget[1024];
+  };
+
+  /**
+   * position of a paged enumeration of the virtual directory tree
+   */
+  struct usvfsTreeCursor;
+
   /**
    * removes all virtual mappings
    */
@@ -124,6 +202,43 @@ extern "C"
   //
   DLLEXPORT BOOL WINAPI usvfsGetVFSProcessList2(size_t* count, DWORD** buffer);
 
+  // retrieve the statistics of all hooks that have been called in any process
+  // connected to the vfs, stores an array of `count` elements ordered by name in
+  // `*buffer`
+  //
+  // if this returns TRUE and `count` is not 0, the caller must release the buffer
+  // with `free(*buffer)`
+  //
+  // return values:
+  //   - ERROR_INVALID_PARAMETERS:  either `count` or `buffer` is NULL
+  //   - ERROR_INVALID_STATE:       not connected to a vfs
+  //   - ERROR_NOT_ENOUGH_MEMORY:   calloc() failed
+  //
+  DLLEXPORT BOOL WINAPI usvfsGetHookStatistics(size_t* count,
+                                               usvfsHookStatistics** buffer);
+
+  // switches lock profiling on or off for all processes connected to the vfs, it is
+  // off by default
+  //
+  // return values:
+  //   - ERROR_INVALID_STATE:       not connected to a vfs
+  //
+  DLLEXPORT BOOL WINAPI usvfsEnableLockStatistics(BOOL enable);
+
+  // retrieve the wait times of all locks that have been acquired while lock
+  // profiling was enabled, stores an array of `count` elements in `*buffer`
+  //
+  // if this returns TRUE and `count` is not 0, the caller must release the buffer
+  // with `free(*buffer)`
+  //
+  // return values:
+  //   - ERROR_INVALID_PARAMETERS:  either `count` or `buffer` is NULL
+  //   - ERROR_INVALID_STATE:       not connected to a vfs
+  //   - ERROR_NOT_ENOUGH_MEMORY:   calloc() failed
+  //
+  DLLEXPORT BOOL WINAPI usvfsGetLockStatistics(size_t* count,
+                                               usvfsLockStatistics** buffer);
+
   /**
    * spawn a new process that can see the virtual file system. The signature is
    * identical to CreateProcess
@@ -143,6 +258,25 @@ extern "C"
   DLLEXPORT bool WINAPI usvfsGetLogMessages(LPSTR buffer, size_t size,
                                             bool blocking = false);
 
+  /**
+   * retrieve as many log messages as fit into the buffer with a single call. Each
+   * message is stored as its length in bytes (uint32_t) followed by the text, without
+   * a terminating null
+   * @param buffer   the buffer to write to
+   * @param size     size of the buffer in bytes. A message that doesn't fit into the
+   *                 empty buffer is truncated, others are kept for the next call
+   * @param written  receives the number of bytes written to the buffer
+   * @param count    receives the number of messages written to the buffer
+   * @param timeout  milliseconds to wait for the first message, 0 to return
+   *                 immediately or INFINITE
+   * @return true if at least one message was retrieved. If the messages couldn't be
+   *         retrieved, false is returned and the buffer holds a single message
+   *         describing the error
+   */
+  DLLEXPORT bool WINAPI usvfsGetLogMessagesBatch(LPSTR buffer, size_t size,
+                                                 size_t* written, size_t* count,
+                                                 DWORD timeout = 0);
+
   /**
    * retrieves a readable representation of the vfs tree
    * @param buffer the buffer to write to. this may be null if you only want to
@@ -153,6 +287,45 @@ extern "C"
    */
   DLLEXPORT BOOL WINAPI usvfsCreateVFSDump(LPSTR buffer, size_t* size);
 
+  /**
+   * writes a readable representation of the vfs tree to a file, in the same format
+   * as usvfsCreateVFSDump. The tree is read in pages so it is neither copied as a
+   * whole nor locked while writing
+   * @param file  handle of a file opened for writing
+   */
+  DLLEXPORT BOOL WINAPI usvfsWriteVFSDump(HANDLE file);
+
+  // starts a depth first enumeration of the vfs tree, the cursor has to be closed
+  // with usvfsCloseTreeCursor
+  //
+  // return values:
+  //   - ERROR_INVALID_PARAMETERS:  `cursor` is NULL
+  //   - ERROR_INVALID_STATE:       not connected to a vfs
+  //   - ERROR_NOT_ENOUGH_MEMORY:   the cursor couldn't be allocated
+  //
+  DLLEXPORT BOOL WINAPI usvfsOpenTreeCursor(usvfsTreeCursor** cursor);
+
+  // reads the next `count` nodes of the vfs tree at most into `records`, `*read`
+  // receives the number of nodes read and is 0 once all nodes have been read
+  //
+  // the tree is only locked during the call. If it changes in between calls, the
+  // enumeration continues after the node read last, in the order of the names: nodes
+  // added behind it are read, nodes removed before they are reached are not
+  //
+  // return values:
+  //   - ERROR_INVALID_PARAMETERS:  `cursor` or `read` is NULL, or `records` is NULL
+  //                                and `count` is not 0
+  //   - ERROR_INVALID_STATE:       not connected to a vfs
+  //
+  DLLEXPORT BOOL WINAPI usvfsReadTreeCursor(usvfsTreeCursor* cursor,
+                                            usvfsTreeRecord* records, size_t count,
+                                            size_t* read);
+
+  /**
+   * releases a cursor opened with usvfsOpenTreeCursor
+   */
+  DLLEXPORT VOID WINAPI usvfsCloseTreeCursor(usvfsTreeCursor* cursor);
+
   /**
    * adds an executable to the blacklist so it doesn't get exposed to the virtual
    * file system
@@ -212,6 +385,13 @@ extern "C"
 
   // #if defined(UNITTEST) || defined(_WINDLL)
   DLLEXPORT void WINAPI usvfsInitLogging(bool toLocal = false);
+
+  /**
+   * same as usvfsInitLogging but sets the depth of the log queue. The queue is made
+   * of slots of 128 bytes, a message takes one slot per 116 bytes of text. The depth
+   * is rounded up to a power of two, the default is 4096 slots
+   */
+  DLLEXPORT void WINAPI usvfsInitLogging2(bool toLocal, size_t queueDepth);
   // #endif
 
   /**
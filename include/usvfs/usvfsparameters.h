@@ -63,6 +63,22 @@ extern "C"
   DLLEXPORT void usvfsSetCrashDumpPath(usvfsParameters* p, const char* path);
   DLLEXPORT void usvfsSetProcessDelay(usvfsParameters* p, int milliseconds);
 
+  // enables tracing the phases of every hook call (path canonicalization, context
+  // lock, tree walk, original function, logging) in all processes connected with
+  // these parameters. Each process writes its spans to <path>\<exe>-<pid>.json in
+  // the trace event format of chrome://tracing and Perfetto when it disconnects or
+  // exits. An empty path disables tracing, the default
+  //
+  DLLEXPORT void usvfsSetTracePath(usvfsParameters* p, const char* path);
+
+  // lets the GetPrivateProfileString and GetPrivateProfileSection hooks answer reads
+  // of redirected ini files from a copy parsed once per process. The file is parsed
+  // again when its size or last write time changes and WritePrivateProfileString
+  // calls through usvfs invalidate it. Lookups whose result isn't certain still go
+  // to the real api. Disabled by default
+  //
+  DLLEXPORT void usvfsSetProfileCache(usvfsParameters* p, BOOL enable);
+
   DLLEXPORT const char* usvfsLogLevelToString(LogLevel lv);
   DLLEXPORT const char* usvfsCrashDumpTypeToString(CrashDumpsType t);
 }
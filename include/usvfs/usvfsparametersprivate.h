@@ -11,6 +11,8 @@ struct usvfsParameters
   CrashDumpsType crashDumpsType{CrashDumpsType::None};
   char crashDumpsPath[260];
   int delayProcessMs;
+  char tracePath[260];
+  bool profileCache;
 
   usvfsParameters();
   usvfsParameters(const usvfsParameters&)            = default;
@@ -19,7 +21,7 @@ struct usvfsParameters
   usvfsParameters(const char* instanceName, const char* currentSHMName,
                   const char* currentInverseSHMName, bool debugMode, LogLevel logLevel,
                   CrashDumpsType crashDumpsType, const char* crashDumpsPath,
-                  int delayProcessMs);
+                  int delayProcessMs, const char* tracePath, bool profileCache);
 
   usvfsParameters(const USVFSParameters& oldParams);
 
@@ -29,4 +31,6 @@ struct usvfsParameters
   void setCrashDumpType(CrashDumpsType type);
   void setCrashDumpPath(const char* path);
   void setProcessDelay(int milliseconds);
+  void setTracePath(const char* path);
+  void setProfileCache(bool enable);
 };
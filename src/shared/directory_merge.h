@@ -0,0 +1,223 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief a stream of directory entries, ordered by ascending key
+ *
+ * sources are pulled lazily by DirectoryMerge, they only have to keep the state
+ * needed to produce their current entry
+ */
+template <typename KeyT>
+class DirectoryEntrySource
+{
+public:
+  virtual ~DirectoryEntrySource() = default;
+
+  /**
+   * @return true if there is a current entry, false once the source is exhausted.
+   *         this may fetch the next batch of entries from the underlying listing
+   */
+  virtual bool valid() = 0;
+
+  /**
+   * @return sort key of the current entry, only defined if valid() returned true
+   */
+  virtual const KeyT& key() const = 0;
+
+  /**
+   * @return size in bytes of the record of the current entry
+   */
+  virtual std::size_t recordSize() const = 0;
+
+  /**
+   * @brief copy the record of the current entry to the specified location. The
+   *        destination has room for at least recordSize() bytes
+   */
+  virtual void copyRecord(void* destination) const = 0;
+
+  /**
+   * @brief advance to the next entry
+   */
+  virtual void next() = 0;
+};
+
+enum class MergeStatus
+{
+  Success,
+  NoMoreEntries,
+  BufferTooSmall
+};
+
+struct MergeResult
+{
+  MergeStatus status;
+  // number of bytes written to the buffer, including alignment padding
+  std::size_t bytesWritten;
+  // number of records written to the buffer
+  std::size_t entries;
+};
+
+/**
+ * @brief merges several sorted directory listings into one buffer of chained
+ *        records
+ *
+ * records are laid out like the FILE_*_INFORMATION structures returned by
+ * NtQueryDirectoryFile: each one starts with a 32-bit offset to the next record
+ * (0 for the last one) and records are 8-byte aligned.
+ *
+ * if several sources produce an entry with the same key, only the one from the
+ * source added first is emitted, so sources should be added in order of
+ * precedence. the merge keeps no state besides the sources themselves, so it can
+ * be used as the cursor of a directory handle and resumed on every query.
+ */
+template <typename KeyT, typename CompareT = std::less<KeyT>>
+class DirectoryMerge
+{
+public:
+  typedef DirectoryEntrySource<KeyT> SourceT;
+
+  static constexpr std::size_t RecordAlignment = 8;
+
+  explicit DirectoryMerge(CompareT compare = CompareT()) : m_Compare(compare) {}
+
+  /**
+   * @brief add a source to the merge. sources added earlier take precedence over
+   *        later ones for entries with the same key
+   */
+  void addSource(std::unique_ptr<SourceT> source)
+  {
+    m_Sources.push_back(std::move(source));
+  }
+
+  /**
+   * @return number of sources in this merge
+   */
+  std::size_t numSources() const { return m_Sources.size(); }
+
+  /**
+   * @brief write the next records to the buffer, in key order
+   * @param buffer the buffer to write to
+   * @param size size of the buffer in bytes
+   * @param singleEntry if true, at most one record is written
+   * @return status of the operation. BufferTooSmall is only reported if not even
+   *         the first record fit into the buffer, in which case that record is
+   *         not consumed
+   */
+  MergeResult fill(void* buffer, std::size_t size, bool singleEntry)
+  {
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+
+    MergeResult result{MergeStatus::Success, 0, 0};
+    std::size_t lastOffset = 0;
+
+    while (SourceT* source = nextSource()) {
+      const std::size_t offset = align(result.bytesWritten);
+      const std::size_t length = source->recordSize();
+
+      if ((offset > size) || (length > size - offset)) {
+        if (result.entries == 0) {
+          result.status = MergeStatus::BufferTooSmall;
+        }
+        break;
+      }
+
+      source->copyRecord(out + offset);
+      setNextOffset(out + offset, 0);
+      if (result.entries > 0) {
+        setNextOffset(out + lastOffset, static_cast<uint32_t>(offset - lastOffset));
+      }
+
+      lastOffset          = offset;
+      result.bytesWritten = offset + length;
+      ++result.entries;
+
+      source->next();
+
+      if (singleEntry) {
+        break;
+      }
+    }
+
+    if ((result.entries == 0) && (result.status == MergeStatus::Success)) {
+      result.status = MergeStatus::NoMoreEntries;
+    }
+
+    return result;
+  }
+
+private:
+  static std::size_t align(std::size_t offset)
+  {
+    return (offset + RecordAlignment - 1) & ~(RecordAlignment - 1);
+  }
+
+  static void setNextOffset(uint8_t* record, uint32_t offset)
+  {
+    memcpy(record, &offset, sizeof(offset));
+  }
+
+  // determines the source with the smallest current key and drops the entries of
+  // lower-precedence sources that have the same key
+  SourceT* nextSource()
+  {
+    SourceT* result = nullptr;
+
+    for (const auto& source : m_Sources) {
+      if (!source->valid()) {
+        continue;
+      }
+
+      if ((result == nullptr) || m_Compare(source->key(), result->key())) {
+        result = source.get();
+      }
+    }
+
+    if (result != nullptr) {
+      // ties are resolved in favour of the first source, so every other source
+      // positioned at the same key is shadowed
+      for (const auto& source : m_Sources) {
+        if ((source.get() != result) && source->valid() &&
+            !m_Compare(source->key(), result->key()) &&
+            !m_Compare(result->key(), source->key())) {
+          source->next();
+        }
+      }
+    }
+
+    return result;
+  }
+
+  CompareT m_Compare;
+  std::vector<std::unique_ptr<SourceT>> m_Sources;
+};
+
+}  // namespace usvfs::shared
@@ -0,0 +1,112 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "file_metadata.h"
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace usvfs::shared
+{
+
+/**
+ * @return true if records of the specified FILE_*_INFORMATION type can be built from
+ *         a file name and its metadata. This is the case for the types returned by
+ *         directory listings, except the ones describing NTFS metadata files and the
+ *         ones carrying a file id, which isn't part of the metadata
+ */
+template <typename InfoT>
+constexpr bool canSynthesizeRecord()
+{
+  return requires(InfoT& info) {
+    info.NextEntryOffset;
+    info.FileNameLength;
+    info.FileName;
+  } && !requires(InfoT& info) { info.FileId; };
+}
+
+/**
+ * @return size in bytes of a record of the specified type with a name of the
+ *         specified length, without trailing alignment
+ */
+template <typename InfoT>
+constexpr std::size_t synthesizedRecordSize(std::size_t nameLength)
+{
+  return offsetof(InfoT, FileName) +
+         nameLength * sizeof(std::declval<InfoT&>().FileName[0]);
+}
+
+/**
+ * @brief build a directory listing record as NtQueryDirectoryFile would return it
+ *
+ * the record is built from the name and the metadata recorded for the file alone,
+ * the disk is not accessed. EA sizes are reported as 0 and the short name is left
+ * empty, as for a volume without 8.3 names
+ *
+ * @param metadata the metadata of the file
+ * @param name name of the file, in UTF-16 code units
+ * @param nameLength length of the name in code units
+ * @param buffer the buffer to write the record to
+ * @param size size of the buffer in bytes
+ * @return size of the record written or 0 if the buffer is too small or records of
+ *         this type can't be synthesized
+ */
+template <typename InfoT, typename CharT>
+std::size_t synthesizeRecord(const FileMetadata& metadata, const CharT* name,
+                             std::size_t nameLength, void* buffer, std::size_t size)
+{
+  if constexpr (!canSynthesizeRecord<InfoT>()) {
+    return 0;
+  } else {
+    static_assert(sizeof(CharT) == sizeof(std::declval<InfoT&>().FileName[0]),
+                  "name has to be in the character type of the record");
+
+    const std::size_t headerSize = offsetof(InfoT, FileName);
+    const std::size_t length     = synthesizedRecordSize<InfoT>(nameLength);
+    if (length > size) {
+      return 0;
+    }
+
+    memset(buffer, 0, headerSize);
+    InfoT* info = static_cast<InfoT*>(buffer);
+
+    if constexpr (requires { info->CreationTime; }) {
+      info->CreationTime.QuadPart   = metadata.creationTime;
+      info->LastAccessTime.QuadPart = metadata.lastAccessTime;
+      info->LastWriteTime.QuadPart  = metadata.lastWriteTime;
+      info->ChangeTime.QuadPart     = metadata.changeTime;
+      info->EndOfFile.QuadPart      = static_cast<int64_t>(metadata.size);
+      info->AllocationSize.QuadPart = static_cast<int64_t>(metadata.allocationSize);
+      info->FileAttributes          = metadata.attributes;
+    }
+
+    info->FileNameLength =
+        static_cast<decltype(info->FileNameLength)>(nameLength * sizeof(CharT));
+    memcpy(info->FileName, name, nameLength * sizeof(CharT));
+
+    return length;
+  }
+}
+
+}  // namespace usvfs::shared
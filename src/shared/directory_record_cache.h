@@ -0,0 +1,326 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief an open directory that is read in batches
+ */
+template <typename StringT>
+class DirectoryListing
+{
+public:
+  typedef std::function<void(const StringT& name, const void* record, size_t size)>
+      VisitorT;
+
+  virtual ~DirectoryListing() = default;
+
+  /**
+   * @brief read the next batch of entries, calling the visitor for each
+   * @return false once the listing is exhausted or failed
+   */
+  virtual bool read(const VisitorT& visitor) = 0;
+};
+
+/**
+ * @brief looks up the directory records of individual files by enumerating their
+ *        parent directories in batches
+ *
+ * instead of opening the parent directory and querying a single name for every
+ * file, each directory is opened once and read with a large buffer. records that
+ * are read ahead of the file asked for are kept until they are asked for
+ * themselves, so each record is read only once no matter in which order the files
+ * are looked up. the listing of a directory stays open across lookups until it is
+ * exhausted. if too many listings are open at the same time, the least recently
+ * used one is read to the end and closed.
+ * the number of records kept is limited. Lookups usually come in the order of the
+ * keys, so once the limit is reached the records before the last lookup are
+ * dropped first, then the ones with the greatest keys. The directory is listed
+ * again if one of them is asked for.
+ *
+ * a directory is forgotten once its listing is closed and none of its records are
+ * left, so the cache holds at most maxOpen listings and maxPending records, plus
+ * the names of the directories those belong to.
+ */
+template <typename StringT>
+class DirectoryRecordCache
+{
+public:
+  typedef DirectoryListing<StringT> ListingT;
+  typedef std::function<std::unique_ptr<ListingT>(const StringT& directory)> OpenerT;
+  typedef std::function<StringT(const StringT&)> NormalizeT;
+
+  /**
+   * @param opener opens a directory for listing, returns nullptr on failure
+   * @param normalize creates the lookup key for directory and file names, usually
+   *        case folding
+   * @param maxOpen number of directory listings kept open at the same time
+   * @param maxPending number of records read ahead that are kept, over all
+   *        directories. Directory records are a few hundred bytes at most, so the
+   *        default keeps the read-ahead of a cache well below 1 MB
+   */
+  DirectoryRecordCache(OpenerT opener, NormalizeT normalize, size_t maxOpen = 16,
+                       size_t maxPending = 1024)
+      : m_Opener(opener), m_Normalize(normalize), m_MaxOpen(maxOpen),
+        m_MaxPending(maxPending)
+  {}
+
+  /**
+   * @brief retrieve the record of a file. Each record can only be retrieved once
+   * @param directory the directory containing the file
+   * @param name name of the file
+   * @param record receives the record as produced by the listing
+   * @return true if the record was found, false if the directory doesn't contain
+   *         the file or can't be listed
+   */
+  bool lookup(const StringT& directory, const StringT& name,
+              std::vector<uint8_t>& record)
+  {
+    m_LookupKey      = m_Normalize(name);
+    Directory& dir   = directoryEntry(directory);
+    const bool found = find(dir, m_LookupKey, record);
+    prune(dir);
+    return found;
+  }
+
+  /**
+   * @return number of directories opened so far
+   */
+  size_t numOpened() const { return m_Opened; }
+
+  /**
+   * @return number of batches read so far
+   */
+  size_t numReads() const { return m_Reads; }
+
+  /**
+   * @return number of records read ahead and kept
+   */
+  size_t numPending() const { return m_NumPending; }
+
+  /**
+   * @return number of directories that have an open listing or records kept
+   */
+  size_t numDirectories() const { return m_Directories.size(); }
+
+private:
+  struct Directory
+  {
+    StringT key;
+    StringT name;
+    std::unique_ptr<ListingT> listing;
+    std::unordered_map<StringT, std::vector<uint8_t>> pending;
+    // records were read but not kept
+    bool dropped{false};
+  };
+
+  bool find(Directory& dir, const StringT& key, std::vector<uint8_t>& record)
+  {
+    auto iter = dir.pending.find(key);
+    if (iter != dir.pending.end()) {
+      record = std::move(iter->second);
+      forget(dir, iter);
+      return true;
+    }
+
+    bool reopened = false;
+    for (;;) {
+      if (!dir.listing) {
+        // the record may have been dropped, but one more listing has to do
+        if (!dir.dropped || reopened) {
+          return false;
+        }
+        dir.dropped = false;
+        reopened    = true;
+        open(dir);
+        continue;
+      }
+
+      bool found = false;
+      if (!read(dir, &key, record, found)) {
+        close(dir);
+      }
+      if (found) {
+        return true;
+      }
+    }
+  }
+
+  Directory& directoryEntry(const StringT& directory)
+  {
+    auto res = m_Directories.try_emplace(m_Normalize(directory));
+    Directory& dir = res.first->second;
+
+    if (res.second) {
+      dir.key  = res.first->first;
+      dir.name = directory;
+      open(dir);
+    } else if (dir.listing && (m_Open.front() != &dir)) {
+      // lookups usually come in runs for the same directory
+      m_Open.remove(&dir);
+      m_Open.push_front(&dir);
+    }
+
+    return dir;
+  }
+
+  void open(Directory& dir)
+  {
+    dir.listing = m_Opener(dir.name);
+    ++m_Opened;
+
+    if (dir.listing) {
+      if (m_Open.size() >= m_MaxOpen) {
+        // once records are dropped there is no point in reading any further
+        Directory* oldest = m_Open.back();
+        while (!oldest->dropped && read(*oldest)) {}
+        close(*oldest);
+        prune(*oldest);
+      }
+      m_Open.push_front(&dir);
+    }
+  }
+
+  bool read(Directory& dir)
+  {
+    std::vector<uint8_t> unused;
+    bool found = false;
+    return read(dir, nullptr, unused, found);
+  }
+
+  // reads the next batch of the listing. The record for key, if any, is stored in
+  // record instead of being kept
+  bool read(Directory& dir, const StringT* key, std::vector<uint8_t>& record,
+            bool& found)
+  {
+    ++m_Reads;
+    return dir.listing->read([&](const StringT& entryName, const void* data,
+                                 size_t size) {
+      const uint8_t* bytes = static_cast<const uint8_t*>(data);
+      StringT entryKey     = m_Normalize(entryName);
+      if (!found && (key != nullptr) && (entryKey == *key)) {
+        record.assign(bytes, bytes + size);
+        found = true;
+        return;
+      }
+
+      auto res = dir.pending.try_emplace(entryKey);
+      if (res.second) {
+        if ((m_NumPending >= m_MaxPending) && !makeRoom(dir, entryKey)) {
+          dir.pending.erase(res.first);
+          dir.dropped = true;
+          return;
+        }
+        m_Order.emplace(std::move(entryKey), &dir);
+        ++m_NumPending;
+      }
+      res.first->second.assign(bytes, bytes + size);
+    });
+  }
+
+  // makes room for the record with key by dropping the one least likely to be asked
+  // for, unless that is the new record itself. Records before the last lookup have
+  // most likely been retrieved already, they are usually read again when a
+  // directory is listed a second time. Called while reading dir, so dir isn't pruned
+  bool makeRoom(Directory& dir, const StringT& key)
+  {
+    if (m_Order.empty() || (key < m_LookupKey)) {
+      return false;
+    }
+
+    auto victim = m_Order.begin();
+    if (!(victim->first < m_LookupKey)) {
+      victim = std::prev(m_Order.end());
+      if (!(key < victim->first)) {
+        return false;
+      }
+    }
+
+    Directory* other = victim->second;
+    other->dropped   = true;
+    forget(*other, other->pending.find(victim->first));
+    if (other != &dir) {
+      prune(*other);
+    }
+    return true;
+  }
+
+  void forget(Directory& dir,
+              typename std::unordered_map<StringT, std::vector<uint8_t>>::iterator iter)
+  {
+    auto range = m_Order.equal_range(iter->first);
+    for (auto order = range.first; order != range.second; ++order) {
+      if (order->second == &dir) {
+        m_Order.erase(order);
+        break;
+      }
+    }
+    dir.pending.erase(iter);
+    --m_NumPending;
+  }
+
+  void close(Directory& dir)
+  {
+    dir.listing.reset();
+    m_Open.remove(&dir);
+  }
+
+  // forgets the directory if there is nothing left to look up in it. Records that
+  // were dropped are found by listing the directory again either way
+  void prune(Directory& dir)
+  {
+    if (!dir.listing && dir.pending.empty()) {
+      m_Directories.erase(m_Directories.find(dir.key));
+    }
+  }
+
+  OpenerT m_Opener;
+  NormalizeT m_Normalize;
+  size_t m_MaxOpen;
+  size_t m_MaxPending;
+
+  // node based so references to the entries stay valid
+  std::unordered_map<StringT, Directory> m_Directories;
+  // directories with an open listing, most recently used first
+  std::list<Directory*> m_Open;
+  // the keys of all records kept, to find the ones least likely to be asked for
+  std::multimap<StringT, Directory*> m_Order;
+  // key of the file looked up last
+  StringT m_LookupKey;
+
+  size_t m_Opened{0};
+  size_t m_Reads{0};
+  size_t m_NumPending{0};
+};
+
+}  // namespace usvfs::shared
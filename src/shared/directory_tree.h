@@ -21,8 +21,10 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "exceptionex.h"
+#include "logger_handle.h"
 #include "logging.h"
 #include "shared_memory.h"
+#include "stringcast.h"
 #include "stringutils.h"
 #include "wildcard.h"
 
@@ -63,10 +65,12 @@ void advanceIter(fs::path::iterator& iter, const fs::path::iterator& end);
 
 // decomposes a path into its components
 //
-class DecomposablePath
+template <typename CharT>
+class BasicDecomposablePath
 {
 public:
-  explicit DecomposablePath(std::string s) : m_s(std::move(s)), m_begin(0), m_end(0)
+  explicit BasicDecomposablePath(std::basic_string<CharT> s)
+      : m_s(std::move(s)), m_begin(0), m_end(0)
   {
     m_end = nextSeparator(m_begin);
   }
@@ -93,7 +97,9 @@ public:
       //  - slashes, happens with consecutive separators
       //  - dot, unnecessary
       const auto c = current();
-      if (!c.empty() && c != "\\" && c != "/" && c != ".") {
+      if (!c.empty() &&
+          !((c.size() == 1) &&
+            (c[0] == CharT('\\') || c[0] == CharT('/') || c[0] == CharT('.')))) {
         return true;
       }
     }
@@ -109,10 +115,13 @@ public:
 
   // the current component, empty when next() returned false
   //
-  std::string_view current() const { return {m_s.data() + m_begin, m_end - m_begin}; }
+  std::basic_string_view<CharT> current() const
+  {
+    return {m_s.data() + m_begin, m_end - m_begin};
+  }
 
 private:
-  const std::string m_s;
+  const std::basic_string<CharT> m_s;
   std::size_t m_begin, m_end;
 
   // finds the next path separator
@@ -120,7 +129,7 @@ private:
   std::size_t nextSeparator(std::size_t from) const
   {
     while (from < m_s.size()) {
-      if (m_s[from] == '/' || m_s[from] == '\\') {
+      if (m_s[from] == CharT('/') || m_s[from] == CharT('\\')) {
         break;
       }
 
@@ -131,6 +140,8 @@ private:
   }
 };
 
+using DecomposablePath = BasicDecomposablePath<char>;
+
 namespace bi  = boost::interprocess;
 namespace bmi = boost::multi_index;
 
@@ -138,12 +149,71 @@ typedef uint8_t TreeFlags;
 
 static const TreeFlags FLAG_DIRECTORY     = 0x01;
 static const TreeFlags FLAG_DUMMY         = 0x02;
+// the node is the anchor of the nodes below it, every node knows how far up its
+// nearest anchor is (see DirectoryTree::anchorDistance)
+static const TreeFlags FLAG_ANCHOR        = 0x04;
 static const TreeFlags FLAG_FIRSTUSERFLAG = 0x10;
 
 struct MissingThrowT
 {};
 static const MissingThrowT MissingThrow = MissingThrowT();
 
+/**
+ * operations on the names in a directory tree that depend on their character type.
+ * names are compared by their upper-cased characters, which is the order NTFS lists
+ * directories in and the order of the keys directory listings are merged by
+ */
+template <typename CharT>
+struct TreeChars;
+
+template <typename CharT>
+int compareUpperCase(const CharT* lhs, const CharT* rhs, size_t length)
+{
+  for (size_t i = 0; i < length; ++i) {
+    const CharT l = TreeChars<CharT>::upper(lhs[i]);
+    const CharT r = TreeChars<CharT>::upper(rhs[i]);
+    if (l != r) {
+      return (l < r) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+template <>
+struct TreeChars<char>
+{
+  static int compare(const char* lhs, const char* rhs, size_t length)
+  {
+    return compareUpperCase(lhs, rhs, length);
+  }
+
+  static char upper(char c) { return ((c >= 'a') && (c <= 'z')) ? c - 'a' + 'A' : c; }
+
+  static std::string toUTF8(const char* name) { return name; }
+};
+
+template <>
+struct TreeChars<wchar_t>
+{
+  static int compare(const wchar_t* lhs, const wchar_t* rhs, size_t length)
+  {
+    return compareUpperCase(lhs, rhs, length);
+  }
+
+  static wchar_t upper(wchar_t c)
+  {
+    if (c < 0x80) {
+      return ((c >= L'a') && (c <= L'z')) ? c - L'a' + L'A' : c;
+    }
+    return to_upper_char(c);
+  }
+
+  static std::string toUTF8(const wchar_t* name)
+  {
+    return string_cast<std::string>(name, CodePage::UTF8);
+  }
+};
+
 template <typename NodeDataT>
 class TreeContainer;
 
@@ -174,14 +244,21 @@ using mimap = bmi::multi_index_container<
 /**
  * a representation of a directory tree in memory.
  * This class is designed to be stored in shared memory.
+ * Names are stored as strings of CharT, lookups and results use the same character
+ * type so no conversion is needed if it matches the caller's
  */
-template <typename NodeDataT>
+template <typename NodeDataT, typename CharT = char>
 class DirectoryTree
 {
   template <typename T>
   friend class TreeContainer;
 
 public:
+  typedef std::basic_string<CharT> NameT;
+  typedef std::basic_string_view<CharT> NameViewT;
+  typedef BasicStringT<CharT> SHMStringT;
+  typedef BasicDecomposablePath<CharT> DecomposablePathT;
+
   struct CILess
   {
     template <typename U, typename V>
@@ -190,8 +267,8 @@ public:
       const size_t lhsLength = getLength(lhs);
       const size_t rhsLength = getLength(rhs);
 
-      const auto r =
-          _strnicmp(getCharPtr(lhs), getCharPtr(rhs), std::min(lhsLength, rhsLength));
+      const auto r = TreeChars<CharT>::compare(getCharPtr(lhs), getCharPtr(rhs),
+                                               std::min(lhsLength, rhsLength));
 
       if (r == 0) {
         return lhsLength < rhsLength;
@@ -201,39 +278,45 @@ public:
     }
 
   private:
-    const char* getCharPtr(const StringT& s) const { return s.c_str(); }
+    const CharT* getCharPtr(const SHMStringT& s) const { return s.c_str(); }
 
-    const char* getCharPtr(const std::string& s) const { return s.c_str(); }
+    const CharT* getCharPtr(const NameT& s) const { return s.c_str(); }
 
-    const char* getCharPtr(const char* s) const { return s; }
+    const CharT* getCharPtr(const CharT* s) const { return s; }
 
-    const char* getCharPtr(std::string_view s) const { return s.data(); }
+    const CharT* getCharPtr(NameViewT s) const { return s.data(); }
 
-    size_t getLength(const StringT& s) const { return s.size(); }
+    size_t getLength(const SHMStringT& s) const { return s.size(); }
 
-    size_t getLength(const std::string& s) const { return s.size(); }
+    size_t getLength(const NameT& s) const { return s.size(); }
 
-    size_t getLength(const char* s) const { return strlen(s); }
+    size_t getLength(const CharT* s) const
+    {
+      return std::char_traits<CharT>::length(s);
+    }
 
-    size_t getLength(std::string_view s) const { return s.size(); }
+    size_t getLength(NameViewT s) const { return s.size(); }
   };
 
-  typedef DirectoryTree<NodeDataT> NodeT;
+  typedef DirectoryTree<NodeDataT, CharT> NodeT;
   typedef bi::deleter<NodeT, SegmentManagerT> DeleterT;
   typedef NodeDataT DataT;
 
   typedef bi::shared_ptr<NodeT, VoidAllocatorT, DeleterT> NodePtrT;
   typedef bi::weak_ptr<NodeT, VoidAllocatorT, DeleterT> WeakPtrT;
 
-  typedef bi::allocator<std::pair<const StringT, NodePtrT>, SegmentManagerT>
+  typedef bi::allocator<std::pair<const SHMStringT, NodePtrT>, SegmentManagerT>
       NodeEntryAllocatorT;
 
-  typedef mimap<StringT, NodePtrT, CILess, NodeEntryAllocatorT> NodeMapT;
+  typedef mimap<SHMStringT, NodePtrT, CILess, NodeEntryAllocatorT> NodeMapT;
   typedef typename NodeMapT::iterator file_iterator;
   typedef typename NodeMapT::const_iterator const_file_iterator;
 
   typedef std::function<void(const NodePtrT&)> VisitorFunction;
 
+  // anchorDistance() of nodes without an anchor
+  static constexpr uint16_t NO_ANCHOR = std::numeric_limits<uint16_t>::max();
+
   DirectoryTree()                       = delete;
   DirectoryTree(const NodeT& reference) = delete;
   DirectoryTree(NodeT&& reference)      = delete;
@@ -242,13 +325,19 @@ public:
   /**
    * @brief construct a new node to be inserted in an existing tree
    **/
-  DirectoryTree(std::string_view name, TreeFlags flags, const NodePtrT& parent,
+  DirectoryTree(NameViewT name, TreeFlags flags, const NodePtrT& parent,
                 const NodeDataT& data, const VoidAllocatorT& allocator)
       : m_Parent(parent), m_Name(name.begin(), name.end(), allocator), m_Data(data),
-        m_Nodes(allocator), m_Flags(flags)
+        m_Nodes(allocator), m_Flags(flags),
+        m_AnchorDistance((flags & FLAG_ANCHOR) != 0 ? 0 : NO_ANCHOR), m_NodeCount(1),
+        m_Changes(0)
   {}
 
-  ~DirectoryTree() { m_Nodes.clear(); }
+  ~DirectoryTree()
+  {
+    disownNodes();
+    m_Nodes.clear();
+  }
 
   /**
    * @return parent node
@@ -279,7 +368,7 @@ public:
   /**
    * @return name of this node
    */
-  std::string name() const { return m_Name.c_str(); }
+  NameT name() const { return m_Name.c_str(); }
 
   /**
    * @brief setFlag change a flag for this node
@@ -288,6 +377,9 @@ public:
   void setFlag(TreeFlags flag, bool enabled = true)
   {
     m_Flags = enabled ? m_Flags | flag : m_Flags & ~flag;
+    if ((flag & FLAG_ANCHOR) != 0) {
+      updateAnchorDistance();
+    }
   }
 
   /**
@@ -295,30 +387,58 @@ public:
    */
   bool hasFlag(TreeFlags flag) const { return (m_Flags & flag) != 0; }
 
+  /**
+   * @return all flags of this node
+   */
+  TreeFlags flags() const { return m_Flags; }
+
   /**
    * @return true if this node is a directory, false if it's a regular file
    */
   bool isDirectory() const { return hasFlag(FLAG_DIRECTORY); }
 
   /**
-   * @return the number of subnodes (directly) below this one
+   * @return number of levels up to the nearest node with FLAG_ANCHOR: 0 if it's this
+   *         node, 1 for the parent and so on. NO_ANCHOR if neither this node nor any
+   *         of its ancestors has the flag
    */
-  size_t numNodes() const { return m_Nodes.size(); }
+  uint16_t anchorDistance() const { return m_AnchorDistance; }
 
   /**
-   * @return number of nodes in this (sub-)tree including this one
+   * @return the nearest node with FLAG_ANCHOR, this one or an ancestor, or an empty
+   *         pointer if there is none
    */
-  size_t numNodesRecursive() const
+  NodePtrT anchor() const
   {
-    size_t result = numNodes() + 1;
-
-    for (const auto& node : m_Nodes) {
-      result += node.second->numNodesRecursive();
+    if (m_AnchorDistance == NO_ANCHOR) {
+      return NodePtrT();
     }
 
+    NodePtrT result = m_Self.lock();
+    for (uint16_t i = 0; (i < m_AnchorDistance) && (result.get() != nullptr); ++i) {
+      result = result->parent();
+    }
     return result;
   }
 
+  /**
+   * @return the number of subnodes (directly) below this one
+   */
+  size_t numNodes() const { return m_Nodes.size(); }
+
+  /**
+   * @return number of nodes in this (sub-)tree including this one, this is kept up
+   *         to date as nodes are added and removed so it doesn't walk the tree
+   */
+  size_t numNodesRecursive() const { return m_NodeCount; }
+
+  /**
+   * @return a number that changes whenever a node in this (sub-)tree is added,
+   *         removed or replaced, results derived from the tree can be cached as long
+   *         as it stays the same
+   */
+  uint32_t changeCount() const { return m_Changes; }
+
   /**
    * @brief find a node by its path
    * @param path the path to look up
@@ -358,7 +478,7 @@ public:
    * @param name name of the node
    * @return the node found or an empty pointer if no such node was found
    */
-  NodePtrT node(std::string_view name, MissingThrowT) const
+  NodePtrT node(NameViewT name, MissingThrowT) const
   {
     auto iter = m_Nodes.find(name);
 
@@ -374,7 +494,7 @@ public:
    * @param name name of the node
    * @return the node found or an empty pointer if no such node was found
    */
-  NodePtrT node(std::string_view name)
+  NodePtrT node(NameViewT name)
   {
     auto iter = m_Nodes.find(name);
 
@@ -390,7 +510,7 @@ public:
    * @param name name of the node
    * @return the node found or an empty pointer if no such node was found
    */
-  const NodePtrT node(std::string_view name, MissingThrowT)
+  const NodePtrT node(NameViewT name, MissingThrowT)
   {
     auto iter = m_Nodes.find(name);
 
@@ -406,7 +526,7 @@ public:
    * @param name name of the node
    * @return the node found or an empty pointer if no such node was found
    */
-  const NodePtrT node(std::string_view name) const
+  const NodePtrT node(NameViewT name) const
   {
     auto iter = m_Nodes.find(name);
 
@@ -422,7 +542,7 @@ public:
    * @param name name of the node
    * @return true if the node exists, false otherwise
    */
-  bool exists(std::string_view name) const
+  bool exists(NameViewT name) const
   {
     return m_Nodes.find(name) != m_Nodes.end();
   }
@@ -432,20 +552,23 @@ public:
    * @param pattern the pattern to look for
    * @return a vector of the found nodes
    */
-  std::vector<NodePtrT> find(const std::string& pattern) const
+  std::vector<NodePtrT> find(const NameT& pattern) const
   {
+    static const CharT wildcards[]  = {CharT('*'), CharT('?'), CharT('\0')};
+    static const CharT separators[] = {CharT('\\'), CharT('/'), CharT('\0')};
+
     // determine if there is a prefix in the pattern that indicates a specific
     // directory.
-    size_t fixedPart = pattern.find_first_of("*?");
+    size_t fixedPart = pattern.find_first_of(wildcards);
 
     if (fixedPart == 0)
-      fixedPart = std::string::npos;
-    if (fixedPart != std::string::npos)
-      fixedPart = pattern.find_last_of(R"(\/)", fixedPart);
+      fixedPart = NameT::npos;
+    if (fixedPart != NameT::npos)
+      fixedPart = pattern.find_last_of(separators, fixedPart);
 
     std::vector<NodePtrT> result;
 
-    if (fixedPart != std::string::npos) {
+    if (fixedPart != NameT::npos) {
       // if there is a prefix, search for the node representing that path and
       // search only on that
       NodePtrT node = findNode(fs::path(pattern.substr(0, fixedPart)));
@@ -479,21 +602,42 @@ public:
    **/
   const_file_iterator filesEnd() const { return m_Nodes.end(); }
 
+  /**
+   * @return a const iterator to the first leaf ordered after the specified name,
+   *         this allows resuming an iteration without holding on to an iterator
+   **/
+  const_file_iterator filesAfter(NameViewT name) const
+  {
+    return m_Nodes.upper_bound(name);
+  }
+
   /**
    * @brief erase the leaf at the specified iterator
    * @return an iterator to the following file
    **/
-  file_iterator erase(file_iterator iter) { return m_Nodes.erase(iter); }
+  file_iterator erase(file_iterator iter)
+  {
+    const uint32_t removed = iter->second->m_NodeCount;
+    iter->second->m_Owner  = nullptr;
+    auto result            = m_Nodes.erase(iter);
+    adjustNodeCount(0 - removed);
+    return result;
+  }
 
   /**
    * @brief clear all nodes
    */
-  void clear() { m_Nodes.clear(); }
+  void clear()
+  {
+    disownNodes();
+    m_Nodes.clear();
+    adjustNodeCount(1 - m_NodeCount);
+  }
 
   void removeFromTree()
   {
     if (auto par = parent()) {
-      spdlog::get("usvfs")->info("remove from tree {}", m_Name.c_str());
+      LOG_USVFS(info, "remove from tree {}", TreeChars<CharT>::toUTF8(m_Name.c_str()));
       auto self = par->m_Nodes.find(m_Name.c_str());
       if (self != par->m_Nodes.end()) {
         par->erase(self);
@@ -501,17 +645,75 @@ public:
         // trying to remove a node that does not exist, most likely because it was
         // already removed in a lower level call. this is known to happen when MoveFile
         // has the MOVEFILE_COPY_ALLOWED flag and moving a mapped file.
-        spdlog::get("usvfs")->warn("Failed to remove inexisting node from tree: {}",
-                                   m_Name.c_str());
+        LOG_USVFS(warn, "Failed to remove inexisting node from tree: {}",
+                  TreeChars<CharT>::toUTF8(m_Name.c_str()));
       }
     }
   }
 
-  PRIVATE : void set(StringT key, const NodePtrT& value)
+  PRIVATE : void set(SHMStringT key, const NodePtrT& value)
   {
-    auto res = m_Nodes.emplace(std::move(key), value);
+    auto res       = m_Nodes.emplace(std::move(key), value);
+    uint32_t delta = value->m_NodeCount;
     if (!res.second) {
-      res.first->second = value;
+      delta -= res.first->second->m_NodeCount;
+      res.first->second->m_Owner = nullptr;
+      res.first->second          = value;
+    }
+    value->m_Owner = this;
+    adjustNodeCount(delta);
+  }
+
+  // adds to the node count of this node and all its ancestors after a subtree was
+  // attached below it or removed, unsigned so removals wrap around. This counts as a
+  // change for all of them
+  void adjustNodeCount(uint32_t delta)
+  {
+    for (NodeT* node = this; node != nullptr; node = node->m_Owner.get()) {
+      node->m_NodeCount += delta;
+      ++node->m_Changes;
+    }
+  }
+
+  // counts as a change for this node and all its ancestors, for nodes that were
+  // modified in place
+  void markChanged()
+  {
+    for (NodeT* node = this; node != nullptr; node = node->m_Owner.get()) {
+      ++node->m_Changes;
+    }
+  }
+
+  // subnodes that are still referenced elsewhere after they were removed from this
+  // node must not update its counts anymore
+  void disownNodes()
+  {
+    for (const auto& node : m_Nodes) {
+      node.second->m_Owner = nullptr;
+    }
+  }
+
+  // recalculates the anchor distance after the node was inserted or its anchor flag
+  // changed
+  void updateAnchorDistance()
+  {
+    const NodePtrT par = parent();
+    updateAnchorDistance(par.get() != nullptr ? par->m_AnchorDistance : NO_ANCHOR);
+  }
+
+  void updateAnchorDistance(uint16_t parentDistance)
+  {
+    uint16_t distance = 0;
+    if (!hasFlag(FLAG_ANCHOR)) {
+      distance = parentDistance >= NO_ANCHOR - 1 ? NO_ANCHOR : parentDistance + 1;
+    }
+
+    if (distance != m_AnchorDistance) {
+      // the subtree only needs updating if this node changed
+      m_AnchorDistance = distance;
+      for (const auto& node : m_Nodes) {
+        node.second->updateAnchorDistance(distance);
+      }
     }
   }
 
@@ -524,10 +726,12 @@ public:
     }
   }
 
+  // a path (component) as a string in the character type of the tree
+  static NameT toName(const fs::path& path) { return path.template string<NameT>(); }
+
   NodePtrT findNode(const fs::path& name, fs::path::iterator& iter)
   {
-    std::string l = iter->string();
-    auto subNode  = m_Nodes.find(iter->string());
+    auto subNode = m_Nodes.find(toName(*iter));
     advanceIter(iter, name.end());
 
     if (iter == name.end()) {
@@ -548,7 +752,7 @@ public:
 
   const NodePtrT findNode(const fs::path& name, fs::path::iterator& iter) const
   {
-    auto subNode = m_Nodes.find(iter->string());
+    auto subNode = m_Nodes.find(toName(*iter));
     advanceIter(iter, name.end());
 
     if (iter == name.end()) {
@@ -570,7 +774,7 @@ public:
   void visitPath(const fs::path& path, fs::path::iterator& iter,
                  const VisitorFunction& visitor) const
   {
-    auto subNode = m_Nodes.find(iter->string());
+    auto subNode = m_Nodes.find(toName(*iter));
 
     if (subNode != m_Nodes.end()) {
       visitor(subNode->second);
@@ -581,10 +785,10 @@ public:
     }
   }
 
-  void findLocal(std::vector<NodePtrT>& output, const std::string& pattern) const
+  void findLocal(std::vector<NodePtrT>& output, const NameT& pattern) const
   {
     for (auto iter = m_Nodes.begin(); iter != m_Nodes.end(); ++iter) {
-      LPCSTR remainder = nullptr;
+      const CharT* remainder = nullptr;
 
       if (pattern.size() > 1 && (pattern[0] == '*') &&
           ((pattern[1] == '/') || (pattern[1] == '\\')) &&
@@ -594,7 +798,8 @@ public:
         iter->second->findLocal(output, pattern.substr(1));
       } else if ((remainder = wildcard::PartialMatch(iter->second->name().c_str(),
                                                      pattern.c_str())) != nullptr) {
-        if ((*remainder == '\0') || (strcmp(remainder, "*") == 0)) {
+        if ((remainder[0] == CharT('\0')) ||
+            ((remainder[0] == CharT('*')) && (remainder[1] == CharT('\0')))) {
           NodePtrT node = iter->second;
           output.push_back(node);
         }
@@ -607,22 +812,34 @@ public:
   }
 
   PRIVATE : TreeFlags m_Flags;
+  uint16_t m_AnchorDistance;
+  // nodes in this subtree including this one, see numNodesRecursive()
+  uint32_t m_NodeCount;
+  // see changeCount()
+  uint32_t m_Changes;
+
+  // the node this one is stored in. Unlike m_Parent this is also set for the nodes
+  // directly below the root, which has no m_Self because it isn't owned by a shared
+  // pointer. Only used to update the counts of all ancestors
+  OffsetPtrT<NodeT> m_Owner;
 
   WeakPtrT m_Parent;
   WeakPtrT m_Self;
 
-  StringT m_Name;
+  SHMStringT m_Name;
   NodeDataT m_Data;
 
   NodeMapT m_Nodes;
 };
 
-template <typename NodeDataT>
-void dumpTree(std::ostream& stream, const DirectoryTree<NodeDataT>& tree, int level = 0)
+template <typename NodeDataT, typename CharT>
+void dumpTree(std::ostream& stream, const DirectoryTree<NodeDataT, CharT>& tree,
+              int level = 0)
 {
-  stream << std::string(level, ' ') << tree.name() << " -> " << tree.data() << "\n";
+  stream << std::string(level, ' ') << TreeChars<CharT>::toUTF8(tree.name().c_str())
+         << " -> " << tree.data() << "\n";
   for (auto iter = tree.filesBegin(); iter != tree.filesEnd(); ++iter) {
-    dumpTree<NodeDataT>(stream, *iter->second, level + 1);
+    dumpTree<NodeDataT, CharT>(stream, *iter->second, level + 1);
   }
 }
 
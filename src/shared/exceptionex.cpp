@@ -19,6 +19,7 @@ You should have received a copy of the GNU General Public License
 along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "exceptionex.h"
+#include "logger_handle.h"
 #include "winapi.h"
 #include <spdlog/spdlog.h>
 
@@ -67,16 +68,16 @@ void logExtInfo(const std::exception& e, LogLevel logLevel)
 
   switch (logLevel) {
   case LogLevel::Debug:
-    spdlog::get("usvfs")->debug(content);
+    LOG_USVFS(debug, content);
     break;
   case LogLevel::Info:
-    spdlog::get("usvfs")->info(content);
+    LOG_USVFS(info, content);
     break;
   case LogLevel::Warning:
-    spdlog::get("usvfs")->warn(content);
+    LOG_USVFS(warn, content);
     break;
   case LogLevel::Error:
-    spdlog::get("usvfs")->error(content);
+    LOG_USVFS(err, content);
     break;
   }
 }
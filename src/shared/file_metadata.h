@@ -0,0 +1,129 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace usvfs::shared
+{
+
+// offset between the FILETIME epoch (1601-01-01) and the unix epoch, in 100ns
+// intervals
+static const int64_t FILETIME_UNIX_EPOCH = 116444736000000000LL;
+
+/**
+ * @brief attributes, size and timestamps of a file as reported by the directory
+ *        listing it was found in
+ *
+ * this is stored in shared memory so it must not contain pointers. Timestamps are in
+ * FILETIME units (100ns intervals since 1601-01-01 UTC)
+ */
+struct FileMetadata
+{
+  uint32_t attributes{0};
+  uint64_t size{0};
+  uint64_t allocationSize{0};
+  int64_t creationTime{0};
+  int64_t lastAccessTime{0};
+  int64_t lastWriteTime{0};
+  int64_t changeTime{0};
+  // false if nothing is known about the file
+  bool valid{false};
+};
+
+/**
+ * @brief convert a point in time to FILETIME units
+ */
+inline int64_t toFileTime(std::chrono::system_clock::time_point time)
+{
+  using Intervals = std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
+  return std::chrono::duration_cast<Intervals>(time.time_since_epoch()).count() +
+         FILETIME_UNIX_EPOCH;
+}
+
+/**
+ * @brief extract the metadata from a FILE_*_DIR_INFORMATION record (any of the
+ *        variants that carry sizes and timestamps)
+ */
+template <typename InfoT>
+FileMetadata metadataFromDirectoryInfo(const InfoT& info)
+{
+  FileMetadata result;
+  result.attributes     = static_cast<uint32_t>(info.FileAttributes);
+  result.size           = static_cast<uint64_t>(info.EndOfFile.QuadPart);
+  result.allocationSize = static_cast<uint64_t>(info.AllocationSize.QuadPart);
+  result.creationTime   = info.CreationTime.QuadPart;
+  result.lastAccessTime = info.LastAccessTime.QuadPart;
+  result.lastWriteTime  = info.LastWriteTime.QuadPart;
+  result.changeTime     = info.ChangeTime.QuadPart;
+  result.valid          = true;
+  return result;
+}
+
+/**
+ * @brief fill a FILE_BASIC_INFORMATION structure
+ */
+template <typename InfoT>
+void toBasicInformation(const FileMetadata& metadata, InfoT& info)
+{
+  info.CreationTime.QuadPart   = metadata.creationTime;
+  info.LastAccessTime.QuadPart = metadata.lastAccessTime;
+  info.LastWriteTime.QuadPart  = metadata.lastWriteTime;
+  info.ChangeTime.QuadPart     = metadata.changeTime;
+  info.FileAttributes          = metadata.attributes;
+}
+
+/**
+ * @brief fill a FILE_NETWORK_OPEN_INFORMATION structure
+ */
+template <typename InfoT>
+void toNetworkOpenInformation(const FileMetadata& metadata, InfoT& info)
+{
+  info.CreationTime.QuadPart   = metadata.creationTime;
+  info.LastAccessTime.QuadPart = metadata.lastAccessTime;
+  info.LastWriteTime.QuadPart  = metadata.lastWriteTime;
+  info.ChangeTime.QuadPart     = metadata.changeTime;
+  info.AllocationSize.QuadPart = static_cast<int64_t>(metadata.allocationSize);
+  info.EndOfFile.QuadPart      = static_cast<int64_t>(metadata.size);
+  info.FileAttributes          = metadata.attributes;
+}
+
+/**
+ * @brief fill a WIN32_FILE_ATTRIBUTE_DATA structure
+ */
+template <typename DataT>
+void toAttributeData(const FileMetadata& metadata, DataT& data)
+{
+  auto split = [](int64_t time, auto& fileTime) {
+    fileTime.dwLowDateTime  = static_cast<uint32_t>(time & 0xFFFFFFFF);
+    fileTime.dwHighDateTime = static_cast<uint32_t>(static_cast<uint64_t>(time) >> 32);
+  };
+
+  data.dwFileAttributes = metadata.attributes;
+  split(metadata.creationTime, data.ftCreationTime);
+  split(metadata.lastAccessTime, data.ftLastAccessTime);
+  split(metadata.lastWriteTime, data.ftLastWriteTime);
+  data.nFileSizeHigh = static_cast<uint32_t>(metadata.size >> 32);
+  data.nFileSizeLow  = static_cast<uint32_t>(metadata.size & 0xFFFFFFFF);
+}
+
+}  // namespace usvfs::shared
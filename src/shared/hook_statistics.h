@@ -0,0 +1,274 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief latency histogram with power of two buckets
+ *
+ * bucket 0 counts calls that took no time at all, bucket i calls that took at least
+ * 2^(i-1) and less than 2^i nanoseconds. The last bucket also counts everything
+ * longer (more than half a second)
+ */
+struct LatencyBuckets
+{
+  static constexpr uint32_t COUNT = 32;
+
+  static constexpr uint32_t bucket(uint64_t nanoseconds)
+  {
+    return std::min<uint32_t>(static_cast<uint32_t>(std::bit_width(nanoseconds)),
+                              COUNT - 1);
+  }
+
+  /**
+   * @return the exclusive upper bound of the bucket in nanoseconds
+   */
+  static constexpr uint64_t upperBound(uint32_t bucket)
+  {
+    return uint64_t(1) << bucket;
+  }
+};
+
+/**
+ * @brief counters of a single hook, updated with relaxed atomics by all threads of
+ *        all processes connected to the same instance
+ */
+struct HookCounters
+{
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> reroutes;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> nanoseconds;
+  std::atomic<uint64_t> latency[LatencyBuckets::COUNT];
+
+  void recordCall(uint64_t duration)
+  {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    nanoseconds.fetch_add(duration, std::memory_order_relaxed);
+    latency[LatencyBuckets::bucket(duration)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief record a lookup in the redirection tree
+   * @param rerouted true if the path was redirected, false if it's not in the tree
+   */
+  void recordLookup(bool rerouted)
+  {
+    (rerouted ? reroutes : misses).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void recordError() { errors.fetch_add(1, std::memory_order_relaxed); }
+};
+
+/**
+ * @brief statistics of a hook copied out of the table
+ */
+struct HookStatistics
+{
+  std::string name;
+  uint64_t calls{0};
+  uint64_t reroutes{0};
+  uint64_t misses{0};
+  uint64_t errors{0};
+  uint64_t nanoseconds{0};
+  std::array<uint64_t, LatencyBuckets::COUNT> latency{};
+
+  /**
+   * @return upper bound in nanoseconds of the bucket containing the specified
+   *         fraction (0 to 1) of calls, 0 if there were no calls
+   */
+  uint64_t percentile(double fraction) const
+  {
+    uint64_t total = 0;
+    for (uint64_t count : latency) {
+      total += count;
+    }
+    if (total == 0) {
+      return 0;
+    }
+
+    const uint64_t rank =
+        std::max<uint64_t>(static_cast<uint64_t>(fraction * total + 0.5), 1);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LatencyBuckets::COUNT; ++i) {
+      seen += latency[i];
+      if (seen >= rank) {
+        return LatencyBuckets::upperBound(i);
+      }
+    }
+    return LatencyBuckets::upperBound(LatencyBuckets::COUNT - 1);
+  }
+};
+
+/**
+ * @brief fixed size table of hook counters in shared memory
+ *
+ * each hook owns a slot identified by its name, so the processes connected to an
+ * instance all count into the same slots and the table always holds the totals.
+ * Slots are claimed on first use and never released, the layout only uses fixed
+ * width types so 32 and 64 bit processes can share the table
+ */
+class HookStatisticsTable
+{
+public:
+  static constexpr uint32_t SLOT_COUNT  = 128;
+  static constexpr uint32_t NAME_LENGTH = 64;
+
+  HookStatisticsTable()
+  {
+    for (Slot& slot : m_Slots) {
+      slot.state.store(FREE, std::memory_order_relaxed);
+      memset(slot.name, 0, sizeof(slot.name));
+      slot.counters.calls.store(0, std::memory_order_relaxed);
+      slot.counters.reroutes.store(0, std::memory_order_relaxed);
+      slot.counters.misses.store(0, std::memory_order_relaxed);
+      slot.counters.errors.store(0, std::memory_order_relaxed);
+      slot.counters.nanoseconds.store(0, std::memory_order_relaxed);
+      for (auto& count : slot.counters.latency) {
+        count.store(0, std::memory_order_relaxed);
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  HookStatisticsTable(const HookStatisticsTable&)            = delete;
+  HookStatisticsTable& operator=(const HookStatisticsTable&) = delete;
+
+  /**
+   * @brief access a table in shared memory, zero filled memory (as in a newly
+   *        created section) is an empty table so there is nothing to set up
+   */
+  static HookStatisticsTable* attach(void* memory)
+  {
+    return static_cast<HookStatisticsTable*>(memory);
+  }
+
+  /**
+   * @brief find the counters of a hook, claiming a slot for it if necessary
+   * @param name name of the hook, truncated to NAME_LENGTH - 1 characters
+   * @return the counters or nullptr if the table is full
+   */
+  HookCounters* counters(const char* name)
+  {
+    char key[NAME_LENGTH] = {};
+    memcpy(key, name, strnlen(name, NAME_LENGTH - 1));
+
+    const uint32_t start = hash(key);
+    for (uint32_t i = 0; i < SLOT_COUNT; ++i) {
+      Slot& slot     = m_Slots[(start + i) % SLOT_COUNT];
+      uint32_t state = slot.state.load(std::memory_order_acquire);
+      if (state == FREE) {
+        if (slot.state.compare_exchange_strong(state, CLAIMED,
+                                               std::memory_order_acquire)) {
+          memcpy(slot.name, key, sizeof(key));
+          slot.state.store(READY, std::memory_order_release);
+          return &slot.counters;
+        }
+      }
+      // another thread is writing the name
+      while (state == CLAIMED) {
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (memcmp(slot.name, key, sizeof(key)) == 0) {
+        return &slot.counters;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @return current values of all hooks that have been called, ordered by name
+   */
+  std::vector<HookStatistics> snapshot() const
+  {
+    std::vector<HookStatistics> result;
+    for (const Slot& slot : m_Slots) {
+      if (slot.state.load(std::memory_order_acquire) != READY) {
+        continue;
+      }
+
+      const HookCounters& counters = slot.counters;
+      HookStatistics stats;
+      stats.name        = slot.name;
+      stats.calls       = counters.calls.load(std::memory_order_relaxed);
+      stats.reroutes    = counters.reroutes.load(std::memory_order_relaxed);
+      stats.misses      = counters.misses.load(std::memory_order_relaxed);
+      stats.errors      = counters.errors.load(std::memory_order_relaxed);
+      stats.nanoseconds = counters.nanoseconds.load(std::memory_order_relaxed);
+      for (uint32_t i = 0; i < LatencyBuckets::COUNT; ++i) {
+        stats.latency[i] = counters.latency[i].load(std::memory_order_relaxed);
+      }
+      result.push_back(std::move(stats));
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const HookStatistics& lhs, const HookStatistics& rhs) {
+                return lhs.name < rhs.name;
+              });
+    return result;
+  }
+
+private:
+  enum : uint32_t
+  {
+    FREE = 0,
+    CLAIMED,
+    READY
+  };
+
+  // aligned so hot hooks don't share cache lines
+  struct alignas(64) Slot
+  {
+    std::atomic<uint32_t> state;
+    char name[NAME_LENGTH];
+    HookCounters counters;
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the table is shared between processes");
+
+  static uint32_t hash(const char* key)
+  {
+    // FNV-1a
+    uint32_t result = 2166136261u;
+    for (; *key != '\0'; ++key) {
+      result = (result ^ static_cast<uint8_t>(*key)) * 16777619u;
+    }
+    return result;
+  }
+
+  Slot m_Slots[SLOT_COUNT];
+};
+
+}  // namespace usvfs::shared
@@ -0,0 +1,162 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// per-thread state consulted on every hook entry. Both types are trivial and empty
+// when zero initialized so they can be thread_local variables without any lazy
+// construction: accessing them is a load from the thread's TLS block and, unlike
+// TlsGetValue, never touches the last error
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief hook groups currently active on a thread
+ *
+ * group 0 is special: while it is active no other group can be entered, but it can
+ * be entered while other groups are active
+ */
+struct HookGroupSet
+{
+  static constexpr uint32_t CAPACITY = 32;
+
+  uint32_t active;
+
+  /**
+   * @return true if the group was entered, false if it or group 0 was already
+   *         active
+   */
+  bool enter(uint32_t group)
+  {
+    const uint32_t bit = uint32_t(1) << group;
+    if ((active & (bit | 1u)) != 0) {
+      return false;
+    }
+    active |= bit;
+    return true;
+  }
+
+  void leave(uint32_t group) { active &= ~(uint32_t(1) << group); }
+
+  bool isActive(uint32_t group) const
+  {
+    return (active & (uint32_t(1) << group)) != 0;
+  }
+};
+
+/**
+ * @brief recursion barriers of the hooked functions on a thread
+ *
+ * a barrier is locked while the replacement of a function runs on the thread, so
+ * the function calling itself (or the replacement calling it) reaches the original.
+ * Functions are assigned a slot on first use, which is never freed, so the lookup
+ * is a hash and a short probe. The slot stores the return address of the locked
+ * call, nullptr when the barrier is open
+ */
+struct BarrierTable
+{
+  // comfortably more than the number of functions hooked
+  static constexpr uint32_t CAPACITY = 128;
+
+  struct Slot
+  {
+    const void* function;
+    void* value;
+  };
+
+  Slot slots[CAPACITY];
+
+  /**
+   * @brief lock the barrier of a function
+   * @return the slot value to store the return address in, nullptr if the barrier is
+   *         already locked or there is no free slot
+   */
+  void** lock(const void* function)
+  {
+    Slot* slot = find(function, true);
+    if ((slot == nullptr) || (slot->value != nullptr)) {
+      return nullptr;
+    }
+    // locked until released, even if the caller doesn't store anything
+    slot->value = reinterpret_cast<void*>(1);
+    return &slot->value;
+  }
+
+  /**
+   * @brief open the barrier of a function
+   * @param found set to false if the function never was locked on this thread
+   * @return the value stored on lock
+   */
+  void* release(const void* function, bool& found)
+  {
+    Slot* slot = find(function, false);
+    found      = slot != nullptr;
+    if (slot == nullptr) {
+      return nullptr;
+    }
+    void* result = slot->value;
+    slot->value  = nullptr;
+    return result;
+  }
+
+  /**
+   * @brief open all barriers
+   */
+  void releaseAll()
+  {
+    for (Slot& slot : slots) {
+      slot.value = nullptr;
+    }
+  }
+
+private:
+  Slot* find(const void* function, bool claim)
+  {
+    // Fibonacci hashing, functions are at least a few bytes apart
+    const uint64_t key   = reinterpret_cast<uintptr_t>(function);
+    const uint32_t start = static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 57);
+    static_assert(CAPACITY == 128, "the shift has to match the capacity");
+
+    for (uint32_t i = 0; i < CAPACITY; ++i) {
+      Slot& slot = slots[(start + i) % CAPACITY];
+      if (slot.function == function) {
+        return &slot;
+      }
+      if (slot.function == nullptr) {
+        if (!claim) {
+          return nullptr;
+        }
+        slot.function = function;
+        return &slot;
+      }
+    }
+
+    return nullptr;
+  }
+};
+
+static_assert(std::is_trivial_v<HookGroupSet> && std::is_trivial_v<BarrierTable>,
+              "used as thread_local without dynamic initialization");
+
+}  // namespace usvfs::shared
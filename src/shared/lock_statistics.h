@@ -0,0 +1,297 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief the locks that can be profiled
+ */
+enum class LockId : uint32_t
+{
+  CONTEXT    = 0,  // the reader-writer lock of the hook context
+  PARAMETERS = 1,  // the mutex of the shared parameters
+  TREE_META  = 2,  // the mutex of the reference count of the redirection trees
+
+  COUNT
+};
+
+/**
+ * @brief a name in shared memory that can be written and read concurrently, a name
+ *        read while it is being written may be a mix of the old and the new one
+ */
+struct SharedName
+{
+  static constexpr uint32_t LENGTH = 64;
+
+  std::atomic<uint64_t> words[LENGTH / 8];
+
+  void store(const char* name)
+  {
+    char buffer[LENGTH] = {};
+    memcpy(buffer, name, strnlen(name, LENGTH - 1));
+    for (uint32_t i = 0; i < LENGTH / 8; ++i) {
+      uint64_t word;
+      memcpy(&word, buffer + i * 8, 8);
+      words[i].store(word, std::memory_order_relaxed);
+    }
+  }
+
+  std::string load() const
+  {
+    char buffer[LENGTH];
+    for (uint32_t i = 0; i < LENGTH / 8; ++i) {
+      const uint64_t word = words[i].load(std::memory_order_relaxed);
+      memcpy(buffer + i * 8, &word, 8);
+    }
+    buffer[LENGTH - 1] = '\0';
+    return buffer;
+  }
+};
+
+/**
+ * @brief counters of one way to acquire a lock
+ */
+struct LockWaitCounters
+{
+  std::atomic<uint64_t> acquisitions;
+  // acquisitions that couldn't get the lock right away
+  std::atomic<uint64_t> contended;
+  std::atomic<uint64_t> waitNanoseconds;
+  std::atomic<uint64_t> maxWaitNanoseconds;
+  // acquisitions that waited longer than LockStatisticsTable::TIMEOUT
+  std::atomic<uint64_t> timeouts;
+  // holder of the lock when the longest wait started
+  SharedName maxWaitHolder;
+};
+
+/**
+ * @brief statistics of a lock copied out of the table
+ */
+struct LockStatistics
+{
+  std::string name;
+  std::string lastHolder;
+  std::string maxWaitHolder;
+  uint64_t acquisitions{0};
+  uint64_t contended{0};
+  uint64_t waitNanoseconds{0};
+  uint64_t maxWaitNanoseconds{0};
+  uint64_t timeouts{0};
+};
+
+/**
+ * @brief wait times of the locks shared between processes
+ *
+ * the table lives in shared memory so all processes connected to an instance count
+ * into it and profiling is switched on and off for all of them at once. While it's
+ * off acquiring a lock costs two extra loads. Zero filled memory is an empty table
+ * with profiling disabled
+ */
+class LockStatisticsTable
+{
+public:
+  // the context lock used to give up and check on the owner after 200 ms
+  static constexpr std::chrono::milliseconds TIMEOUT{200};
+
+  LockStatisticsTable() = default;
+
+  LockStatisticsTable(const LockStatisticsTable&)            = delete;
+  LockStatisticsTable& operator=(const LockStatisticsTable&) = delete;
+
+  static LockStatisticsTable* attach(void* memory)
+  {
+    return static_cast<LockStatisticsTable*>(memory);
+  }
+
+  /**
+   * @return the table of the process, nullptr if there is none
+   */
+  static LockStatisticsTable* current()
+  {
+    return s_Current.load(std::memory_order_acquire);
+  }
+
+  static void setCurrent(LockStatisticsTable* table)
+  {
+    s_Current.store(table, std::memory_order_release);
+  }
+
+  bool enabled() const { return m_Enabled.load(std::memory_order_relaxed) != 0; }
+
+  void setEnabled(bool enabled)
+  {
+    m_Enabled.store(enabled ? 1 : 0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief acquire a lock, recording how long that took
+   * @param exclusive false for a shared acquisition of a reader-writer lock
+   * @param holder    recorded as the holder of the lock, usually the calling function
+   * @param tryLock   acquires the lock if that doesn't block, returns true on success
+   * @param lock      acquires the lock
+   */
+  template <typename TryLock, typename Lock>
+  void acquire(LockId id, bool exclusive, const char* holder, TryLock&& tryLock,
+               Lock&& lock)
+  {
+    Entry& entry              = m_Locks[static_cast<uint32_t>(id)];
+    LockWaitCounters& counters = entry.counters[exclusive ? 1 : 0];
+
+    if (!tryLock()) {
+      // probably whoever holds the lock now
+      const std::string blocking = entry.lastHolder.load();
+
+      const auto start = std::chrono::steady_clock::now();
+      lock();
+      const uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+
+      counters.contended.fetch_add(1, std::memory_order_relaxed);
+      counters.waitNanoseconds.fetch_add(wait, std::memory_order_relaxed);
+      if (wait > TIMEOUT_NANOSECONDS) {
+        counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      uint64_t max = counters.maxWaitNanoseconds.load(std::memory_order_relaxed);
+      while (wait > max) {
+        if (counters.maxWaitNanoseconds.compare_exchange_weak(
+                max, wait, std::memory_order_relaxed)) {
+          counters.maxWaitHolder.store(blocking.c_str());
+          break;
+        }
+      }
+    }
+
+    counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    entry.lastHolder.store(holder);
+  }
+
+  /**
+   * @return current values of all locks and ways to acquire them that have been used
+   */
+  std::vector<LockStatistics> snapshot() const
+  {
+    static const char* const names[][2] = {{"context read", "context write"},
+                                           {nullptr, "parameters"},
+                                           {nullptr, "tree meta"}};
+    static_assert(std::size(names) == static_cast<uint32_t>(LockId::COUNT));
+
+    std::vector<LockStatistics> result;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(LockId::COUNT); ++i) {
+      const Entry& entry = m_Locks[i];
+      for (uint32_t mode = 0; mode < 2; ++mode) {
+        const LockWaitCounters& counters = entry.counters[mode];
+        if ((names[i][mode] == nullptr) ||
+            (counters.acquisitions.load(std::memory_order_relaxed) == 0)) {
+          continue;
+        }
+
+        LockStatistics stats;
+        stats.name          = names[i][mode];
+        stats.lastHolder    = entry.lastHolder.load();
+        stats.maxWaitHolder = counters.maxWaitHolder.load();
+        stats.acquisitions  = counters.acquisitions.load(std::memory_order_relaxed);
+        stats.contended     = counters.contended.load(std::memory_order_relaxed);
+        stats.waitNanoseconds =
+            counters.waitNanoseconds.load(std::memory_order_relaxed);
+        stats.maxWaitNanoseconds =
+            counters.maxWaitNanoseconds.load(std::memory_order_relaxed);
+        stats.timeouts = counters.timeouts.load(std::memory_order_relaxed);
+        result.push_back(std::move(stats));
+      }
+    }
+
+    return result;
+  }
+
+private:
+  struct Entry
+  {
+    // shared, exclusive
+    LockWaitCounters counters[2];
+    SharedName lastHolder;
+  };
+
+  static constexpr uint64_t TIMEOUT_NANOSECONDS =
+      std::chrono::nanoseconds(TIMEOUT).count();
+
+  static inline std::atomic<LockStatisticsTable*> s_Current{nullptr};
+
+  std::atomic<uint32_t> m_Enabled;
+  Entry m_Locks[static_cast<uint32_t>(LockId::COUNT)];
+};
+
+/**
+ * @brief acquire a lock that may be profiled, calls lock() directly if there is no
+ *        table or profiling is disabled
+ */
+template <typename TryLock, typename Lock>
+void profiledLock(LockId id, bool exclusive, const char* holder, TryLock&& tryLock,
+                  Lock&& lock)
+{
+  LockStatisticsTable* table = LockStatisticsTable::current();
+  if ((table != nullptr) && table->enabled()) {
+    table->acquire(id, exclusive, holder, tryLock, lock);
+  } else {
+    lock();
+  }
+}
+
+/**
+ * @brief scoped lock of a mutex that may be profiled
+ */
+template <typename MutexT>
+class ProfiledScopedLock
+{
+public:
+  ProfiledScopedLock(MutexT& mutex, LockId id, const char* holder) : m_Mutex(mutex)
+  {
+    profiledLock(
+        id, true, holder,
+        [this]() {
+          return m_Mutex.try_lock();
+        },
+        [this]() {
+          m_Mutex.lock();
+        });
+  }
+
+  ~ProfiledScopedLock() { m_Mutex.unlock(); }
+
+  ProfiledScopedLock(const ProfiledScopedLock&)            = delete;
+  ProfiledScopedLock& operator=(const ProfiledScopedLock&) = delete;
+
+private:
+  MutexT& m_Mutex;
+};
+
+}  // namespace usvfs::shared
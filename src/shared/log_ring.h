@@ -0,0 +1,295 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief ring buffer of log records in shared memory
+ *
+ * any number of threads in any number of processes can write to the ring without
+ * taking a lock, there is a single reader. A record is the level and the raw text of
+ * a message, everything else (trimming, scrubbing, splitting) is left to the reader
+ * so writing stays cheap.
+ *
+ * the ring is made of fixed size slots, a record occupies as many consecutive slots as
+ * its text requires. Each slot has a sequence number telling whether it's free for a
+ * writer or holds data for the reader at its position. A writer claims all slots of a
+ * record at once by advancing the tail, fills them and publishes them last to first so
+ * the reader can take the record as soon as its first slot is published.
+ *
+ * if the ring is full, the record is not written and the caller decides whether to
+ * retry or drop it. Dropped records are counted per level so the reader can report
+ * them.
+ *
+ * the ring doesn't block. A reader that wants to wait for records announces it with
+ * setReaderWaiting() and checks hasRecord() once more before it sleeps, writers call
+ * takeReaderWaiting() after each record and wake it up, only the first one after the
+ * announcement has to.
+ *
+ * the layout only uses fixed width types so 32 and 64 bit processes can share a ring
+ */
+class LogRing
+{
+public:
+  static constexpr uint32_t SLOT_SIZE        = 128;
+  static constexpr uint32_t MAX_RECORD_SLOTS = 32;
+  static constexpr uint32_t MIN_CAPACITY     = MAX_RECORD_SLOTS * 2;
+  static constexpr uint32_t LEVEL_COUNT      = 8;
+
+private:
+  struct Slot
+  {
+    std::atomic<uint64_t> sequence;
+    // only set in the first slot of a record
+    uint16_t length;
+    uint8_t level;
+    uint8_t slots;
+    char data[SLOT_SIZE - 12];
+  };
+  static_assert(sizeof(Slot) == SLOT_SIZE, "unexpected slot layout");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the ring is shared between processes");
+
+  static constexpr std::size_t SLOT_DATA = sizeof(Slot::data);
+
+public:
+  /**
+   * @return longest text a record can hold, longer text is truncated
+   */
+  static constexpr std::size_t maxRecordLength()
+  {
+    return SLOT_DATA * MAX_RECORD_SLOTS;
+  }
+
+  /**
+   * @return number of bytes of shared memory required for a ring with the specified
+   *         number of slots
+   */
+  static constexpr std::size_t requiredSize(uint32_t capacity)
+  {
+    return sizeof(LogRing) + static_cast<std::size_t>(capacity) * SLOT_SIZE;
+  }
+
+  /**
+   * @brief set up a new ring in the specified memory
+   * @param memory shared memory of at least requiredSize(capacity) bytes, aligned to a
+   *        cache line
+   * @param capacity number of slots, rounded up to a power of two of at least
+   *        MIN_CAPACITY
+   */
+  static LogRing* create(void* memory, uint32_t capacity)
+  {
+    return new (memory) LogRing(roundCapacity(capacity));
+  }
+
+  /**
+   * @brief access a ring set up by another process
+   * @return the ring or nullptr if the memory doesn't contain one
+   */
+  static LogRing* open(void* memory)
+  {
+    LogRing* ring = static_cast<LogRing*>(memory);
+    return ring->m_Magic == MAGIC ? ring : nullptr;
+  }
+
+  /**
+   * @return the capacity create() will use for the requested number of slots
+   */
+  static constexpr uint32_t roundCapacity(uint32_t capacity)
+  {
+    uint32_t result = MIN_CAPACITY;
+    while (result < capacity) {
+      result *= 2;
+    }
+    return result;
+  }
+
+  uint32_t capacity() const { return m_Capacity; }
+
+  /**
+   * @brief write a record
+   * @param level level of the message, less than LEVEL_COUNT
+   * @param text the message, truncated to maxRecordLength()
+   * @param length length of the message in bytes
+   * @return false if the ring is full
+   */
+  bool tryPush(uint8_t level, const char* text, std::size_t length)
+  {
+    length               = std::min(length, maxRecordLength());
+    const uint32_t count = std::max<uint32_t>(
+        static_cast<uint32_t>((length + SLOT_DATA - 1) / SLOT_DATA), 1);
+
+    uint64_t pos = m_Tail.load(std::memory_order_relaxed);
+    for (;;) {
+      // the reader frees slots in order, if the last slot of the record is free, so
+      // are the others
+      const uint64_t last = pos + count - 1;
+      const int64_t diff  = static_cast<int64_t>(
+          slot(last).sequence.load(std::memory_order_acquire) - last);
+      if (diff == 0) {
+        if (m_Tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_Tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    for (uint32_t i = count; i-- > 0;) {
+      Slot& s                 = slot(pos + i);
+      const std::size_t begin = i * SLOT_DATA;
+      memcpy(s.data, text + begin, std::min(SLOT_DATA, length - begin));
+      if (i == 0) {
+        s.length = static_cast<uint16_t>(length);
+        s.level  = level;
+        s.slots  = static_cast<uint8_t>(count);
+      }
+      s.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief called by writers after a record was pushed
+   * @return true if the reader is waiting for records and has to be woken up, only
+   *         returned to one writer per call to setReaderWaiting()
+   */
+  bool takeReaderWaiting()
+  {
+    // pairs with the fence in setReaderWaiting(), either the reader sees the record
+    // or the writer sees the reader waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return (m_ReaderWaiting.load(std::memory_order_relaxed) != 0) &&
+           (m_ReaderWaiting.exchange(0, std::memory_order_relaxed) != 0);
+  }
+
+  /**
+   * @brief called by the reader before it waits for a record, it has to check
+   *        hasRecord() afterwards since records pushed earlier don't wake it up
+   */
+  void setReaderWaiting()
+  {
+    m_ReaderWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  /**
+   * @return true if the oldest record can be read
+   */
+  bool hasRecord()
+  {
+    const uint64_t pos = m_Head.load(std::memory_order_relaxed);
+    return slot(pos).sequence.load(std::memory_order_acquire) == pos + 1;
+  }
+
+  /**
+   * @brief count a record the caller gave up on writing
+   */
+  void recordDropped(uint8_t level)
+  {
+    m_Dropped[std::min<uint32_t>(level, LEVEL_COUNT - 1)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @return number of records of the level dropped since the last call
+   */
+  uint32_t takeDropped(uint8_t level)
+  {
+    return m_Dropped[level].exchange(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief read the oldest record, must only be called by one thread at a time
+   * @return false if there is no record or the oldest one is still being written
+   */
+  bool tryPop(uint8_t& level, std::string& text)
+  {
+    const uint64_t pos = m_Head.load(std::memory_order_relaxed);
+    Slot& first        = slot(pos);
+    if (first.sequence.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+
+    level                    = first.level;
+    const uint32_t count     = first.slots;
+    const std::size_t length = first.length;
+    text.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+      const std::size_t begin = i * SLOT_DATA;
+      text.append(slot(pos + i).data, std::min(SLOT_DATA, length - begin));
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+      slot(pos + i).sequence.store(pos + i + m_Capacity, std::memory_order_release);
+    }
+    m_Head.store(pos + count, std::memory_order_relaxed);
+
+    return true;
+  }
+
+private:
+  static constexpr uint32_t MAGIC = 0x676f6c75;  // "ulog"
+
+  explicit LogRing(uint32_t capacity) : m_Capacity(capacity)
+  {
+    for (uint32_t i = 0; i < LEVEL_COUNT; ++i) {
+      m_Dropped[i].store(0, std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < capacity; ++i) {
+      new (&slot(i)) Slot;
+      slot(i).sequence.store(i, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    m_Magic = MAGIC;
+  }
+
+  Slot& slot(uint64_t pos)
+  {
+    Slot* slots = reinterpret_cast<Slot*>(reinterpret_cast<char*>(this + 1));
+    return slots[pos & (m_Capacity - 1)];
+  }
+
+  uint32_t m_Magic{0};
+  uint32_t m_Capacity;
+  // written by the writers
+  alignas(64) std::atomic<uint64_t> m_Tail{0};
+  // written by the reader
+  alignas(64) std::atomic<uint64_t> m_Head{0};
+  alignas(64) std::atomic<uint32_t> m_Dropped[LEVEL_COUNT];
+  // set by the reader while it waits for records
+  alignas(64) std::atomic<uint32_t> m_ReaderWaiting{0};
+};
+
+}  // namespace usvfs::shared
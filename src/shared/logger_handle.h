@@ -0,0 +1,144 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+// messages below this level are compiled out entirely, defaults to keeping all of
+// them so the level can still be chosen at runtime
+#ifndef USVFS_LOG_MIN_LEVEL
+#define USVFS_LOG_MIN_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+namespace usvfs::log
+{
+
+/**
+ * @brief cached reference to a named spdlog logger
+ *
+ * spdlog::get() looks the logger up in the registry and copies a shared_ptr on every
+ * call. The handle looks it up once and afterwards only loads a pointer, the level
+ * check is the logger's own relaxed atomic so runtime level changes take effect
+ * immediately.
+ *
+ * loggers that are dropped and recreated have to be picked up with refresh(), the
+ * loggers replaced that way are kept alive because other threads may still be using
+ * them
+ */
+class LoggerHandle
+{
+public:
+  explicit LoggerHandle(const char* name) : m_Name(name) {}
+
+  LoggerHandle(const LoggerHandle&)            = delete;
+  LoggerHandle& operator=(const LoggerHandle&) = delete;
+
+  /**
+   * @return the logger or nullptr if it doesn't exist (yet)
+   */
+  spdlog::logger* get()
+  {
+    spdlog::logger* result = m_Logger.load(std::memory_order_acquire);
+    return result != nullptr ? result : resolve();
+  }
+
+  spdlog::logger* operator->() { return get(); }
+
+  /**
+   * @return the logger if a message of the specified level would be written, nullptr
+   *         otherwise
+   */
+  spdlog::logger* enabled(spdlog::level::level_enum level)
+  {
+    spdlog::logger* result = get();
+    return (result != nullptr) && result->should_log(level) ? result : nullptr;
+  }
+
+  /**
+   * @brief look the logger up again, must be called after it has been recreated
+   */
+  void refresh()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Owner) {
+      m_Retired.push_back(std::move(m_Owner));
+    }
+    m_Owner = spdlog::get(m_Name);
+    m_Logger.store(m_Owner.get(), std::memory_order_release);
+  }
+
+private:
+  spdlog::logger* resolve()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Owner) {
+      m_Owner = spdlog::get(m_Name);
+      m_Logger.store(m_Owner.get(), std::memory_order_release);
+    }
+    return m_Owner.get();
+  }
+
+  const std::string m_Name;
+  std::atomic<spdlog::logger*> m_Logger{nullptr};
+  std::mutex m_Mutex;
+  std::shared_ptr<spdlog::logger> m_Owner;
+  std::vector<std::shared_ptr<spdlog::logger>> m_Retired;
+};
+
+// general messages
+inline LoggerHandle usvfsLogger("usvfs");
+// messages from the hooks
+inline LoggerHandle hooksLogger("hooks");
+
+/**
+ * @brief pick up the usvfs and hooks loggers after they have been (re)created
+ */
+inline void refreshLoggers()
+{
+  usvfsLogger.refresh();
+  hooksLogger.refresh();
+}
+
+}  // namespace usvfs::log
+
+/**
+ * log through a LoggerHandle. The arguments are only evaluated and formatted if the
+ * message is actually written and levels below USVFS_LOG_MIN_LEVEL don't generate
+ * any code. lvl is the name of a spdlog level: trace, debug, info, warn, err or
+ * critical
+ */
+#define USVFS_LOG(handle, lvl, ...)                                                    \
+  do {                                                                                 \
+    if constexpr (spdlog::level::lvl >= USVFS_LOG_MIN_LEVEL) {                         \
+      if (spdlog::logger* usvfs_logger_ = (handle).enabled(spdlog::level::lvl)) {      \
+        usvfs_logger_->log(spdlog::level::lvl, __VA_ARGS__);                           \
+      }                                                                                \
+    }                                                                                  \
+  } while (false)
+
+#define LOG_USVFS(lvl, ...) USVFS_LOG(usvfs::log::usvfsLogger, lvl, __VA_ARGS__)
+#define LOG_HOOKS(lvl, ...) USVFS_LOG(usvfs::log::hooksLogger, lvl, __VA_ARGS__)
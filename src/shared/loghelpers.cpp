@@ -32,14 +32,6 @@ namespace usvfs::log
 
 // this is declared in formatters but is defined here to avoid a whole .cpp
 // file for two small functions
-//
-// comments from old code, taken as is:
-//
-//    TODO this does not correctly support surrogate pairs since the size used here
-//    is the number of 16-bit characters in the buffer whereas toNarrow expects the
-//    actual number of characters. It will always underestimate though, so worst
-//    case scenario we truncate the string
-//
 std::string to_string(LPCWSTR value)
 {
   if (value == nullptr) {
@@ -22,9 +22,11 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dllimport.h"
 #include "formatters.h"
+#include "logger_handle.h"
 #include "ntdll_declarations.h"
 #include "shmlogger.h"
 #include "stringutils.h"
+#include "trace_recorder.h"
 
 namespace usvfs::log
 {
@@ -48,7 +50,16 @@ class CallLogger
 {
 public:
   explicit CallLogger(const char* function)
+      : m_Logger(hooksLogger.enabled(spdlog::level::debug))
   {
+    if (m_Logger == nullptr) {
+      return;
+    }
+
+    if (shared::TraceRecorder::instance().enabled()) {
+      m_TraceStart = shared::TraceRecorder::now();
+    }
+
     const char* namespaceend = strrchr(function, ':');
 
     if (namespaceend != nullptr) {
@@ -60,28 +71,39 @@ public:
 
   ~CallLogger()
   {
+    if (m_Logger == nullptr) {
+      return;
+    }
+
     try {
-      static std::shared_ptr<spdlog::logger> log = spdlog::get("hooks");
-      log->debug("{}", m_Message);
+      m_Logger->debug("{}", m_Message);
     } catch (...) {
       // suppress all exceptions in destructor
     }
+
+    if (m_TraceStart != 0) {
+      shared::TraceRecorder::instance().record("logging", m_TraceStart,
+                                               shared::TraceRecorder::now());
+    }
   }
 
   template <typename T>
   CallLogger& addParam(const char* name, const T& value, uint8_t style = 0);
 
 private:
+  // null if debug messages are disabled, checked once per call
+  spdlog::logger* m_Logger;
   std::string m_Message;
+  // building and writing the message is traced if tracing was enabled on creation
+  uint64_t m_TraceStart{0};
 };
 
 template <typename T>
 CallLogger& CallLogger::addParam(const char* name, const T& value, uint8_t style)
 {
-  static bool enabled = spdlog::get("hooks")->should_log(spdlog::level::debug);
   typedef std::underlying_type<DisplayStyle>::type DSType;
 
-  if (enabled) {
+  if (m_Logger != nullptr) {
     if constexpr (std::is_pointer_v<T>) {
       if (value == nullptr) {
         std::format_to(std::back_inserter(m_Message), "[{}=<null>]", name);
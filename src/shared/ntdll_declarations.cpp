@@ -41,6 +41,7 @@ RtlDosPathNameToRelativeNtPathName_U_WithStatus_type
 RtlReleaseRelativeName_type RtlReleaseRelativeName;
 RtlGetVersion_type RtlGetVersion;
 NtTerminateProcess_type NtTerminateProcess;
+NtQueueApcThread_type NtQueueApcThread;
 
 static bool ntdll_initialized;
 
@@ -64,6 +65,7 @@ void ntdll_declarations_init()
     LOAD_EXT(ntDLLMod, RtlReleaseRelativeName);
     LOAD_EXT(ntDLLMod, RtlGetVersion);
     LOAD_EXT(ntDLLMod, NtTerminateProcess);
+    LOAD_EXT(ntDLLMod, NtQueueApcThread);
 
     ntdll_initialized = true;
   }
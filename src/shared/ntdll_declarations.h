@@ -358,6 +358,7 @@ typedef struct _FILE_REPARSE_POINT_INFORMATION
 #define STATUS_NO_MORE_FILES ((NTSTATUS)0x80000006L)
 #define STATUS_INFO_LENGTH_MISMATCH ((NTSTATUS)0xC0000004L)
 #define STATUS_NO_SUCH_FILE ((NTSTATUS)0xC000000FL)
+#define STATUS_BUFFER_TOO_SMALL ((NTSTATUS)0xC0000023L)
 
 #define SL_RESTART_SCAN 0x01
 #define SL_RETURN_SINGLE_ENTRY 0x02
@@ -404,6 +405,8 @@ typedef struct _IO_STATUS_BLOCK* PIO_STATUS_BLOCK;
 // PIO_STATUS_BLOCK IoStatusBlock, __in ULONG Reserved);
 typedef VOID(NTAPI* PIO_APC_ROUTINE)(PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock,
                                      ULONG Reserved);
+typedef VOID(NTAPI* PPS_APC_ROUTINE)(PVOID ApcArgument1, PVOID ApcArgument2,
+                                     PVOID ApcArgument3);
 typedef enum _FILE_INFORMATION_CLASS FILE_INFORMATION_CLASS;
 
 typedef struct _UNICODE_STRING
@@ -579,6 +582,10 @@ using NtClose_type = NTSTATUS(WINAPI*)(HANDLE);
 using NtTerminateProcess_type = NTSTATUS(WINAPI*)(HANDLE ProcessHandle,
                                                   NTSTATUS ExitStatus);
 
+using NtQueueApcThread_type =
+    NTSTATUS(NTAPI*)(HANDLE ThreadHandle, PPS_APC_ROUTINE ApcRoutine,
+                     PVOID ApcArgument1, PVOID ApcArgument2, PVOID ApcArgument3);
+
 // Rtl
 
 using RtlDoesFileExists_U_type = NTSYSAPI BOOLEAN(NTAPI*)(PCWSTR);
@@ -599,6 +606,7 @@ extern NtOpenFile_type NtOpenFile;
 extern NtCreateFile_type NtCreateFile;
 extern NtClose_type NtClose;
 extern NtTerminateProcess_type NtTerminateProcess;
+extern NtQueueApcThread_type NtQueueApcThread;
 extern RtlDoesFileExists_U_type RtlDoesFileExists_U;
 extern RtlDosPathNameToRelativeNtPathName_U_WithStatus_type
     RtlDosPathNameToRelativeNtPathName_U_WithStatus;
@@ -0,0 +1,345 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USVFS_PATH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief null terminated path kept on the stack unless it's unusually long
+ */
+template <typename CharT, std::size_t InlineSize = 512>
+class PathBuffer
+{
+public:
+  PathBuffer() { m_Inline[0] = CharT(0); }
+
+  PathBuffer(const PathBuffer&)            = delete;
+  PathBuffer& operator=(const PathBuffer&) = delete;
+
+  const CharT* c_str() const { return m_Data; }
+  std::size_t size() const { return m_Size; }
+  bool empty() const { return m_Size == 0; }
+  CharT operator[](std::size_t index) const { return m_Data[index]; }
+
+  std::basic_string_view<CharT> view() const
+  {
+    return std::basic_string_view<CharT>(m_Data, m_Size);
+  }
+
+  std::basic_string<CharT> str() const
+  {
+    return std::basic_string<CharT>(m_Data, m_Size);
+  }
+
+  void append(CharT c)
+  {
+    reserve(m_Size + 1);
+    m_Data[m_Size++] = c;
+    m_Data[m_Size]   = CharT(0);
+  }
+
+  void append(const CharT* source, std::size_t length)
+  {
+    reserve(m_Size + length);
+    memcpy(m_Data + m_Size, source, length * sizeof(CharT));
+    m_Size += length;
+    m_Data[m_Size] = CharT(0);
+  }
+
+  void truncate(std::size_t size)
+  {
+    m_Size         = size;
+    m_Data[m_Size] = CharT(0);
+  }
+
+private:
+  void reserve(std::size_t size)
+  {
+    if (size < m_Capacity) {
+      return;
+    }
+
+    std::size_t capacity = m_Capacity * 2;
+    while (capacity <= size) {
+      capacity *= 2;
+    }
+    std::unique_ptr<CharT[]> heap(new CharT[capacity]);
+    memcpy(heap.get(), m_Data, (m_Size + 1) * sizeof(CharT));
+    m_Heap     = std::move(heap);
+    m_Data     = m_Heap.get();
+    m_Capacity = capacity;
+  }
+
+  CharT m_Inline[InlineSize];
+  CharT* m_Data{m_Inline};
+  std::size_t m_Size{0};
+  // including the terminating null
+  std::size_t m_Capacity{InlineSize};
+  std::unique_ptr<CharT[]> m_Heap;
+};
+
+namespace detail
+{
+
+template <typename CharT>
+bool isPathSeparator(CharT c)
+{
+  return (c == CharT('\\')) || (c == CharT('/'));
+}
+
+template <typename CharT>
+bool startsWith(std::basic_string_view<CharT> path, const char* prefix)
+{
+  for (std::size_t i = 0; prefix[i] != '\0'; ++i) {
+    if ((i >= path.size()) || (path[i] != CharT(prefix[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename CharT>
+const CharT* findPathSeparator(const CharT* begin, const CharT* end)
+{
+#ifdef USVFS_PATH_SSE2
+  if constexpr (sizeof(CharT) == 2) {
+    const __m128i backslash = _mm_set1_epi16('\\');
+    const __m128i slash     = _mm_set1_epi16('/');
+    for (; end - begin >= 8; begin += 8) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+      const int mask  = _mm_movemask_epi8(
+          _mm_or_si128(_mm_cmpeq_epi16(v, backslash), _mm_cmpeq_epi16(v, slash)));
+      if (mask != 0) {
+        return begin + std::countr_zero(static_cast<unsigned int>(mask)) / 2;
+      }
+    }
+  }
+#endif
+
+  while ((begin != end) && !isPathSeparator(*begin)) {
+    ++begin;
+  }
+  return begin;
+}
+
+// length of the root of an absolute path: "X:" or "\\server\share"
+template <typename CharT>
+std::size_t rootNameLength(std::basic_string_view<CharT> path)
+{
+  if ((path.size() >= 2) && (path[1] == CharT(':'))) {
+    return 2;
+  } else if ((path.size() >= 2) && isPathSeparator(path[0]) &&
+             isPathSeparator(path[1])) {
+    const CharT* begin  = path.data();
+    const CharT* end    = begin + path.size();
+    const CharT* server = findPathSeparator(begin + 2, end);
+    return (server == end ? end : findPathSeparator(server + 1, end)) - begin;
+  }
+  return 0;
+}
+
+/**
+ * writes a path with separators collapsed and converted to backslashes, "." removed
+ * and ".." applied. ".." never goes above the root
+ */
+template <typename CharT, std::size_t InlineSize>
+class PathNormalizer
+{
+public:
+  explicit PathNormalizer(PathBuffer<CharT, InlineSize>& out) : m_Out(out) {}
+
+  /**
+   * writes the root of the path, "X:\", "X:", "\\server\share" or "\", if any
+   * @return the rest of the path
+   */
+  std::basic_string_view<CharT> root(std::basic_string_view<CharT> path)
+  {
+    std::size_t length = rootNameLength(path);
+    for (std::size_t i = 0; i < length; ++i) {
+      m_Out.append(isPathSeparator(path[i]) ? CharT('\\') : path[i]);
+    }
+
+    if (length == 2) {
+      // drive, relative to the current directory of the drive unless followed by a
+      // separator
+      if ((path.size() > 2) && isPathSeparator(path[2])) {
+        m_Out.append(CharT('\\'));
+        ++length;
+      }
+    } else if (length > 2) {
+      // the share of a UNC path is part of its root
+      m_SeparatorAfterRoot = true;
+    } else if (!path.empty() && isPathSeparator(path[0])) {
+      m_Out.append(CharT('\\'));
+      length = 1;
+    }
+
+    m_RootLength = m_Out.size();
+    return path.substr(length);
+  }
+
+  /**
+   * makes the root written so far absolute, as in "X:" to "X:\"
+   */
+  void rootDirectory()
+  {
+    if (!m_SeparatorAfterRoot) {
+      m_Out.append(CharT('\\'));
+      m_RootLength = m_Out.size();
+    }
+  }
+
+  void segments(std::basic_string_view<CharT> path)
+  {
+    const CharT* pos = path.data();
+    const CharT* end = pos + path.size();
+    while (pos != end) {
+      const CharT* separator = findPathSeparator(pos, end);
+      segment(pos, separator - pos);
+      pos = separator == end ? end : separator + 1;
+    }
+  }
+
+private:
+  void segment(const CharT* name, std::size_t length)
+  {
+    if ((length == 0) || ((length == 1) && (name[0] == CharT('.')))) {
+      return;
+    }
+
+    if ((length == 2) && (name[0] == CharT('.')) && (name[1] == CharT('.'))) {
+      if ((m_Out.size() > m_RootLength) && !endsWithParent()) {
+        std::size_t pos = m_Out.size();
+        while ((pos > m_RootLength) && (m_Out[pos - 1] != CharT('\\'))) {
+          --pos;
+        }
+        m_Out.truncate(pos > m_RootLength ? pos - 1 : m_RootLength);
+        return;
+      } else if (m_RootLength > 0) {
+        // can't go above the root
+        return;
+      }
+    }
+
+    if ((m_Out.size() > m_RootLength) || m_SeparatorAfterRoot) {
+      m_Out.append(CharT('\\'));
+    }
+    m_Out.append(name, length);
+  }
+
+  // true if a relative path starts with more ".." than it has names
+  bool endsWithParent() const
+  {
+    const std::size_t size = m_Out.size();
+    return (size >= 2) && (m_Out[size - 1] == CharT('.')) &&
+           (m_Out[size - 2] == CharT('.')) &&
+           ((size == 2) || (m_Out[size - 3] == CharT('\\')));
+  }
+
+  PathBuffer<CharT, InlineSize>& m_Out;
+  std::size_t m_RootLength{0};
+  bool m_SeparatorAfterRoot{false};
+};
+
+}  // namespace detail
+
+/**
+ * @return true if canonicalizePath needs the current directory for the path
+ */
+template <typename CharT>
+bool requiresCurrentDirectory(std::basic_string_view<CharT> path)
+{
+  if (path.empty() || ((path.size() >= 2) && (path[1] == CharT(':')))) {
+    return false;
+  }
+  // relative to the root of the current drive or to the current directory, not UNC
+  return !((path.size() >= 2) && detail::isPathSeparator(path[0]) &&
+           detail::isPathSeparator(path[1]));
+}
+
+/**
+ * @brief turn a path passed to a hook into the absolute form the redirection tree is
+ *        keyed by
+ *
+ * this is done in a single pass without allocations for all but very long paths:
+ *   - "\\?\" and "\??\" prefixes are removed
+ *   - "\\localhost\X$" and "\\127.0.0.1\X$" become "X:"
+ *   - paths relative to the current directory or the root of the current drive are
+ *     made absolute
+ *   - separators are collapsed and converted to backslashes, "." is removed, ".."
+ *     is applied and trailing separators are dropped except after a drive
+ *
+ * a path with a drive but no separator after it, as in "X:file", is only
+ * normalized, the current directory of drives other than the current one isn't
+ * known
+ *
+ * @param path the path to canonicalize
+ * @param currentDirectory absolute path of the current directory, only used if
+ *        requiresCurrentDirectory() is true for the path
+ * @param result buffer receiving the canonical path, must be empty
+ */
+template <typename CharT, std::size_t InlineSize>
+void canonicalizePath(std::basic_string_view<CharT> path,
+                      std::basic_string_view<CharT> currentDirectory,
+                      PathBuffer<CharT, InlineSize>& result)
+{
+  detail::PathNormalizer<CharT, InlineSize> normalizer(result);
+
+  if (detail::startsWith(path, "\\\\?\\") || detail::startsWith(path, "\\??\\")) {
+    normalizer.segments(normalizer.root(path.substr(4)));
+  } else if ((detail::startsWith(path, "\\\\localhost\\") ||
+              detail::startsWith(path, "\\\\127.0.0.1\\")) &&
+             (path.size() > 13) && (path[13] == CharT('$'))) {
+    CharT drive = path[12];
+    if ((drive >= CharT('a')) && (drive <= CharT('z'))) {
+      drive = drive - CharT('a') + CharT('A');
+    }
+    const CharT root[] = {drive, CharT(':'), CharT('\\')};
+    const bool rooted  = (path.size() > 14) && detail::isPathSeparator(path[14]);
+    normalizer.root(std::basic_string_view<CharT>(root, rooted ? 3 : 2));
+    normalizer.segments(path.substr(14));
+  } else if (!requiresCurrentDirectory(path)) {
+    normalizer.segments(normalizer.root(path));
+  } else if (detail::isPathSeparator(path[0])) {
+    normalizer.root(
+        currentDirectory.substr(0, detail::rootNameLength(currentDirectory)));
+    normalizer.rootDirectory();
+    normalizer.segments(path);
+  } else {
+    normalizer.segments(normalizer.root(currentDirectory));
+    normalizer.segments(path);
+  }
+}
+
+}  // namespace usvfs::shared
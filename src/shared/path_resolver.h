@@ -0,0 +1,252 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "file_metadata.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+// attributes reported for files that don't exist, same as INVALID_FILE_ATTRIBUTES
+static const uint32_t RESOLVER_INVALID_ATTRIBUTES = 0xFFFFFFFF;
+
+// createTargetDistance() of nodes without a create target
+static const std::size_t RESOLVER_NO_CREATE_TARGET = static_cast<std::size_t>(-1);
+
+/**
+ * @brief access to the real file system, as far as the PathResolver needs it
+ */
+template <typename StringT>
+class ResolverFileSystem
+{
+public:
+  virtual ~ResolverFileSystem() = default;
+
+  /**
+   * @return attributes of the file or RESOLVER_INVALID_ATTRIBUTES if it doesn't
+   *         exist. This must not be redirected
+   */
+  virtual uint32_t attributes(const StringT& path) const = 0;
+};
+
+/**
+ * @brief resolves a path against the redirection tree in a single walk
+ *
+ * the hooks used to look up the same path several times for one call: once to
+ * reroute it, once for each create target and again for the attribute queries made
+ * on the way, each one walking the tree from the root. The resolver visits every
+ * node on the path once and collects everything the hooks need to decide where a
+ * call goes in one record.
+ *
+ * TreeT provides the tree nodes:
+ *   - typedef NodeRef, a copyable handle to a node that converts to false if empty
+ *   - NodeRef child(const NodeRef& parent, std::basic_string_view<CharT> name) const,
+ *     looks up the child of a node (of the root if parent is empty), empty if there
+ *     is none
+ *   - bool isDirectory(const NodeRef&) const
+ *   - std::size_t createTargetDistance(const NodeRef&) const, number of levels up to
+ *     the nearest create target (0 for the node itself) or RESOLVER_NO_CREATE_TARGET
+ *   - NodeRef ancestor(const NodeRef&, std::size_t levels) const
+ *   - StringT linkTarget(const NodeRef&) const, empty if the node has no target
+ *   - const FileMetadata* metadata(const NodeRef&) const, nullptr if unknown
+ *
+ * paths are expected to be absolute and normalized, components are separated by
+ * backslashes or slashes. The leading separators of a UNC path are kept with the
+ * server name, the way the tree stores them
+ */
+template <typename TreeT, typename StringT>
+class PathResolver
+{
+public:
+  typedef typename TreeT::NodeRef NodeRef;
+  typedef typename StringT::value_type CharT;
+  typedef std::basic_string_view<CharT> ViewT;
+
+  // looks up where a deleted file was rerouted to, returns false if the path wasn't
+  // deleted through usvfs
+  typedef std::function<bool(const StringT& path, StringT& target)> DeletedLookupT;
+
+  struct Result
+  {
+    // the path that was resolved
+    StringT path;
+    // where calls on the path go, same as path if it's not redirected
+    StringT target;
+    // true if calls on the path are redirected. This includes directories that only
+    // exist in the tree, in which case target is the same as path
+    bool rerouted{false};
+    // true if the file was deleted through usvfs and is rerouted to its former
+    // location, the node is not used in that case
+    bool deleted{false};
+    // node of the path in the tree, empty if it's not in the tree
+    NodeRef node{};
+    // true if the path exists in the tree
+    bool isVirtual{false};
+    // true if the path is a directory in the tree
+    bool isDirectory{false};
+    // true if the parent of the path is a directory in the tree
+    bool parentVirtual{false};
+    // where a new file at this path would be created, empty if no create target
+    // applies
+    StringT createTarget;
+  };
+
+  PathResolver(const TreeT& tree, const ResolverFileSystem<StringT>& fileSystem,
+               DeletedLookupT deleted = DeletedLookupT())
+      : m_Tree(tree), m_FileSystem(fileSystem), m_Deleted(deleted)
+  {}
+
+  /**
+   * @brief resolve a path, this only consults the tree and doesn't touch the disk
+   */
+  Result resolve(ViewT path) const
+  {
+    Result result;
+    result.path   = StringT(path);
+    result.target = result.path;
+
+    // the components point into the path, it doesn't have to be copied for them
+    std::vector<ViewT> components;
+    split(path, components);
+
+    // deepest node on the path and the number of components it covers
+    NodeRef deepest{};
+    size_t deepestDepth = 0;
+    for (size_t depth = 0; depth < components.size(); ++depth) {
+      NodeRef node = m_Tree.child(deepest, components[depth]);
+      if (!node) {
+        break;
+      }
+
+      if (depth + 2 == components.size()) {
+        result.parentVirtual = m_Tree.isDirectory(node);
+      }
+
+      if (depth + 1 == components.size()) {
+        result.node        = node;
+        result.isVirtual   = true;
+        result.isDirectory = m_Tree.isDirectory(node);
+      }
+
+      deepest      = std::move(node);
+      deepestDepth = depth + 1;
+    }
+
+    if (deepest) {
+      // every node knows how far up its nearest create target is, so the target is
+      // the link target of that node followed by the rest of the path
+      const size_t distance = m_Tree.createTargetDistance(deepest);
+      if (distance < deepestDepth) {
+        NodeRef createTarget =
+            distance == 0 ? deepest : m_Tree.ancestor(deepest, distance);
+        if (createTarget) {
+          result.createTarget = join(m_Tree.linkTarget(createTarget), components,
+                                     deepestDepth - distance);
+        }
+      }
+    }
+
+    StringT deletedTarget;
+    if (m_Deleted && m_Deleted(result.path, deletedTarget)) {
+      result.target   = std::move(deletedTarget);
+      result.deleted  = true;
+      result.rerouted = true;
+    } else if (result.isVirtual) {
+      StringT linkTarget = m_Tree.linkTarget(result.node);
+      if (!linkTarget.empty()) {
+        result.target   = std::move(linkTarget);
+        result.rerouted = true;
+      } else if (result.isDirectory) {
+        // directory that only exists because of its children
+        result.rerouted = true;
+      }
+    }
+
+    return result;
+  }
+
+  /**
+   * @brief determine the attributes of the target of a resolved path. The recorded
+   *        metadata is used if available, otherwise the disk is queried once
+   */
+  uint32_t attributes(const Result& result) const
+  {
+    if (!result.deleted && result.node) {
+      if (const FileMetadata* metadata = m_Tree.metadata(result.node)) {
+        return metadata->attributes;
+      }
+    }
+
+    return m_FileSystem.attributes(result.target);
+  }
+
+private:
+  static bool isSeparator(CharT c) { return c == CharT('\\') || c == CharT('/'); }
+
+  static void split(ViewT path, std::vector<ViewT>& components)
+  {
+    size_t begin = 0;
+    while (begin < path.size()) {
+      size_t end = begin;
+      if ((begin == 0) && (path.size() > 2) && isSeparator(path[0]) &&
+          isSeparator(path[1])) {
+        // the server of a UNC path is a single component, including the separators
+        end = 2;
+      }
+      while (end < path.size() && !isSeparator(path[end])) {
+        ++end;
+      }
+
+      if (end > begin) {
+        const ViewT component = path.substr(begin, end - begin);
+        if ((component.size() != 1) || (component[0] != CharT('.'))) {
+          components.push_back(component);
+        }
+      }
+
+      begin = end + 1;
+    }
+  }
+
+  // appends the components from the specified index to a base path
+  static StringT join(StringT base, const std::vector<ViewT>& components, size_t from)
+  {
+    for (size_t i = from; i < components.size(); ++i) {
+      if (!base.empty() && !isSeparator(base.back())) {
+        base += CharT('\\');
+      }
+      base += components[i];
+    }
+    return base;
+  }
+
+  const TreeT& m_Tree;
+  const ResolverFileSystem<StringT>& m_FileSystem;
+  DeletedLookupT m_Deleted;
+};
+
+}  // namespace usvfs::shared
@@ -0,0 +1,102 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief measures consecutive phases of a sequence like attaching to a process,
+ *        each phase ends where the next one starts
+ */
+class PhaseTimer
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase
+  {
+    // must outlive the timer, usually a string literal
+    const char* name;
+    Clock::duration duration;
+  };
+
+  PhaseTimer() : m_Start(Clock::now()), m_Last(m_Start) {}
+
+  /**
+   * @brief ends the current phase, the next one starts now
+   */
+  void lap(const char* name)
+  {
+    const Clock::time_point now = Clock::now();
+    m_Phases.push_back({name, now - m_Last});
+    m_Last = now;
+  }
+
+  const std::vector<Phase>& phases() const { return m_Phases; }
+
+  /**
+   * @return time from construction to the end of the last phase
+   */
+  Clock::duration total() const { return m_Last - m_Start; }
+
+  /**
+   * @return the phases and their durations in milliseconds, like
+   *         "context 1.20 ms, hooks 0.35 ms (total 1.55 ms)"
+   */
+  std::string summary() const
+  {
+    std::string result;
+    for (const Phase& phase : m_Phases) {
+      if (!result.empty()) {
+        result += ", ";
+      }
+      result += phase.name;
+      result += " ";
+      result += milliseconds(phase.duration);
+    }
+
+    result += result.empty() ? "(total " : " (total ";
+    result += milliseconds(total());
+    result += ")";
+    return result;
+  }
+
+private:
+  static std::string milliseconds(Clock::duration duration)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f ms",
+             std::chrono::duration<double, std::milli>(duration).count());
+    return buffer;
+  }
+
+  Clock::time_point m_Start;
+  Clock::time_point m_Last;
+  std::vector<Phase> m_Phases;
+};
+
+}  // namespace usvfs::shared
@@ -0,0 +1,521 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "skip_rules.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief result of a lookup answered from a parsed profile
+ */
+struct ProfileResult
+{
+  // characters written to the buffer, not counting the terminating null
+  uint32_t length;
+  // false if the section or key doesn't exist and the default was returned
+  bool found;
+};
+
+/**
+ * @brief an ini file parsed the way GetPrivateProfileString and
+ *        GetPrivateProfileSection read it
+ *
+ * the profile api has quirks that differ between implementations, so only what can
+ * be answered with certainty is: parse() rejects files that aren't plain ascii or
+ * have malformed section headers, and lookups return std::nullopt for results that
+ * would be truncated, for sections that appear more than once and for listings of
+ * sections with comments or lines that aren't written as key=value. The caller has
+ * to fall back to the real api in these cases
+ */
+class ProfileData
+{
+public:
+  /**
+   * @return the parsed file, nullptr if lookups in it can't be answered
+   */
+  static std::shared_ptr<const ProfileData> parse(std::string_view content)
+  {
+    auto result = std::make_shared<ProfileData>();
+    // lines before the first section header are in a section without a name
+    result->m_Sections.push_back({});
+
+    for (char c : content) {
+      const unsigned char u = static_cast<unsigned char>(c);
+      if ((u >= 0x80) || ((u < 0x20) && (c != '\t') && (c != '\r') && (c != '\n'))) {
+        return nullptr;
+      }
+    }
+
+    size_t start = 0;
+    while (start < content.size()) {
+      size_t end = content.find('\n', start);
+      if (end == std::string_view::npos) {
+        end = content.size();
+      }
+
+      std::string_view line = content.substr(start, end - start);
+      start                 = end + 1;
+
+      if (!line.empty() && (line.back() == '\r')) {
+        line.remove_suffix(1);
+      }
+      if (line.find('\r') != std::string_view::npos) {
+        return nullptr;
+      }
+
+      line = trim(line);
+      if (line.empty()) {
+        continue;
+      }
+
+      if (line.front() == '[') {
+        if (!result->addSection(line)) {
+          return nullptr;
+        }
+      } else {
+        result->m_Sections.back().addLine(line);
+      }
+    }
+
+    return result;
+  }
+
+  /**
+   * @brief GetPrivateProfileString: the section names if section is null, the key
+   *        names in the section if key is null, the value of the key otherwise
+   */
+  template <typename CharT>
+  std::optional<ProfileResult> getString(const CharT* section, const CharT* key,
+                                         const CharT* defaultValue, CharT* buffer,
+                                         uint32_t size) const
+  {
+    if ((buffer == nullptr) || (size == 0)) {
+      return std::nullopt;
+    }
+
+    if (section == nullptr) {
+      if (m_Duplicates) {
+        return std::nullopt;
+      }
+
+      std::vector<std::string_view> names;
+      for (const Section& s : m_Sections) {
+        if (!s.name.empty()) {
+          names.push_back(s.name);
+        }
+      }
+      return writeList(names, buffer, size);
+    }
+
+    const std::optional<std::string> sectionName = queryName(section);
+    if (!sectionName) {
+      return std::nullopt;
+    }
+
+    const Section* s = findSection(*sectionName);
+
+    if (key == nullptr) {
+      if ((s == nullptr) || s->duplicate || !s->listable || s->keys.empty()) {
+        return std::nullopt;
+      }
+
+      std::vector<std::string_view> names;
+      for (const Key& k : s->keys) {
+        names.push_back(k.name);
+      }
+      return writeList(names, buffer, size);
+    }
+
+    const std::optional<std::string> keyName = queryName(key);
+    if (!keyName || ((s != nullptr) && s->duplicate)) {
+      return std::nullopt;
+    }
+
+    const Key* k = (s != nullptr) ? s->findKey(*keyName) : nullptr;
+    if (k != nullptr) {
+      if (!k->hasValue) {
+        return std::nullopt;
+      }
+      return writeValue(unquote(k->value), true, buffer, size);
+    }
+
+    // the default without trailing blanks, a null default is an empty string
+    std::optional<std::string> fallback =
+        defaultValue != nullptr ? toASCII(defaultValue) : std::string();
+    if (!fallback || (!fallback->empty() && isQuote(fallback->front()))) {
+      return std::nullopt;
+    }
+    while (!fallback->empty() && (fallback->back() == ' ')) {
+      fallback->pop_back();
+    }
+
+    return writeValue(*fallback, false, buffer, size);
+  }
+
+  /**
+   * @brief GetPrivateProfileSection: all key=value lines in the section
+   */
+  template <typename CharT>
+  std::optional<ProfileResult> getSection(const CharT* section, CharT* buffer,
+                                          uint32_t size) const
+  {
+    if ((section == nullptr) || (buffer == nullptr) || (size < 2)) {
+      return std::nullopt;
+    }
+
+    const std::optional<std::string> sectionName = queryName(section);
+    if (!sectionName) {
+      return std::nullopt;
+    }
+
+    const Section* s = findSection(*sectionName);
+    if (s == nullptr) {
+      buffer[0] = CharT('\0');
+      buffer[1] = CharT('\0');
+      return ProfileResult{0, false};
+    }
+
+    if (s->duplicate || !s->listable) {
+      return std::nullopt;
+    }
+
+    std::vector<std::string> lines;
+    for (const Key& k : s->keys) {
+      lines.push_back(k.name + "=" + k.value);
+    }
+
+    std::vector<std::string_view> views(lines.begin(), lines.end());
+    return writeList(views, buffer, size);
+  }
+
+private:
+  struct Key
+  {
+    std::string name;
+    // the value as written, including quotes
+    std::string value;
+    // false for lines without =
+    bool hasValue;
+  };
+
+  struct Section
+  {
+    std::string name;
+    std::vector<Key> keys;
+    // a later section has the same name
+    bool duplicate{false};
+    // all lines are key=value without blanks around the =, no comments
+    bool listable{true};
+
+    void addLine(std::string_view line)
+    {
+      const size_t equals = line.find('=');
+      Key key;
+      key.hasValue = equals != std::string_view::npos;
+      key.name     = std::string(trim(line.substr(0, equals)));
+      if (key.hasValue) {
+        key.value = std::string(trim(line.substr(equals + 1)));
+      }
+
+      if (!key.hasValue || key.name.empty() || (key.name.front() == ';') ||
+          (line.size() != key.name.size() + 1 + key.value.size()) ||
+          (findKey(key.name) != nullptr)) {
+        listable = false;
+      }
+
+      keys.push_back(std::move(key));
+    }
+
+    const Key* findKey(std::string_view name) const
+    {
+      for (const Key& key : keys) {
+        if (equalsFolded(key.name, name)) {
+          return &key;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  // the name of a section header has to be between the brackets, without blanks
+  // around it or another bracket in it
+  bool addSection(std::string_view line)
+  {
+    if ((line.size() < 3) || (line.back() != ']')) {
+      return false;
+    }
+
+    const std::string_view name = line.substr(1, line.size() - 2);
+    if ((name.find(']') != std::string_view::npos) || (trim(name) != name)) {
+      return false;
+    }
+
+    for (Section& section : m_Sections) {
+      if (equalsFolded(section.name, name)) {
+        section.duplicate = true;
+        m_Duplicates      = true;
+      }
+    }
+
+    Section section;
+    section.name = std::string(name);
+    m_Sections.push_back(std::move(section));
+    return true;
+  }
+
+  const Section* findSection(std::string_view name) const
+  {
+    for (const Section& section : m_Sections) {
+      if (equalsFolded(section.name, name)) {
+        return &section;
+      }
+    }
+    return nullptr;
+  }
+
+  static bool isBlank(char c) { return (c == ' ') || (c == '\t'); }
+
+  static bool isQuote(char c) { return (c == '"') || (c == '\''); }
+
+  static std::string_view trim(std::string_view text)
+  {
+    while (!text.empty() && isBlank(text.front())) {
+      text.remove_prefix(1);
+    }
+    while (!text.empty() && isBlank(text.back())) {
+      text.remove_suffix(1);
+    }
+    return text;
+  }
+
+  static bool equalsFolded(std::string_view lhs, std::string_view rhs)
+  {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i) {
+      if (foldCase(lhs[i]) != foldCase(rhs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // values in matching quotes are returned without them
+  static std::string_view unquote(std::string_view value)
+  {
+    if ((value.size() >= 2) && isQuote(value.front()) &&
+        (value.back() == value.front())) {
+      return value.substr(1, value.size() - 2);
+    }
+    return value;
+  }
+
+  // the text if it's printable ascii, case folding of anything else depends on the
+  // locale
+  template <typename CharT>
+  static std::optional<std::string> toASCII(const CharT* text)
+  {
+    std::string result;
+    for (; *text != CharT('\0'); ++text) {
+      const auto c = static_cast<std::make_unsigned_t<CharT>>(*text);
+      if ((c >= 0x80) || ((c < 0x20) && (c != '\t'))) {
+        return std::nullopt;
+      }
+      result.push_back(static_cast<char>(c));
+    }
+    return result;
+  }
+
+  // section and key names are trimmed by the real api, but not consistently
+  template <typename CharT>
+  static std::optional<std::string> queryName(const CharT* name)
+  {
+    std::optional<std::string> result = toASCII(name);
+    if (!result || result->empty() || (trim(*result).size() != result->size())) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  template <typename CharT>
+  static std::optional<ProfileResult> writeValue(std::string_view value, bool found,
+                                                 CharT* buffer, uint32_t size)
+  {
+    if (value.size() + 1 > size) {
+      return std::nullopt;
+    }
+
+    std::copy(value.begin(), value.end(), buffer);
+    buffer[value.size()] = CharT('\0');
+    return ProfileResult{static_cast<uint32_t>(value.size()), found};
+  }
+
+  // null separated strings followed by another null, there has to be room to spare
+  // since truncation is reported differently when the list fits exactly
+  template <typename CharT>
+  static std::optional<ProfileResult>
+  writeList(const std::vector<std::string_view>& strings, CharT* buffer, uint32_t size)
+  {
+    size_t total = 0;
+    for (std::string_view s : strings) {
+      total += s.size() + 1;
+    }
+
+    if (total + 2 > size) {
+      return std::nullopt;
+    }
+
+    CharT* out = buffer;
+    for (std::string_view s : strings) {
+      out  = std::copy(s.begin(), s.end(), out);
+      *out = CharT('\0');
+      ++out;
+    }
+    *out = CharT('\0');
+
+    return ProfileResult{static_cast<uint32_t>(total), true};
+  }
+
+  std::vector<Section> m_Sections;
+  // a section name appears more than once
+  bool m_Duplicates{false};
+};
+
+/**
+ * @brief parsed ini files by path, an entry is only used while the file still has
+ *        the size and last write time it had when it was parsed
+ *
+ * the cache is process local and disabled by default. Files that can't be parsed
+ * are cached as nullptr so they aren't read again for every lookup
+ */
+class ProfileCache
+{
+public:
+  // entries at most, the cache is cleared when it's full
+  static constexpr size_t MAX_FILES = 64;
+
+  static ProfileCache& instance()
+  {
+    static ProfileCache cache;
+    return cache;
+  }
+
+  bool enabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+  void setEnabled(bool enabled)
+  {
+    m_Enabled.store(enabled, std::memory_order_relaxed);
+    if (!enabled) {
+      clear();
+    }
+  }
+
+  /**
+   * @return std::nullopt if the file isn't cached with that size and write time,
+   *         otherwise the parsed file or nullptr if it couldn't be parsed
+   */
+  std::optional<std::shared_ptr<const ProfileData>>
+  find(std::wstring_view path, uint64_t size, uint64_t writeTime) const
+  {
+    std::shared_lock lock(m_Mutex);
+    auto iter = m_Entries.find(key(path));
+    if ((iter == m_Entries.end()) || (iter->second.size != size) ||
+        (iter->second.writeTime != writeTime)) {
+      return std::nullopt;
+    }
+    return iter->second.data;
+  }
+
+  void insert(std::wstring_view path, uint64_t size, uint64_t writeTime,
+              std::shared_ptr<const ProfileData> data)
+  {
+    std::unique_lock lock(m_Mutex);
+    std::wstring k = key(path);
+    if ((m_Entries.size() >= MAX_FILES) && (m_Entries.find(k) == m_Entries.end())) {
+      m_Entries.clear();
+    }
+    m_Entries[std::move(k)] = Entry{size, writeTime, std::move(data)};
+  }
+
+  /**
+   * @brief forget the file, called after writing to it
+   */
+  void invalidate(std::wstring_view path)
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Entries.erase(key(path));
+  }
+
+  void clear()
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Entries.clear();
+  }
+
+  size_t size() const
+  {
+    std::shared_lock lock(m_Mutex);
+    return m_Entries.size();
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t size;
+    uint64_t writeTime;
+    std::shared_ptr<const ProfileData> data;
+  };
+
+  // paths differing only in the case of ascii letters are the same file, other
+  // differences only cost a second entry since the size and write time are checked
+  static std::wstring key(std::wstring_view path)
+  {
+    std::wstring result(path);
+    for (wchar_t& c : result) {
+      if ((c >= L'A') && (c <= L'Z')) {
+        c = static_cast<wchar_t>(c - L'A' + L'a');
+      }
+    }
+    return result;
+  }
+
+  mutable std::shared_mutex m_Mutex;
+  std::unordered_map<std::wstring, Entry> m_Entries;
+  std::atomic<bool> m_Enabled{false};
+};
+
+}  // namespace usvfs::shared
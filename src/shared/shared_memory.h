@@ -46,8 +46,15 @@ using SegmentManagerT = SharedMemoryT::segment_manager;
 
 using VoidAllocatorT = boost::container::scoped_allocator_adaptor<
     boost::interprocess::allocator<void, SegmentManagerT>>;
-using CharAllocatorT = VoidAllocatorT::rebind<char>::other;
+using CharAllocatorT  = VoidAllocatorT::rebind<char>::other;
+using WCharAllocatorT = VoidAllocatorT::rebind<wchar_t>::other;
 
-using StringT = bc::basic_string<char, std::char_traits<char>, CharAllocatorT>;
+template <typename CharT>
+using BasicStringT =
+    bc::basic_string<CharT, std::char_traits<CharT>,
+                     typename VoidAllocatorT::template rebind<CharT>::other>;
+
+using StringT  = BasicStringT<char>;
+using WStringT = BasicStringT<wchar_t>;
 
 }  // namespace usvfs::shared
@@ -0,0 +1,740 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#endif
+
+#ifndef _WIN32
+#include <cerrno>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief state of a SharedRWLock, meant to be placed in shared memory. Zero filled
+ *        memory is an unlocked lock without owners
+ *
+ * only fixed width types are used so 32 and 64 bit processes can share the lock
+ */
+struct SharedRWLockState
+{
+  static constexpr uint32_t OWNER_COUNT = 1024;
+
+  // bits of the lock word
+  static constexpr uint32_t READERS_MASK = (1u << 20) - 1;
+  static constexpr uint32_t WAITING_ONE  = 1u << 20;
+  static constexpr uint32_t WAITING_MASK = ((1u << 11) - 1) << 20;
+  static constexpr uint32_t WRITER       = 1u << 31;
+
+  /**
+   * @brief a thread that used the lock, kept while the thread is alive so a thread
+   *        finds its slot through a thread_local cache
+   */
+  struct Owner
+  {
+    // 0 if the slot is free
+    std::atomic<uint32_t> tid;
+    // 0 while the slot is being claimed
+    std::atomic<uint32_t> pid;
+    // creation time of the thread, tells apart threads with a reused id
+    std::atomic<uint64_t> created;
+    std::atomic<uint32_t> reads;
+    std::atomic<uint32_t> writes;
+    // reads given up by the thread to acquire the write lock, not in the lock word
+    std::atomic<uint32_t> upgraded;
+    // nonzero while the thread waits for the write lock
+    std::atomic<uint32_t> waiting;
+  };
+
+  // readers (including reentrant reads) | waiting writers | writer
+  std::atomic<uint32_t> word;
+  // threads sleeping or about to sleep
+  std::atomic<uint32_t> sleepers;
+  // changed whenever sleepers have to recheck the lock, this is the futex
+  std::atomic<uint32_t> sequence;
+  // number of owners that died while holding or waiting for the lock
+  std::atomic<uint32_t> recovered;
+  // used instead of sequence on Windows: the sequence in the high half and the number
+  // of threads that committed to sleeping on the semaphore of that sequence in the
+  // low half. Both change in one step so each of those threads gets exactly one
+  // token
+  std::atomic<uint64_t> sleeping;
+  Owner owners[OWNER_COUNT];
+};
+
+/**
+ * @brief a reader-writer lock shared between processes
+ *
+ * - readers are reentrant, a thread may also read while it holds the write lock
+ * - writers are reentrant and preferred: once a writer waits no new readers get in.
+ *   A thread holding read locks that asks for the write lock gives up its reads while
+ *   it waits, so two such threads can't deadlock, and gets them back on unlock
+ * - every thread using the lock has an owner slot recording what it holds. When a
+ *   thread dies holding or waiting for the lock its share is removed by the next
+ *   thread that has to wait. On Windows sleeping threads also wait on the handles of
+ *   the owner threads so they are woken by a death, on Linux the death is noticed
+ *   by the next thread that contends
+ *
+ * sleeping threads wait on the sequence word with futex on Linux. WaitOnAddress
+ * doesn't work across processes, so on Windows they wait on one of a few named
+ * semaphores picked by the sequence. The semaphore is released once for every thread
+ * that committed to sleeping in the sequence that ended, so tokens don't pile up, and
+ * a thread that is slow to start waiting can't lose its token to a thread of the next
+ * sequence. The handles of owner threads are kept open between waits
+ */
+class SharedRWLock
+{
+public:
+  using State = SharedRWLockState;
+  using Owner = SharedRWLockState::Owner;
+
+  /**
+   * @param state zero filled or shared with other instances of the lock
+   * @param name identifies the lock between processes
+   */
+  SharedRWLock(State* state, const std::string& name) : m_State(state)
+  {
+#ifdef _WIN32
+    for (size_t i = 0; i < std::size(m_Wake); ++i) {
+      const std::string wakeName = name + "_wake" + std::to_string(i);
+      m_Wake[i] = ::CreateSemaphoreA(nullptr, 0, LONG_MAX, wakeName.c_str());
+      if (m_Wake[i] == nullptr) {
+        closeSemaphores();
+        throw std::runtime_error("failed to create semaphore for " + name);
+      }
+    }
+#else
+    (void)name;
+#endif
+  }
+
+  ~SharedRWLock()
+  {
+#ifdef _WIN32
+    closeSemaphores();
+#endif
+  }
+
+  SharedRWLock(const SharedRWLock&)            = delete;
+  SharedRWLock& operator=(const SharedRWLock&) = delete;
+
+  void lockShared()
+  {
+    Owner& self = owner();
+    if ((self.reads.load(std::memory_order_relaxed) != 0) ||
+        (self.writes.load(std::memory_order_relaxed) != 0)) {
+      // reentrant, must not wait for writers that wait for this thread
+      self.reads.fetch_add(1, std::memory_order_relaxed);
+      m_State->word.fetch_add(1);
+      return;
+    }
+
+    for (;;) {
+      uint32_t word = m_State->word.load();
+      if ((word & (State::WRITER | State::WAITING_MASK)) == 0) {
+        if (m_State->word.compare_exchange_weak(word, word + 1)) {
+          break;
+        }
+        continue;
+      }
+      wait([this]() {
+        return (m_State->word.load() & (State::WRITER | State::WAITING_MASK)) != 0;
+      });
+    }
+    self.reads.store(1, std::memory_order_relaxed);
+  }
+
+  void unlockShared()
+  {
+    Owner& self = owner();
+    self.reads.fetch_sub(1, std::memory_order_relaxed);
+    if ((m_State->word.fetch_sub(1) & State::READERS_MASK) == 1) {
+      wake();
+    }
+  }
+
+  void lock()
+  {
+    Owner& self = owner();
+    if (self.writes.load(std::memory_order_relaxed) != 0) {
+      self.writes.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    const uint32_t reads = self.reads.load(std::memory_order_relaxed);
+    self.waiting.store(1, std::memory_order_relaxed);
+    self.upgraded.store(reads, std::memory_order_relaxed);
+    // give up the reads of this thread and keep out new readers
+    if (((m_State->word.fetch_add(State::WAITING_ONE - reads) - reads) &
+         State::READERS_MASK) == 0) {
+      wake();
+    }
+
+    for (;;) {
+      uint32_t word = m_State->word.load();
+      if (((word & State::WRITER) == 0) && ((word & State::READERS_MASK) == 0)) {
+        if (m_State->word.compare_exchange_weak(
+                word, (word - State::WAITING_ONE) | State::WRITER)) {
+          break;
+        }
+        continue;
+      }
+      wait([this]() {
+        const uint32_t word = m_State->word.load();
+        return ((word & State::WRITER) != 0) || ((word & State::READERS_MASK) != 0);
+      });
+    }
+    self.writes.store(1, std::memory_order_relaxed);
+    self.waiting.store(0, std::memory_order_relaxed);
+  }
+
+  void unlock()
+  {
+    Owner& self = owner();
+    if (self.writes.fetch_sub(1, std::memory_order_relaxed) > 1) {
+      return;
+    }
+
+    // clear the writer bit and restore the reads given up in one step
+    const uint32_t upgraded = self.upgraded.exchange(0, std::memory_order_relaxed);
+    m_State->word.fetch_add(upgraded - State::WRITER);
+    wake();
+  }
+
+  /**
+   * @brief same as lockShared() but fails instead of waiting
+   */
+  bool tryLockShared()
+  {
+    Owner& self = owner();
+    if ((self.reads.load(std::memory_order_relaxed) != 0) ||
+        (self.writes.load(std::memory_order_relaxed) != 0)) {
+      self.reads.fetch_add(1, std::memory_order_relaxed);
+      m_State->word.fetch_add(1);
+      return true;
+    }
+
+    uint32_t word = m_State->word.load();
+    if (((word & (State::WRITER | State::WAITING_MASK)) != 0) ||
+        !m_State->word.compare_exchange_strong(word, word + 1)) {
+      return false;
+    }
+    self.reads.store(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @brief same as lock() but fails instead of waiting, also fails if the thread
+   *        would have to give up its reads
+   */
+  bool tryLock()
+  {
+    Owner& self = owner();
+    if (self.writes.load(std::memory_order_relaxed) != 0) {
+      self.writes.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    if (self.reads.load(std::memory_order_relaxed) != 0) {
+      return false;
+    }
+
+    uint32_t word = m_State->word.load();
+    if (((word & (State::WRITER | State::READERS_MASK)) != 0) ||
+        !m_State->word.compare_exchange_strong(word, word | State::WRITER)) {
+      return false;
+    }
+    self.writes.store(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @return number of owners that died while holding or waiting for the lock
+   */
+  uint32_t recovered() const
+  {
+    return m_State->recovered.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr uint32_t RECOVERING = 0xFFFFFFFFu;
+
+#ifdef _WIN32
+  static uint32_t currentThreadId() { return ::GetCurrentThreadId(); }
+
+  static uint32_t currentProcessId() { return ::GetCurrentProcessId(); }
+#else
+  // both are system calls, the ids are cached until the process forks
+  struct ThreadIds
+  {
+    uint32_t forks;
+    uint32_t tid;
+    uint32_t pid;
+  };
+
+  static std::atomic<uint32_t>& forks()
+  {
+    static std::atomic<uint32_t> s_Forks = []() {
+      ::pthread_atfork(nullptr, nullptr, []() {
+        forks().fetch_add(1, std::memory_order_relaxed);
+      });
+      return 1u;
+    }();
+    return s_Forks;
+  }
+
+  static const ThreadIds& currentIds()
+  {
+    thread_local ThreadIds ids = {};
+    const uint32_t current     = forks().load(std::memory_order_relaxed);
+    if (ids.forks != current) {
+      ids = {current, static_cast<uint32_t>(::gettid()),
+             static_cast<uint32_t>(::getpid())};
+    }
+    return ids;
+  }
+
+  static uint32_t currentThreadId() { return currentIds().tid; }
+
+  static uint32_t currentProcessId() { return currentIds().pid; }
+#endif
+
+#ifdef _WIN32
+  static uint64_t creationTime(HANDLE thread)
+  {
+    FILETIME creation, exit, kernel, user;
+    if (!::GetThreadTimes(thread, &creation, &exit, &kernel, &user)) {
+      return 0;
+    }
+    return (uint64_t(creation.dwHighDateTime) << 32) | creation.dwLowDateTime;
+  }
+#endif
+
+  static uint64_t currentThreadCreated()
+  {
+#ifdef _WIN32
+    thread_local const uint64_t created = creationTime(::GetCurrentThread());
+    return created;
+#else
+    // thread ids are only reused after a while, good enough for tests
+    return 0;
+#endif
+  }
+
+  /**
+   * @return slot of the calling thread, claimed on first use
+   */
+  Owner& owner()
+  {
+    struct CacheEntry
+    {
+      State* state;
+      Owner* owner;
+    };
+    // a process rarely has more than one lock
+    thread_local CacheEntry cache[4] = {};
+    thread_local uint32_t nextEntry  = 0;
+
+    const uint32_t tid = currentThreadId();
+    const uint32_t pid = currentProcessId();
+    for (const CacheEntry& entry : cache) {
+      // after a fork the cache of the parent thread is still there
+      if ((entry.state == m_State) &&
+          (entry.owner->tid.load(std::memory_order_relaxed) == tid) &&
+          (entry.owner->pid.load(std::memory_order_relaxed) == pid)) {
+        return *entry.owner;
+      }
+    }
+
+    Owner& result                         = findOrClaim(tid, pid);
+    cache[nextEntry++ % std::size(cache)] = {m_State, &result};
+    return result;
+  }
+
+  Owner& findOrClaim(uint32_t tid, uint32_t pid)
+  {
+    for (Owner& owner : m_State->owners) {
+      if ((owner.tid.load() == tid) && (owner.pid.load() == pid)) {
+        // may be left behind by a dead thread that had the same ids
+        if (!recover(owner, false)) {
+          return owner;
+        }
+      }
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      const uint32_t start = (tid ^ pid) * 2654435761u;
+      for (uint32_t i = 0; i < State::OWNER_COUNT; ++i) {
+        Owner& owner      = m_State->owners[(start + i) % State::OWNER_COUNT];
+        uint32_t expected = 0;
+        if (owner.tid.compare_exchange_strong(expected, tid)) {
+          owner.reads.store(0, std::memory_order_relaxed);
+          owner.writes.store(0, std::memory_order_relaxed);
+          owner.upgraded.store(0, std::memory_order_relaxed);
+          owner.waiting.store(0, std::memory_order_relaxed);
+          owner.created.store(currentThreadCreated());
+          owner.pid.store(pid);
+          return owner;
+        }
+      }
+
+      // slots of threads that have exited are only freed when the table is full
+      for (Owner& owner : m_State->owners) {
+        recover(owner, false);
+      }
+    }
+
+    throw std::runtime_error("too many threads using the shared lock");
+  }
+
+  /**
+   * @brief remove the share of the owner from the lock if its thread has died
+   * @param active only check owners holding or waiting for the lock
+   * @return true if the owner was dead
+   */
+  bool recover(Owner& owner, bool active)
+  {
+    uint32_t tid       = owner.tid.load();
+    const uint32_t pid = owner.pid.load();
+    if ((tid == 0) || (tid == RECOVERING) || (pid == 0)) {
+      return false;
+    }
+    if (active && !isActive(owner)) {
+      return false;
+    }
+    if (isAlive(owner, tid, pid)) {
+      return false;
+    }
+    if (!owner.tid.compare_exchange_strong(tid, RECOVERING)) {
+      // freed or recovered by another thread
+      return false;
+    }
+
+    const uint32_t reads    = owner.reads.load();
+    const uint32_t writes   = owner.writes.load();
+    const uint32_t upgraded = owner.upgraded.load();
+    const uint32_t waiting  = owner.waiting.load();
+
+    uint32_t share = 0;
+    if (writes != 0) {
+      share = (reads - upgraded) + State::WRITER;
+    } else if (waiting != 0) {
+      // the reads were given up when it started to wait
+      share = (reads - upgraded) + State::WAITING_ONE;
+    } else {
+      share = reads;
+    }
+
+    const bool holding = (reads != 0) || (writes != 0) || (waiting != 0);
+    if (holding) {
+      m_State->word.fetch_sub(share);
+      m_State->recovered.fetch_add(1);
+    }
+
+#ifdef _WIN32
+    forgetThread(owner);
+#endif
+    owner.pid.store(0);
+    owner.tid.store(0);
+
+    if (holding) {
+      wake();
+    }
+    return true;
+  }
+
+  static bool isActive(const Owner& owner)
+  {
+    return (owner.reads.load(std::memory_order_relaxed) != 0) ||
+           (owner.writes.load(std::memory_order_relaxed) != 0) ||
+           (owner.waiting.load(std::memory_order_relaxed) != 0);
+  }
+
+  bool isAlive(const Owner& owner, uint32_t tid, uint32_t pid)
+  {
+    if ((tid == currentThreadId()) && (pid == currentProcessId())) {
+      return owner.created.load() == currentThreadCreated();
+    }
+
+#ifdef _WIN32
+    bool gone                 = false;
+    const ThreadHandle thread = ownerThread(owner, tid, gone);
+    if (!thread) {
+      // access denied means there is a thread, no matter whose
+      return !gone;
+    }
+    return ::WaitForSingleObject(thread.get(), 0) == WAIT_TIMEOUT;
+#else
+    (void)owner;
+    return (::syscall(SYS_tgkill, pid, tid, 0) == 0) || (errno != ESRCH);
+#endif
+  }
+
+  /**
+   * @brief sleep until the lock changed, unless blocked() returns false after
+   *        announcing the sleep
+   */
+  template <typename F>
+  void wait(F blocked)
+  {
+    m_State->sleepers.fetch_add(1);
+    const uint32_t sequence = currentSequence();
+    if (blocked()) {
+      sleep(sequence);
+    }
+    m_State->sleepers.fetch_sub(1);
+  }
+
+#ifdef _WIN32
+  uint32_t currentSequence() const
+  {
+    return static_cast<uint32_t>(m_State->sleeping.load() >> 32);
+  }
+
+  void wake()
+  {
+    if (m_State->sleepers.load() == 0) {
+      return;
+    }
+
+    // start the next sequence and wake everybody who committed to the old one
+    uint64_t state = m_State->sleeping.load();
+    while (!m_State->sleeping.compare_exchange_weak(
+        state, ((state >> 32) + 1) << 32)) {
+    }
+    const uint32_t committed = static_cast<uint32_t>(state);
+    if (committed != 0) {
+      ::ReleaseSemaphore(semaphore(static_cast<uint32_t>(state >> 32)),
+                         static_cast<LONG>(committed), nullptr);
+    }
+  }
+
+  void sleep(uint32_t sequence)
+  {
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    // keep the cached handles open while waiting on them
+    ThreadHandle threads[MAXIMUM_WAIT_OBJECTS];
+    Owner* owners[MAXIMUM_WAIT_OBJECTS];
+    DWORD count      = 0;
+    handles[count++] = semaphore(sequence);
+
+    const uint32_t self = currentThreadId();
+    for (Owner& owner : m_State->owners) {
+      if (count == MAXIMUM_WAIT_OBJECTS) {
+        break;
+      }
+      const uint32_t tid = owner.tid.load();
+      if ((tid == 0) || (tid == RECOVERING) || (tid == self) || !isActive(owner)) {
+        continue;
+      }
+      if (recover(owner, true)) {
+        // the lock may be free now
+        return;
+      }
+      bool gone = false;
+      if (ThreadHandle thread = ownerThread(owner, tid, gone)) {
+        owners[count]    = &owner;
+        handles[count]   = thread.get();
+        threads[count++] = std::move(thread);
+      }
+    }
+
+    if (!commit(sequence)) {
+      // the lock changed in the meantime
+      return;
+    }
+
+    for (;;) {
+      const DWORD res = ::WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+      if (res == WAIT_OBJECT_0) {
+        if (currentSequence() != sequence) {
+          return;
+        }
+        // the semaphore is shared with an earlier sequence and this token belongs
+        // to a thread that committed to it but hasn't started waiting yet
+        ::ReleaseSemaphore(handles[0], 1, nullptr);
+        ::SwitchToThread();
+        continue;
+      }
+
+      uncommit(sequence);
+      if ((res > WAIT_OBJECT_0) && (res < WAIT_OBJECT_0 + count)) {
+        // an owner thread has ended
+        recover(*owners[res - WAIT_OBJECT_0], true);
+      }
+      return;
+    }
+  }
+
+  /**
+   * @brief count the calling thread as sleeping in the sequence
+   * @return false if the sequence has already ended
+   */
+  bool commit(uint32_t sequence)
+  {
+    uint64_t state = m_State->sleeping.load();
+    while (static_cast<uint32_t>(state >> 32) == sequence) {
+      if (m_State->sleeping.compare_exchange_weak(state, state + 1)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief undo commit() for a thread that stops sleeping without a token
+   */
+  void uncommit(uint32_t sequence)
+  {
+    uint64_t state = m_State->sleeping.load();
+    while (static_cast<uint32_t>(state >> 32) == sequence) {
+      if (m_State->sleeping.compare_exchange_weak(state, state - 1)) {
+        return;
+      }
+    }
+
+    // the sequence ended in the meantime and a token was released for this thread,
+    // it must not wake a thread of a later sequence. The timeout only matters if
+    // the waking thread died before releasing the semaphore
+    ::WaitForSingleObject(semaphore(sequence), 1000);
+  }
+
+  HANDLE semaphore(uint32_t sequence) const
+  {
+    return m_Wake[sequence % std::size(m_Wake)];
+  }
+
+  void closeSemaphores()
+  {
+    for (HANDLE& wake : m_Wake) {
+      if (wake != nullptr) {
+        ::CloseHandle(wake);
+        wake = nullptr;
+      }
+    }
+  }
+
+  // a thread handle that stays open while any thread waits on it, even if the cache
+  // entry is replaced in the meantime
+  using ThreadHandle = std::shared_ptr<void>;
+
+  struct CachedThread
+  {
+    uint32_t tid;
+    uint64_t created;
+    ThreadHandle handle;
+  };
+
+  /**
+   * @return handle of the thread that owns the slot, opened on first use and kept
+   *         until the slot is freed or claimed by another thread. Empty if it can't be
+   *         opened, gone is set if that's because the thread has ended
+   */
+  ThreadHandle ownerThread(const Owner& owner, uint32_t tid, bool& gone)
+  {
+    gone                   = false;
+    const size_t slot      = &owner - m_State->owners;
+    const uint64_t created = owner.created.load();
+
+    std::lock_guard<std::mutex> lock(m_ThreadsMutex);
+    CachedThread& cached = m_Threads[slot];
+    if (cached.handle && (cached.tid == tid) && (cached.created == created)) {
+      return cached.handle;
+    }
+
+    cached     = {};
+    HANDLE raw = ::OpenThread(SYNCHRONIZE | THREAD_QUERY_LIMITED_INFORMATION, FALSE,
+                              tid);
+    if (raw == nullptr) {
+      gone = ::GetLastError() == ERROR_INVALID_PARAMETER;
+      return {};
+    }
+    ThreadHandle thread(raw, ::CloseHandle);
+    if (creationTime(raw) != created) {
+      // the id has been reused by another thread
+      gone = true;
+      return {};
+    }
+    cached = {tid, created, thread};
+    return thread;
+  }
+
+  void forgetThread(const Owner& owner)
+  {
+    std::lock_guard<std::mutex> lock(m_ThreadsMutex);
+    m_Threads.erase(&owner - m_State->owners);
+  }
+#else
+  uint32_t currentSequence() const { return m_State->sequence.load(); }
+
+  void wake()
+  {
+    const uint32_t sleepers = m_State->sleepers.load();
+    if (sleepers == 0) {
+      return;
+    }
+
+    m_State->sequence.fetch_add(1);
+    ::syscall(SYS_futex, &m_State->sequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr,
+              0);
+  }
+
+  void sleep(uint32_t sequence)
+  {
+    for (Owner& owner : m_State->owners) {
+      if (recover(owner, true)) {
+        return;
+      }
+    }
+
+    ::syscall(SYS_futex, &m_State->sequence, FUTEX_WAIT, sequence, nullptr, nullptr,
+              0);
+  }
+#endif
+
+  State* m_State;
+#ifdef _WIN32
+  HANDLE m_Wake[4] = {};
+  std::mutex m_ThreadsMutex;
+  // by owner slot
+  std::unordered_map<size_t, CachedThread> m_Threads;
+#endif
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the lock is shared between processes");
+
+}  // namespace usvfs::shared
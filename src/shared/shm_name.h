@@ -0,0 +1,67 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief a shared memory name with a running number like "mod_organizer_3"
+ */
+struct SHMName
+{
+  // everything up to and including the last underscore, "mod_organizer_"
+  std::string_view prefix;
+  uint32_t number;
+};
+
+/**
+ * @brief splits a name ending with an underscore followed by digits
+ * @return the parts of the name, std::nullopt if it doesn't end with _N or the number
+ *         doesn't fit into 32 bits
+ */
+inline std::optional<SHMName> parseSHMName(std::string_view name)
+{
+  size_t digits = name.size();
+  while ((digits > 0) && (name[digits - 1] >= '0') && (name[digits - 1] <= '9')) {
+    --digits;
+  }
+
+  if ((digits == name.size()) || (digits == 0) || (name[digits - 1] != '_')) {
+    return std::nullopt;
+  }
+
+  uint32_t number      = 0;
+  const char* end      = name.data() + name.size();
+  const auto [ptr, ec] = std::from_chars(name.data() + digits, end, number);
+  if ((ec != std::errc()) || (ptr != end)) {
+    return std::nullopt;
+  }
+
+  return SHMName{name.substr(0, digits), number};
+}
+
+}  // namespace usvfs::shared
@@ -27,17 +27,46 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #pragma warning(disable : 4996)
 
 using namespace boost::interprocess;
-using namespace boost::posix_time;
+using usvfs::shared::LogRing;
 
 SHMLogger* SHMLogger::s_Instance = nullptr;
 
 SHMLogger::owner_t SHMLogger::owner;
 SHMLogger::client_t SHMLogger::client;
 
-SHMLogger::SHMLogger(owner_t, const std::string& queueName)
-    : m_QueueName(queueName),
-      m_LogQueue(create_only, queueName.c_str(), MESSAGE_COUNT, MESSAGE_SIZE),
-      m_DroppedMessages(0)
+namespace
+{
+
+LogRing* openRing(const mapped_region& region)
+{
+  LogRing* ring = LogRing::open(region.get_address());
+  if ((ring == nullptr) ||
+      (region.get_size() < LogRing::requiredSize(ring->capacity()))) {
+    throw std::runtime_error("invalid shm log");
+  }
+  return ring;
+}
+
+// the event writers signal when the reader waits for records. Both sides create it,
+// whoever comes first. Kernel objects of all types share one namespace, so the name
+// has to differ from the one of the shared memory
+HANDLE openWakeEvent(const std::string& shmName)
+{
+  HANDLE event = ::CreateEventA(nullptr, FALSE, FALSE, (shmName + "_wake").c_str());
+  if (event == nullptr) {
+    throw std::runtime_error("failed to create shm log event");
+  }
+  return event;
+}
+
+}  // namespace
+
+SHMLogger::SHMLogger(owner_t, const std::string& shmName, uint32_t capacity)
+    : m_SHM(create_only, shmName.c_str(), read_write,
+            LogRing::requiredSize(LogRing::roundCapacity(capacity))),
+      m_Region(m_SHM, read_write),
+      m_Ring(LogRing::create(m_Region.get_address(), capacity)),
+      m_Wake(openWakeEvent(shmName))
 {
   if (s_Instance != nullptr) {
     throw std::runtime_error("duplicate shm logger instantiation");
@@ -46,9 +75,9 @@ SHMLogger::SHMLogger(owner_t, const std::string& queueName)
   }
 }
 
-SHMLogger::SHMLogger(client_t, const std::string& queueName)
-    : m_QueueName(queueName), m_LogQueue(open_only, queueName.c_str()),
-      m_DroppedMessages(0)
+SHMLogger::SHMLogger(client_t, const std::string& shmName)
+    : m_SHM(open_only, shmName.c_str(), read_write), m_Region(m_SHM, read_write),
+      m_Ring(openRing(m_Region)), m_Wake(openWakeEvent(shmName))
 {
   if (s_Instance != nullptr) {
     throw std::runtime_error("duplicate shm logger instantiation");
@@ -59,18 +88,21 @@ SHMLogger::SHMLogger(client_t, const std::string& queueName)
 
 SHMLogger::~SHMLogger()
 {
+  ::CloseHandle(m_Wake);
   s_Instance = nullptr;
-  message_queue_interop::remove(m_QueueName.c_str());
 }
 
-SHMLogger& SHMLogger::create(const char* instanceName)
+std::string SHMLogger::shmName(const char* instanceName)
+{
+  return std::string("__shm_sink_") + instanceName;
+}
+
+SHMLogger& SHMLogger::create(const char* instanceName, uint32_t capacity)
 {
   if (s_Instance != nullptr) {
     throw std::runtime_error("duplicate shm logger instantiation");
   } else {
-    std::string queueName = std::string("__shm_sink_") + instanceName;
-    message_queue::remove(queueName.c_str());
-    new SHMLogger(owner, queueName);
+    new SHMLogger(owner, shmName(instanceName), capacity);
     atexit([]() {
       delete s_Instance;
     });
@@ -83,7 +115,7 @@ SHMLogger& SHMLogger::open(const char* instanceName)
   if (s_Instance != nullptr) {
     throw std::runtime_error("duplicate shm logger instantiation");
   } else {
-    new SHMLogger(client, std::string("__shm_sink_") + instanceName);
+    new SHMLogger(client, shmName(instanceName));
   }
   return *s_Instance;
 }
@@ -97,96 +129,195 @@ void SHMLogger::free()
   }
 }
 
+bool SHMLogger::fetch()
+{
+  static_assert(spdlog::level::n_levels <= LogRing::LEVEL_COUNT);
+  for (int level = 0; level < spdlog::level::n_levels; ++level) {
+    const uint32_t dropped = m_Ring->takeDropped(static_cast<uint8_t>(level));
+    if (dropped > 0) {
+      const auto name =
+          spdlog::level::to_string_view(static_cast<spdlog::level::level_enum>(level));
+      m_Pending.push_back(std::format("{} {} messages dropped", dropped, name));
+    }
+  }
+
+  uint8_t level;
+  if (m_Ring->tryPop(level, m_Record)) {
+    addRecord(m_Record);
+  }
+
+  return !m_Pending.empty();
+}
+
+void SHMLogger::addRecord(std::string& message)
+{
+  // spdlog auto-append line breaks which we don't need
+  message.erase(message.find_last_not_of("\r\n") + 1);
+
+  // blacklist %USERNAME% because PII
+  static const char* username = getenv("USERNAME");
+  if ((username != nullptr) && (*username != '\0')) {
+    boost::algorithm::ireplace_all(message, std::string("\\") + username,
+                                   "\\USERNAME");
+    boost::algorithm::ireplace_all(message, std::string("/") + username, "/USERNAME");
+  }
+
+  if (message.length() > MESSAGE_SIZE) {
+    std::vector<std::string> splitVec;
+    boost::split(splitVec, message, boost::is_any_of("\r\n"),
+                 boost::token_compress_on);
+    for (std::string& line : splitVec) {
+      m_Pending.push_back(std::move(line));
+    }
+  } else {
+    m_Pending.push_back(message);
+  }
+}
+
 bool SHMLogger::tryGet(char* buffer, size_t bufferSize)
 {
-  message_queue_interop::size_type receivedSize;
-  unsigned int prio;
-  bool res = m_LogQueue.try_receive(buffer, static_cast<unsigned int>(bufferSize),
-                                    receivedSize, prio);
-  if (res) {
-    buffer[std::min(bufferSize - 1, static_cast<size_t>(receivedSize))] = '\0';
+  std::lock_guard<std::mutex> lock(m_ReadMutex);
+
+  if (m_Pending.empty() && !fetch()) {
+    return false;
   }
-  return res;
+
+  const std::string& message = m_Pending.front();
+  const size_t length        = std::min(bufferSize - 1, message.size());
+  memcpy(buffer, message.data(), length);
+  buffer[length] = '\0';
+  m_Pending.pop_front();
+  return true;
 }
 
 void SHMLogger::get(char* buffer, size_t bufferSize)
 {
-  message_queue_interop::size_type receivedSize;
-  unsigned int prio;
-  m_LogQueue.receive(buffer, static_cast<unsigned int>(bufferSize), receivedSize, prio);
-  buffer[std::min(bufferSize - 1, static_cast<size_t>(receivedSize))] = '\0';
+  while (!tryGet(buffer, bufferSize)) {
+    waitForRecord(INFINITE);
+  }
 }
 
-usvfs::sinks::shm_sink::shm_sink(const char* queueName)
-    : m_LogQueue(open_only, (std::string("__shm_sink_") + queueName).c_str()),
-      m_DroppedMessages(0)
-{}
+void SHMLogger::waitForRecord(DWORD timeout)
+{
+  std::unique_lock<std::timed_mutex> lock(m_WaitMutex, std::defer_lock);
+  if (timeout == INFINITE) {
+    lock.lock();
+  } else if (!lock.try_lock_for(std::chrono::milliseconds(timeout))) {
+    return;
+  }
 
-void usvfs::sinks::shm_sink::flush_() {}
+  m_Ring->setReaderWaiting();
+  if (m_Ring->hasRecord()) {
+    return;
+  }
+  ::WaitForSingleObject(m_Wake, timeout);
+}
 
-void usvfs::sinks::shm_sink::sink_it_(const spdlog::details::log_msg& msg)
+size_t SHMLogger::tryGetBatch(char* buffer, size_t bufferSize, size_t& count)
 {
-  int droppedMessages = m_DroppedMessages.load(std::memory_order_relaxed);
-  if (droppedMessages > 0) {
-    auto dropMessage = std::format("{} debug messages dropped", droppedMessages);
-    if (m_LogQueue.try_send(dropMessage.c_str(),
-                            static_cast<unsigned int>(dropMessage.size()), 0)) {
-      m_DroppedMessages.store(0, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(m_ReadMutex);
+
+  size_t offset = 0;
+  count         = 0;
+  while (!m_Pending.empty() || fetch()) {
+    const std::string& message = m_Pending.front();
+    size_t length              = message.size();
+    if (offset + sizeof(uint32_t) + length > bufferSize) {
+      if ((count > 0) || (bufferSize <= sizeof(uint32_t))) {
+        break;
+      }
+      length = bufferSize - sizeof(uint32_t);
     }
-  }
 
-  std::string message{msg.payload};
+    const uint32_t prefix = static_cast<uint32_t>(length);
+    memcpy(buffer + offset, &prefix, sizeof(prefix));
+    memcpy(buffer + offset + sizeof(prefix), message.data(), length);
+    offset += sizeof(prefix) + length;
+    ++count;
+    m_Pending.pop_front();
+  }
 
-  // blacklist %USERNAME% because PII
-  static const std::string username = std::string(getenv("USERNAME"));
-  boost::algorithm::ireplace_all(message, std::string("\\") + username, "\\USERNAME");
-  boost::algorithm::ireplace_all(message, std::string("/") + username, "/USERNAME");
+  return offset;
+}
 
-  if (message.length() > SHMLogger::MESSAGE_SIZE) {
-    std::vector<std::string> splitVec;
-    boost::split(splitVec, message, boost::is_any_of("\r\n"), boost::token_compress_on);
-    for (const std::string& line : splitVec) {
-      output(msg.level, line);
+size_t SHMLogger::getBatch(char* buffer, size_t bufferSize, size_t& count,
+                           std::chrono::milliseconds timeout)
+{
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;;) {
+    const size_t result = tryGetBatch(buffer, bufferSize, count);
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if ((count > 0) || (remaining.count() <= 0)) {
+      return result;
     }
-  } else {
-    output(msg.level, message);
+    waitForRecord(static_cast<DWORD>(remaining.count()));
   }
 }
 
-void usvfs::sinks::shm_sink::output(spdlog::level::level_enum lev,
-                                    const std::string& message)
+usvfs::sinks::shm_sink::shm_sink(const char* queueName)
+    : m_SHM(open_only, SHMLogger::shmName(queueName).c_str(), read_write),
+      m_Region(m_SHM, read_write), m_Ring(openRing(m_Region)),
+      m_Wake(openWakeEvent(SHMLogger::shmName(queueName)))
+{}
+
+usvfs::sinks::shm_sink::~shm_sink()
 {
-  bool sent = true;
+  ::CloseHandle(m_Wake);
+}
 
-  // spdlog auto-append line breaks which we don't need. Probably would be
-  // better to not write the breaks to begin with?
-  size_t count = std::min(message.find_last_not_of("\r\n") + 1,
-                          static_cast<size_t>(m_LogQueue.get_max_msg_size()));
+void usvfs::sinks::shm_sink::flush_() {}
 
-  // depending on the log level, drop less important messages if the receiver
-  // can't keep up
-  switch (lev) {
+bool usvfs::sinks::shm_sink::tryPush(uint8_t level, const char* text, size_t length)
+{
+  if (!m_Ring->tryPush(level, text, length)) {
+    return false;
+  }
+  if (m_Ring->takeReaderWaiting()) {
+    ::SetEvent(m_Wake);
+  }
+  return true;
+}
+
+void usvfs::sinks::shm_sink::sink_it_(const spdlog::details::log_msg& msg)
+{
+  // the record is the raw payload, trimming, scrubbing and splitting it is left to
+  // the reader
+  const uint8_t level = static_cast<uint8_t>(msg.level);
+  const char* text    = msg.payload.data();
+  const size_t length = msg.payload.size();
+
+  if (tryPush(level, text, length)) {
+    return;
+  }
+
+  // depending on the log level, drop less important messages right away if the
+  // receiver can't keep up and wait a while for it otherwise. Nothing may be reading
+  // the queue at all, so even errors are eventually dropped
+  std::chrono::milliseconds wait(0);
+  switch (msg.level) {
   case spdlog::level::trace:
   case spdlog::level::debug:
   case spdlog::level::info: {
-    // m_LogQueue.send(message.c_str(), count, 0);
-    sent = m_LogQueue.try_send(message.c_str(), static_cast<unsigned int>(count), 0);
   } break;
   case spdlog::level::err:
   case spdlog::level::critical: {
-    m_LogQueue.send(message.c_str(), static_cast<unsigned int>(count), 0);
+    wait = std::chrono::milliseconds(1000);
   } break;
   default: {
-    boost::posix_time::ptime time =
-        microsec_clock::universal_time() + boost::posix_time::milliseconds(200);
-    sent = m_LogQueue.timed_send(message.c_str(), static_cast<unsigned int>(count), 0,
-                                 time);
+    wait = std::chrono::milliseconds(200);
   } break;
   }
 
-  if (!sent) {
-    m_DroppedMessages.fetch_add(1, std::memory_order_relaxed);
+  const auto timeout = std::chrono::steady_clock::now() + wait;
+  while (std::chrono::steady_clock::now() < timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (tryPush(level, text, length)) {
+      return;
+    }
   }
+
+  m_Ring->recordDropped(level);
 }
 
 void __cdecl boost::interprocess::ipcdetail::get_shared_dir(std::string& shared_dir)
@@ -23,28 +23,31 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #include <spdlog/details/null_mutex.h>
 #include <spdlog/sinks/base_sink.h>
 
+#include "log_ring.h"
 #include "logging.h"
 #include "shared_memory.h"
 #include "windows_sane.h"
 
-typedef boost::interprocess::message_queue_t<usvfs::shared::VoidPointerT>
-    message_queue_interop;
-
 namespace usvfs::sinks
 {
 class shm_sink : public spdlog::sinks::base_sink<spdlog::details::null_mutex>
 {
 public:
   shm_sink(const char* queueName);
+  ~shm_sink();
 
 protected:
   void sink_it_(const spdlog::details::log_msg& msg) override;
-  void output(spdlog::level::level_enum lev, const std::string& message);
   void flush_() override;
 
 private:
-  message_queue_interop m_LogQueue;
-  std::atomic<int> m_DroppedMessages;
+  // pushes the record and wakes up the reader if it's waiting for one
+  bool tryPush(uint8_t level, const char* text, size_t length);
+
+  bi::windows_shared_memory m_SHM;
+  bi::mapped_region m_Region;
+  usvfs::shared::LogRing* m_Ring;
+  HANDLE m_Wake;
 };
 
 }  // namespace usvfs::sinks
@@ -52,10 +55,19 @@ private:
 class SHMLogger
 {
 public:
-  static const size_t MESSAGE_COUNT = 1024;
-  static const size_t MESSAGE_SIZE  = 512;
-
-  static SHMLogger& create(const char* instanceName);
+  // number of slots in the ring, same amount of memory as the message queue used
+  // before: 1024 messages of 512 bytes
+  static const uint32_t RING_CAPACITY = 4096;
+  // longer messages are handed out line by line
+  static const size_t MESSAGE_SIZE = 512;
+
+  /**
+   * @brief set up the log for an instance
+   * @param capacity number of slots in the ring, a message takes one slot per 116
+   *        bytes of text. Rounded up to a power of two
+   */
+  static SHMLogger& create(const char* instanceName,
+                           uint32_t capacity = RING_CAPACITY);
   static SHMLogger& open(const char* instanceName);
   static void free();
 
@@ -70,10 +82,30 @@ public:
     return *s_Instance;
   }
 
+  static std::string shmName(const char* instanceName);
+
   void log(LogLevel logLevel, const std::string& message);
   bool tryGet(char* buffer, size_t bufferSize);
   void get(char* buffer, size_t bufferSize);
 
+  /**
+   * @brief retrieve as many messages as fit into the buffer, each one stored as its
+   *        length (uint32_t) followed by the text without a terminating null
+   *
+   * a message that doesn't fit into the empty buffer is truncated, all others are
+   * left for the next call
+   *
+   * @param count receives the number of messages written
+   * @return number of bytes written
+   */
+  size_t tryGetBatch(char* buffer, size_t bufferSize, size_t& count);
+
+  /**
+   * @brief same as tryGetBatch() but waits up to timeout for the first message
+   */
+  size_t getBatch(char* buffer, size_t bufferSize, size_t& count,
+                  std::chrono::milliseconds timeout);
+
 private:
   struct owner_t
   {};
@@ -84,7 +116,7 @@ private:
   static client_t client;
 
 private:
-  SHMLogger(owner_t, const std::string& instanceName);
+  SHMLogger(owner_t, const std::string& instanceName, uint32_t capacity);
   SHMLogger(client_t, const std::string& instanceName);
 
   SHMLogger(const SHMLogger&)            = delete;
@@ -92,14 +124,26 @@ private:
 
   ~SHMLogger();
 
+  // moves the dropped message counts and the next record to m_Pending
+  bool fetch();
+  void addRecord(std::string& message);
+
+  // blocks until a record is pushed or the timeout in milliseconds elapsed
+  void waitForRecord(DWORD timeout);
+
 private:
   static SHMLogger* s_Instance;
 
-  message_queue_interop m_LogQueue;
+  bi::windows_shared_memory m_SHM;
+  bi::mapped_region m_Region;
+  usvfs::shared::LogRing* m_Ring;
 
-  std::string m_SHMName;
-  std::string m_LockName;
-  std::string m_QueueName;
+  // messages are formatted by the reader, one record may turn into several lines
+  std::mutex m_ReadMutex;
+  std::deque<std::string> m_Pending;
+  std::string m_Record;
 
-  std::atomic<int> m_DroppedMessages;
+  // writers wake up a single waiting thread, so waiting threads take turns
+  std::timed_mutex m_WaitMutex;
+  HANDLE m_Wake;
 };
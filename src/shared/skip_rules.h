@@ -0,0 +1,424 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief case folding of the rule matchers, only ascii letters are folded like
+ *        boost::algorithm::iequals does in the default locale
+ */
+inline char foldCase(char c)
+{
+  return ((c >= 'A') && (c <= 'Z')) ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/**
+ * @return true if the rule contains a * or ? wildcard
+ */
+inline bool isGlob(std::string_view rule)
+{
+  return rule.find_first_of("*?") != std::string_view::npos;
+}
+
+/**
+ * @brief case insensitive match of a whole name against a pattern, * matches any
+ *        number of characters, ? exactly one
+ */
+inline bool globMatch(std::string_view pattern, std::string_view name)
+{
+  size_t p = 0;
+  size_t n = 0;
+  // position of the last * in the pattern and of the name when it was reached
+  size_t star      = std::string_view::npos;
+  size_t starMatch = 0;
+
+  while (n < name.size()) {
+    if ((p < pattern.size()) &&
+        ((pattern[p] == '?') || (foldCase(pattern[p]) == foldCase(name[n])))) {
+      ++p;
+      ++n;
+    } else if ((p < pattern.size()) && (pattern[p] == '*')) {
+      star      = p++;
+      starMatch = n;
+    } else if (star != std::string_view::npos) {
+      // let the last * consume one more character
+      p = star + 1;
+      n = ++starMatch;
+    } else {
+      return false;
+    }
+  }
+
+  while ((p < pattern.size()) && (pattern[p] == '*')) {
+    ++p;
+  }
+
+  return p == pattern.size();
+}
+
+/**
+ * @brief maps the characters used by a set of rules to dense indices so the
+ *        automata only need a column per character that actually occurs, all other
+ *        characters map to 0
+ */
+class RuleAlphabet
+{
+public:
+  RuleAlphabet() { m_Index.fill(0); }
+
+  void add(std::string_view rule)
+  {
+    for (char c : rule) {
+      uint16_t& index = m_Index[static_cast<uint8_t>(foldCase(c))];
+      if (index == 0) {
+        index = static_cast<uint16_t>(++m_Count);
+      }
+    }
+  }
+
+  uint32_t operator[](char c) const
+  {
+    return m_Index[static_cast<uint8_t>(foldCase(c))];
+  }
+
+  // number of columns, including the one for unknown characters
+  uint32_t size() const { return m_Count + 1; }
+
+private:
+  std::array<uint16_t, 256> m_Index;
+  uint32_t m_Count{0};
+};
+
+/**
+ * @brief rules that match the end of a name, like the skip file suffixes
+ *
+ * plain rules are compiled into a trie of the reversed rules so a name is checked
+ * against all of them in a single walk from its last character. Rules with
+ * wildcards have to match the end of the name as well and are checked one by one
+ */
+class SuffixRules
+{
+public:
+  SuffixRules() = default;
+
+  explicit SuffixRules(const std::vector<std::string>& rules)
+  {
+    for (const std::string& rule : rules) {
+      if (isGlob(rule)) {
+        m_Globs.push_back(rule);
+        m_GlobPatterns.push_back("*" + rule);
+      } else {
+        m_Alphabet.add(rule);
+      }
+    }
+
+    m_Width = m_Alphabet.size();
+    m_Next.assign(m_Width, 0);
+    m_Terminal.assign(1, 0);
+
+    for (const std::string& rule : rules) {
+      if (isGlob(rule)) {
+        continue;
+      }
+
+      uint32_t node = 0;
+      for (auto iter = rule.rbegin(); iter != rule.rend(); ++iter) {
+        const size_t edge = node * m_Width + m_Alphabet[*iter];
+        if (m_Next[edge] == 0) {
+          m_Next[edge] = static_cast<uint32_t>(m_Terminal.size());
+          m_Terminal.push_back(0);
+          m_Next.resize(m_Next.size() + m_Width, 0);
+        }
+        node = m_Next[edge];
+      }
+
+      if (m_Terminal[node] == 0) {
+        m_Rules.push_back(rule);
+        m_Terminal[node] = static_cast<uint32_t>(m_Rules.size());
+      }
+    }
+  }
+
+  bool empty() const { return m_Rules.empty() && m_Globs.empty(); }
+
+  /**
+   * @return the shortest plain rule or the first wildcard rule matching the end of
+   *         the name, nullptr if none does
+   */
+  const std::string* match(std::string_view name) const
+  {
+    if (!m_Rules.empty()) {
+      uint32_t node = 0;
+      if (m_Terminal[0] != 0) {
+        return &m_Rules[m_Terminal[0] - 1];
+      }
+
+      for (size_t i = name.size(); i > 0; --i) {
+        node = m_Next[node * m_Width + m_Alphabet[name[i - 1]]];
+        if (node == 0) {
+          break;
+        }
+        if (m_Terminal[node] != 0) {
+          return &m_Rules[m_Terminal[node] - 1];
+        }
+      }
+    }
+
+    for (size_t i = 0; i < m_Globs.size(); ++i) {
+      if (globMatch(m_GlobPatterns[i], name)) {
+        return &m_Globs[i];
+      }
+    }
+
+    return nullptr;
+  }
+
+private:
+  RuleAlphabet m_Alphabet;
+  uint32_t m_Width{1};
+  // m_Width transitions per node, 0 means there is none since the root is never a
+  // target
+  std::vector<uint32_t> m_Next{0};
+  // one-based index of the rule ending at each node, 0 if none does
+  std::vector<uint32_t> m_Terminal{0};
+  std::vector<std::string> m_Rules;
+  std::vector<std::string> m_Globs;
+  std::vector<std::string> m_GlobPatterns;
+};
+
+/**
+ * @brief rules that match a whole name, like the skip directories
+ *
+ * plain rules are looked up in a hash set, rules with wildcards have to match the
+ * whole name and are checked one by one
+ */
+class NameRules
+{
+public:
+  NameRules() = default;
+
+  explicit NameRules(const std::vector<std::string>& rules)
+  {
+    for (const std::string& rule : rules) {
+      if (isGlob(rule)) {
+        m_Globs.push_back(rule);
+      } else {
+        m_Names.insert(rule);
+      }
+    }
+  }
+
+  bool empty() const { return m_Names.empty() && m_Globs.empty(); }
+
+  /**
+   * @return the rule matching the name, nullptr if none does
+   */
+  const std::string* match(std::string_view name) const
+  {
+    auto iter = m_Names.find(name);
+    if (iter != m_Names.end()) {
+      return &*iter;
+    }
+
+    for (const std::string& glob : m_Globs) {
+      if (globMatch(glob, name)) {
+        return &glob;
+      }
+    }
+
+    return nullptr;
+  }
+
+private:
+  struct FoldedHash
+  {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view name) const
+    {
+      // FNV-1a
+      uint64_t hash = 14695981039346656037ull;
+      for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(foldCase(c))) * 1099511628211ull;
+      }
+      return static_cast<size_t>(hash);
+    }
+  };
+
+  struct FoldedEqual
+  {
+    using is_transparent = void;
+
+    bool operator()(std::string_view lhs, std::string_view rhs) const
+    {
+      if (lhs.size() != rhs.size()) {
+        return false;
+      }
+      for (size_t i = 0; i < lhs.size(); ++i) {
+        if (foldCase(lhs[i]) != foldCase(rhs[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  std::unordered_set<std::string, FoldedHash, FoldedEqual> m_Names;
+  std::vector<std::string> m_Globs;
+};
+
+/**
+ * @brief rules that match anywhere in a text, like executable names in a command
+ *        line
+ *
+ * plain rules are compiled into an Aho-Corasick automaton so the text is scanned
+ * once for all of them. Rules with wildcards may match anywhere as well and are
+ * checked one by one
+ */
+class SubstringRules
+{
+public:
+  SubstringRules() = default;
+
+  explicit SubstringRules(const std::vector<std::string>& rules)
+  {
+    for (const std::string& rule : rules) {
+      if (isGlob(rule)) {
+        m_Globs.push_back(rule);
+        m_GlobPatterns.push_back("*" + rule + "*");
+      } else {
+        m_Alphabet.add(rule);
+      }
+    }
+
+    m_Width = m_Alphabet.size();
+    m_Next.assign(m_Width, 0);
+    m_Output.assign(1, 0);
+
+    // trie of the rules
+    for (const std::string& rule : rules) {
+      if (isGlob(rule)) {
+        continue;
+      }
+
+      uint32_t node = 0;
+      for (char c : rule) {
+        const size_t edge = node * m_Width + m_Alphabet[c];
+        if (m_Next[edge] == 0) {
+          m_Next[edge] = static_cast<uint32_t>(m_Output.size());
+          m_Output.push_back(0);
+          m_Next.resize(m_Next.size() + m_Width, 0);
+        }
+        node = m_Next[edge];
+      }
+
+      if (m_Output[node] == 0) {
+        m_Rules.push_back(rule);
+        m_Output[node] = static_cast<uint32_t>(m_Rules.size());
+      }
+    }
+
+    // breadth first, turn missing transitions into the ones of the longest proper
+    // suffix that is also in the trie, and let nodes report the rules ending there
+    std::vector<uint32_t> fail(m_Output.size(), 0);
+    std::deque<uint32_t> queue;
+    for (uint32_t c = 1; c < m_Width; ++c) {
+      if (m_Next[c] != 0) {
+        queue.push_back(m_Next[c]);
+      }
+    }
+
+    while (!queue.empty()) {
+      const uint32_t node = queue.front();
+      queue.pop_front();
+
+      if (m_Output[node] == 0) {
+        m_Output[node] = m_Output[fail[node]];
+      }
+
+      for (uint32_t c = 1; c < m_Width; ++c) {
+        uint32_t& next             = m_Next[node * m_Width + c];
+        const uint32_t fallthrough = m_Next[fail[node] * m_Width + c];
+        if (next == 0) {
+          next = fallthrough;
+        } else {
+          fail[next] = fallthrough;
+          queue.push_back(next);
+        }
+      }
+    }
+  }
+
+  bool empty() const { return m_Rules.empty() && m_Globs.empty(); }
+
+  /**
+   * @return the plain rule ending first in the text or the first wildcard rule found
+   *         in it, nullptr if there is none
+   */
+  const std::string* match(std::string_view text) const
+  {
+    if (!m_Rules.empty()) {
+      uint32_t node = 0;
+      if (m_Output[0] != 0) {
+        return &m_Rules[m_Output[0] - 1];
+      }
+
+      for (char c : text) {
+        node = m_Next[node * m_Width + m_Alphabet[c]];
+        if (m_Output[node] != 0) {
+          return &m_Rules[m_Output[node] - 1];
+        }
+      }
+    }
+
+    for (size_t i = 0; i < m_Globs.size(); ++i) {
+      if (globMatch(m_GlobPatterns[i], text)) {
+        return &m_Globs[i];
+      }
+    }
+
+    return nullptr;
+  }
+
+private:
+  RuleAlphabet m_Alphabet;
+  uint32_t m_Width{1};
+  // complete transition table, m_Width entries per node
+  std::vector<uint32_t> m_Next{0};
+  // one-based index of a rule ending at each node, 0 if none does
+  std::vector<uint32_t> m_Output{0};
+  std::vector<std::string> m_Rules;
+  std::vector<std::string> m_Globs;
+  std::vector<std::string> m_GlobPatterns;
+};
+
+}  // namespace usvfs::shared
@@ -21,6 +21,7 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "exceptionex.h"
+#include "utf_transcoder.h"
 
 namespace usvfs::shared
 {
@@ -95,8 +96,11 @@ public:
       sourceLength = wcslen(source);
     }
 
-    if (sourceLength > 0) {
-      // use utf8 or local 8-bit encoding depending on user choice
+    if (codePage == CodePage::UTF8) {
+      // single pass into a worst-case sized buffer, no preflight needed
+      utf::appendUTF8(result, source, sourceLength);
+    } else if (sourceLength > 0) {
+      // local 8-bit encoding
       UINT cp = windowsCP(codePage);
       // preflight to find out the required buffer size
       int outLength = WideCharToMultiByte(cp, 0, source, static_cast<int>(sourceLength),
@@ -110,10 +114,11 @@ public:
       if (outLength == 0) {
         throw windows_error("string conversion failed");
       }
-      // fix output string length (i.e. in case of unconvertible characters
-      while (result[outLength - 1] == L'\0') {
-        result.resize(--outLength);
-      }
+    }
+
+    // fix output string length (i.e. in case of unconvertible characters
+    while (!result.empty() && (result.back() == '\0')) {
+      result.pop_back();
     }
 
     return result;
@@ -133,8 +138,11 @@ public:
       sourceLength = strlen(source);
     }
 
-    if (sourceLength > 0) {
-      // use utf8 or local 8-bit encoding depending on user choice
+    if (codePage == CodePage::UTF8) {
+      // single pass into a worst-case sized buffer, no preflight needed
+      utf::appendUTF16(result, source, sourceLength);
+    } else if (sourceLength > 0) {
+      // local 8-bit encoding
       UINT cp = windowsCP(codePage);
       // preflight to find out the required source size
       int outLength = MultiByteToWideChar(cp, 0, source, static_cast<int>(sourceLength),
@@ -148,9 +156,10 @@ public:
       if (outLength == 0) {
         throw windows_error("string conversion failed");
       }
-      while (result[outLength - 1] == L'\0') {
-        result.resize(--outLength);
-      }
+    }
+
+    while (!result.empty() && (result.back() == L'\0')) {
+      result.pop_back();
     }
 
     return result;
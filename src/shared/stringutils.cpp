@@ -130,6 +130,13 @@ std::wstring to_upper(const std::wstring& input)
   return result;
 }
 
+wchar_t to_upper_char(wchar_t input)
+{
+  wchar_t result = input;
+  ::LCMapStringW(LOCALE_INVARIANT, LCMAP_UPPERCASE, &input, 1, &result, 1);
+  return result;
+}
+
 std::string byte_string(std::size_t n)
 {
   auto s = std::to_string(n);
@@ -36,6 +36,10 @@ std::string to_hex(void* bufferIn, size_t bufferSize);
 // convert unicode string to upper-case (locale invariant)
 std::wstring to_upper(const std::wstring& input);
 
+// convert a single character to upper-case the same way to_upper() converts each
+// character of a string
+wchar_t to_upper_char(wchar_t input);
+
 // formats a number with thousand separators and B at the end
 //
 std::string byte_string(std::size_t n);
@@ -0,0 +1,130 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief machine code assembled once, with values patched in at fixed offsets
+ *
+ * the template is created by assembling the code with placeholders for the values
+ * and looking for them in the result. It's assembled a second time with different
+ * placeholders to verify that patching reproduces exactly what the assembler emits.
+ * Code that encodes a value differently depending on its size, or that leaks it
+ * into other instructions, can't be a template and valid() is false for it
+ */
+template <typename ValueT, std::size_t Count>
+class StubTemplate
+{
+public:
+  using Values = std::array<ValueT, Count>;
+
+  StubTemplate() = default;
+
+  /**
+   * @param assemble returns the code for the values passed to it as a
+   *                 std::vector<uint8_t>, values that aren't used by the code are
+   *                 ignored
+   */
+  template <typename AssembleF>
+  static StubTemplate create(AssembleF&& assemble)
+  {
+    StubTemplate result;
+    result.m_Code = assemble(placeholders(0));
+
+    std::vector<bool> patched(result.m_Code.size(), false);
+    for (std::size_t index = 0; index < Count; ++index) {
+      const ValueT placeholder = placeholders(0)[index];
+
+      std::size_t offset = 0;
+      while (offset + sizeof(ValueT) <= result.m_Code.size()) {
+        if (memcmp(result.m_Code.data() + offset, &placeholder, sizeof(ValueT)) != 0) {
+          ++offset;
+          continue;
+        }
+
+        for (std::size_t i = offset; i < offset + sizeof(ValueT); ++i) {
+          if (patched[i]) {
+            return StubTemplate();
+          }
+          patched[i] = true;
+        }
+        result.m_Patches.push_back({offset, index});
+        offset += sizeof(ValueT);
+      }
+    }
+
+    if (result.patch(placeholders(1)) != assemble(placeholders(1))) {
+      return StubTemplate();
+    }
+
+    result.m_Valid = true;
+    return result;
+  }
+
+  bool valid() const { return m_Valid; }
+
+  std::size_t size() const { return m_Code.size(); }
+
+  /**
+   * @return the code for the given values
+   */
+  std::vector<uint8_t> patch(const Values& values) const
+  {
+    std::vector<uint8_t> result(m_Code);
+    for (const Patch& patch : m_Patches) {
+      memcpy(result.data() + patch.offset, &values[patch.index], sizeof(ValueT));
+    }
+    return result;
+  }
+
+private:
+  struct Patch
+  {
+    std::size_t offset;
+    std::size_t index;
+  };
+
+  // distinct values that need the full width of their encoding and are unlikely to
+  // appear in code by accident
+  static Values placeholders(uint32_t set)
+  {
+    Values result;
+    for (std::size_t i = 0; i < Count; ++i) {
+      const uint64_t variation = (set * Count + i + 1) * 0x0101010101010101ull;
+      result[i] = static_cast<ValueT>(0xC3A5F00DD15EA5E0ull ^ variation);
+    }
+    return result;
+  }
+
+  bool m_Valid{false};
+  std::vector<uint8_t> m_Code;
+  std::vector<Patch> m_Patches;
+};
+
+}  // namespace usvfs::shared
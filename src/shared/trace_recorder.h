@@ -0,0 +1,286 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief a finished span, times are in nanoseconds of the steady clock
+ */
+struct TraceEvent
+{
+  // must outlive the recorder, usually a string literal
+  const char* name;
+  uint64_t start;
+  uint64_t duration;
+};
+
+/**
+ * @brief collects timing spans of all threads of a process and exports them in the
+ *        trace event format read by chrome://tracing and Perfetto
+ *
+ * every thread writes to its own buffer so recording a span only takes a lock no
+ * other thread contends for, except while exporting. The recorder is disabled by
+ * default and a disabled recorder costs a relaxed load per span.
+ *
+ * the steady clock is the performance counter on Windows, which is the same for all
+ * processes, so the traces of several processes can be loaded together
+ */
+class TraceRecorder
+{
+public:
+  // about 24 MiB of events
+  static constexpr std::size_t DEFAULT_MAX_EVENTS = 1 << 20;
+
+  explicit TraceRecorder(std::size_t maxEvents = DEFAULT_MAX_EVENTS)
+      : m_Id(s_NextId.fetch_add(1, std::memory_order_relaxed)), m_MaxEvents(maxEvents)
+  {}
+
+  TraceRecorder(const TraceRecorder&)            = delete;
+  TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+  /**
+   * @return the recorder used by the hooks
+   */
+  static TraceRecorder& instance()
+  {
+    static TraceRecorder s_Instance;
+    return s_Instance;
+  }
+
+  static uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  bool enabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+  void setEnabled(bool enabled) { m_Enabled.store(enabled, std::memory_order_relaxed); }
+
+  /**
+   * @brief add a span of the calling thread
+   */
+  void record(const char* name, uint64_t start, uint64_t end)
+  {
+    if (m_Count.fetch_add(1, std::memory_order_relaxed) >= m_MaxEvents) {
+      m_Count.fetch_sub(1, std::memory_order_relaxed);
+      m_Dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({name, start, end - start});
+  }
+
+  /**
+   * @return number of spans not recorded because the limit was reached
+   */
+  uint64_t dropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+
+  /**
+   * @return spans recorded so far by each thread
+   */
+  std::vector<std::pair<uint32_t, std::vector<TraceEvent>>> events() const
+  {
+    std::vector<std::pair<uint32_t, std::vector<TraceEvent>>> result;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (const auto& buffer : m_Buffers) {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      result.emplace_back(buffer->tid, buffer->events);
+    }
+    return result;
+  }
+
+  /**
+   * @brief discard all recorded spans
+   */
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (const auto& buffer : m_Buffers) {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      m_Count.fetch_sub(buffer->events.size(), std::memory_order_relaxed);
+      buffer->events.clear();
+    }
+  }
+
+  /**
+   * @brief write all recorded spans as a trace event json document
+   * @param processName shown instead of the pid if not empty
+   */
+  void writeChromeTrace(std::ostream& out, uint32_t pid,
+                        std::string_view processName = {}) const
+  {
+    out << "{\"traceEvents\":[";
+    bool first    = true;
+    auto separate = [&]() {
+      out << (first ? "\n" : ",\n");
+      first = false;
+    };
+
+    if (!processName.empty()) {
+      separate();
+      out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+          << ",\"args\":{\"name\":\"";
+      writeEscaped(out, processName);
+      out << "\"}}";
+    }
+
+    char times[64];
+    for (const auto& [tid, threadEvents] : events()) {
+      for (const TraceEvent& event : threadEvents) {
+        separate();
+        out << "{\"name\":\"";
+        writeEscaped(out, event.name);
+        // microseconds with nanosecond precision
+        snprintf(times, sizeof(times), "\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+                 static_cast<unsigned long long>(event.start / 1000),
+                 static_cast<unsigned int>(event.start % 1000),
+                 static_cast<unsigned long long>(event.duration / 1000),
+                 static_cast<unsigned int>(event.duration % 1000));
+        out << "\",\"cat\":\"usvfs\",\"ph\":\"X\"," << times << ",\"pid\":" << pid
+            << ",\"tid\":" << tid << "}";
+      }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  }
+
+private:
+  struct ThreadBuffer
+  {
+    uint32_t tid;
+    mutable std::mutex mutex;
+    std::vector<TraceEvent> events;
+  };
+
+  static uint32_t currentThreadId()
+  {
+#ifdef _WIN32
+    return ::GetCurrentThreadId();
+#else
+    return static_cast<uint32_t>(::gettid());
+#endif
+  }
+
+  static void writeEscaped(std::ostream& out, std::string_view text)
+  {
+    for (char c : text) {
+      if ((c == '"') || (c == '\\')) {
+        out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out << escaped;
+      } else {
+        out << c;
+      }
+    }
+  }
+
+  ThreadBuffer& threadBuffer()
+  {
+    // the buffer of the recorder last used by this thread
+    thread_local uint64_t cachedId          = 0;
+    thread_local ThreadBuffer* cachedBuffer = nullptr;
+    if (cachedId == m_Id) {
+      return *cachedBuffer;
+    }
+
+    const uint32_t tid = currentThreadId();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto iter = std::find_if(m_Buffers.begin(), m_Buffers.end(),
+                             [tid](const std::unique_ptr<ThreadBuffer>& buffer) {
+                               return buffer->tid == tid;
+                             });
+    if (iter == m_Buffers.end()) {
+      auto buffer = std::make_unique<ThreadBuffer>();
+      buffer->tid = tid;
+      iter        = m_Buffers.insert(m_Buffers.end(), std::move(buffer));
+    }
+
+    cachedId     = m_Id;
+    cachedBuffer = iter->get();
+    return *cachedBuffer;
+  }
+
+  static inline std::atomic<uint64_t> s_NextId{1};
+
+  const uint64_t m_Id;
+  const std::size_t m_MaxEvents;
+  std::atomic<bool> m_Enabled{false};
+  std::atomic<std::size_t> m_Count{0};
+  std::atomic<uint64_t> m_Dropped{0};
+
+  mutable std::mutex m_Mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_Buffers;
+};
+
+/**
+ * @brief records the time from construction to destruction as a span if the
+ *        recorder was enabled on construction
+ */
+class TraceSpan
+{
+public:
+  explicit TraceSpan(const char* name,
+                     TraceRecorder& recorder = TraceRecorder::instance())
+      : m_Recorder(recorder.enabled() ? &recorder : nullptr), m_Name(name),
+        m_Start(m_Recorder != nullptr ? TraceRecorder::now() : 0)
+  {}
+
+  ~TraceSpan()
+  {
+    if (m_Recorder != nullptr) {
+      m_Recorder->record(m_Name, m_Start, TraceRecorder::now());
+    }
+  }
+
+  TraceSpan(const TraceSpan&)            = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  TraceRecorder* m_Recorder;
+  const char* m_Name;
+  uint64_t m_Start;
+};
+
+}  // namespace usvfs::shared
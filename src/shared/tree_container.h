@@ -1,11 +1,27 @@
 #pragma once
 
 #include "directory_tree.h"
+#include "lock_statistics.h"
 #include "shared_memory.h"
+#include "shm_name.h"
+
+#include <chrono>
 
 namespace usvfs::shared
 {
 
+// boost::filesystem converts paths with the locale imbued into fs::path, which is
+// process wide, so this only has to happen for the first container
+inline void imbueUTF8Paths()
+{
+  static const bool imbued = [] {
+    std::locale loc(std::locale(), new fs::detail::utf8_codecvt_facet);
+    fs::path::imbue(loc);
+    return true;
+  }();
+  (void)imbued;
+}
+
 // smart pointer to DirectoryTrees (only intended for top-level nodes). This
 // will transparently switch to new shared memory regions in case they get
 // reallocated
@@ -69,17 +85,12 @@ public:
   TreeContainer(const std::string& SHMName, size_t size = 64 * 1024)
       : m_TreeMeta(nullptr), m_SHMName(SHMName)
   {
-    std::locale global_loc = std::locale();
-    std::locale loc(global_loc, new fs::detail::utf8_codecvt_facet);
-    fs::path::imbue(loc);
+    const auto start = std::chrono::steady_clock::now();
 
-    // append _1 to the name if it doesn't end with _N already
-    std::regex pattern(R"exp((.*_)(\d+))exp");
-    std::smatch match;
-    std::string shmName(m_SHMName.c_str());
-    regex_match(shmName, match, pattern);
+    imbueUTF8Paths();
 
-    if (match.size() != 3) {
+    // append _1 to the name if it doesn't end with _N already
+    if (!parseSHMName(m_SHMName)) {
       m_SHMName += "_1";
     }
 
@@ -87,9 +98,11 @@ public:
     // to an already existing one
     createOrOpen(m_SHMName, size);
 
-    spdlog::get("usvfs")->info("attached to {0} with {1} nodes, size {2}", m_SHMName,
-                               m_TreeMeta->tree->numNodesRecursive(),
-                               byte_string(m_SHM->get_size()));
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    LOG_USVFS(info, "attached to {0} with {1} nodes, size {2} in {3:.2f} ms", m_SHMName,
+              m_TreeMeta->tree->numNodesRecursive(), byte_string(m_SHM->get_size()),
+              elapsed.count());
   }
 
   TreeContainer(const TreeContainer&)            = delete;
@@ -164,7 +177,7 @@ public:
                                    TreeFlags flags = 0, bool overwrite = true)
   {
     for (;;) {
-      DecomposablePath dp(name.string());
+      typename TreeT::DecomposablePathT dp(TreeT::toName(name));
 
       try {
         return addNode(m_TreeMeta->tree.get(), dp, data, overwrite, flags, allocator());
@@ -190,7 +203,7 @@ public:
                                         TreeFlags flags = 0, bool overwrite = true)
   {
     for (;;) {
-      DecomposablePath dp(name.string());
+      typename TreeT::DecomposablePathT dp(TreeT::toName(name));
 
       try {
         return addNode(m_TreeMeta->tree.get(), dp, data, overwrite,
@@ -213,7 +226,8 @@ private:
   {
     TreeMeta(const typename TreeT::DataT& data, SegmentManagerT* segmentManager)
         : tree(segmentManager->construct<TreeT>(bi::anonymous_instance)(
-              "", true, TreeT::NodePtrT(), data, VoidAllocatorT(segmentManager))),
+              typename TreeT::NameViewT(), true, TreeT::NodePtrT(), data,
+              VoidAllocatorT(segmentManager))),
           referenceCount(0),  // reference count only set on top level node
           outdated(false)
     {}
@@ -234,7 +248,7 @@ private:
   }
 
   template <typename T>
-  TreeT* createSubNode(const VoidAllocatorT& allocator, std::string_view name,
+  TreeT* createSubNode(const VoidAllocatorT& allocator, typename TreeT::NameViewT name,
                        unsigned long flags, const T& data)
   {
     auto* manager = allocator.get_segment_manager();
@@ -251,8 +265,8 @@ private:
   }
 
   template <typename T>
-  typename TreeT::NodePtrT addNode(TreeT* base, DecomposablePath& path, const T& data,
-                                   bool overwrite, unsigned int flags,
+  typename TreeT::NodePtrT addNode(TreeT* base, typename TreeT::DecomposablePathT& path,
+                                   const T& data, bool overwrite, unsigned int flags,
                                    const VoidAllocatorT& allocator)
   {
     if (!path.peekNext()) {
@@ -264,11 +278,15 @@ private:
         newNode           = createSubPtr(node);
         newNode->m_Self   = TreeT::WeakPtrT(newNode);
         newNode->m_Parent = base->m_Self;
-        base->set(StringT(path.current(), allocator), newNode);
+        newNode->updateAnchorDistance();
+        base->set(typename TreeT::SHMStringT(path.current(), allocator), newNode);
         return newNode;
       } else if (overwrite) {
         newNode->m_Data  = createData<typename TreeT::DataT, T>(data, allocator);
         newNode->m_Flags = static_cast<usvfs::shared::TreeFlags>(flags);
+        newNode->updateAnchorDistance();
+        // same number of nodes, but the node now points somewhere else
+        newNode->markChanged();
         return newNode;
       } else {
         // the node is already in the tree, overwrite is false, nothing to do
@@ -282,10 +300,15 @@ private:
         typename TreeT::NodePtrT newNode = createSubPtr(createSubNode(
             allocator, path.current(), FLAG_DIRECTORY | FLAG_DUMMY, createEmpty()));
 
-        subNode =
-            base->m_Nodes.emplace(StringT(path.current(), allocator), newNode).first;
+        subNode = base->m_Nodes
+                      .emplace(typename TreeT::SHMStringT(path.current(), allocator),
+                               newNode)
+                      .first;
         subNode->second->m_Self   = TreeT::WeakPtrT(subNode->second);
         subNode->second->m_Parent = base->m_Self;
+        subNode->second->m_Owner  = base;
+        subNode->second->updateAnchorDistance();
+        base->adjustNodeCount(1);
       }
 
       path.next();
@@ -305,13 +328,15 @@ private:
    */
   void copyTree(TreeT* destination, const TreeT* reference)
   {
-    VoidAllocatorT allocator = VoidAllocatorT(m_SHM->get_segment_manager());
-    destination->m_Flags     = reference->m_Flags;
+    VoidAllocatorT allocator      = VoidAllocatorT(m_SHM->get_segment_manager());
+    destination->m_Flags          = reference->m_Flags;
+    destination->m_AnchorDistance = reference->m_AnchorDistance;
     dataAssign(destination->m_Data, reference->m_Data);
     destination->m_Name.assign(reference->m_Name.c_str());
 
     for (const auto& kv : reference->m_Nodes) {
-      TreeT* newNode = createSubNode(allocator, "", true, createEmpty());
+      TreeT* newNode =
+          createSubNode(allocator, typename TreeT::NameViewT(), true, createEmpty());
       typename TreeT::NodePtrT newNodePtr = createSubPtr(newNode);
 
       // need to set self BEFORE recursively copying the subtree, otherwise
@@ -327,13 +352,13 @@ private:
 
   int increaseRefCount(TreeMeta* treeMeta)
   {
-    bi::scoped_lock<bi::interprocess_mutex> lock(treeMeta->mutex);
+    ProfiledScopedLock lock(treeMeta->mutex, LockId::TREE_META, __FUNCTION__);
     return ++treeMeta->referenceCount;
   }
 
   int decreaseRefCount(TreeMeta* treeMeta)
   {
-    bi::scoped_lock<bi::interprocess_mutex> lock(treeMeta->mutex);
+    ProfiledScopedLock lock(treeMeta->mutex, LockId::TREE_META, __FUNCTION__);
     return --treeMeta->referenceCount;
   }
 
@@ -344,20 +369,18 @@ private:
     SharedMemoryT* newSHM = openSHM(SHMName);
 
     if (newSHM) {
-      spdlog::get("usvfs")->info("{} opened in process {}", SHMName,
-                                 ::GetCurrentProcessId());
+      LOG_USVFS(info, "{} opened in process {}", SHMName, ::GetCurrentProcessId());
     } else {
       newSHM = createSHM(SHMName, size);
 
       if (newSHM) {
-        spdlog::get("usvfs")->info("{} created in process {}", SHMName,
-                                   ::GetCurrentProcessId());
+        LOG_USVFS(info, "{} created in process {}", SHMName, ::GetCurrentProcessId());
       }
     }
 
     if (!newSHM) {
-      spdlog::get("usvfs")->error("failed to create or open {} in process {}", SHMName,
-                                  ::GetCurrentProcessId());
+      LOG_USVFS(err, "failed to create or open {} in process {}", SHMName,
+                ::GetCurrentProcessId());
 
       throw std::exception("no shm instance");
     }
@@ -411,6 +434,9 @@ private:
       }
       if (m_TreeMeta != nullptr) {
         copyTree(res.first->tree.get(), m_TreeMeta->tree.get());
+        // the copy starts counting from scratch, but it must not come back to a
+        // count the old tree had with different content
+        res.first->tree->m_Changes = m_TreeMeta->tree->m_Changes + 1;
       }
     }
 
@@ -433,16 +459,12 @@ private:
 
   static std::string followupName(const std::string& currentName)
   {
-    std::regex pattern(R"exp((.*_)(\d+))exp");
-    std::smatch match;
-    regex_match(currentName, match, pattern);
-
-    if (match.size() != 3) {
+    const auto name = parseSHMName(currentName);
+    if (!name || (name->number == std::numeric_limits<uint32_t>::max())) {
       USVFS_THROW_EXCEPTION(usage_error() << ex_msg("shared memory name invalid"));
     }
 
-    const int count = boost::lexical_cast<int>(match[2]);
-    return match[1].str() + std::to_string(count + 1);
+    return std::string(name->prefix) + std::to_string(name->number + 1);
   }
 
   bool unassign(const std::shared_ptr<SharedMemoryT>& shm, TreeMeta* tree)
@@ -488,8 +510,7 @@ private:
       // another process has ran out of memory and started allocating blocks
       // with higher numbers
 
-      spdlog::get("usvfs")->info("tree {0} is outdated, looking for another one",
-                                 m_SHMName);
+      LOG_USVFS(info, "tree {0} is outdated, looking for another one", m_SHMName);
 
       if (findNewerBlock(deadSHMNames)) {
         // the new block was found and activated
@@ -498,8 +519,8 @@ private:
     } else {
       // this block isn't outdated, so reassign() was called because a bad_alloc
       // exception was thrown
-      spdlog::get("usvfs")->info(
-          "ran out of memory in tree {0}, will create another one", m_SHMName);
+      LOG_USVFS(info, "ran out of memory in tree {0}, will create another one",
+                m_SHMName);
     }
 
     // either the block is full or it's outdated, but no higher block was found;
@@ -510,7 +531,7 @@ private:
     // remove the old shared memory blocks; this can be recursive and call
     // reassign() again, but it's safe at this point
     for (const std::string& name : deadSHMNames) {
-      spdlog::get("usvfs")->info("destroying {0}", name);
+      LOG_USVFS(info, "destroying {0}", name);
       bi::shared_memory_object::remove(name.c_str());
     }
   }
@@ -539,7 +560,7 @@ private:
       // the shm name is something like "mod_organizer_3", which becomes
       // "mod_organizer_4"
       nextName = followupName(nextName);
-      spdlog::get("usvfs")->info("opening {0}", nextName);
+      LOG_USVFS(info, "opening {0}", nextName);
 
       // open the shm, see if it exists
       SharedMemoryT* shm = openSHM(nextName);
@@ -548,18 +569,18 @@ private:
         // this is not necessarily an error, another process might have created
         // a bunch of blocks and destroyed them before this process had a chance
         // to see them, so just keep going
-        spdlog::get("usvfs")->info("{0} doesn't exist", nextName);
+        LOG_USVFS(info, "{0} doesn't exist", nextName);
         continue;
       }
 
-      spdlog::get("usvfs")->info("{0} exists, activating", nextName);
+      LOG_USVFS(info, "{0} exists, activating", nextName);
       const auto deadSHMName = activateSHM(shm, nextName);
 
       // if this process was the last user of the previous block, it must be
       // deallocated, but only after this whole thing is finished, because it
       // can end up calling reassign() again
       if (deadSHMName) {
-        spdlog::get("usvfs")->info("will destroy {0}", *deadSHMName);
+        LOG_USVFS(info, "will destroy {0}", *deadSHMName);
         deadSHMNames.push_back(*deadSHMName);
       }
 
@@ -567,11 +588,11 @@ private:
       // memory and created more, so make sure to only stop when finding a block
       // that's not outdated
       if (m_TreeMeta->outdated) {
-        spdlog::get("usvfs")->info("{0} is also outdated", nextName);
+        LOG_USVFS(info, "{0} is also outdated", nextName);
       } else {
         // shm opened correctly, activated and not outdated, done
-        spdlog::get("usvfs")->info("{0} not outdated, taking it, size now {1}",
-                                   nextName, byte_string(m_SHM->get_size()));
+        LOG_USVFS(info, "{0} not outdated, taking it, size now {1}", nextName,
+                  byte_string(m_SHM->get_size()));
 
         return true;
       }
@@ -581,8 +602,8 @@ private:
     // shouldn't happen, but just create a new block to make sure programs can
     // still run
 
-    spdlog::get("usvfs")->error(
-        "found no existing tree above {0}, will create a new one", m_SHMName);
+    LOG_USVFS(err, "found no existing tree above {0}, will create a new one",
+              m_SHMName);
 
     return false;
   }
@@ -601,29 +622,28 @@ private:
     // the shm name is something like "mod_organizer_3", which becomes
     // "mod_organizer_4"
     const std::string nextName = followupName(m_SHMName);
-    spdlog::get("usvfs")->info("creating {0}", nextName);
+    LOG_USVFS(info, "creating {0}", nextName);
 
     SharedMemoryT* shm = createSHM(nextName, m_SHM->get_size() * 2);
 
     if (!shm) {
       // this shouldn't happen
-      spdlog::get("usvfs")->error("failed to create {0}", nextName);
+      LOG_USVFS(err, "failed to create {0}", nextName);
       throw std::exception("cannot create block");
     }
 
-    spdlog::get("usvfs")->info("{0} created, activating", nextName);
+    LOG_USVFS(info, "{0} created, activating", nextName);
     const auto deadSHMName = activateSHM(shm, nextName);
 
     // if this process was the last user of the previous block, it must be
     // deallocated, but only after this whole thing is finished, because it
     // can end up calling reassign() again
     if (deadSHMName) {
-      spdlog::get("usvfs")->info("will destroy {0}", *deadSHMName);
+      LOG_USVFS(info, "will destroy {0}", *deadSHMName);
       deadSHMNames.push_back(*deadSHMName);
     }
 
-    spdlog::get("usvfs")->info("tree {0} size now {1}", m_SHMName,
-                               byte_string(m_SHM->get_size()));
+    LOG_USVFS(info, "tree {0} size now {1}", m_SHMName, byte_string(m_SHM->get_size()));
   }
 };
 
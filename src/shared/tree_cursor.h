@@ -0,0 +1,142 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief enumerates a tree depth first in pages, remembering its position by name
+ *        so the tree doesn't need to stay locked between pages
+ *
+ * nodes get ids in the order they are visited, starting with 1 for the root, so
+ * the parent of a node always has a smaller id. If the tree changes between pages
+ * the enumeration continues after the last node visited, in name order, like a
+ * directory listing does: nodes added behind that position are visited, nodes
+ * removed before they were reached are not
+ */
+template <typename TreeT>
+class TreeCursor
+{
+public:
+  struct Position
+  {
+    uint32_t id;
+    uint32_t parentId;
+    // 0 for the root
+    uint32_t depth;
+  };
+
+  /**
+   * @brief visit up to maxNodes nodes following the ones visited by the last call
+   * @param root     root of the tree, which has to stay locked during the call
+   * @param maxNodes number of nodes to visit at most
+   * @param visitor  called as visitor(const TreeT& node, const Position& position)
+   * @return number of nodes visited, 0 once all nodes were
+   */
+  template <typename VisitorT>
+  size_t read(const TreeT& root, size_t maxNodes, VisitorT&& visitor)
+  {
+    size_t count = 0;
+    if (m_Done || (maxNodes == 0)) {
+      return count;
+    }
+
+    if (m_NextId == 1) {
+      visitor(root, Position{m_NextId++, 0, 0});
+      ++count;
+    }
+
+    // find the nodes along the path to the last one visited, a node that has been
+    // removed since is where the search for the next one continues
+    std::vector<const TreeT*> nodes{&root};
+    for (size_t depth = 0; depth < m_Path.size(); ++depth) {
+      const auto child = nodes.back()->node(m_Path[depth].name);
+      if (child.get() == nullptr) {
+        m_Path.resize(depth + 1);
+        nodes.push_back(nullptr);
+        break;
+      }
+      nodes.push_back(&*child);
+    }
+
+    while (count < maxNodes) {
+      const TreeT* last = nodes.back();
+      if ((last != nullptr) && (last->filesBegin() != last->filesEnd())) {
+        // first child of the last node visited
+        const TreeT& child = *last->filesBegin()->second;
+        m_Path.push_back({child.name(), m_NextId});
+        nodes.push_back(&child);
+      } else {
+        // otherwise the next sibling of it or of its closest ancestor that has one
+        const TreeT* next = nullptr;
+        while (!m_Path.empty()) {
+          const TreeT* parent = nodes[nodes.size() - 2];
+          auto iter           = parent->filesAfter(m_Path.back().name);
+          if (iter != parent->filesEnd()) {
+            next = &*iter->second;
+            break;
+          }
+          m_Path.pop_back();
+          nodes.pop_back();
+        }
+
+        if (next == nullptr) {
+          m_Done = true;
+          break;
+        }
+
+        m_Path.back() = {next->name(), m_NextId};
+        nodes.back()  = next;
+      }
+
+      const uint32_t depth    = static_cast<uint32_t>(m_Path.size());
+      const uint32_t parentId = depth > 1 ? m_Path[depth - 2].id : 1;
+      visitor(*nodes.back(), Position{m_NextId++, parentId, depth});
+      ++count;
+    }
+
+    return count;
+  }
+
+  /**
+   * @return true if all nodes were visited
+   */
+  bool done() const { return m_Done; }
+
+private:
+  struct Frame
+  {
+    typename TreeT::NameT name;
+    uint32_t id;
+  };
+
+  // names and ids of the last node visited and its ancestors, excluding the root
+  std::vector<Frame> m_Path;
+  uint32_t m_NextId{1};
+  bool m_Done{false};
+};
+
+}  // namespace usvfs::shared
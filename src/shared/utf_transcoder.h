@@ -0,0 +1,305 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USVFS_UTF_SSE2
+#include <emmintrin.h>
+#endif
+
+// the avx2 path is only compiled in if the whole build targets avx2, the dll has to
+// run on any x86 cpu
+#if defined(__AVX2__)
+#define USVFS_UTF_AVX2
+#include <immintrin.h>
+#endif
+
+/**
+ * conversion between UTF-16 and UTF-8 in a single pass
+ *
+ * the converted text is written to a buffer supplied by the caller, which must be
+ * large enough for the worst case (see maxUTF8Length and maxUTF16Length), so the
+ * size of the result doesn't have to be determined up front. Runs of ASCII
+ * characters, which make up almost all paths, are converted 16 or 32 at a time.
+ *
+ * invalid input is converted the way WideCharToMultiByte and MultiByteToWideChar do
+ * without error flags: unpaired surrogates and each maximal invalid UTF-8 sequence
+ * are replaced by U+FFFD
+ */
+namespace usvfs::shared::utf
+{
+
+static const char32_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+/**
+ * @return number of bytes required to convert the specified number of UTF-16 code
+ *         units to UTF-8 in the worst case
+ */
+constexpr std::size_t maxUTF8Length(std::size_t utf16Length)
+{
+  return utf16Length * 3;
+}
+
+/**
+ * @return number of code units required to convert the specified number of UTF-8
+ *         bytes to UTF-16 in the worst case
+ */
+constexpr std::size_t maxUTF16Length(std::size_t utf8Length)
+{
+  return utf8Length;
+}
+
+namespace detail
+{
+
+// converts the leading ASCII characters, returns how many there were
+template <typename CharT>
+std::size_t asciiToUTF8(const CharT* source, std::size_t length, char* dest)
+{
+  std::size_t i = 0;
+
+#ifdef USVFS_UTF_AVX2
+  const __m256i nonAscii256 = _mm256_set1_epi16(static_cast<short>(0xFF80));
+  for (; i + 32 <= length; i += 32) {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 16));
+    if (!_mm256_testz_si256(_mm256_or_si256(a, b), nonAscii256)) {
+      break;
+    }
+    // packus works per 128 bit lane, the permute puts the quarters back in order
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), packed);
+  }
+#endif
+
+#ifdef USVFS_UTF_SSE2
+  const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+  const __m128i zero     = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8));
+    const __m128i high = _mm_and_si128(_mm_or_si128(a, b), nonAscii);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xFFFF) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(a, b));
+  }
+#endif
+
+  for (; (i < length) && (source[i] < 0x80); ++i) {
+    dest[i] = static_cast<char>(source[i]);
+  }
+  return i;
+}
+
+// converts the leading ASCII characters, returns how many there were
+template <typename CharT>
+std::size_t asciiToUTF16(const uint8_t* source, std::size_t length, CharT* dest)
+{
+  std::size_t i = 0;
+
+#ifdef USVFS_UTF_AVX2
+  for (; i + 32 <= length; i += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+    if (_mm256_movemask_epi8(v) != 0) {
+      break;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+                        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i + 16),
+                        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+  }
+#endif
+
+#ifdef USVFS_UTF_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+    if (_mm_movemask_epi8(v) != 0) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i + 8),
+                     _mm_unpackhi_epi8(v, zero));
+  }
+#endif
+
+  for (; (i < length) && (source[i] < 0x80); ++i) {
+    dest[i] = static_cast<CharT>(source[i]);
+  }
+  return i;
+}
+
+inline char* encodeUTF8(char32_t c, char* dest)
+{
+  if (c < 0x800) {
+    *dest++ = static_cast<char>(0xC0 | (c >> 6));
+  } else {
+    if (c < 0x10000) {
+      *dest++ = static_cast<char>(0xE0 | (c >> 12));
+    } else {
+      *dest++ = static_cast<char>(0xF0 | (c >> 18));
+      *dest++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+    }
+    *dest++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+  }
+  *dest++ = static_cast<char>(0x80 | (c & 0x3F));
+  return dest;
+}
+
+}  // namespace detail
+
+/**
+ * @brief convert UTF-16 to UTF-8
+ * @param source the text to convert, may contain null characters
+ * @param length length of the text in code units
+ * @param dest buffer receiving the result, at least maxUTF8Length(length) bytes
+ * @return number of bytes written, the result is not null terminated
+ */
+template <typename CharT>
+std::size_t toUTF8(const CharT* source, std::size_t length, char* dest)
+{
+  static_assert(sizeof(CharT) == 2, "source has to be UTF-16");
+
+  char* out     = dest;
+  std::size_t i = 0;
+  while (i < length) {
+    const std::size_t ascii = detail::asciiToUTF8(source + i, length - i, out);
+    i += ascii;
+    out += ascii;
+
+    for (; (i < length) && (source[i] >= 0x80); ++i) {
+      char32_t c = source[i];
+      if ((c >= 0xD800) && (c < 0xE000)) {
+        if ((c < 0xDC00) && (i + 1 < length) && (source[i + 1] >= 0xDC00) &&
+            (source[i + 1] < 0xE000)) {
+          c = 0x10000 + ((c - 0xD800) << 10) + (source[++i] - 0xDC00);
+        } else {
+          c = REPLACEMENT_CHARACTER;
+        }
+      }
+      out = detail::encodeUTF8(c, out);
+    }
+  }
+
+  return out - dest;
+}
+
+/**
+ * @brief convert UTF-8 to UTF-16
+ * @param source the text to convert, may contain null characters
+ * @param length length of the text in bytes
+ * @param dest buffer receiving the result, at least maxUTF16Length(length) code
+ *        units
+ * @return number of code units written, the result is not null terminated
+ */
+template <typename CharT>
+std::size_t toUTF16(const char* source, std::size_t length, CharT* dest)
+{
+  static_assert(sizeof(CharT) == 2, "destination has to be UTF-16");
+
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(source);
+  CharT* out        = dest;
+  std::size_t i     = 0;
+  while (i < length) {
+    const std::size_t ascii = detail::asciiToUTF16(in + i, length - i, out);
+    i += ascii;
+    out += ascii;
+
+    while ((i < length) && (in[i] >= 0x80)) {
+      const uint8_t lead = in[i++];
+      // valid range of the first continuation byte, this excludes overlong
+      // encodings, surrogates and code points past U+10FFFF
+      uint8_t lower = 0x80;
+      uint8_t upper = 0xBF;
+      std::size_t continuations;
+      char32_t c;
+      if ((lead >= 0xC2) && (lead <= 0xDF)) {
+        continuations = 1;
+        c             = lead & 0x1F;
+      } else if ((lead >= 0xE0) && (lead <= 0xEF)) {
+        continuations = 2;
+        c             = lead & 0x0F;
+        lower         = lead == 0xE0 ? 0xA0 : 0x80;
+        upper         = lead == 0xED ? 0x9F : 0xBF;
+      } else if ((lead >= 0xF0) && (lead <= 0xF4)) {
+        continuations = 3;
+        c             = lead & 0x07;
+        lower         = lead == 0xF0 ? 0x90 : 0x80;
+        upper         = lead == 0xF4 ? 0x8F : 0xBF;
+      } else {
+        *out++ = static_cast<CharT>(REPLACEMENT_CHARACTER);
+        continue;
+      }
+
+      for (; (continuations > 0) && (i < length); --continuations) {
+        if ((in[i] < lower) || (in[i] > upper)) {
+          break;
+        }
+        c     = (c << 6) | (in[i++] & 0x3F);
+        lower = 0x80;
+        upper = 0xBF;
+      }
+
+      if (continuations > 0) {
+        // truncated sequence, the bytes read so far are replaced as a whole
+        *out++ = static_cast<CharT>(REPLACEMENT_CHARACTER);
+      } else if (c >= 0x10000) {
+        *out++ = static_cast<CharT>(0xD800 + ((c - 0x10000) >> 10));
+        *out++ = static_cast<CharT>(0xDC00 + ((c - 0x10000) & 0x3FF));
+      } else {
+        *out++ = static_cast<CharT>(c);
+      }
+    }
+  }
+
+  return out - dest;
+}
+
+/**
+ * @brief convert UTF-16 to UTF-8, appending to a string
+ */
+template <typename CharT>
+void appendUTF8(std::string& dest, const CharT* source, std::size_t length)
+{
+  const std::size_t offset = dest.size();
+  dest.resize(offset + maxUTF8Length(length));
+  dest.resize(offset + toUTF8(source, length, &dest[offset]));
+}
+
+/**
+ * @brief convert UTF-8 to UTF-16, appending to a string
+ */
+template <typename CharT>
+void appendUTF16(std::basic_string<CharT>& dest, const char* source,
+                 std::size_t length)
+{
+  const std::size_t offset = dest.size();
+  dest.resize(offset + maxUTF16Length(length));
+  dest.resize(offset + toUTF16(source, length, &dest[offset]));
+}
+
+}  // namespace usvfs::shared::utf
@@ -0,0 +1,105 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace usvfs::shared
+{
+
+/**
+ * @brief results computed from data that rarely changes, kept as long as the version
+ *        of that data stays the same
+ *
+ * all entries belong to a single version. Inserting an entry for a newer version
+ * drops all older ones and lookups with a version other than the current one miss,
+ * so the caller only has to pass in a number that changes whenever the data the
+ * results depend on changes. The cache is also cleared when it's full
+ */
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>>
+class VersionedCache
+{
+public:
+  explicit VersionedCache(size_t maxSize = 1024) : m_MaxSize(maxSize) {}
+
+  /**
+   * @return the value stored for the key, std::nullopt if there is none or it was
+   *         stored for a different version
+   */
+  std::optional<ValueT> find(const KeyT& key, uint64_t version) const
+  {
+    std::shared_lock lock(m_Mutex);
+    if (version != m_Version) {
+      return std::nullopt;
+    }
+
+    auto iter = m_Entries.find(key);
+    if (iter == m_Entries.end()) {
+      return std::nullopt;
+    }
+    return iter->second;
+  }
+
+  void insert(const KeyT& key, uint64_t version, ValueT value)
+  {
+    std::unique_lock lock(m_Mutex);
+    if (version != m_Version) {
+      m_Entries.clear();
+      m_Version = version;
+    } else if ((m_Entries.size() >= m_MaxSize) &&
+               (m_Entries.find(key) == m_Entries.end())) {
+      m_Entries.clear();
+    }
+    m_Entries.insert_or_assign(key, std::move(value));
+  }
+
+  void erase(const KeyT& key)
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Entries.erase(key);
+  }
+
+  void clear()
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Entries.clear();
+  }
+
+  size_t size() const
+  {
+    std::shared_lock lock(m_Mutex);
+    return m_Entries.size();
+  }
+
+private:
+  mutable std::shared_mutex m_Mutex;
+  std::unordered_map<KeyT, ValueT, HashT> m_Entries;
+  uint64_t m_Version{0};
+  size_t m_MaxSize;
+};
+
+}  // namespace usvfs::shared
@@ -54,7 +54,18 @@ static bool IsInnerMatch(LPCWSTR pszString, LPCWSTR pszMatch)
   return !*pszString && !*pszMatch;
 }
 
-static LPCSTR InnerMatch(LPCSTR pszString, LPCSTR pszMatch)
+static LPSTR CharUpperT(char c)
+{
+  return CharUpperA(MAKEINTRESOURCEA(MAKELONG(c, 0)));
+}
+
+static LPWSTR CharUpperT(wchar_t c)
+{
+  return CharUpperW(MAKEINTRESOURCEW(MAKELONG(c, 0)));
+}
+
+template <typename CharT>
+static const CharT* InnerMatch(const CharT* pszString, const CharT* pszMatch)
 {
   // We have a special case where string is empty ("") and the mask is "*".
   // We need to handle this too. So we can't test on !*pszString here.
@@ -89,7 +100,7 @@ static LPCSTR InnerMatch(LPCSTR pszString, LPCSTR pszMatch)
       //      Because we eat one character from the match string, the
       //      recursion will stop.
       {
-        LPCSTR remainder = InnerMatch(pszString, pszMatch + 1);
+        const CharT* remainder = InnerMatch(pszString, pszMatch + 1);
         if (remainder != nullptr) {
           // we have a match and the * replaces no other character
           return remainder;
@@ -100,7 +111,7 @@ static LPCSTR InnerMatch(LPCSTR pszString, LPCSTR pszMatch)
       //    wildcard * match. This is done by recursion. Because we eat
       //      one character from the string, the recursion will stop.
       if (*pszString != '\0') {
-        LPCSTR remainder = InnerMatch(pszString + 1, pszMatch);
+        const CharT* remainder = InnerMatch(pszString + 1, pszMatch);
         if (remainder != nullptr) {
           return remainder;
         }
@@ -112,8 +123,7 @@ static LPCSTR InnerMatch(LPCSTR pszString, LPCSTR pszMatch)
       // Standard compare of 2 chars. Note that *pszSring might be 0
       // here, but then we never get a match on *pszMask that has always
       // a value while inside this loop.
-      if (CharUpperA(MAKEINTRESOURCEA(MAKELONG(*pszString++, 0))) !=
-          CharUpperA(MAKEINTRESOURCEA(MAKELONG(*pszMatch++, 0))))
+      if (CharUpperT(*pszString++) != CharUpperT(*pszMatch++))
         return nullptr;
     }
   }
@@ -129,6 +139,32 @@ static LPCSTR InnerMatch(LPCSTR pszString, LPCSTR pszMatch)
   }
 }
 
+template <typename CharT>
+static const CharT* PartialMatchT(const CharT* pszString, const CharT* pszMatch)
+{
+  if (*pszString == CharT('.')) {
+    // cmd.exe seems to ignore dots at the start
+    return PartialMatchT(pszString + 1, pszMatch);
+  } else {
+    size_t len = std::char_traits<CharT>::length(pszMatch);
+    if ((len > 2) && (pszMatch[len - 2] == CharT('.')) &&
+        (pszMatch[len - 1] == CharT('*'))) {
+      // in cmd.exe there seems to be no difference between <something>* and
+      // <something>*.*
+      std::basic_string<CharT> temp(pszMatch, pszMatch + len - 2);
+      const CharT* pos = InnerMatch(pszString, temp.c_str());
+      if (pos != nullptr) {
+        if (*pos == CharT('\0')) {
+          return pszMatch + len;
+        } else {
+          return pszMatch + (pos - temp.c_str());
+        }
+      }
+    }
+    return InnerMatch(pszString, pszMatch);
+  }
+}
+
 namespace usvfs::shared::wildcard
 {
 
@@ -169,26 +205,12 @@ bool Match(LPCSTR pszString, LPCSTR pszMatch)
 
 LPCSTR PartialMatch(LPCSTR pszString, LPCSTR pszMatch)
 {
-  if (*pszString == '.') {
-    // cmd.exe seems to ignore dots at the start
-    return PartialMatch(pszString + 1, pszMatch);
-  } else {
-    size_t len = strlen(pszMatch);
-    if ((len > 2) && (strcmp(pszMatch + len - 2, ".*") == 0)) {
-      // in cmd.exe there seems to be no difference between <something>* and
-      // <something>*.*
-      std::string temp(pszMatch, pszMatch + len - 2);
-      LPCSTR pos = InnerMatch(pszString, temp.c_str());
-      if (pos != nullptr) {
-        if (*pos == '\0') {
-          return pszMatch + strlen(pszMatch);
-        } else {
-          return pszMatch + (pos - temp.c_str());
-        }
-      }
-    }
-    return InnerMatch(pszString, pszMatch);
-  }
+  return PartialMatchT(pszString, pszMatch);
+}
+
+LPCWSTR PartialMatch(LPCWSTR pszString, LPCWSTR pszMatch)
+{
+  return PartialMatchT(pszString, pszMatch);
 }
 
 }  // namespace usvfs::shared::wildcard
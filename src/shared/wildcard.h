@@ -64,4 +64,17 @@ bool Match(LPCSTR pszString, LPCSTR pszMatch);
  */
 LPCSTR PartialMatch(LPCSTR pszString, LPCSTR pszMatch);
 
+/**
+ * @brief match string to wildcard windows-style
+ * @param pszString Input string to match
+ * @param pszMatch Match mask that may contain wildcards like ? and *
+ * @note A ? sign matches any character, except an empty string.
+ * @note A * sign matches any string inclusive an empty string.
+ * @note Characters are compared caseless.
+ * @return the "not-consumed" remainder of the pattern. If this points to a
+ *         zero terminator, this was a full match.
+ *         Returns nullptr if no match is possible
+ */
+LPCWSTR PartialMatch(LPCWSTR pszString, LPCWSTR pszMatch);
+
 }  // namespace usvfs::shared::wildcard
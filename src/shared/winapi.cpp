@@ -417,6 +417,7 @@ std::vector<FileResult> quickFindFiles(LPCWSTR directoryName, LPCWSTR pattern)
         file.fileName =
             std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t));
         file.attributes = info->FileAttributes;
+        file.metadata   = usvfs::shared::metadataFromDirectoryInfo(*info);
 
         result.push_back(file);
         if (info->NextEntryOffset == 0) {
@@ -20,6 +20,7 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include "file_metadata.h"
 #include "logging.h"
 #include "stringcast.h"
 #include "windows_sane.h"
@@ -520,6 +521,7 @@ struct FileResult
 {
   std::wstring fileName;
   ULONG attributes;
+  usvfs::shared::FileMetadata metadata;
 };
 
 /**
@@ -30,6 +30,7 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #include "utility.h"
 #include <addrtools.h>
 #include <formatters.h>
+#include <logger_handle.h>
 #include <shmlogger.h>
 #include <winapi.h>
 
@@ -308,9 +309,9 @@ BOOL HookChainHook(THookInfo& hookInfo, LPBYTE jumpPos, HookError* error)
   hookInfo.preamble.resize(size);
   memcpy(&hookInfo.preamble[0], jumpPos, size);
 
-  spdlog::get("usvfs")->info("existing hook to {0:x} in {1}", chainTarget,
-                             shared::string_cast<std::string>(
-                                 winapi::ex::wide::getSectionName((void*)chainTarget)));
+  LOG_USVFS(info, "existing hook to {0:x} in {1}", chainTarget,
+            shared::string_cast<std::string>(
+                winapi::ex::wide::getSectionName((void*)chainTarget)));
 
   if (hookInfo.stub) {
     hookInfo.trampoline = TrampolinePool::instance().storeStub(
@@ -674,13 +675,13 @@ void HookLib::RemoveHook(HOOKHANDLE handle)
           reinterpret_cast<uintptr_t>(info.originalFunction);
       VirtualProtect(reinterpret_cast<LPVOID>(res), JUMP_SIZE, oldProtect, &oldProtect);
     } else {
-      spdlog::get("usvfs")->critical("can't remove hook, unknown hook type!");
+      LOG_USVFS(critical, "can't remove hook, unknown hook type!");
     }
 
     s_Hooks.erase(iter);
     ResumePausedThreads();
   } else {
-    spdlog::get("usvfs")->info("handle unknown: {0:x}", handle);
+    LOG_USVFS(info, "handle unknown: {0:x}", handle);
   }
 }
 
@@ -721,7 +722,7 @@ const char* HookLib::GetHookType(HOOKHANDLE handle)
     case THookInfo::TYPE_RIPINDIRECT:
       return "rip indirection modified";
     default: {
-      spdlog::get("usvfs")->error("invalid hook type {0}", info.type);
+      LOG_USVFS(err, "invalid hook type {0}", info.type);
       return "invalid hook type";
     }
     }
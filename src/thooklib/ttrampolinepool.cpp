@@ -20,6 +20,8 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "ttrampolinepool.h"
 #include <addrtools.h>
+#include <hook_thread_state.h>
+#include <logger_handle.h>
 #include <shmlogger.h>
 // #include <boost/thread/lock_guard.hpp>
 #include "udis86wrapper.h"
@@ -38,6 +40,9 @@ namespace HookLib
 
 TrampolinePool* TrampolinePool::s_Instance = nullptr;
 
+// the barriers of the current thread, there only ever is one pool
+static thread_local BarrierTable s_ThreadBarriers;
+
 TrampolinePool::TrampolinePool() : m_MaxTrampolineSize(sizeof(LPVOID))
 {
   m_BarrierAddr = &TrampolinePool::barrier;
@@ -69,9 +74,6 @@ void TrampolinePool::initialize()
 void TrampolinePool::setBlock(bool block)
 {
   m_FullBlock = block;
-  if (m_ThreadGuards.get() == nullptr) {
-    m_ThreadGuards.reset(new TThreadMap());
-  }
 }
 
 #if BOOST_ARCH_X86_64
@@ -486,11 +488,7 @@ LPVOID TrampolinePool::currentBufferAddress(LPVOID addressNear)
 
 void TrampolinePool::forceUnlockBarrier()
 {
-  if (m_ThreadGuards.get() != nullptr) {
-    for (auto funcId : *m_ThreadGuards) {
-      (*m_ThreadGuards)[funcId.first] = nullptr;
-    }
-  }  // else no barriers to unlock
+  s_ThreadBarriers.releaseAll();
 }
 
 TrampolinePool::BufferMap::iterator TrampolinePool::allocateBuffer(LPVOID addressNear)
@@ -534,11 +532,11 @@ TrampolinePool::BufferMap::iterator TrampolinePool::allocateBuffer(LPVOID addres
 
   iter->second.offset = 0;
   iter->second.buffers.push_back(buffer);
-  spdlog::get("usvfs")->debug(
-      "allocated trampoline buffer for jumps between {0:p} and {1:x} at {2:p}"
-      "(size {3})",
-      rounded, (reinterpret_cast<uintptr_t>(rounded) + m_SearchRange), buffer,
-      m_BufferSize);
+  LOG_USVFS(debug,
+            "allocated trampoline buffer for jumps between {0:p} and {1:x} at {2:p}"
+            "(size {3})",
+            rounded, (reinterpret_cast<uintptr_t>(rounded) + m_SearchRange), buffer,
+            m_BufferSize);
   return iter;
 }
 
@@ -564,37 +562,20 @@ LPVOID TrampolinePool::barrierInt(LPVOID func)
     return nullptr;
   }
 
-  if (m_ThreadGuards.get() == nullptr) {
-    m_ThreadGuards.reset(new TThreadMap());
-  }
-
-  auto iter = m_ThreadGuards->find(func);
-  if ((iter == m_ThreadGuards->end()) || (iter->second == nullptr)) {
-    (*m_ThreadGuards)[func] = reinterpret_cast<LPVOID>(1);
-    return &(*m_ThreadGuards)[func];
-  } else {
-    return nullptr;
-  }
+  // if the table is full the hook is skipped as if the barrier was locked
+  return s_ThreadBarriers.lock(func);
 }
 
 LPVOID TrampolinePool::releaseInt(LPVOID func)
 {
-  DWORD lastError = GetLastError();
-  if (m_ThreadGuards.get() == nullptr) {
-    m_ThreadGuards.reset(new TThreadMap());
-  }
-
-  auto iter = m_ThreadGuards->find(func);
-  if (iter == m_ThreadGuards->end()) {
-    spdlog::get("hooks")->error("failed to release barrier for func {}", func);
+  bool found = false;
+  LPVOID res = s_ThreadBarriers.release(func, found);
+  if (!found) {
+    DWORD lastError = GetLastError();
+    LOG_HOOKS(err, "failed to release barrier for func {}", func);
     ::SetLastError(lastError);
-    return nullptr;
   }
 
-  LPVOID res              = (*m_ThreadGuards)[func];
-  (*m_ThreadGuards)[func] = nullptr;
-
-  ::SetLastError(lastError);
   return res;
 }
 
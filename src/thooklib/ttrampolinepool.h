@@ -33,7 +33,6 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #include <boost/config/compiler/gcc.hpp>
 #endif
 #include <boost/predef.h>
-#include <boost/thread.hpp>
 #include <mutex>
 
 // #include <boost/thread/mutex.hpp>
@@ -206,9 +205,6 @@ private:
 
   BufferMap m_Buffers;
 
-  typedef std::map<void*, void*> TThreadMap;
-  boost::thread_specific_ptr<TThreadMap> m_ThreadGuards;
-
   LPVOID m_BarrierAddr;
   LPVOID m_ReleaseAddr;
 
@@ -18,8 +18,12 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
+#include <array>
 #include <cstdio>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/predef.h>
@@ -30,8 +34,10 @@ namespace fs = boost::filesystem;
 #include "injectlib.h"
 #include <addrtools.h>
 #include <exceptionex.h>
+#include <logger_handle.h>
 #include <stringcast.h>
 #include <stringutils.h>
+#include <stub_template.h>
 // local version of asmjit with warning suppression
 #include "asmjit_sane.h"
 #include <TlHelp32.h>
@@ -69,6 +75,52 @@ struct TDataRemote
   WCHAR dllName[MAX_PATH];
 };
 
+// the values that differ between injections, everything else in the stub only
+// depends on which parts of it are used
+enum StubValue : size_t
+{
+  STUB_RETURN_ADDRESS,
+  STUB_DLL_NAME,
+  STUB_INIT_FUNCTION,
+  STUB_USER_DATA,
+  STUB_USER_DATA_SIZE,
+  STUB_LOAD_LIBRARY,
+  STUB_GET_PROC_ADDRESS,
+  STUB_GET_LAST_ERROR,
+
+  STUB_VALUE_COUNT
+};
+
+using StubValues   = std::array<REGWORD, STUB_VALUE_COUNT>;
+using StubTemplate = usvfs::shared::StubTemplate<REGWORD, STUB_VALUE_COUNT>;
+
+static const uint8_t REG_AX = 0;
+static const uint8_t REG_CX = 1;
+static const uint8_t REG_DX = 2;
+
+// immediates are always emitted at their full width, the assembler would use shorter
+// encodings for small values and the stub couldn't be patched then
+void movImm(X86Assembler& assembler, uint8_t reg, REGWORD value)
+{
+#if BOOST_ARCH_X86_64
+  uint8_t code[10] = {0x48, static_cast<uint8_t>(0xB8 + reg)};
+  memcpy(code + 2, &value, sizeof(value));
+#else
+  uint8_t code[5] = {static_cast<uint8_t>(0xB8 + reg)};
+  memcpy(code + 1, &value, sizeof(value));
+#endif
+  assembler.embed(code, sizeof(code));
+}
+
+#if BOOST_ARCH_X86_32
+void pushImm(X86Assembler& assembler, REGWORD value)
+{
+  uint8_t code[5] = {0x68};
+  memcpy(code + 1, &value, sizeof(value));
+  assembler.embed(code, sizeof(code));
+}
+#endif  // BOOST_ARCH_X86_32
+
 #if BOOST_ARCH_X86_64
 void pushAll(X86Assembler& assembler)
 {
@@ -111,16 +163,16 @@ void popAll(X86Assembler& assembler)
 }
 #endif  // BOOST_ARCH_X86_64
 
-void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
-             TDataRemote* localData, TDataRemote* remoteData, LPCSTR initFunction)
+void addStub(const StubValues& values, X86Assembler& assembler, bool skipInit,
+             bool callInit)
 {
   Label Label_DLLLoaded = assembler.newLabel();
 
 #if BOOST_ARCH_X86_64
   pushAll(assembler);
   // call load library for the actual injection
-  assembler.mov(rcx, imm(reinterpret_cast<int64_t>(&remoteData->dllName)));
-  assembler.mov(rax, imm((intptr_t)(void*)localData->loadLibrary));
+  movImm(assembler, REG_CX, values[STUB_DLL_NAME]);
+  movImm(assembler, REG_AX, values[STUB_LOAD_LIBRARY]);
   assembler.sub(rsp, 32);
   assembler.call(rax);
   assembler.add(rsp, 32);
@@ -140,12 +192,11 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
   assembler.bind(Label_DLLLoaded);
 
   // determine address of the init function
-  if (initFunction != nullptr) {
+  if (callInit) {
     Label Label_SkipInit = assembler.newLabel();
-    assembler.mov(rcx, rax);  // handle of the dll
-    assembler.mov(rdx, imm(reinterpret_cast<int64_t>(
-                           remoteData->initFunction)));  // name of init function
-    assembler.mov(rax, imm((intptr_t)(void*)localData->getProcAddress));
+    assembler.mov(rcx, rax);                                // handle of the dll
+    movImm(assembler, REG_DX, values[STUB_INIT_FUNCTION]);  // name of init function
+    movImm(assembler, REG_AX, values[STUB_GET_PROC_ADDRESS]);
     assembler.sub(rsp, 32);
     assembler.call(rax);
     assembler.add(rsp, 32);
@@ -156,9 +207,8 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
     }
 
     // call the init function with user data
-    assembler.mov(rcx,
-                  imm(reinterpret_cast<int64_t>(remoteData) + sizeof(TDataRemote)));
-    assembler.mov(rdx, imm(static_cast<int64_t>(userDataSize)));
+    movImm(assembler, REG_CX, values[STUB_USER_DATA]);
+    movImm(assembler, REG_DX, values[STUB_USER_DATA_SIZE]);
     assembler.sub(rsp, 32);
     assembler.call(rax);
     assembler.add(rsp, 32);
@@ -174,9 +224,8 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
   assembler.pushf();
 
   // call load library for the actual injection
-  assembler.push(imm(void_ptr_cast<int64_t>(remoteData->dllName)));
-  //  assembler.call(ptr_abs(static_cast<void*>(remoteData->loadLibrary)));
-  assembler.mov(eax, imm(void_ptr_cast<int64_t>(localData->loadLibrary)));
+  pushImm(assembler, values[STUB_DLL_NAME]);
+  movImm(assembler, REG_AX, values[STUB_LOAD_LIBRARY]);
   assembler.call(eax);
 
   assembler.test(eax, eax);
@@ -191,12 +240,11 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
   assembler.bind(Label_DLLLoaded);
 
   // determine address of the init function
-  if (initFunction != nullptr) {
+  if (callInit) {
     Label Label_SkipInit = assembler.newLabel();
-    assembler.push(imm(
-        void_ptr_cast<int64_t>(remoteData->initFunction)));  // name of init function
-    assembler.push(eax);                                     // handle of the dll
-    assembler.mov(eax, imm(void_ptr_cast<int64_t>(localData->getProcAddress)));
+    pushImm(assembler, values[STUB_INIT_FUNCTION]);  // name of init function
+    assembler.push(eax);                             // handle of the dll
+    movImm(assembler, REG_AX, values[STUB_GET_PROC_ADDRESS]);
     assembler.call(eax);
     if (skipInit) {
       assembler.cmp(eax, 0);
@@ -205,15 +253,15 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
       assembler.cmp(eax, 0);
       assembler.jnz(Label_SkipInit);
       // heading for a crash! give an attached debugger a chance to analyse the error
-      assembler.mov(eax, imm(void_ptr_cast<int64_t>(localData->getLastError)));
+      movImm(assembler, REG_AX, values[STUB_GET_LAST_ERROR]);
       assembler.call(eax);
       assembler.int3();
       assembler.bind(Label_SkipInit);
     }
 
     // call the init function with user data
-    assembler.push(userDataSize);
-    assembler.push(imm(void_ptr_cast<int64_t>(remoteData) + sizeof(TDataRemote)));
+    pushImm(assembler, values[STUB_USER_DATA_SIZE]);
+    pushImm(assembler, values[STUB_USER_DATA]);
     assembler.call(eax);
     // init function is declared __cdecl so we have to remove parameters from the stack
     assembler.pop(eax);
@@ -230,6 +278,65 @@ void addStub(size_t userDataSize, X86Assembler& assembler, bool skipInit,
 #endif
 }
 
+std::vector<uint8_t> assembleStub(const StubValues& values, bool pushReturnAddress,
+                                  bool callInit, bool skipInit)
+{
+  JitRuntime runtime;
+  X86Assembler assembler(&runtime);
+  if (pushReturnAddress) {
+#if BOOST_ARCH_X86_64
+    // put return address on the stack
+    // (this damages rax which hopefully doesn't matter)
+    movImm(assembler, REG_AX, values[STUB_RETURN_ADDRESS]);
+    assembler.push(rax);
+#else
+    pushImm(assembler, values[STUB_RETURN_ADDRESS]);
+#endif
+  }  // otherwise no return address was specified here. It better be on the stack
+     // already
+
+  addStub(values, assembler, skipInit, callInit);
+  assembler.ret(0);
+
+  const uint8_t* code = reinterpret_cast<const uint8_t*>(assembler.getBuffer());
+  return std::vector<uint8_t>(code, code + assembler.getCodeSize());
+}
+
+/**
+ * @brief the stub for the given values, patched into a template that is assembled
+ *        only once for each combination of flags
+ */
+std::vector<uint8_t> injectionStub(const StubValues& values, bool pushReturnAddress,
+                                   bool callInit, bool skipInit)
+{
+  static std::mutex mutex;
+  static std::array<std::optional<StubTemplate>, 8> templates;
+
+  const size_t variant =
+      (pushReturnAddress ? 1 : 0) | (callInit ? 2 : 0) | (skipInit ? 4 : 0);
+
+  const StubTemplate* stubTemplate = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!templates[variant].has_value()) {
+      templates[variant] = StubTemplate::create([&](const StubValues& placeholders) {
+        return assembleStub(placeholders, pushReturnAddress, callInit, skipInit);
+      });
+
+      if (!templates[variant]->valid()) {
+        LOG_USVFS(warn, "injection stub can't be patched, assembling it every time");
+      }
+    }
+    stubTemplate = &*templates[variant];
+  }
+
+  if (stubTemplate->valid()) {
+    return stubTemplate->patch(values);
+  }
+
+  return assembleStub(values, pushReturnAddress, callInit, skipInit);
+}
+
 REGWORD WriteInjectionStub(HANDLE processHandle, LPCWSTR dllName, LPCSTR initFunction,
                            LPCVOID userData, size_t userDataSize, bool skipInit,
                            REGWORD returnAddress)
@@ -298,28 +405,19 @@ REGWORD WriteInjectionStub(HANDLE processHandle, LPCWSTR dllName, LPCSTR initFun
 
   // now for the interesting part: write a stub into the target process that is run
   // before any code of the original binary.
-
-  JitRuntime runtime;
-#if BOOST_ARCH_X86_64
-  X86Assembler assembler(&runtime);
-  if (returnAddress != 0) {
-    // put return address on the stack
-    // (this damages rax which hopefully doesn't matter)
-    assembler.mov(rax, imm((intptr_t)(void*)data.returnAddress));
-    assembler.push(rax);
-  }  // otherwise no return address was specified here. It better be on the stack
-     // already
-#else
-  X86Assembler assembler(&runtime);
-  if (returnAddress != 0) {
-    assembler.push(imm((intptr_t)(void*)data.returnAddress));
-  }
-#endif
-
-  addStub(userDataSize, assembler, skipInit, &data, remoteData, initFunction);
-  assembler.ret(0);
-
-  size_t stubSize = assembler.getCodeSize();
+  StubValues values             = {};
+  values[STUB_RETURN_ADDRESS]   = data.returnAddress;
+  values[STUB_DLL_NAME]         = reinterpret_cast<REGWORD>(&remoteData->dllName);
+  values[STUB_INIT_FUNCTION]    = reinterpret_cast<REGWORD>(remoteData->initFunction);
+  values[STUB_USER_DATA]        = reinterpret_cast<REGWORD>(remoteData + 1);
+  values[STUB_USER_DATA_SIZE]   = static_cast<REGWORD>(userDataSize);
+  values[STUB_LOAD_LIBRARY]     = reinterpret_cast<REGWORD>(data.loadLibrary);
+  values[STUB_GET_PROC_ADDRESS] = reinterpret_cast<REGWORD>(data.getProcAddress);
+  values[STUB_GET_LAST_ERROR]   = reinterpret_cast<REGWORD>(data.getLastError);
+
+  const std::vector<uint8_t> stub =
+      injectionStub(values, returnAddress != 0, initFunction != nullptr, skipInit);
+  size_t stubSize = stub.size();
 
   // reserve memory for the stub
   PBYTE stubRemote = reinterpret_cast<PBYTE>(
@@ -330,8 +428,7 @@ REGWORD WriteInjectionStub(HANDLE processHandle, LPCWSTR dllName, LPCSTR initFun
   }
 
   // almost there. copy stub to target process
-  if (!WriteProcessMemory(processHandle, stubRemote, assembler.getBuffer(), stubSize,
-                          &written) ||
+  if (!WriteProcessMemory(processHandle, stubRemote, stub.data(), stubSize, &written) ||
       (written != stubSize)) {
     throw windows_error("failed to write stub to target process");
   }
@@ -406,8 +503,7 @@ void InjectDLLRemoteThread(HANDLE processHandle, LPCWSTR dllName, LPCSTR initFun
     throw windows_error("failed to start remote thread");
   }
   ResumeThread(threadHandle);
-  spdlog::get("usvfs")->info("waiting for {0:x} to complete",
-                             GetThreadId(threadHandle));
+  LOG_USVFS(info, "waiting for {0:x} to complete", GetThreadId(threadHandle));
   ::WaitForSingleObject(threadHandle, 100);
   ::CloseHandle(threadHandle);
 }
@@ -437,7 +533,7 @@ void InjectLib::InjectDLL(HANDLE processHandle, HANDLE threadHandle, LPCWSTR dll
     std::vector<HANDLE> threadHandles;
     HANDLE injectThread = INVALID_HANDLE_VALUE;
     FILETIME injectThreadTime;
-    spdlog::get("usvfs")->info("inject dll to process {0}", pid);
+    LOG_USVFS(info, "inject dll to process {0}", pid);
     while (moreThreads) {
       if (threadInfo.th32OwnerProcessID == pid) {
         HANDLE thread = ::OpenThread(THREAD_ALL_ACCESS, FALSE, threadInfo.th32ThreadID);
@@ -450,8 +546,8 @@ void InjectLib::InjectDLL(HANDLE processHandle, HANDLE threadHandle, LPCWSTR dll
 
             if ((injectThread == INVALID_HANDLE_VALUE) ||
                 (CompareFileTime(&creationTime, &injectThreadTime) < 0)) {
-              spdlog::get("usvfs")->info("candidate for oldest thread: {0}",
-                                         threadInfo.th32ThreadID);
+              LOG_USVFS(info, "candidate for oldest thread: {0}",
+                        threadInfo.th32ThreadID);
               injectThread     = thread;
               injectThreadTime = creationTime;
             }
@@ -462,15 +558,15 @@ void InjectLib::InjectDLL(HANDLE processHandle, HANDLE threadHandle, LPCWSTR dll
       moreThreads = Thread32Next(snapshot, &threadInfo);
     }
     if (injectThread != INVALID_HANDLE_VALUE) {
-      spdlog::get("usvfs")->debug("going to inject dll");
+      LOG_USVFS(debug, "going to inject dll");
       InjectDLLEIP(processHandle, injectThread, dllName, initFunction, userData,
                    userDataSize, skipInit);
     } else {
-      spdlog::get("usvfs")->critical("found no thread to use for injecting");
+      LOG_USVFS(critical, "found no thread to use for injecting");
     }
 
     for (HANDLE hdl : threadHandles) {
-      spdlog::get("usvfs")->info("resuming thread {0}", ::GetThreadId(hdl));
+      LOG_USVFS(info, "resuming thread {0}", ::GetThreadId(hdl));
       ResumeThread(hdl);
       CloseHandle(hdl);
     }
@@ -20,64 +20,93 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
 #include "hookcallcontext.h"
 #include "hookcontext.h"
+#include <hook_statistics.h>
+#include <hook_thread_state.h>
 #include <logging.h>
 
 namespace usvfs
 {
 
-class HookStack
+namespace
 {
-public:
-  static HookStack& instance()
-  {
-    PreserveGetLastError boostChangesGetLastError;
-    if (s_Instance.get() == nullptr) {
-      s_Instance.reset(new HookStack());
-    }
-    return *s_Instance.get();
-  }
 
-  bool setGroup(MutExHookGroup group)
-  {
-    if (m_ActiveGroups.test(static_cast<size_t>(group)) ||
-        m_ActiveGroups.test(static_cast<size_t>(MutExHookGroup::ALL_GROUPS))) {
-      return false;
-    } else {
-      m_ActiveGroups.set(static_cast<size_t>(group), true);
-      return true;
-    }
-  }
+// groups of the hooks currently running on this thread
+thread_local shared::HookGroupSet activeGroups;
 
-  void unsetGroup(MutExHookGroup group)
-  {
-    m_ActiveGroups.set(static_cast<size_t>(group), false);
-  }
+bool enterGroup(MutExHookGroup group)
+{
+  return activeGroups.enter(static_cast<uint32_t>(group));
+}
 
-private:
-  HookStack() {}
+void leaveGroup(MutExHookGroup group)
+{
+  activeGroups.leave(static_cast<uint32_t>(group));
+}
 
-private:
-  static boost::thread_specific_ptr<HookStack> s_Instance;
-  std::bitset<static_cast<size_t>(MutExHookGroup::LAST)> m_ActiveGroups;
-};
+uint64_t elapsedNanoseconds(const LARGE_INTEGER& start)
+{
+  static const LONGLONG frequency = []() {
+    LARGE_INTEGER result;
+    QueryPerformanceFrequency(&result);
+    return result.QuadPart;
+  }();
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  const uint64_t ticks = static_cast<uint64_t>(now.QuadPart - start.QuadPart);
+  // split to avoid overflowing for long calls
+  return ticks / frequency * 1000000000ull +
+         ticks % frequency * 1000000000ull / frequency;
+}
+
+}  // namespace
+
+shared::HookCounters* HookSite::counters()
+{
+  const uint32_t generation = HookContext::generation();
+  if (m_Generation.load(std::memory_order_acquire) != generation) {
+    // racing threads resolve the same counters
+    shared::HookStatisticsTable* table = HookContext::statistics();
+    m_Counters.store(table != nullptr ? table->counters(m_Name) : nullptr,
+                     std::memory_order_relaxed);
+    m_Generation.store(generation, std::memory_order_release);
+  }
+
+  return m_Counters.load(std::memory_order_relaxed);
+}
 
-boost::thread_specific_ptr<HookStack> HookStack::s_Instance;
+void HookSite::recordError(const char* name)
+{
+  if (shared::HookStatisticsTable* table = HookContext::statistics()) {
+    if (shared::HookCounters* counters = table->counters(name)) {
+      counters->recordError();
+    }
+  }
+}
 
-HookCallContext::HookCallContext() : m_Active(true), m_Group(MutExHookGroup::NO_GROUP)
+HookCallContext::HookCallContext(HookSite& site)
+    : m_Active(true), m_Group(MutExHookGroup::NO_GROUP), m_Counters(site.counters()),
+      m_Span(site.name())
 {
   updateLastError();
+  QueryPerformanceCounter(&m_Start);
 }
 
-HookCallContext::HookCallContext(MutExHookGroup group)
-    : m_Active(HookStack::instance().setGroup(group)), m_Group(group)
+HookCallContext::HookCallContext(MutExHookGroup group, HookSite& site)
+    : m_Active(enterGroup(group)), m_Group(group),
+      m_Counters(site.counters()), m_Span(site.name())
 {
   updateLastError();
+  QueryPerformanceCounter(&m_Start);
 }
 
 HookCallContext::~HookCallContext()
 {
+  if (m_Counters != nullptr) {
+    m_Counters->recordCall(elapsedNanoseconds(m_Start));
+  }
   if (m_Active && (m_Group != MutExHookGroup::NO_GROUP)) {
-    HookStack::instance().unsetGroup(m_Group);
+    leaveGroup(m_Group);
   }
   SetLastError(m_LastError);
 }
@@ -92,20 +121,44 @@ void HookCallContext::updateLastError(DWORD lastError)
   m_LastError = lastError;
 }
 
+void HookCallContext::beginRealCall()
+{
+  m_RealCallStart =
+      shared::TraceRecorder::instance().enabled() ? shared::TraceRecorder::now() : 0;
+  restoreLastError();
+}
+
+void HookCallContext::endRealCall()
+{
+  updateLastError();
+  if (m_RealCallStart != 0) {
+    shared::TraceRecorder::instance().record("real call", m_RealCallStart,
+                                             shared::TraceRecorder::now());
+    m_RealCallStart = 0;
+  }
+}
+
 bool HookCallContext::active() const
 {
   return m_Active;
 }
 
+void HookCallContext::recordLookup(bool rerouted) const
+{
+  if (m_Counters != nullptr) {
+    m_Counters->recordLookup(rerouted);
+  }
+}
+
 FunctionGroupLock::FunctionGroupLock(MutExHookGroup group) : m_Group(group)
 {
-  m_Active = HookStack::instance().setGroup(m_Group);
+  m_Active = enterGroup(m_Group);
 }
 
 FunctionGroupLock::~FunctionGroupLock()
 {
   if (m_Active) {
-    HookStack::instance().unsetGroup(m_Group);
+    leaveGroup(m_Group);
   }
 }
 
@@ -20,9 +20,17 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
 
+#include <atomic>
+#include <trace_recorder.h>
+
 namespace usvfs
 {
 
+namespace shared
+{
+struct HookCounters;
+}  // namespace shared
+
 /**
  * @brief groups of hooks which may be used to implement each other, so only the first
  * call should be to one should be manipulated
@@ -48,12 +56,45 @@ enum class MutExHookGroup : int
   LAST     = NO_GROUP,
 };
 
+static_assert(static_cast<uint32_t>(MutExHookGroup::LAST) <= 32,
+              "active groups are kept in a 32 bit mask");
+
+/**
+ * @brief statistics slot of a hook, one static instance per hook
+ *
+ * the slot is looked up by name on the first call and again whenever a hook context
+ * has been created or destroyed, otherwise this is two loads
+ */
+class HookSite
+{
+public:
+  constexpr explicit HookSite(const char* name) : m_Name(name) {}
+
+  const char* name() const { return m_Name; }
+
+  /**
+   * @return counters of the hook in the current statistics table, nullptr if there
+   *         is none
+   */
+  shared::HookCounters* counters();
+
+  /**
+   * @brief count an exception that escaped the hook with the specified name
+   */
+  static void recordError(const char* name);
+
+private:
+  const char* m_Name;
+  std::atomic<uint32_t> m_Generation{0};
+  std::atomic<shared::HookCounters*> m_Counters{nullptr};
+};
+
 class HookCallContext
 {
 
 public:
-  HookCallContext();
-  HookCallContext(MutExHookGroup group);
+  explicit HookCallContext(HookSite& site);
+  HookCallContext(MutExHookGroup group, HookSite& site);
   ~HookCallContext();
 
   HookCallContext(const HookCallContext& reference)            = delete;
@@ -65,12 +106,32 @@ public:
 
   DWORD lastError() const { return m_LastError; }
 
+  /**
+   * @brief restore the last error before calling the original function, the time
+   *        until endRealCall() is traced
+   */
+  void beginRealCall();
+
+  /**
+   * @brief keep the last error set by the original function
+   */
+  void endRealCall();
+
   bool active() const;
 
+  /**
+   * @brief count a lookup in the redirection tree for the statistics of the hook
+   */
+  void recordLookup(bool rerouted) const;
+
 private:
   DWORD m_LastError;
   bool m_Active;
   MutExHookGroup m_Group;
+  shared::HookCounters* m_Counters;
+  LARGE_INTEGER m_Start;
+  shared::TraceSpan m_Span;
+  uint64_t m_RealCallStart{0};
 };
 
 class FunctionGroupLock
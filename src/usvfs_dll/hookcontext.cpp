@@ -36,6 +36,7 @@ using namespace usvfs;
 namespace ush = usvfs::shared;
 
 HookContext* HookContext::s_Instance = nullptr;
+std::atomic<uint32_t> HookContext::s_Generation{0};
 
 void printBuffer(const char* buffer, size_t size)
 {
@@ -47,16 +48,46 @@ void printBuffer(const char* buffer, size_t size)
     size_t offset = i % 16;
     _snprintf(&temp[offset * 3], 3, "%02x ", (unsigned char)buffer[i]);
     if (offset == 15) {
-      spdlog::get("hooks")->info("{0:x} - {1}", i - offset, temp);
+      LOG_HOOKS(info, "{0:x} - {1}", i - offset, temp);
     }
   }
 
-  spdlog::get("hooks")->info(temp);
+  LOG_HOOKS(info, temp);
 }
 
+namespace
+{
+
+std::string statisticsSHMName(const char* instanceName)
+{
+  return std::string(instanceName) + "_stats";
+}
+
+std::string lockSHMName(const char* instanceName)
+{
+  return std::string(instanceName) + "_lock";
+}
+
+}  // namespace
+
 HookContext::HookContext(const usvfsParameters& params, HMODULE module)
     : m_ConfigurationSHM(bi::open_or_create, params.instanceName, 64 * 1024),
       m_Parameters(retrieveParameters(params)),
+      m_StatisticsSHM(bi::open_or_create,
+                      statisticsSHMName(params.instanceName).c_str(), bi::read_write,
+                      sizeof(shared::HookStatisticsTable) +
+                          sizeof(shared::LockStatisticsTable)),
+      m_StatisticsRegion(m_StatisticsSHM, bi::read_write),
+      m_Statistics(
+          shared::HookStatisticsTable::attach(m_StatisticsRegion.get_address())),
+      m_LockStatistics(shared::LockStatisticsTable::attach(
+          static_cast<char*>(m_StatisticsRegion.get_address()) +
+          sizeof(shared::HookStatisticsTable))),
+      m_LockSHM(bi::open_or_create, lockSHMName(params.instanceName).c_str(),
+                bi::read_write, sizeof(shared::SharedRWLockState)),
+      m_LockRegion(m_LockSHM, bi::read_write),
+      m_Lock(static_cast<shared::SharedRWLockState*>(m_LockRegion.get_address()),
+             lockSHMName(params.instanceName)),
       m_Tree(m_Parameters->currentSHMName(),
              4 * 1024 * 1024)  // 4 MiB empirically covers most small setups without
                                // need to resize
@@ -73,10 +104,12 @@ HookContext::HookContext(const usvfsParameters& params, HMODULE module)
 
   const auto userCount = m_Parameters->userConnected();
 
-  spdlog::get("usvfs")->debug("context current shm: {0} (now {1} connections)",
-                              m_Parameters->currentSHMName(), userCount);
+  LOG_USVFS(debug, "context current shm: {0} (now {1} connections)",
+            m_Parameters->currentSHMName(), userCount);
 
   s_Instance = this;
+  s_Generation.fetch_add(1, std::memory_order_release);
+  shared::LockStatisticsTable::setCurrent(m_LockStatistics);
 
   if (m_Tree.get() == nullptr) {
     USVFS_THROW_EXCEPTION(usage_error()
@@ -91,19 +124,32 @@ void HookContext::remove(const char* instanceName)
 
 HookContext::~HookContext()
 {
-  spdlog::get("usvfs")->info("releasing hook context");
+  LOG_USVFS(info, "releasing hook context");
+
+  s_Instance = nullptr;
+  s_Generation.fetch_add(1, std::memory_order_release);
+  shared::LockStatisticsTable::setCurrent(nullptr);
 
-  s_Instance           = nullptr;
   const auto userCount = m_Parameters->userDisconnected();
 
   if (userCount == 0) {
-    spdlog::get("usvfs")->info("removing tree {}", m_Parameters->instanceName());
+    LOG_USVFS(info, "removing tree {}", m_Parameters->instanceName());
     bi::shared_memory_object::remove(m_Parameters->instanceName().c_str());
   } else {
-    spdlog::get("usvfs")->info("{} users left", userCount);
+    LOG_USVFS(info, "{} users left", userCount);
   }
 }
 
+shared::HookStatisticsTable* HookContext::statistics()
+{
+  return s_Instance != nullptr ? s_Instance->m_Statistics : nullptr;
+}
+
+shared::LockStatisticsTable* HookContext::lockStatistics()
+{
+  return s_Instance != nullptr ? s_Instance->m_LockStatistics : nullptr;
+}
+
 SharedParameters* HookContext::retrieveParameters(const usvfsParameters& params)
 {
   std::pair<SharedParameters*, SharedMemoryT::size_type> res =
@@ -111,7 +157,7 @@ SharedParameters* HookContext::retrieveParameters(const usvfsParameters& params)
 
   if (res.first == nullptr) {
     // not configured yet
-    spdlog::get("usvfs")->info("create config in {}", ::GetCurrentProcessId());
+    LOG_USVFS(info, "create config in {}", ::GetCurrentProcessId());
 
     res.first = m_ConfigurationSHM.construct<SharedParameters>("parameters")(
         params, VoidAllocatorT(m_ConfigurationSHM.get_segment_manager()));
@@ -120,28 +166,51 @@ SharedParameters* HookContext::retrieveParameters(const usvfsParameters& params)
       USVFS_THROW_EXCEPTION(bi::bad_alloc());
     }
   } else {
-    spdlog::get("usvfs")->info("access existing config in {}", ::GetCurrentProcessId());
+    LOG_USVFS(info, "access existing config in {}", ::GetCurrentProcessId());
   }
 
-  spdlog::get("usvfs")->info("{} processes", res.first->registeredProcessCount());
+  LOG_USVFS(info, "{} processes", res.first->registeredProcessCount());
 
   return res.first;
 }
 
-HookContext::ConstPtr HookContext::readAccess(const char*)
+HookContext::ConstPtr HookContext::readAccess(const char* source)
 {
   BOOST_ASSERT(s_Instance != nullptr);
 
-  // TODO: this should be a shared mutex!
-  s_Instance->m_Mutex.wait(200);
+  {
+    shared::TraceSpan span("context lock");
+    shared::SharedRWLock& lock = s_Instance->m_Lock;
+    shared::profiledLock(
+        shared::LockId::CONTEXT, false, source,
+        [&lock]() {
+          return lock.tryLockShared();
+        },
+        [&lock]() {
+          lock.lockShared();
+        });
+  }
+  s_Instance->checkRecovered();
   return ConstPtr(s_Instance, unlockShared);
 }
 
-HookContext::Ptr HookContext::writeAccess(const char*)
+HookContext::Ptr HookContext::writeAccess(const char* source)
 {
   BOOST_ASSERT(s_Instance != nullptr);
 
-  s_Instance->m_Mutex.wait(200);
+  {
+    shared::TraceSpan span("context lock");
+    shared::SharedRWLock& lock = s_Instance->m_Lock;
+    shared::profiledLock(
+        shared::LockId::CONTEXT, true, source,
+        [&lock]() {
+          return lock.tryLock();
+        },
+        [&lock]() {
+          lock.lock();
+        });
+  }
+  s_Instance->checkRecovered();
   return Ptr(s_Instance, unlock);
 }
 
@@ -188,13 +257,13 @@ void HookContext::blacklistExecutable(const std::wstring& wexe)
 {
   const auto exe = shared::string_cast<std::string>(wexe, shared::CodePage::UTF8);
 
-  spdlog::get("usvfs")->debug("blacklisting '{}'", exe);
+  LOG_USVFS(debug, "blacklisting '{}'", exe);
   m_Parameters->blacklistExecutable(exe);
 }
 
 void HookContext::clearExecutableBlacklist()
 {
-  spdlog::get("usvfs")->debug("clearing blacklist");
+  LOG_USVFS(debug, "clearing blacklist");
   m_Parameters->clearExecutableBlacklist();
 }
 
@@ -210,7 +279,7 @@ BOOL HookContext::executableBlacklisted(LPCWSTR wapp, LPCWSTR wcmd) const
     cmd = ush::string_cast<std::string>(wcmd, ush::CodePage::UTF8);
   }
 
-  return m_Parameters->executableBlacklisted(app, cmd);
+  return parameters()->executableBlacklisted(app, cmd);
 }
 
 void usvfs::HookContext::addSkipFileSuffix(const std::wstring& fileSuffix)
@@ -222,21 +291,16 @@ void usvfs::HookContext::addSkipFileSuffix(const std::wstring& fileSuffix)
     return;
   }
 
-  spdlog::get("usvfs")->debug("added skip file suffix '{}'", fsuffix);
+  LOG_USVFS(debug, "added skip file suffix '{}'", fsuffix);
   m_Parameters->addSkipFileSuffix(fsuffix);
 }
 
 void usvfs::HookContext::clearSkipFileSuffixes()
 {
-  spdlog::get("usvfs")->debug("clearing skip file suffixes");
+  LOG_USVFS(debug, "clearing skip file suffixes");
   m_Parameters->clearSkipFileSuffixes();
 }
 
-std::vector<std::string> usvfs::HookContext::skipFileSuffixes() const
-{
-  return m_Parameters->skipFileSuffixes();
-}
-
 void usvfs::HookContext::addSkipDirectory(const std::wstring& directory)
 {
   const auto dir = shared::string_cast<std::string>(directory, shared::CodePage::UTF8);
@@ -245,21 +309,16 @@ void usvfs::HookContext::addSkipDirectory(const std::wstring& directory)
     return;
   }
 
-  spdlog::get("usvfs")->debug("added skip directory '{}'", dir);
+  LOG_USVFS(debug, "added skip directory '{}'", dir);
   m_Parameters->addSkipDirectory(dir);
 }
 
 void usvfs::HookContext::clearSkipDirectories()
 {
-  spdlog::get("usvfs")->debug("clearing skip directories");
+  LOG_USVFS(debug, "clearing skip directories");
   m_Parameters->clearSkipDirectories();
 }
 
-std::vector<std::string> usvfs::HookContext::skipDirectories() const
-{
-  return m_Parameters->skipDirectories();
-}
-
 void HookContext::forceLoadLibrary(const std::wstring& wprocess,
                                    const std::wstring& wpath)
 {
@@ -268,22 +327,22 @@ void HookContext::forceLoadLibrary(const std::wstring& wprocess,
 
   const auto path = shared::string_cast<std::string>(wpath, shared::CodePage::UTF8);
 
-  spdlog::get("usvfs")->debug("adding forced library '{}' for process '{}'", path,
-                              process);
+  LOG_USVFS(debug, "adding forced library '{}' for process '{}'", path, process);
 
   m_Parameters->addForcedLibrary(process, path);
 }
 
 void HookContext::clearLibraryForceLoads()
 {
-  spdlog::get("usvfs")->debug("clearing forced libraries");
+  LOG_USVFS(debug, "clearing forced libraries");
   m_Parameters->clearForcedLibraries();
 }
 
 std::vector<std::wstring>
 HookContext::librariesToForceLoad(const std::wstring& processName)
 {
-  const auto v = m_Parameters->forcedLibraries(
+  const auto snapshot = parameters();
+  const auto& v        = snapshot->forcedLibraries(
       shared::string_cast<std::string>(processName, shared::CodePage::UTF8));
 
   std::vector<std::wstring> wv;
@@ -294,6 +353,11 @@ HookContext::librariesToForceLoad(const std::wstring& processName)
   return wv;
 }
 
+std::shared_ptr<const ParametersSnapshot> HookContext::parameters() const
+{
+  return m_Snapshot.get(*m_Parameters);
+}
+
 void HookContext::registerDelayed(std::future<int> delayed)
 {
   m_Futures.push_back(std::move(delayed));
@@ -306,12 +370,24 @@ std::vector<std::future<int>>& HookContext::delayed()
 
 void HookContext::unlock(HookContext* instance)
 {
-  instance->m_Mutex.signal();
+  instance->m_Lock.unlock();
 }
 
 void HookContext::unlockShared(const HookContext* instance)
 {
-  instance->m_Mutex.signal();
+  instance->m_Lock.unlockShared();
+}
+
+void HookContext::checkRecovered() const
+{
+  const uint32_t recovered = m_Lock.recovered();
+  uint32_t known           = m_Recovered.load(std::memory_order_relaxed);
+  if ((recovered != known) &&
+      m_Recovered.compare_exchange_strong(known, recovered,
+                                          std::memory_order_relaxed)) {
+    LOG_USVFS(err, "{} thread(s) died without releasing the context lock",
+              recovered - known);
+  }
 }
 
 // deprecated
@@ -22,10 +22,13 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dllimport.h"
 #include "redirectiontree.h"
-#include "semaphore.h"
 #include "tree_container.h"
 #include <directory_tree.h>
 #include <exceptionex.h>
+#include <hook_statistics.h>
+#include <lock_statistics.h>
+#include <shared_rwlock.h>
+#include <sharedparameters.h>
 #include <usvfsparameters.h>
 #include <usvfsparametersprivate.h>
 #include <winapi.h>
@@ -33,11 +36,9 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 namespace usvfs
 {
 
-class DLLEXPORT SharedParameters;
-
 /**
  * @brief context available to hooks. This is protected by a many-reader
- * single-writer mutex
+ * single-writer lock shared by all processes connected to the instance
  */
 class HookContext
 {
@@ -86,6 +87,24 @@ public:
 
   const RedirectionTreeContainer& inverseTable() const { return m_InverseTree; }
 
+  /**
+   * @return counters of all hooks, shared by all processes connected to the
+   *         instance, nullptr if there is no context
+   */
+  static shared::HookStatisticsTable* statistics();
+
+  /**
+   * @return wait times of the locks shared between processes, nullptr if there is
+   *         no context
+   */
+  static shared::LockStatisticsTable* lockStatistics();
+
+  /**
+   * @return a number that changes whenever a context is created or destroyed, so
+   *         pointers into the statistics table can be cached
+   */
+  static uint32_t generation() { return s_Generation.load(std::memory_order_acquire); }
+
   /**
    * @return the parameters passed in on dll initialisation
    */
@@ -105,6 +124,7 @@ public:
   template <typename T>
   T& customData(DataIDT id) const
   {
+    std::lock_guard<std::mutex> lock(m_CustomDataMutex);
     auto iter = m_CustomData.find(id);
     if (iter == m_CustomData.end()) {
       iter = m_CustomData.insert(std::make_pair(id, T())).first;
@@ -126,11 +146,9 @@ public:
 
   void addSkipFileSuffix(const std::wstring& fileSuffix);
   void clearSkipFileSuffixes();
-  std::vector<std::string> skipFileSuffixes() const;
 
   void addSkipDirectory(const std::wstring& directory);
   void clearSkipDirectories();
-  std::vector<std::string> skipDirectories() const;
 
   void forceLoadLibrary(const std::wstring& processName,
                         const std::wstring& libraryPath);
@@ -143,6 +161,12 @@ public:
 
   void updateParameters() const;
 
+  /**
+   * @return process local copy of the lists in the shared parameters, only copied
+   *         again after they have changed
+   */
+  std::shared_ptr<const ParametersSnapshot> parameters() const;
+
   void registerDelayed(std::future<int> delayed);
 
   std::vector<std::future<int>>& delayed();
@@ -151,24 +175,36 @@ private:
   static void unlock(HookContext* instance);
   static void unlockShared(const HookContext* instance);
 
+  void checkRecovered() const;
+
   SharedParameters* retrieveParameters(const usvfsParameters& params);
 
 private:
   static HookContext* s_Instance;
+  static std::atomic<uint32_t> s_Generation;
 
   shared::SharedMemoryT m_ConfigurationSHM;
   SharedParameters* m_Parameters{nullptr};
+  bi::windows_shared_memory m_StatisticsSHM;
+  bi::mapped_region m_StatisticsRegion;
+  shared::HookStatisticsTable* m_Statistics{nullptr};
+  shared::LockStatisticsTable* m_LockStatistics{nullptr};
+  bi::windows_shared_memory m_LockSHM;
+  bi::mapped_region m_LockRegion;
+  // readers run concurrently
+  mutable shared::SharedRWLock m_Lock;
+  mutable std::atomic<uint32_t> m_Recovered{0};
   RedirectionTreeContainer m_Tree;
   RedirectionTreeContainer m_InverseTree;
 
   std::vector<std::future<int>> m_Futures;
 
+  ParametersSnapshotCache m_Snapshot;
+
   mutable std::map<DataIDT, boost::any> m_CustomData;
+  mutable std::mutex m_CustomDataMutex;
 
   HMODULE m_DLLModule;
-
-  //  mutable std::recursive_mutex m_Mutex;
-  mutable RecursiveBenaphore m_Mutex;
 };
 
 }  // namespace usvfs
@@ -197,28 +233,31 @@ private:
 
 #define HOOK_START_GROUP(group)                                                        \
   try {                                                                                \
-    HookCallContext callContext(group);
+    static usvfs::HookSite hookSite(__MYFUNC__);                                       \
+    HookCallContext callContext(group, hookSite);
 
 #define HOOK_START                                                                     \
   try {                                                                                \
-    HookCallContext callContext;
+    static usvfs::HookSite hookSite(__MYFUNC__);                                       \
+    HookCallContext callContext(hookSite);
 
 #define HOOK_END                                                                       \
   }                                                                                    \
   catch (const std::exception& e)                                                      \
   {                                                                                    \
-    spdlog::get("usvfs")->error("exception in {0}: {1}", __MYFUNC__, e.what());        \
+    LOG_USVFS(err, "exception in {0}: {1}", __MYFUNC__, e.what());                     \
     logExtInfo(e);                                                                     \
+    usvfs::HookSite::recordError(__MYFUNC__);                                          \
   }
 
 #define HOOK_ENDP(param)                                                               \
   }                                                                                    \
   catch (const std::exception& e)                                                      \
   {                                                                                    \
-    spdlog::get("usvfs")->error("exception in {0} ({1}): {2}", __MYFUNC__, param,      \
-                                e.what());                                             \
+    LOG_USVFS(err, "exception in {0} ({1}): {2}", __MYFUNC__, param, e.what());        \
     logExtInfo(e);                                                                     \
+    usvfs::HookSite::recordError(__MYFUNC__);                                          \
   }
 
-#define PRE_REALCALL callContext.restoreLastError();
-#define POST_REALCALL callContext.updateLastError();
+#define PRE_REALCALL callContext.beginRealCall();
+#define POST_REALCALL callContext.endRealCall();
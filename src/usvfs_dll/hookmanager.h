@@ -21,7 +21,12 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "hookcontext.h"
+#include "hooktable.h"
+#include <array>
 #include <hooklib.h>
+#include <map>
+#include <phase_timer.h>
+#include <string>
 #include <usvfsparameters.h>
 
 namespace usvfs
@@ -30,7 +35,12 @@ namespace usvfs
 class HookManager
 {
 public:
-  HookManager(const usvfsParameters& params, HMODULE module);
+  ///
+  /// \param timer if not null, receives how long attaching to the context, registering
+  ///              the process and installing the hooks took
+  ///
+  HookManager(const usvfsParameters& params, HMODULE module,
+              shared::PhaseTimer* timer = nullptr);
   ~HookManager();
 
   HookManager(const HookManager& reference) = delete;
@@ -43,27 +53,29 @@ public:
 
   ///
   /// \brief retrieve address of the detour of a function
-  /// \param functionName name of the function to look up
-  /// \return function address that can be used to directly execute the original code
+  /// \param id id of the hook, see hookId()
+  /// \return function address that can be used to directly execute the original code,
+  ///         nullptr if the function isn't hooked
   ///
-  LPVOID detour(const char* functionName);
+  LPVOID detour(HookId id) const { return m_Detours[id]; }
 
   ///
   /// \brief remove the hook on the specified function.
-  /// \param functionName name of the function to unhook
+  /// \param id id of the hook on the function to unhook
   /// \note This function is only exposed to allow a workaround for ExitProcess and may
   /// be
   ///       removed if a better solution is found there. If you have another legit use
   ///       case, please let me know!
   ///
-  void removeHook(const std::string& functionName);
+  void removeHook(HookId id);
 
 private:
   void logStubInt(LPVOID address);
   static void logStub(LPVOID address);
 
-  void installHook(HMODULE module1, HMODULE module2, const std::string& functionName,
-                   LPVOID hook, LPVOID* fillFuncAddr);
+  void installHook(HMODULE module1, HMODULE module2, HookId id);
+  // stubs only log calls to the function, meant for finding out whether functions
+  // that aren't in the hook table get called
   void installStub(HMODULE module1, HMODULE module2, const std::string& functionName);
   void initHooks();
   void removeHooks();
@@ -71,9 +83,20 @@ private:
 private:
   static HookManager* s_Instance;
 
-  std::map<std::string, HookLib::HOOKHANDLE> m_Hooks;
+  // all indexed by HookId
+  std::array<HookLib::HOOKHANDLE, HOOK_COUNT> m_Hooks;
+  // address of the hooked function
+  std::array<LPVOID, HOOK_COUNT> m_Functions{};
+  std::array<LPVOID, HOOK_COUNT> m_Detours{};
+
+  struct Stub
+  {
+    std::string name;
+    HookLib::HOOKHANDLE handle;
+  };
 
-  std::map<LPVOID, std::string> m_Stubs;
+  // stubbed functions by address, see installStub()
+  std::map<LPVOID, Stub> m_Stubs;
 
   HookContext m_Context;
 };
@@ -7,6 +7,7 @@
 
 #include <type_traits>
 
+#include <directory_record.h>
 #include <ntdll_declarations.h>
 
 #include <windows.h>
@@ -85,6 +86,14 @@ struct FileInformationClassUtilsImpl
       }
     }
   }
+
+  static size_t synthesize(LPVOID address, size_t size,
+                           const usvfs::shared::FileMetadata& metadata,
+                           const std::wstring& fileName)
+  {
+    return usvfs::shared::synthesizeRecord<FileInformationClass>(
+        metadata, fileName.c_str(), fileName.size(), address, size);
+  }
 };
 
 template <FILE_INFORMATION_CLASS fileInformationClass>
@@ -200,6 +209,13 @@ struct FileInformationClassUtils<FileAllInformation>
     FileInformationClassUtils<FileNameInformation>::set_filename(
         &reinterpret_cast<FILE_ALL_INFORMATION*>(address)->NameInformation, fileName);
   }
+
+  static size_t synthesize(LPVOID, size_t, const usvfs::shared::FileMetadata&,
+                           const std::wstring&)
+  {
+    // not a directory listing record
+    return 0;
+  }
 };
 
 }  // namespace usvfs::details
@@ -259,5 +275,20 @@ void SetFileInformationFileName(FILE_INFORMATION_CLASS fileInformationClass,
   }
 }
 
+// builds the record of a directory entry from recorded metadata instead of querying
+// the file, returns the size of the record or 0 if that's not possible for this
+// information class or the buffer is too small
+size_t SynthesizeFileInformation(FILE_INFORMATION_CLASS fileInformationClass,
+                                 LPVOID address, size_t size,
+                                 const usvfs::shared::FileMetadata& metadata,
+                                 const std::wstring& fileName)
+{
+  switch (fileInformationClass) {
+    _APPLY_FILEINFO_FN(synthesize, address, size, metadata, fileName);
+  default:
+    return 0;
+  }
+}
+
 #undef _APP_FINFO_CASE
 #undef _APPLY_FILEINFO_FN
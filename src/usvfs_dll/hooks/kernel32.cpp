@@ -8,9 +8,11 @@
 #include <formatters.h>
 #include <inject.h>
 #include <loghelpers.h>
+#include <profile_cache.h>
 #include <stringcast.h>
 #include <stringutils.h>
 #include <usvfs.h>
+#include <versioned_cache.h>
 #include <winapi.h>
 #include <winbase.h>
 
@@ -22,6 +24,7 @@ namespace usvfs
 {
 MapTracker k32DeleteTracker;
 MapTracker k32FakeDirTracker;
+CurrentDirectoryCache k32CurrentDirectoryCache;
 }  // namespace usvfs
 
 class CurrentDirectoryTracker
@@ -34,11 +37,12 @@ public:
     int index = m_currentDrive;
     if (forRelativePath && *forRelativePath && forRelativePath[1] == ':')
       if (!getDriveIndex(forRelativePath, index))
-        spdlog::get("usvfs")->warn(
-            "CurrentDirectoryTracker::get() invalid drive letter: {}, will use current "
-            "drive {}",
-            string_cast<std::string>(forRelativePath),
-            static_cast<char>('A' + index));  // prints '@' for m_currentDrive == -1
+        LOG_USVFS(warn,
+                  "CurrentDirectoryTracker::get() invalid drive letter: {}, will use "
+                  "current drive {}",
+                  string_cast<std::string>(forRelativePath),
+                  // prints '@' for m_currentDrive == -1
+                  static_cast<char>('A' + index));
     if (index < 0)
       return false;
 
@@ -82,6 +86,83 @@ private:
 
 CurrentDirectoryTracker k32CurrentDirectoryTracker;
 
+// where a module loaded from a redirected file claims to be loaded from
+struct ModulePath
+{
+  std::wstring realPath;
+  // empty if the module wasn't loaded through usvfs
+  std::wstring virtualPath;
+};
+
+// GetModuleFileName is called in loops by some games and their plugins
+ush::VersionedCache<HMODULE, ModulePath> k32ModulePathCache;
+// LoadLibraryExW is called with the same few names over and over
+ush::VersionedCache<std::wstring, usvfs::Resolver::Result> k32LibraryCache;
+
+// changes whenever the result of resolving a path against the table may change: the
+// context was recreated, the table was modified or a file was deleted through usvfs.
+// All three only ever count up, so their sums can't repeat
+static uint64_t mappingVersion(const usvfs::RedirectionTreeContainer& table)
+{
+  const uint32_t local =
+      usvfs::HookContext::generation() + usvfs::k32DeleteTracker.version();
+  return (static_cast<uint64_t>(table->changeCount()) << 32) | local;
+}
+
+// the virtual path of a module, empty if it wasn't loaded from a redirected file.
+// Entries are only used while the module at that address still has the same real
+// path, so unloading a module doesn't have to be tracked
+static std::wstring moduleVirtualPath(const usvfs::HookCallContext& callContext,
+                                      HMODULE module, const std::wstring& realPath)
+{
+  using namespace usvfs;
+
+  auto context           = READ_CONTEXT();
+  const uint64_t version = mappingVersion(context->inverseTable());
+
+  if (auto cached = k32ModulePathCache.find(module, version)) {
+    if (cached->realPath == realPath) {
+      return cached->virtualPath;
+    }
+  }
+
+  const RerouteW reroute =
+      RerouteW::create(context, callContext, realPath.c_str(), true);
+  ModulePath result{realPath, reroute.wasRerouted() ? reroute.fileName() : L""};
+  k32ModulePathCache.insert(module, version, result);
+  return result.virtualPath;
+}
+
+// RerouteW::create() for a library name, the tree is only walked the first time the
+// name is loaded with the current mappings
+static usvfs::RerouteW rerouteLibrary(const usvfs::HookCallContext& callContext,
+                                      LPCWSTR fileName)
+{
+  using namespace usvfs;
+
+  auto context = READ_CONTEXT();
+  if (!RerouteW::interestingPath(fileName) || !callContext.active()) {
+    return RerouteW::create(context, callContext, fileName);
+  }
+
+  const std::wstring path = RerouteW::canonicalPath(fileName);
+  const uint64_t version  = mappingVersion(context->redirectionTable());
+
+  std::optional<Resolver::Result> resolved = k32LibraryCache.find(path, version);
+  if (!resolved) {
+    const Resolver resolver(context->redirectionTable());
+    resolved = resolver.resolve(path);
+    // the cache is local to the process, it must not keep nodes of the shared tree
+    // alive. Loading a library doesn't use them
+    resolved->node = {};
+    k32LibraryCache.insert(path, version, *resolved);
+  }
+
+  RerouteW result = RerouteW::create(*resolved, fileName);
+  callContext.recordLookup(result.wasRerouted());
+  return result;
+}
+
 // attempts to copy source to destination and return the error code
 static inline DWORD copyFileDirect(LPCWSTR source, LPCWSTR destination, bool overwrite)
 {
@@ -146,7 +227,7 @@ HMODULE WINAPI usvfs::hook_LoadLibraryExW(LPCWSTR lpFileName, HANDLE hFile,
   HOOK_START_GROUP(MutExHookGroup::LOAD_LIBRARY)
   // Why is the usual if (!callContext.active()... check missing?
 
-  RerouteW reroute = RerouteW::create(READ_CONTEXT(), callContext, lpFileName);
+  RerouteW reroute = rerouteLibrary(callContext, lpFileName);
   PRE_REALCALL
   res = ::LoadLibraryExW(reroute.fileName(), hFile, dwFlags);
   POST_REALCALL
@@ -327,17 +408,17 @@ BOOL WINAPI usvfs::hook_CreateProcessInternalW(
       try {
         injectProcess(dllPath, callParameters, *lpProcessInformation);
       } catch (const std::exception& e) {
-        spdlog::get("hooks")->error("failed to inject into {0}: {1}",
-                                    lpApplicationName != nullptr
-                                        ? applicationReroute.fileName()
-                                        : static_cast<LPCWSTR>(lpCommandLine),
-                                    e.what());
+        LOG_HOOKS(err, "failed to inject into {0}: {1}",
+                  lpApplicationName != nullptr
+                      ? applicationReroute.fileName()
+                      : static_cast<LPCWSTR>(lpCommandLine),
+                  e.what());
       }
     }
 
     // resume unless process is supposed to start suspended
     if (!susp && (ResumeThread(lpProcessInformation->hThread) == (DWORD)-1)) {
-      spdlog::get("hooks")->error("failed to inject into spawned process");
+      LOG_HOOKS(err, "failed to inject into spawned process");
       res = FALSE;
     }
   }
@@ -392,14 +473,23 @@ BOOL WINAPI usvfs::hook_GetFileAttributesExW(LPCWSTR lpFileName,
     return res;
   }
 
-  fs::path canonicalFile = RerouteW::canonizePath(RerouteW::absolutePath(lpFileName));
+  fs::path canonicalFile = RerouteW::canonicalPath(lpFileName);
 
   RerouteW reroute =
       RerouteW::create(READ_CONTEXT(), callContext, canonicalFile.c_str());
 
-  PRE_REALCALL
-  res = ::GetFileAttributesExW(reroute.fileName(), fInfoLevelId, lpFileInformation);
-  POST_REALCALL
+  const std::optional<ush::FileMetadata>& metadata = reroute.metadata();
+  if (metadata && (fInfoLevelId == GetFileExInfoStandard) && lpFileInformation) {
+    // linked files are not expected to change unless written through usvfs, which
+    // invalidates the metadata
+    ush::toAttributeData(
+        *metadata, *reinterpret_cast<WIN32_FILE_ATTRIBUTE_DATA*>(lpFileInformation));
+    res = TRUE;
+  } else {
+    PRE_REALCALL
+    res = ::GetFileAttributesExW(reroute.fileName(), fInfoLevelId, lpFileInformation);
+    POST_REALCALL
+  }
 
   DWORD originalError = callContext.lastError();
   DWORD fixedError    = originalError;
@@ -488,15 +578,19 @@ DWORD WINAPI usvfs::hook_GetFileAttributesW(LPCWSTR lpFileName)
     return res;
   }
 
-  fs::path canonicalFile = RerouteW::canonizePath(RerouteW::absolutePath(lpFileName));
+  fs::path canonicalFile = RerouteW::canonicalPath(lpFileName);
 
   RerouteW reroute =
       RerouteW::create(READ_CONTEXT(), callContext, canonicalFile.c_str());
 
-  if (reroute.wasRerouted())
-    PRE_REALCALL
-  res = ::GetFileAttributesW(reroute.fileName());
-  POST_REALCALL
+  if (const std::optional<ush::FileMetadata>& metadata = reroute.metadata()) {
+    res = metadata->attributes;
+  } else {
+    if (reroute.wasRerouted())
+      PRE_REALCALL
+    res = ::GetFileAttributesW(reroute.fileName());
+    POST_REALCALL
+  }
 
   DWORD originalError = callContext.lastError();
   DWORD fixedError    = originalError;
@@ -555,6 +649,10 @@ DWORD WINAPI usvfs::hook_SetFileAttributesW(LPCWSTR lpFileName, DWORD dwFileAttr
   res = ::SetFileAttributesW(reroute.fileName(), dwFileAttributes);
   POST_REALCALL
 
+  if (res) {
+    reroute.invalidateMetadata();
+  }
+
   if (reroute.wasRerouted()) {
     LOG_CALL().PARAM(reroute.fileName()).PARAM(res).PARAM(callContext.lastError());
   }
@@ -571,8 +669,7 @@ BOOL WINAPI usvfs::hook_DeleteFileW(LPCWSTR lpFileName)
   HOOK_START_GROUP(MutExHookGroup::DELETE_FILE)
   // Why is the usual if (!callContext.active()... check missing?
 
-  const std::wstring path =
-      RerouteW::canonizePath(RerouteW::absolutePath(lpFileName)).wstring();
+  const std::wstring path = RerouteW::canonicalPath(lpFileName);
 
   RerouteW reroute = RerouteW::create(READ_CONTEXT(), callContext, path.c_str());
 
@@ -585,7 +682,7 @@ BOOL WINAPI usvfs::hook_DeleteFileW(LPCWSTR lpFileName)
   POST_REALCALL
 
   if (res) {
-    reroute.removeMapping(READ_CONTEXT());
+    reroute.removeMapping(WRITE_CONTEXT());
   }
 
   if (reroute.wasRerouted())
@@ -704,8 +801,9 @@ BOOL WINAPI usvfs::hook_MoveFileW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileN
 
     if (res) {
       readReroute.removeMapping(
-          READ_CONTEXT(), isDirectory);  // Updating the rerouteCreate to check deleted
-                                         // file entries should make this okay
+          WRITE_CONTEXT(),
+          isDirectory);  // Updating the rerouteCreate to check deleted file entries
+                         // should make this okay
 
       if (writeReroute.newReroute()) {
         if (isDirectory)
@@ -837,8 +935,9 @@ BOOL WINAPI usvfs::hook_MoveFileExW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFil
 
     if (res) {
       readReroute.removeMapping(
-          READ_CONTEXT(), isDirectory);  // Updating the rerouteCreate to check deleted
-                                         // file entries should make this okay
+          WRITE_CONTEXT(),
+          isDirectory);  // Updating the rerouteCreate to check deleted file entries
+                         // should make this okay
 
       if (writeReroute.newReroute()) {
         if (isDirectory)
@@ -988,7 +1087,7 @@ BOOL WINAPI usvfs::hook_MoveFileWithProgressW(LPCWSTR lpExistingFileName,
       // it, but deleteFile can't be disabled since we are relying on it in case of
       // MOVEFILE_REPLACE_EXISTING for the destination file.
       readReroute.removeMapping(
-          READ_CONTEXT(),
+          WRITE_CONTEXT(),
           isDirectory);  // Updating the rerouteCreate to check deleted file entries
                          // should make this okay (not related to comments above)
 
@@ -1140,8 +1239,8 @@ BOOL WINAPI usvfs::hook_SetCurrentDirectoryW(LPCWSTR lpPathName)
 
   HOOK_START
 
-  const fs::path& realPath = RerouteW::canonizePath(RerouteW::absolutePath(lpPathName));
-  const std::wstring& realPathStr = realPath.wstring();
+  const std::wstring realPathStr = RerouteW::canonicalPath(lpPathName);
+  const fs::path realPath(realPathStr);
   std::wstring finalRoute;
   BOOL found = FALSE;
 
@@ -1177,10 +1276,16 @@ BOOL WINAPI usvfs::hook_SetCurrentDirectoryW(LPCWSTR lpPathName)
   res = ::SetCurrentDirectoryW(finalRoute.c_str());
   POST_REALCALL
 
-  if (res)
-    if (!k32CurrentDirectoryTracker.set(realPathStr))
-      spdlog::get("usvfs")->warn("Updating actual current directory failed: {} ?!",
-                                 string_cast<std::string>(realPathStr));
+  if (res) {
+    if (k32CurrentDirectoryTracker.set(realPathStr)) {
+      k32CurrentDirectoryCache.set(realPathStr);
+    } else {
+      // GetCurrentDirectoryW reports the real directory now
+      k32CurrentDirectoryCache.invalidate();
+      LOG_USVFS(warn, "Updating actual current directory failed: {} ?!",
+                string_cast<std::string>(realPathStr));
+    }
+  }
 
   LOG_CALL()
       .PARAM(lpPathName)
@@ -1240,7 +1345,7 @@ DLLEXPORT BOOL WINAPI usvfs::hook_RemoveDirectoryW(LPCWSTR lpPathName)
   POST_REALCALL
 
   if (res) {
-    reroute.removeMapping(READ_CONTEXT(), true);
+    reroute.removeMapping(WRITE_CONTEXT(), true);
   }
 
   if (reroute.wasRerouted())
@@ -1364,19 +1469,18 @@ DWORD WINAPI usvfs::hook_GetModuleFileNameA(HMODULE hModule, LPSTR lpFilename,
       full_res = ::GetModuleFileNameA(hModule, buf.data(), buf_size);
     }
 
-    RerouteW reroute = RerouteW::create(
-        READ_CONTEXT(), callContext,
-        ush::string_cast<std::wstring>(buf.empty() ? lpFilename : buf.data()).c_str(),
-        true);
-    if (reroute.wasRerouted()) {
-      DWORD reroutedSize = static_cast<DWORD>(wcslen(reroute.fileName()));
+    const std::wstring virtualPath = moduleVirtualPath(
+        callContext, hModule,
+        ush::string_cast<std::wstring>(buf.empty() ? lpFilename : buf.data()));
+    if (!virtualPath.empty()) {
+      DWORD reroutedSize = static_cast<DWORD>(virtualPath.size());
       if (reroutedSize >= nSize) {
         reroutedSize = nSize - 1;
         callContext.updateLastError(ERROR_INSUFFICIENT_BUFFER);
         res = nSize;
       } else
         res = reroutedSize;
-      memcpy(lpFilename, ush::string_cast<std::string>(reroute.fileName()).c_str(),
+      memcpy(lpFilename, ush::string_cast<std::string>(virtualPath).c_str(),
              reroutedSize * sizeof(lpFilename[0]));
       lpFilename[reroutedSize] = 0;
 
@@ -1418,17 +1522,17 @@ DWORD WINAPI usvfs::hook_GetModuleFileNameW(HMODULE hModule, LPWSTR lpFilename,
       full_res = ::GetModuleFileNameW(hModule, buf.data(), buf_size);
     }
 
-    RerouteW reroute = RerouteW::create(READ_CONTEXT(), callContext,
-                                        buf.empty() ? lpFilename : buf.data(), true);
-    if (reroute.wasRerouted()) {
-      DWORD reroutedSize = static_cast<DWORD>(wcslen(reroute.fileName()));
+    const std::wstring virtualPath =
+        moduleVirtualPath(callContext, hModule, buf.empty() ? lpFilename : buf.data());
+    if (!virtualPath.empty()) {
+      DWORD reroutedSize = static_cast<DWORD>(virtualPath.size());
       if (reroutedSize >= nSize) {
         reroutedSize = nSize - 1;
         callContext.updateLastError(ERROR_INSUFFICIENT_BUFFER);
         res = nSize;
       } else
         res = reroutedSize;
-      memcpy(lpFilename, reroute.fileName(), reroutedSize * sizeof(lpFilename[0]));
+      memcpy(lpFilename, virtualPath.c_str(), reroutedSize * sizeof(lpFilename[0]));
       lpFilename[reroutedSize] = 0;
 
       LOG_CALL()
@@ -1463,9 +1567,9 @@ HANDLE WINAPI usvfs::hook_FindFirstFileExW(
     const auto len = wcslen(lpFileName);
     if (len > 0) {
       if (lpFileName[len - 1] == L'\\' || lpFileName[len - 1] == L'/') {
-        spdlog::get("usvfs")->warn(
-            "hook_FindFirstFileExW(): path '{}' ends with slash, always fails",
-            fs::path(lpFileName).string());
+        LOG_USVFS(warn,
+                  "hook_FindFirstFileExW(): path '{}' ends with slash, always fails",
+                  fs::path(lpFileName).string());
         return INVALID_HANDLE_VALUE;
       }
     }
@@ -1480,7 +1584,7 @@ HANDLE WINAPI usvfs::hook_FindFirstFileExW(
   // We need to do some trickery here, since we only want to use the hooked
   // NtQueryDirectoryFile for rerouted locations we need to check if the Directory path
   // has been routed instead of the full path.
-  originalPath = RerouteW::canonizePath(RerouteW::absolutePath(lpFileName));
+  originalPath = RerouteW::canonicalPath(lpFileName);
   PRE_REALCALL
   res = ::FindFirstFileExW(originalPath.c_str(), fInfoLevelId, lpFindFileData,
                            fSearchOp, lpSearchFilter, dwAdditionalFlags);
@@ -1511,7 +1615,7 @@ HANDLE WINAPI usvfs::hook_FindFirstFileExW(
 
   if (res != INVALID_HANDLE_VALUE) {
     // store the original search path for use during iteration
-    WRITE_CONTEXT()->customData<SearchHandleMap>(SearchHandles)[res] = lpFileName;
+    searchHandles.insert(res, lpFileName);
   }
 
   LOG_CALL()
@@ -1588,6 +1692,67 @@ HRESULT WINAPI usvfs::hook_CopyFile2(PCWSTR pwszExistingFileName,
   return res;
 }
 
+// the parsed ini file the profile api would read, nullptr if the cache is disabled
+// or the file has to be read by the real api
+static std::shared_ptr<const ush::ProfileData>
+cachedProfile(const usvfs::RerouteW& reroute)
+{
+  // larger files aren't ini files in the sense of the profile api
+  static constexpr uint64_t MAX_PROFILE_SIZE = 4 * 1024 * 1024;
+
+  ush::ProfileCache& cache = ush::ProfileCache::instance();
+  if (!cache.enabled() || !reroute.wasRerouted()) {
+    return nullptr;
+  }
+
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  {
+    usvfs::FunctionGroupLock lock(usvfs::MutExHookGroup::FILE_ATTRIBUTES);
+    if (!GetFileAttributesExW(reroute.fileName(), GetFileExInfoStandard,
+                              &attributes) ||
+        (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      return nullptr;
+    }
+  }
+
+  const uint64_t size =
+      (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+  const uint64_t writeTime =
+      (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+      attributes.ftLastWriteTime.dwLowDateTime;
+
+  if (auto cached = cache.find(reroute.fileName(), size, writeTime)) {
+    return *cached;
+  }
+
+  if (size > MAX_PROFILE_SIZE) {
+    cache.insert(reroute.fileName(), size, writeTime, nullptr);
+    return nullptr;
+  }
+
+  HANDLE file = CreateFileW(reroute.fileName(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+
+  std::string content(static_cast<size_t>(size), '\0');
+  DWORD read = 0;
+  const BOOL success =
+      ReadFile(file, content.data(), static_cast<DWORD>(size), &read, nullptr);
+  CloseHandle(file);
+
+  // the file changed in between, it's parsed on the next call
+  if (!success || (read != size)) {
+    return nullptr;
+  }
+
+  auto data = ush::ProfileData::parse(content);
+  cache.insert(reroute.fileName(), size, writeTime, data);
+  return data;
+}
+
 DWORD WINAPI usvfs::hook_GetPrivateProfileStringA(LPCSTR lpAppName, LPCSTR lpKeyName,
                                                   LPCSTR lpDefault,
                                                   LPSTR lpReturnedString, DWORD nSize,
@@ -1607,11 +1772,22 @@ DWORD WINAPI usvfs::hook_GetPrivateProfileStringA(LPCSTR lpAppName, LPCSTR lpKey
   RerouteW reroute = RerouteW::create(
       READ_CONTEXT(), callContext, ush::string_cast<std::wstring>(lpFileName).c_str());
 
-  PRE_REALCALL
-  res = ::GetPrivateProfileStringA(
-      lpAppName, lpKeyName, lpDefault, lpReturnedString, nSize,
-      ush::string_cast<std::string>(reroute.fileName()).c_str());
-  POST_REALCALL
+  std::optional<ush::ProfileResult> cached;
+  if (auto profile = cachedProfile(reroute)) {
+    cached =
+        profile->getString(lpAppName, lpKeyName, lpDefault, lpReturnedString, nSize);
+  }
+
+  if (cached) {
+    res = cached->length;
+    callContext.updateLastError(cached->found ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND);
+  } else {
+    PRE_REALCALL
+    res = ::GetPrivateProfileStringA(
+        lpAppName, lpKeyName, lpDefault, lpReturnedString, nSize,
+        ush::string_cast<std::string>(reroute.fileName()).c_str());
+    POST_REALCALL
+  }
 
   if (reroute.wasRerouted()) {
     LOG_CALL()
@@ -1646,10 +1822,21 @@ DWORD WINAPI usvfs::hook_GetPrivateProfileStringW(LPCWSTR lpAppName, LPCWSTR lpK
 
   RerouteW reroute = RerouteW::create(READ_CONTEXT(), callContext, lpFileName);
 
-  PRE_REALCALL
-  res = ::GetPrivateProfileStringW(lpAppName, lpKeyName, lpDefault, lpReturnedString,
-                                   nSize, reroute.fileName());
-  POST_REALCALL
+  std::optional<ush::ProfileResult> cached;
+  if (auto profile = cachedProfile(reroute)) {
+    cached =
+        profile->getString(lpAppName, lpKeyName, lpDefault, lpReturnedString, nSize);
+  }
+
+  if (cached) {
+    res = cached->length;
+    callContext.updateLastError(cached->found ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND);
+  } else {
+    PRE_REALCALL
+    res = ::GetPrivateProfileStringW(lpAppName, lpKeyName, lpDefault, lpReturnedString,
+                                     nSize, reroute.fileName());
+    POST_REALCALL
+  }
 
   if (reroute.wasRerouted()) {
     LOG_CALL()
@@ -1683,11 +1870,21 @@ DWORD WINAPI usvfs::hook_GetPrivateProfileSectionA(LPCSTR lpAppName,
   RerouteW reroute = RerouteW::create(
       READ_CONTEXT(), callContext, ush::string_cast<std::wstring>(lpFileName).c_str());
 
-  PRE_REALCALL
-  res = ::GetPrivateProfileSectionA(
-      lpAppName, lpReturnedString, nSize,
-      ush::string_cast<std::string>(reroute.fileName()).c_str());
-  POST_REALCALL
+  std::optional<ush::ProfileResult> cached;
+  if (auto profile = cachedProfile(reroute)) {
+    cached = profile->getSection(lpAppName, lpReturnedString, nSize);
+  }
+
+  if (cached) {
+    res = cached->length;
+    callContext.updateLastError(cached->found ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND);
+  } else {
+    PRE_REALCALL
+    res = ::GetPrivateProfileSectionA(
+        lpAppName, lpReturnedString, nSize,
+        ush::string_cast<std::string>(reroute.fileName()).c_str());
+    POST_REALCALL
+  }
 
   if (reroute.wasRerouted()) {
     LOG_CALL()
@@ -1719,10 +1916,20 @@ DWORD WINAPI usvfs::hook_GetPrivateProfileSectionW(LPCWSTR lpAppName,
 
   RerouteW reroute = RerouteW::create(READ_CONTEXT(), callContext, lpFileName);
 
-  PRE_REALCALL
-  res = ::GetPrivateProfileSectionW(lpAppName, lpReturnedString, nSize,
-                                    reroute.fileName());
-  POST_REALCALL
+  std::optional<ush::ProfileResult> cached;
+  if (auto profile = cachedProfile(reroute)) {
+    cached = profile->getSection(lpAppName, lpReturnedString, nSize);
+  }
+
+  if (cached) {
+    res = cached->length;
+    callContext.updateLastError(cached->found ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND);
+  } else {
+    PRE_REALCALL
+    res = ::GetPrivateProfileSectionW(lpAppName, lpReturnedString, nSize,
+                                      reroute.fileName());
+    POST_REALCALL
+  }
 
   if (reroute.wasRerouted()) {
     LOG_CALL()
@@ -1764,6 +1971,9 @@ BOOL WINAPI usvfs::hook_WritePrivateProfileStringA(LPCSTR lpAppName, LPCSTR lpKe
     POST_REALCALL
     reroute.updateResult(callContext, res);
 
+    // the write time may not change if the file is written to again quickly
+    ush::ProfileCache::instance().invalidate(reroute.fileName());
+
     if (res && reroute.newReroute())
       reroute.insertMapping(WRITE_CONTEXT());
 
@@ -1807,6 +2017,9 @@ BOOL WINAPI usvfs::hook_WritePrivateProfileStringW(LPCWSTR lpAppName, LPCWSTR lp
     POST_REALCALL
     reroute.updateResult(callContext, res);
 
+    // the write time may not change if the file is written to again quickly
+    ush::ProfileCache::instance().invalidate(reroute.fileName());
+
     if (res && reroute.newReroute())
       reroute.insertMapping(WRITE_CONTEXT());
 
@@ -1851,7 +2064,7 @@ VOID WINAPI usvfs::hook_ExitProcess(UINT exitCode)
 
   usvfsDisconnectVFS();
 
-  //  HookManager::instance().removeHook("ExitProcess");
+  //  HookManager::instance().removeHook(hookId("ExitProcess"));
   //  PRE_REALCALL
   ::ExitProcess(exitCode);
   //  POST_REALCALL
@@ -1,12 +1,14 @@
 #include "ntdll.h"
 
+#include <deque>
 #include <mutex>
-#include <queue>
-#include <set>
+#include <optional>
 
 #include <boost/filesystem.hpp>
 
 #include <addrtools.h>
+#include <directory_merge.h>
+#include <directory_record_cache.h>
 #include <loghelpers.h>
 #include <stringcast.h>
 #include <stringutils.h>
@@ -44,6 +46,10 @@ class RedirectionInfo
 public:
   UnicodeString path;
   bool redirected;
+  // the node the path was redirected through, if any
+  usvfs::RedirectionTree::NodePtrT node;
+  // metadata recorded for the node, copied while the tree was locked
+  std::optional<ush::FileMetadata> metadata;
 
   RedirectionInfo() {}
   RedirectionInfo(UnicodeString path, bool redirected)
@@ -119,6 +125,8 @@ private:
 
 HandleTracker ntdllHandleTracker;
 
+SearchHandleMap searchHandles;
+
 UnicodeString CreateUnicodeString(const OBJECT_ATTRIBUTES* objectAttributes)
 {
   UnicodeString result = ntdllHandleTracker.lookup(objectAttributes->RootDirectory);
@@ -131,12 +139,7 @@ UnicodeString CreateUnicodeString(const OBJECT_ATTRIBUTES* objectAttributes)
 std::ostream& operator<<(std::ostream& os, const _UNICODE_STRING& str)
 {
   try {
-    // TODO this does not correctly support surrogate pairs
-    // since the size used here is the number of 16-bit characters in the buffer
-    // whereas
-    // toNarrow expects the actual number of characters.
-    // It will always underestimate though, so worst case scenario we truncate
-    // the string
+    // the length is in code units, surrogate pairs are combined by the conversion
     os << ush::string_cast<std::string>(str.Buffer, ush::CodePage::UTF8,
                                         str.Length / sizeof(WCHAR));
   } catch (const std::exception& e) {
@@ -160,23 +163,21 @@ RedirectionInfo applyReroute(const usvfs::HookContext::ConstPtr& context,
   result.redirected = false;
 
   if (callContext.active()) {
+    usvfs::shared::TraceSpan span("tree walk");
     // see if the file exists in the redirection tree
-    std::string lookupPath = ush::string_cast<std::string>(
-        static_cast<LPCWSTR>(result.path) + 4, ush::CodePage::UTF8);
-    auto node = context->redirectionTable()->findNode(lookupPath.c_str());
+    std::wstring lookupPath(static_cast<LPCWSTR>(result.path) + 4);
+    auto node = context->redirectionTable()->findNode(lookupPath);
     // if so, replace the file name with the path to the mapped file
     if ((node.get() != nullptr) &&
         (!node->data().linkTarget.empty() || node->isDirectory())) {
       std::wstring reroutePath;
 
       if (node->data().linkTarget.length() > 0) {
-        reroutePath = ush::string_cast<std::wstring>(node->data().linkTarget.c_str(),
-                                                     ush::CodePage::UTF8);
+        reroutePath = node->data().linkTarget.c_str();
       } else {
-        reroutePath =
-            ush::string_cast<std::wstring>(node->path().c_str(), ush::CodePage::UTF8);
+        reroutePath = node->path().wstring();
       }
-      if ((*reroutePath.rbegin() == L'\\') && (*lookupPath.rbegin() != '\\')) {
+      if ((*reroutePath.rbegin() == L'\\') && (*lookupPath.rbegin() != L'\\')) {
         reroutePath.resize(reroutePath.size() - 1);
       }
       std::replace(reroutePath.begin(), reroutePath.end(), L'/', L'\\');
@@ -184,7 +185,12 @@ RedirectionInfo applyReroute(const usvfs::HookContext::ConstPtr& context,
         reroutePath[1] = L'?';
       result.path       = LR"(\??\)" + reroutePath;
       result.redirected = true;
+      result.node       = node;
+      if (const ush::FileMetadata* metadata = cachedMetadata(node)) {
+        result.metadata = *metadata;
+      }
     }
+    callContext.recordLookup(result.redirected);
   }
   return result;
 }
@@ -207,17 +213,6 @@ RedirectionInfo applyReroute(const usvfs::CreateRerouter& rerouter)
   return result;
 }
 
-struct FindCreateTarget
-{
-  usvfs::RedirectionTree::NodePtrT target;
-  void operator()(usvfs::RedirectionTree::NodePtrT node)
-  {
-    if (node->hasFlag(usvfs::shared::FLAG_CREATETARGET)) {
-      target = node;
-    }
-  }
-};
-
 std::pair<UnicodeString, UnicodeString>
 findCreateTarget(const usvfs::HookContext::ConstPtr& context,
                  const UnicodeString& inPath)
@@ -226,23 +221,12 @@ findCreateTarget(const usvfs::HookContext::ConstPtr& context,
   result.first  = inPath;
   result.second = UnicodeString();
 
-  std::string lookupPath = ush::string_cast<std::string>(
-      static_cast<LPCWSTR>(result.first) + 4, ush::CodePage::UTF8);
-  FindCreateTarget visitor;
-  usvfs::RedirectionTree::VisitorFunction visitorWrapper =
-      [&](const usvfs::RedirectionTree::NodePtrT& node) {
-        visitor(node);
-      };
-  context->redirectionTable()->visitPath(lookupPath, visitorWrapper);
-  if (visitor.target.get() != nullptr) {
-    bfs::path relativePath =
-        ush::make_relative(visitor.target->path(), bfs::path(lookupPath));
-
-    bfs::path target(visitor.target->data().linkTarget.c_str());
-    target /= relativePath;
-
-    result.second = UnicodeString(target.wstring().c_str());
-    winapi::ex::wide::createPath(target.parent_path());
+  const std::wstring_view lookupPath(static_cast<LPCWSTR>(result.first) + 4);
+  const usvfs::Resolver resolver(context->redirectionTable());
+  const std::wstring target = resolver.resolve(lookupPath).createTarget;
+  if (!target.empty()) {
+    result.second = UnicodeString(target.c_str());
+    winapi::ex::wide::createPath(bfs::path(target).parent_path());
   }
   return result;
 }
@@ -292,380 +276,652 @@ bool isDeviceFile(std::wstring_view name)
   }
 }
 
-NTSTATUS addNtSearchData(HANDLE hdl, PUNICODE_STRING FileName,
-                         const std::wstring& fakeName,
-                         FILE_INFORMATION_CLASS FileInformationClass, PVOID& buffer,
-                         ULONG& bufferSize, std::set<std::wstring>& foundFiles,
-                         HANDLE event, PIO_APC_ROUTINE apcRoutine, PVOID apcContext,
-                         BOOLEAN returnSingleEntry)
+// directory entries are sorted by their upper-cased name, which is the order NTFS
+// lists them in and the order of the nodes in the redirection tree. "." and ".."
+// always go first since callers expect them at the start of a wildcard search
+struct DirectoryEntryLess
 {
-  NTSTATUS res = STATUS_NO_SUCH_FILE;
-  if (hdl != INVALID_HANDLE_VALUE) {
-    PVOID lastValidRecord = nullptr;
-    PVOID bufferInit      = buffer;
-    IO_STATUS_BLOCK status;
-    res = NtQueryDirectoryFile(hdl, event, apcRoutine, apcContext, &status, buffer,
-                               bufferSize, FileInformationClass, returnSingleEntry,
-                               FileName, FALSE);
+  bool operator()(const std::wstring& lhs, const std::wstring& rhs) const
+  {
+    const int lhsRank = rank(lhs);
+    const int rhsRank = rank(rhs);
+    if (lhsRank != rhsRank) {
+      return lhsRank < rhsRank;
+    }
+    return lhs < rhs;
+  }
 
-    if ((res != STATUS_SUCCESS) || (status.Information <= 0)) {
-      bufferSize = 0UL;
+private:
+  static int rank(const std::wstring& name)
+  {
+    if (name == L".") {
+      return 0;
+    } else if (name == L"..") {
+      return 1;
     } else {
-      ULONG totalOffset = 0;
-      PVOID lastSkipPos = nullptr;
-
-      while (totalOffset < status.Information) {
-        ULONG offset;
-        std::wstring fileName;
-        GetFileInformationData(FileInformationClass, buffer, offset, fileName);
-        // in case this is a single-file search result and the specified
-        // filename differs from the file name found, replace it in the
-        // information structure
-        if ((totalOffset == 0) && (offset == 0) && (fakeName.length() > 0)) {
-          // if the fake name is larger than what is in the buffer and there is
-          // not enough room, that's a buffer overflow
-          if ((fakeName.length() > fileName.length()) &&
-              ((fakeName.length() - fileName.length()) >
-               (bufferSize - status.Information))) {
-            res = STATUS_BUFFER_OVERFLOW;
-            break;
-          }
-          // WARNING for the case where the fake name is longer this needs to
-          // move back all further results and update the offset first
-          SetFileInformationFileName(FileInformationClass, buffer, fakeName);
-          fileName = fakeName;
-        }
-        bool add = true;
-        if (fileName.length() > 0) {
-          auto insertRes = foundFiles.insert(ush::to_upper(fileName));
-          add = insertRes.second;  // add only if we didn't find this file before
-        }
-        if (!add) {
-          if (lastSkipPos == nullptr) {
-            lastSkipPos = buffer;
-          }
-        } else {
-          if (lastSkipPos != nullptr) {
-            memmove(lastSkipPos, buffer, status.Information - totalOffset);
-            ULONG delta = static_cast<ULONG>(ush::AddrDiff(buffer, lastSkipPos));
-            totalOffset -= delta;
-
-            buffer      = lastSkipPos;
-            lastSkipPos = nullptr;
-          }
-          lastValidRecord = buffer;
-        }
+      return 2;
+    }
+  }
+};
 
-        if (offset == 0) {
-          offset = static_cast<ULONG>(status.Information) - totalOffset;
-        }
-        buffer = ush::AddrAdd(buffer, offset);
-        totalOffset += offset;
-      }
+typedef ush::DirectoryEntrySource<std::wstring> DirectoryEntrySource;
+typedef ush::DirectoryMerge<std::wstring, DirectoryEntryLess> DirectoryCursor;
 
-      if (lastSkipPos != nullptr) {
-        buffer     = lastSkipPos;
-        bufferSize = static_cast<ULONG>(ush::AddrDiff(buffer, bufferInit));
-        // null out the unused rest if there is some
-        memset(lastSkipPos, 0, status.Information - bufferSize);
-      } else {
-        bufferSize = static_cast<ULONG>(ush::AddrDiff(buffer, bufferInit));
-      }
-    }
-    if (lastValidRecord != nullptr) {
-      SetFileInformationOffset(FileInformationClass, lastValidRecord, 0);
+// true if the node is listed in the virtual directory
+bool isVirtualEntry(const usvfs::RedirectionTree::NodePtrT& node)
+{
+  return ((node->data().linkTarget.length() > 0) || node->isDirectory()) &&
+         !node->hasFlag(usvfs::shared::FLAG_DUMMY);
+}
+
+bool matchesSearchPattern(const std::wstring& name, const std::wstring& pattern)
+{
+  LPCWSTR remainder = ush::wildcard::PartialMatch(name.c_str(), pattern.c_str());
+  return (remainder != nullptr) &&
+         ((*remainder == L'\0') || (wcscmp(remainder, L"*") == 0));
+}
+
+// calls the visitor for every record in a buffer filled by NtQueryDirectoryFile,
+// with the offset of the record in the buffer and its length including padding
+void forEachDirectoryRecord(
+    FILE_INFORMATION_CLASS FileInformationClass, const uint8_t* buffer, ULONG size,
+    const std::function<void(const std::wstring&, ULONG, ULONG)>& visitor)
+{
+  ULONG totalOffset = 0;
+  for (;;) {
+    ULONG offset;
+    std::wstring name;
+    GetFileInformationData(FileInformationClass, buffer + totalOffset, offset, name);
+    visitor(name, totalOffset, (offset != 0) ? offset : size - totalOffset);
+
+    if ((offset == 0) || (offset == ULONG_MAX)) {
+      break;
     }
+    totalOffset += offset;
   }
-  return res;
 }
 
-DATA_ID(SearchInfo);
-
-struct Searches
+/**
+ * entries of the real directory, queried from the search handle in batches. entries
+ * overridden by the virtual directory are removed from each batch
+ */
+class RealDirectoryEntries : public DirectoryEntrySource
 {
-  struct Info
+public:
+  struct Entry
   {
-    struct VirtualMatch
-    {
-      // full path to where the file/directory actually is
-      std::wstring realPath;
-      // virtual filename (only filename since it has to be within the searched
-      // directory)
-      // this is left empty when a folder with all its content is mapped to the
-      // search directory
-      std::wstring virtualName;
-    };
-
-    Info() : currentSearchHandle(INVALID_HANDLE_VALUE) {}
-    std::set<std::wstring> foundFiles;
-    HANDLE currentSearchHandle;
-    std::queue<VirtualMatch> virtualMatches;
-    UnicodeString searchPattern;
-    bool regularComplete{false};
+    ULONG offset;
+    ULONG length;
+    std::wstring name;
+    std::wstring key;
   };
 
-  Searches() = default;
+  typedef std::function<void(std::vector<Entry>&)> FilterFunction;
+
+  RealDirectoryEntries(HANDLE handle, bool ownsHandle,
+                       FILE_INFORMATION_CLASS fileInformationClass,
+                       PUNICODE_STRING pattern, bool restartScan, FilterFunction filter)
+      : m_Handle(handle), m_OwnsHandle(ownsHandle),
+        m_FileInformationClass(fileInformationClass), m_Filter(filter),
+        m_Restart(restartScan)
+  {
+    m_Pattern.appendPath(pattern);
+  }
+
+  ~RealDirectoryEntries()
+  {
+    if (m_OwnsHandle) {
+      ::CloseHandle(m_Handle);
+    }
+  }
+
+  bool valid() override
+  {
+    while ((m_Current >= m_Entries.size()) && !m_Complete) {
+      fetch();
+    }
+    return m_Current < m_Entries.size();
+  }
 
-  // must provide a special copy constructor because boost::mutex is
-  // non-copyable
-  Searches(const Searches& reference) : info(reference.info) {}
+  const std::wstring& key() const override { return m_Entries[m_Current].key; }
 
-  Searches& operator=(const Searches&) = delete;
+  size_t recordSize() const override { return m_Entries[m_Current].length; }
 
-  std::recursive_mutex queryMutex;
+  void copyRecord(void* destination) const override
+  {
+    const Entry& entry = m_Entries[m_Current];
+    memcpy(destination, m_Batch.data() + entry.offset, entry.length);
+  }
 
-  std::map<HANDLE, Info> info;
-};
+  void next() override { ++m_Current; }
 
-void gatherVirtualEntries(const UnicodeString& dirName,
-                          const usvfs::RedirectionTreeContainer& redir,
-                          PUNICODE_STRING FileName, Searches::Info& info)
-{
-  LPCWSTR dirNameW = static_cast<LPCWSTR>(dirName);
-  // fix directory name. I'd love to know why microsoft sometimes uses "\??\" vs
-  // "\\?\"
-  if ((wcsncmp(dirNameW, LR"(\\?\)", 4) == 0) ||
-      (wcsncmp(dirNameW, LR"(\??\)", 4) == 0)) {
-    dirNameW += 4;
-  }
-  auto node = redir->findNode(boost::filesystem::path(dirNameW));
-  if (node.get() != nullptr) {
-    std::string searchPattern =
-        FileName != nullptr
-            ? ush::string_cast<std::string>(FileName->Buffer, ush::CodePage::UTF8)
-            : "*.*";
-
-    boost::replace_all(searchPattern, "\"", ".");
-
-    for (const auto& subNode : node->find(searchPattern)) {
-      if (((subNode->data().linkTarget.length() > 0) || subNode->isDirectory()) &&
-          !subNode->hasFlag(usvfs::shared::FLAG_DUMMY)) {
-        std::wstring vName =
-            ush::string_cast<std::wstring>(subNode->name(), ush::CodePage::UTF8);
-
-        Searches::Info::VirtualMatch m;
-        if (subNode->data().linkTarget.length() > 0) {
-          m = {ush::string_cast<std::wstring>(subNode->data().linkTarget.c_str(),
-                                              ush::CodePage::UTF8),
-               vName};
-        } else {
-          m = {ush::string_cast<std::wstring>(subNode->path().c_str(),
-                                              ush::CodePage::UTF8),
-               vName};
-        }
+private:
+  static const ULONG BatchSize = 64 * 1024;
 
-        info.virtualMatches.push(m);
-        info.foundFiles.insert(ush::to_upper(vName));
+  void fetch()
+  {
+    m_Entries.clear();
+    m_Current = 0;
+
+    // allocated on first use, most searches are closed before the end is reached
+    // but some are never read at all
+    m_Batch.resize(BatchSize);
+
+    IO_STATUS_BLOCK status;
+    NTSTATUS res = NtQueryDirectoryFile(
+        m_Handle, nullptr, nullptr, nullptr, &status, m_Batch.data(), BatchSize,
+        m_FileInformationClass, FALSE,
+        m_Pattern.size() > 0 ? static_cast<PUNICODE_STRING>(m_Pattern) : nullptr,
+        m_Restart ? TRUE : FALSE);
+    m_Restart = false;
+    if (res == STATUS_PENDING) {
+      // the caller may have opened the directory for asynchronous access
+      ::WaitForSingleObject(m_Handle, INFINITE);
+      res = status.Status;
+    }
+
+    if ((res != STATUS_SUCCESS) || (status.Information == 0)) {
+      if ((res != STATUS_SUCCESS) && (res != STATUS_NO_MORE_FILES) &&
+          (res != STATUS_NO_SUCH_FILE)) {
+        LOG_HOOKS(warn, "error reported listing files: {0:x}",
+                  static_cast<uint32_t>(res));
       }
+      m_Complete = true;
+      return;
+    }
+
+    forEachDirectoryRecord(
+        m_FileInformationClass, m_Batch.data(), static_cast<ULONG>(status.Information),
+        [this](const std::wstring& name, ULONG offset, ULONG length) {
+          m_Entries.push_back({offset, length, name, ush::to_upper(name)});
+        });
+
+    if (m_Filter) {
+      m_Filter(m_Entries);
     }
   }
-}
+
+  HANDLE m_Handle;
+  bool m_OwnsHandle;
+  FILE_INFORMATION_CLASS m_FileInformationClass;
+  UnicodeString m_Pattern;
+  FilterFunction m_Filter;
+
+  std::vector<uint8_t> m_Batch;
+  std::vector<Entry> m_Entries;
+  size_t m_Current{0};
+  bool m_Restart;
+  bool m_Complete{false};
+};
 
 /**
- * @brief insert a virtual entry into the search result
- * @param FileInformation
- * @param FileInformationClass
- * @param info
- * @param realPath path were the actual file resides
- * @param virtualName virtual file name (without path). will often be the same
- *        as the name component of realpath
- * @param ReturnSingleEntry
- * @param dataRead
- * @return true if a virtual result was added, false if the search handle in the
- *         info object yields no more results
+ * a real directory that is read in batches through the same handle, used to look up
+ * the records of virtual entries
  */
-bool addVirtualSearchResult(PVOID& FileInformation,
-                            FILE_INFORMATION_CLASS FileInformationClass,
-                            Searches::Info& info, const std::wstring& realPath,
-                            const std::wstring& virtualName, BOOLEAN ReturnSingleEntry,
-                            ULONG& dataRead)
+class NtDirectoryListing : public ush::DirectoryListing<std::wstring>
 {
-  // this opens a search in the real location, then copies the information about
-  // files we care about (the ones being mapped) to the result we intend to
-  // return
-  bfs::path fullPath(realPath);
-  if (fullPath.filename().wstring() == L".") {
-    fullPath = fullPath.parent_path();
-  }
-  if (info.currentSearchHandle == INVALID_HANDLE_VALUE) {
-    std::wstring dirName = fullPath.parent_path().wstring();
+public:
+  NtDirectoryListing(HANDLE handle, FILE_INFORMATION_CLASS fileInformationClass)
+      : m_Handle(handle), m_FileInformationClass(fileInformationClass),
+        m_Batch(BatchSize)
+  {}
+
+  ~NtDirectoryListing() { ::CloseHandle(m_Handle); }
+
+  static std::unique_ptr<NtDirectoryListing>
+  open(const std::wstring& directory, FILE_INFORMATION_CLASS fileInformationClass)
+  {
+    std::wstring dirName = directory;
     if (dirName.length() >= MAX_PATH && !ush::startswith(dirName.c_str(), LR"(\\?\)"))
       dirName = LR"(\\?\)" + dirName;
-    info.currentSearchHandle =
-        CreateFileW(dirName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
-                    nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
-  }
-  std::wstring fileName =
-      ush::string_cast<std::wstring>(fullPath.filename().string(), ush::CodePage::UTF8);
-  NTSTATUS subRes = addNtSearchData(
-      info.currentSearchHandle,
-      (fileName != L".") ? static_cast<PUNICODE_STRING>(UnicodeString(fileName.c_str()))
-                         : nullptr,
-      virtualName, FileInformationClass, FileInformation, dataRead, info.foundFiles,
-      nullptr, nullptr, nullptr, ReturnSingleEntry);
-  if (subRes == STATUS_SUCCESS) {
-    return true;
-  } else {
-    // STATUS_NO_MORE_FILES merely means the search ended, everything else is an
-    // error message. Either way, the search here is finished and we should
-    // resume in the next mapped directory
-    if (subRes != STATUS_NO_MORE_FILES) {
-      spdlog::get("hooks")->warn("error reported listing files in {0}: {1:x}",
-                                 fullPath.string(), static_cast<uint32_t>(subRes));
+
+    // the listing stays open across lookups, it mustn't keep files in the
+    // directory from being deleted or renamed
+    HANDLE handle = CreateFileW(dirName.c_str(), GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                                nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return nullptr;
     }
-    return false;
+
+    return std::make_unique<NtDirectoryListing>(handle, fileInformationClass);
   }
-}
 
-NTSTATUS WINAPI usvfs::hook_NtQueryDirectoryFile(
-    HANDLE FileHandle, HANDLE Event, PIO_APC_ROUTINE ApcRoutine, PVOID ApcContext,
-    PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation, ULONG Length,
-    FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    PUNICODE_STRING FileName, BOOLEAN RestartScan)
+  bool read(const VisitorT& visitor) override
+  {
+    IO_STATUS_BLOCK status;
+    NTSTATUS res = NtQueryDirectoryFile(m_Handle, nullptr, nullptr, nullptr, &status,
+                                        m_Batch.data(), BatchSize,
+                                        m_FileInformationClass, FALSE, nullptr, FALSE);
+
+    if ((res != STATUS_SUCCESS) || (status.Information == 0)) {
+      if ((res != STATUS_SUCCESS) && (res != STATUS_NO_MORE_FILES)) {
+        LOG_HOOKS(warn, "error reported listing files: {0:x}",
+                  static_cast<uint32_t>(res));
+      }
+      return false;
+    }
+
+    forEachDirectoryRecord(m_FileInformationClass, m_Batch.data(),
+                           static_cast<ULONG>(status.Information),
+                           [&](const std::wstring& name, ULONG offset, ULONG length) {
+                             visitor(name, m_Batch.data() + offset, length);
+                           });
+
+    return true;
+  }
+
+private:
+  static const ULONG BatchSize = 64 * 1024;
+
+  HANDLE m_Handle;
+  FILE_INFORMATION_CLASS m_FileInformationClass;
+  std::vector<uint8_t> m_Batch;
+};
+
+/**
+ * entries of the virtual directory, taken from the redirection tree a few at a time.
+ * only the name of the last node visited is kept between batches so the tree is free
+ * to change while the search is running
+ */
+class VirtualDirectoryEntries : public DirectoryEntrySource
 {
-  PreserveGetLastError ntFunctionsDoNotChangeGetLastError;
+public:
+  VirtualDirectoryEntries(const bfs::path& directory,
+                          FILE_INFORMATION_CLASS fileInformationClass,
+                          PUNICODE_STRING pattern)
+      : m_Directory(directory), m_FileInformationClass(fileInformationClass),
+        m_Records(
+            [fileInformationClass](const std::wstring& path) {
+              return NtDirectoryListing::open(path, fileInformationClass);
+            },
+            &ush::to_upper)
+  {
+    m_Pattern = pattern != nullptr
+                    ? std::wstring(pattern->Buffer, pattern->Length / sizeof(WCHAR))
+                    : L"*.*";
+    boost::replace_all(m_Pattern, L"\"", L".");
+  }
 
-  // this is quite messy...
-  // first, this will gather the virtual locations mapping to the iterated one
-  // then we return results from the real location, skipping those that exist
-  //   in the virtual locations, as those take precedence
-  // finally the virtual results are returned, adding each result to a skip
-  //   list, so they don't get added twice
-  //
-  // if we don't add the regular files first, "." and ".." wouldn't be in the
-  //   first search result of wildcard searches which may confuse the caller
-  NTSTATUS res = STATUS_NO_MORE_FILES;
-  HOOK_START_GROUP(MutExHookGroup::FIND_FILES)
-  if (!callContext.active()) {
-    return ::NtQueryDirectoryFile(
-        FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock, FileInformation,
-        Length, FileInformationClass, ReturnSingleEntry, FileName, RestartScan);
+  bool valid() override
+  {
+    while (!m_HasCurrent && !m_Complete) {
+      fetch();
+    }
+    return m_HasCurrent;
+  }
+
+  const std::wstring& key() const override { return m_Key; }
+
+  size_t recordSize() const override { return m_Length; }
+
+  void copyRecord(void* destination) const override
+  {
+    memcpy(destination, m_Record.data(), m_Length);
+  }
+
+  void next() override { m_HasCurrent = false; }
+
+private:
+  static const ULONG RecordSize = 4096;
+
+  // number of nodes taken from the tree per lookup of the directory
+  static const size_t MatchBatchSize = 32;
+
+  struct Match
+  {
+    std::wstring realPath;
+    std::wstring virtualName;
+    ush::FileMetadata metadata;
+  };
+
+  void fetch()
+  {
+    if (m_Matches.empty() && !nextMatches()) {
+      m_Complete = true;
+      return;
+    }
+
+    const Match match = std::move(m_Matches.front());
+    m_Matches.pop_front();
+
+    m_HasCurrent =
+        (match.metadata.valid && buildRecord(match.virtualName, match.metadata)) ||
+        queryRecord(match.realPath, match.virtualName);
+    if (m_HasCurrent) {
+      m_Key = ush::to_upper(match.virtualName);
+    }
   }
 
-  //  std::unique_lock<std::recursive_mutex> queryLock;
-  std::map<HANDLE, Searches::Info>::iterator infoIter;
-  bool firstSearch = false;
+  // finds the next nodes in the virtual directory matching the search pattern. the
+  // lock is held and the directory looked up once per batch, not once per entry
+  bool nextMatches()
+  {
+    using namespace usvfs;
 
-  {  // scope to limit context lifetime
     HookContext::ConstPtr context = READ_CONTEXT();
-    Searches& activeSearches      = context->customData<Searches>(SearchInfo);
-    //    queryLock = std::unique_lock<std::recursive_mutex>(activeSearches.queryMutex);
+    auto node = context->redirectionTable()->findNode(m_Directory);
+    if (node.get() == nullptr) {
+      return false;
+    }
+
+    for (auto iter = node->filesAfter(m_LastName);
+         (iter != node->filesEnd()) && (m_Matches.size() < MatchBatchSize); ++iter) {
+      const auto& subNode = iter->second;
+      m_LastName          = subNode->name();
+
+      if (!isVirtualEntry(subNode) || !matchesSearchPattern(m_LastName, m_Pattern)) {
+        continue;
+      }
+
+      Match match;
+      match.virtualName = m_LastName;
+      if (subNode->data().linkTarget.length() > 0) {
+        match.realPath = subNode->data().linkTarget.c_str();
+      } else {
+        match.realPath = subNode->path().wstring();
+      }
 
-    if (RestartScan) {
-      auto iter = activeSearches.info.find(FileHandle);
-      if (iter != activeSearches.info.end()) {
-        activeSearches.info.erase(iter);
+      const ush::FileMetadata* recorded = cachedMetadata(subNode);
+      if (recorded != nullptr) {
+        match.metadata = *recorded;
       }
+      m_Matches.push_back(std::move(match));
     }
 
-    // see if we already have a running search
-    infoIter    = activeSearches.info.find(FileHandle);
-    firstSearch = (infoIter == activeSearches.info.end());
+    return !m_Matches.empty();
   }
 
-  if (firstSearch) {
-    HookContext::Ptr context = WRITE_CONTEXT();
-    Searches& activeSearches = context->customData<Searches>(SearchInfo);
-    // tradeoff time: we store this search status even if no virtual results
-    // were found. This causes a little extra cost here and in NtClose every
-    // time a non-virtual dir is being searched. However if we don't,
-    // whenever NtQueryDirectoryFile is called another time on the same handle,
-    // this (expensive) block would be run again.
-    infoIter =
-        activeSearches.info.insert(std::make_pair(FileHandle, Searches::Info())).first;
-    infoIter->second.searchPattern.appendPath(FileName);
+  // builds the record from the metadata recorded when the file was linked, so the
+  // real directory doesn't have to be listed at all
+  bool buildRecord(const std::wstring& virtualName, const ush::FileMetadata& metadata)
+  {
+    m_Record.resize(RecordSize);
+    m_Length = SynthesizeFileInformation(m_FileInformationClass, m_Record.data(),
+                                         RecordSize, metadata, virtualName);
+    return m_Length > 0;
+  }
+
+  // retrieves the directory record of the file at the real location and renames it
+  // to the virtual name. the real directories are enumerated in batches, so
+  // consecutive entries mapped from the same directory share one listing
+  bool queryRecord(const std::wstring& realPath, const std::wstring& virtualName)
+  {
+    bfs::path fullPath(realPath);
+    if (fullPath.filename().wstring() == L".") {
+      fullPath = fullPath.parent_path();
+    }
+
+    if (!m_Records.lookup(fullPath.parent_path().wstring(),
+                          fullPath.filename().wstring(), m_Found) ||
+        (m_Found.size() > RecordSize)) {
+      return false;
+    }
+    m_Record.resize(RecordSize);
+    memcpy(m_Record.data(), m_Found.data(), m_Found.size());
+
+    ULONG offset;
+    std::wstring foundName;
+    GetFileInformationData(m_FileInformationClass, m_Record.data(), offset,
+                           foundName);
+
+    m_Length = m_Found.size();
+    if (foundName != virtualName) {
+      const size_t length = m_Length - foundName.size() * sizeof(WCHAR) +
+                            virtualName.size() * sizeof(WCHAR);
+      if (length > RecordSize) {
+        return false;
+      }
+      SetFileInformationFileName(m_FileInformationClass, m_Record.data(), virtualName);
+      m_Length = length;
+    }
 
-    SearchHandleMap& searchMap = context->customData<SearchHandleMap>(SearchHandles);
-    SearchHandleMap::iterator iter = searchMap.find(FileHandle);
+    return true;
+  }
+
+  bfs::path m_Directory;
+  FILE_INFORMATION_CLASS m_FileInformationClass;
+  std::wstring m_Pattern;
+
+  std::wstring m_LastName;
+  std::deque<Match> m_Matches;
+  ush::DirectoryRecordCache<std::wstring> m_Records;
+  std::vector<uint8_t> m_Found;
+  std::vector<uint8_t> m_Record;
+  size_t m_Length{0};
+  std::wstring m_Key;
+  bool m_HasCurrent{false};
+  bool m_Complete{false};
+};
+
+// removes the real entries that are replaced by an entry of the virtual directory
+void hideOverriddenEntries(const bfs::path& directory,
+                           std::vector<RealDirectoryEntries::Entry>& entries)
+{
+  using namespace usvfs;
+
+  HookContext::ConstPtr context = READ_CONTEXT();
+  auto node = context->redirectionTable()->findNode(directory);
+  if (node.get() == nullptr) {
+    return;
+  }
+
+  entries.erase(
+      std::remove_if(entries.begin(), entries.end(),
+                     [&node](const RealDirectoryEntries::Entry& entry) {
+                       auto subNode = node->node(entry.name);
+                       return (subNode.get() != nullptr) && isVirtualEntry(subNode);
+                     }),
+      entries.end());
+}
+
+// the searches running in this process, guarded by their own lock so queries and
+// NtClose don't need the shared context for them
+class Searches
+{
+public:
+  struct Info
+  {
+    // merges the virtual and the real listing, virtual entries take precedence.
+    // nullptr if queries on the handle are passed on to the real function
+    std::shared_ptr<DirectoryCursor> cursor;
+    bool virtualized{false};
+  };
+
+  // returns std::nullopt if there is no search running on the handle
+  std::optional<Info> lookup(HANDLE handle) const
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto find = m_map.find(handle);
+    if (find != m_map.end())
+      return find->second;
+    return std::nullopt;
+  }
+
+  // returns the search stored for the handle, which is the existing one if another
+  // thread started a search on the same handle first
+  Info insert(HANDLE handle, const Info& info)
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    return m_map.emplace(handle, info).first->second;
+  }
+
+  bool erase(HANDLE handle)
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    return m_map.erase(handle) != 0;
+  }
+
+private:
+  mutable std::shared_mutex m_mutex;
+  std::map<HANDLE, Info> m_map;
+};
+
+Searches ntdllSearches;
+
+/**
+ * @brief common implementation of NtQueryDirectoryFile and NtQueryDirectoryFileEx
+ *        for the active case
+ *
+ * the real and the virtual listing are treated as sorted streams and merged lazily
+ * into the caller's buffer, only the cursor of each search is kept between calls.
+ * the merged queries complete synchronously, the event is signaled and the apc
+ * queued before this returns. returns STATUS_NO_SUCH_FILE in res if the first
+ * query of a handle yields nothing
+ *
+ * @return false if the directory isn't virtualized and the handle wasn't rerouted,
+ *         in which case nothing was done and the caller has to pass the query on to
+ *         the real function unchanged
+ */
+bool queryDirectoryMerged(HANDLE FileHandle, HANDLE Event, PIO_APC_ROUTINE ApcRoutine,
+                          PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock,
+                          PVOID FileInformation, ULONG Length,
+                          FILE_INFORMATION_CLASS FileInformationClass,
+                          BOOLEAN ReturnSingleEntry, PUNICODE_STRING FileName,
+                          BOOLEAN RestartScan, NTSTATUS& res)
+{
+  using namespace usvfs;
+
+  if (RestartScan) {
+    ntdllSearches.erase(FileHandle);
+  }
+
+  // see if we already have a running search
+  std::optional<Searches::Info> search = ntdllSearches.lookup(FileHandle);
+  const bool firstSearch               = !search.has_value();
+
+  if (firstSearch) {
+    const std::wstring originalPath = searchHandles.lookup(FileHandle);
 
     UnicodeString searchPath;
-    if (iter != searchMap.end()) {
-      searchPath                           = UnicodeString(iter->second.c_str());
-      infoIter->second.currentSearchHandle = CreateFileW(
-          iter->second.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
-          nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (!originalPath.empty()) {
+      searchPath = UnicodeString(originalPath.c_str());
     } else {
       searchPath = ntdllHandleTracker.lookup(FileHandle);
     }
-    gatherVirtualEntries(searchPath, context->redirectionTable(), FileName,
-                         infoIter->second);
-  }
 
-  ULONG dataRead               = Length;
-  PVOID FileInformationCurrent = FileInformation;
+    // fix directory name. I'd love to know why microsoft sometimes uses "\??\" vs
+    // "\\?\"
+    LPCWSTR dirNameW = static_cast<LPCWSTR>(searchPath);
+    if ((wcsncmp(dirNameW, LR"(\\?\)", 4) == 0) ||
+        (wcsncmp(dirNameW, LR"(\??\)", 4) == 0)) {
+      dirNameW += 4;
+    }
+    const bfs::path directory(dirNameW);
 
-  // add regular search results, skipping those files we have in a virtual
-  // location
-  bool moreRegular  = !infoIter->second.regularComplete;
-  bool dataReturned = false;
-  while (moreRegular && !dataReturned) {
-    dataRead = Length;
+    // tradeoff time: we store this search status even if the directory isn't
+    // virtualized. This causes a little extra cost here and in NtClose every
+    // time a non-virtual dir is being searched. However if we don't,
+    // whenever NtQueryDirectoryFile is called another time on the same handle,
+    // this block would be run again. Searches that need neither the virtual
+    // entries nor a different handle are stored without cursor and passed on
+    const bool virtualized =
+        READ_CONTEXT()->redirectionTable()->findNode(directory).get() != nullptr;
+
+    std::shared_ptr<DirectoryCursor> cursor;
+    if (virtualized || !originalPath.empty()) {
+      HANDLE searchHandle = INVALID_HANDLE_VALUE;
+      if (!originalPath.empty()) {
+        searchHandle = CreateFileW(originalPath.c_str(), GENERIC_READ,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                   OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+      }
 
-    HANDLE handle = infoIter->second.currentSearchHandle;
-    if (handle == INVALID_HANDLE_VALUE) {
-      handle = FileHandle;
-    }
-    NTSTATUS subRes = addNtSearchData(
-        handle, FileName, L"", FileInformationClass, FileInformationCurrent, dataRead,
-        infoIter->second.foundFiles, Event, ApcRoutine, ApcContext, ReturnSingleEntry);
-    moreRegular = subRes == STATUS_SUCCESS;
-    if (moreRegular) {
-      dataReturned = dataRead != 0;
-    } else {
-      infoIter->second.regularComplete = true;
-      infoIter->second.foundFiles.clear();
-      if (infoIter->second.currentSearchHandle != INVALID_HANDLE_VALUE) {
-        ::CloseHandle(infoIter->second.currentSearchHandle);
-        infoIter->second.currentSearchHandle = INVALID_HANDLE_VALUE;
+      cursor = std::make_shared<DirectoryCursor>();
+      RealDirectoryEntries::FilterFunction filter;
+      if (virtualized) {
+        cursor->addSource(std::make_unique<VirtualDirectoryEntries>(
+            directory, FileInformationClass, FileName));
+        filter = [directory](std::vector<RealDirectoryEntries::Entry>& entries) {
+          hideOverriddenEntries(directory, entries);
+        };
       }
-    }
-  }
-  if (!moreRegular) {
-    // add virtual results
-    while (!dataReturned && infoIter->second.virtualMatches.size() > 0) {
-      auto match = infoIter->second.virtualMatches.front();
-      if (match.realPath.size() != 0) {
-        dataRead = Length;
-        if (addVirtualSearchResult(FileInformationCurrent, FileInformationClass,
-                                   infoIter->second, match.realPath, match.virtualName,
-                                   ReturnSingleEntry, dataRead)) {
-          // a positive result here means the call returned data and there may
-          // be further objects to be retrieved by repeating the call
-          dataReturned = true;
-        } else {
-          // proceed to next search handle
-
-          // TODO: doesn't append search results from more than one redirection
-          // per call. This is bad for performance but otherwise we'd need to
-          // re-write the offsets between information objects
-          infoIter->second.virtualMatches.pop();
-          CloseHandle(infoIter->second.currentSearchHandle);
-          infoIter->second.currentSearchHandle = INVALID_HANDLE_VALUE;
-        }
+      if (searchHandle != INVALID_HANDLE_VALUE) {
+        cursor->addSource(std::make_unique<RealDirectoryEntries>(
+            searchHandle, true, FileInformationClass, FileName, false, filter));
+      } else {
+        // the caller's handle may have been read from before the restart
+        cursor->addSource(std::make_unique<RealDirectoryEntries>(
+            FileHandle, false, FileInformationClass, FileName, RestartScan, filter));
       }
     }
+
+    // if another thread got here first the search it started is used and the
+    // cursor created here closes its handle when it goes out of scope
+    search = ntdllSearches.insert(FileHandle, {cursor, virtualized});
   }
 
-  if (!dataReturned) {
-    if (firstSearch) {
-      res = STATUS_NO_SUCH_FILE;
-    } else {
-      res = STATUS_NO_MORE_FILES;
-    }
-  } else {
+  if (!search->cursor) {
+    return false;
+  }
+
+  // the sources acquire the context themselves and only while they access the
+  // tree, so no lock is held while the file system is queried
+  ush::MergeResult merged =
+      search->cursor->fill(FileInformation, Length, ReturnSingleEntry);
+
+  switch (merged.status) {
+  case ush::MergeStatus::Success:
     res = STATUS_SUCCESS;
+    break;
+  case ush::MergeStatus::BufferTooSmall:
+    // not even the first record fits, nothing is returned
+    res = STATUS_BUFFER_TOO_SMALL;
+    break;
+  default:
+    res = firstSearch ? STATUS_NO_SUCH_FILE : STATUS_NO_MORE_FILES;
+    break;
   }
+
   IoStatusBlock->Status      = res;
-  IoStatusBlock->Information = dataRead;
+  IoStatusBlock->Information = merged.bytesWritten;
 
-  size_t numVirtualFiles = infoIter->second.virtualMatches.size();
-  if ((numVirtualFiles > 0)) {
+  if (Event != nullptr) {
+    ::SetEvent(Event);
+  }
+  if (ApcRoutine != nullptr) {
+    // the same call the io manager makes once a query completes, the apc runs the
+    // next time the thread waits alertably
+    NtQueueApcThread(::GetCurrentThread(),
+                     reinterpret_cast<PPS_APC_ROUTINE>(ApcRoutine), ApcContext,
+                     IoStatusBlock, nullptr);
+  }
+
+  return true;
+}
+
+NTSTATUS WINAPI usvfs::hook_NtQueryDirectoryFile(
+    HANDLE FileHandle, HANDLE Event, PIO_APC_ROUTINE ApcRoutine, PVOID ApcContext,
+    PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation, ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
+    PUNICODE_STRING FileName, BOOLEAN RestartScan)
+{
+  PreserveGetLastError ntFunctionsDoNotChangeGetLastError;
+
+  NTSTATUS res = STATUS_NO_MORE_FILES;
+  HOOK_START_GROUP(MutExHookGroup::FIND_FILES)
+  if (!callContext.active()) {
+    return ::NtQueryDirectoryFile(
+        FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock, FileInformation,
+        Length, FileInformationClass, ReturnSingleEntry, FileName, RestartScan);
+  }
+
+  if (queryDirectoryMerged(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock,
+                           FileInformation, Length, FileInformationClass,
+                           ReturnSingleEntry, FileName, RestartScan, res)) {
     LOG_CALL()
         .addParam("path", ntdllHandleTracker.lookup(FileHandle))
         .PARAM(FileInformationClass)
         .PARAM(FileName)
-        .PARAM(numVirtualFiles)
         .PARAMWRAP(res);
+  } else {
+    PRE_REALCALL
+    res = ::NtQueryDirectoryFile(FileHandle, Event, ApcRoutine, ApcContext,
+                                 IoStatusBlock, FileInformation, Length,
+                                 FileInformationClass, ReturnSingleEntry, FileName,
+                                 RestartScan);
+    POST_REALCALL
   }
 
   HOOK_END
@@ -681,15 +937,6 @@ NTSTATUS WINAPI usvfs::hook_NtQueryDirectoryFileEx(
   PreserveGetLastError ntFunctionsDoNotChangeGetLastError;
   NTSTATUS res = STATUS_NO_MORE_FILES;
 
-  // this is quite messy...
-  // first, this will gather the virtual locations mapping to the iterated one
-  // then we return results from the real location, skipping those that exist
-  //   in the virtual locations, as those take precedence
-  // finally the virtual results are returned, adding each result to a skip
-  //   list, so they don't get added twice
-  //
-  // if we don't add the regular files first, "." and ".." wouldn't be in the
-  //   first search result of wildcard searches which may confuse the caller
   HOOK_START_GROUP(MutExHookGroup::FIND_FILES)
   if (!callContext.active()) {
     return ::NtQueryDirectoryFileEx(FileHandle, Event, ApcRoutine, ApcContext,
@@ -697,132 +944,22 @@ NTSTATUS WINAPI usvfs::hook_NtQueryDirectoryFileEx(
                                     FileInformationClass, QueryFlags, FileName);
   }
 
-  //  std::unique_lock<std::recursive_mutex> queryLock;
-  std::map<HANDLE, Searches::Info>::iterator infoIter;
-  bool firstSearch = false;
-
-  {  // scope to limit context lifetime
-    HookContext::ConstPtr context = READ_CONTEXT();
-    Searches& activeSearches      = context->customData<Searches>(SearchInfo);
-    //    queryLock = std::unique_lock<std::recursive_mutex>(activeSearches.queryMutex);
-
-    if (QueryFlags & SL_RESTART_SCAN) {
-      auto iter = activeSearches.info.find(FileHandle);
-      if (iter != activeSearches.info.end()) {
-        activeSearches.info.erase(iter);
-      }
-    }
-
-    // see if we already have a running search
-    infoIter    = activeSearches.info.find(FileHandle);
-    firstSearch = (infoIter == activeSearches.info.end());
-  }
-
-  if (firstSearch) {
-    HookContext::Ptr context = WRITE_CONTEXT();
-    Searches& activeSearches = context->customData<Searches>(SearchInfo);
-    // tradeoff time: we store this search status even if no virtual results
-    // were found. This causes a little extra cost here and in NtClose every
-    // time a non-virtual dir is being searched. However if we don't,
-    // whenever NtQueryDirectoryFile is called another time on the same handle,
-    // this (expensive) block would be run again.
-    infoIter =
-        activeSearches.info.insert(std::make_pair(FileHandle, Searches::Info())).first;
-    infoIter->second.searchPattern.appendPath(FileName);
-
-    SearchHandleMap& searchMap = context->customData<SearchHandleMap>(SearchHandles);
-    SearchHandleMap::iterator iter = searchMap.find(FileHandle);
-
-    UnicodeString searchPath;
-    if (iter != searchMap.end()) {
-      searchPath                           = UnicodeString(iter->second.c_str());
-      infoIter->second.currentSearchHandle = CreateFileW(
-          iter->second.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
-          nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
-    } else {
-      searchPath = ntdllHandleTracker.lookup(FileHandle);
-    }
-    gatherVirtualEntries(searchPath, context->redirectionTable(), FileName,
-                         infoIter->second);
-  }
-
-  ULONG dataRead               = Length;
-  PVOID FileInformationCurrent = FileInformation;
-
-  // add regular search results, skipping those files we have in a virtual
-  // location
-  bool moreRegular  = !infoIter->second.regularComplete;
-  bool dataReturned = false;
-  while (moreRegular && !dataReturned) {
-    dataRead = Length;
-
-    HANDLE handle = infoIter->second.currentSearchHandle;
-    if (handle == INVALID_HANDLE_VALUE) {
-      handle = FileHandle;
-    }
-    NTSTATUS subRes = addNtSearchData(handle, FileName, L"", FileInformationClass,
-                                      FileInformationCurrent, dataRead,
-                                      infoIter->second.foundFiles, Event, ApcRoutine,
-                                      ApcContext, QueryFlags & SL_RETURN_SINGLE_ENTRY);
-    moreRegular     = subRes == STATUS_SUCCESS;
-    if (moreRegular) {
-      dataReturned = dataRead != 0;
-    } else {
-      infoIter->second.regularComplete = true;
-      infoIter->second.foundFiles.clear();
-      if (infoIter->second.currentSearchHandle != INVALID_HANDLE_VALUE) {
-        ::CloseHandle(infoIter->second.currentSearchHandle);
-        infoIter->second.currentSearchHandle = INVALID_HANDLE_VALUE;
-      }
-    }
-  }
-  if (!moreRegular) {
-    // add virtual results
-    while (!dataReturned && infoIter->second.virtualMatches.size() > 0) {
-      auto match = infoIter->second.virtualMatches.front();
-      if (match.realPath.size() != 0) {
-        dataRead = Length;
-        if (addVirtualSearchResult(FileInformationCurrent, FileInformationClass,
-                                   infoIter->second, match.realPath, match.virtualName,
-                                   QueryFlags & SL_RETURN_SINGLE_ENTRY, dataRead)) {
-          // a positive result here means the call returned data and there may
-          // be further objects to be retrieved by repeating the call
-          dataReturned = true;
-        } else {
-          // proceed to next search handle
-
-          // TODO: doesn't append search results from more than one redirection
-          // per call. This is bad for performance but otherwise we'd need to
-          // re-write the offsets between information objects
-          infoIter->second.virtualMatches.pop();
-          CloseHandle(infoIter->second.currentSearchHandle);
-          infoIter->second.currentSearchHandle = INVALID_HANDLE_VALUE;
-        }
-      }
-    }
-  }
-
-  if (!dataReturned) {
-    if (firstSearch) {
-      res = STATUS_NO_SUCH_FILE;
-    } else {
-      res = STATUS_NO_MORE_FILES;
-    }
-  } else {
-    res = STATUS_SUCCESS;
-  }
-  IoStatusBlock->Status      = res;
-  IoStatusBlock->Information = dataRead;
-
-  size_t numVirtualFiles = infoIter->second.virtualMatches.size();
-  if ((numVirtualFiles > 0)) {
+  if (queryDirectoryMerged(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock,
+                           FileInformation, Length, FileInformationClass,
+                           (QueryFlags & SL_RETURN_SINGLE_ENTRY) != 0, FileName,
+                           (QueryFlags & SL_RESTART_SCAN) != 0, res)) {
     LOG_CALL()
         .addParam("path", ntdllHandleTracker.lookup(FileHandle))
         .PARAM(FileInformationClass)
         .PARAM(FileName)
         .PARAM(QueryFlags)
-        .PARAM(numVirtualFiles)
         .PARAMWRAP(res);
+  } else {
+    PRE_REALCALL
+    res = ::NtQueryDirectoryFileEx(FileHandle, Event, ApcRoutine, ApcContext,
+                                   IoStatusBlock, FileInformation, Length,
+                                   FileInformationClass, QueryFlags, FileName);
+    POST_REALCALL
   }
 
   HOOK_END
@@ -1147,10 +1284,16 @@ NTSTATUS ntdll_mess_NtOpenFile(PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
     res = ::NtOpenFile(FileHandle, DesiredAccess, adjustedAttributes.get(),
                        IoStatusBlock, ShareAccess, OpenOptions);
     POST_REALCALL
+    if (SUCCEEDED(res) && mayModifyFile(DesiredAccess) && redir.metadata) {
+      // the flags are part of the shared tree, the node may have been relinked since
+      auto context = WRITE_CONTEXT();
+      if (cachedMetadata(redir.node) != nullptr) {
+        redir.node->setFlag(ush::FLAG_METADATASTALE);
+      }
+    }
     if (SUCCEEDED(res) && storePath) {
       // store the original search path for use during iteration
-      READ_CONTEXT()->customData<SearchHandleMap>(SearchHandles)[*FileHandle] =
-          static_cast<LPCWSTR>(fullName);
+      searchHandles.insert(*FileHandle, static_cast<LPCWSTR>(fullName));
 #pragma message("need to clean up this handle in CloseHandle call")
     }
 
@@ -1210,9 +1353,8 @@ NTSTATUS ntdll_mess_NtCreateFile(PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
   LPCWSTR inPathW      = static_cast<LPCWSTR>(inPath);
 
   if (inPath.size() == 0) {
-    spdlog::get("hooks")->info(
-        "failed to set from handle: {0}",
-        ush::string_cast<std::string>(ObjectAttributes->ObjectName->Buffer));
+    LOG_HOOKS(info, "failed to set from handle: {0}",
+              ush::string_cast<std::string>(ObjectAttributes->ObjectName->Buffer));
     return ::NtCreateFile(FileHandle, DesiredAccess, ObjectAttributes, IoStatusBlock,
                           AllocationSize, FileAttributes, ShareAccess,
                           CreateDisposition, CreateOptions, EaBuffer, EaLength);
@@ -1245,7 +1387,7 @@ NTSTATUS ntdll_mess_NtCreateFile(PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
     convertedDisposition = CREATE_ALWAYS;
     break;
   default:
-    spdlog::get("hooks")->error("invalid disposition: {0}", CreateDisposition);
+    LOG_HOOKS(err, "invalid disposition: {0}", CreateDisposition);
     break;
   }
 
@@ -1298,13 +1440,15 @@ NTSTATUS ntdll_mess_NtCreateFile(PHANDLE FileHandle, ACCESS_MASK DesiredAccess,
     if (res == STATUS_SUCCESS) {
       if (rerouter.newReroute())
         rerouter.insertMapping(WRITE_CONTEXT());
+      else if (mayModifyFile(DesiredAccess) ||
+               (CreateDisposition != FILE_OPEN && CreateDisposition != FILE_OPEN_IF))
+        rerouter.invalidateMetadata();
 
       if (rerouter.isDir() && rerouter.wasRerouted() &&
           ((FileAttributes & FILE_OPEN_FOR_BACKUP_INTENT) ==
            FILE_OPEN_FOR_BACKUP_INTENT)) {
         // store the original search path for use during iteration
-        WRITE_CONTEXT()->customData<SearchHandleMap>(SearchHandles)[*FileHandle] =
-            inPathW;
+        searchHandles.insert(*FileHandle, inPathW);
       }
     }
 
@@ -1364,31 +1508,13 @@ NTSTATUS WINAPI usvfs::hook_NtClose(HANDLE Handle)
   bool log = false;
 
   if ((::GetFileType(Handle) == FILE_TYPE_DISK)) {
-    HookContext::Ptr context = WRITE_CONTEXT();
-
-    {  // clean up search data associated with this handle part 1
-      Searches& activeSearches = context->customData<Searches>(SearchInfo);
-      //      std::lock_guard<std::recursive_mutex> lock(activeSearches.queryMutex);
-      auto iter = activeSearches.info.find(Handle);
-      if (iter != activeSearches.info.end()) {
-        if (iter->second.currentSearchHandle != INVALID_HANDLE_VALUE) {
-          ::CloseHandle(iter->second.currentSearchHandle);
-        }
+    // clean up search data associated with this handle, the cursor closes its
+    // search handles once the last query using it is done
+    if (ntdllSearches.erase(Handle))
+      log = true;
 
-        activeSearches.info.erase(iter);
-        log = true;
-      }
-    }
-
-    {
-      SearchHandleMap& searchHandles =
-          context->customData<SearchHandleMap>(SearchHandles);
-      auto iter = searchHandles.find(Handle);
-      if (iter != searchHandles.end()) {
-        searchHandles.erase(iter);
-        log = true;
-      }
-    }
+    if (searchHandles.erase(Handle))
+      log = true;
   }
 
   if (GetFileType(Handle) == FILE_TYPE_DISK)
@@ -1423,9 +1549,14 @@ NTSTATUS WINAPI usvfs::hook_NtQueryAttributesFile(
   unique_ptr_deleter<OBJECT_ATTRIBUTES> adjustedAttributes =
       makeObjectAttributes(redir, ObjectAttributes);
 
-  PRE_REALCALL
-  res = ::NtQueryAttributesFile(adjustedAttributes.get(), FileInformation);
-  POST_REALCALL
+  if (redir.metadata && FileInformation) {
+    ush::toBasicInformation(*redir.metadata, *FileInformation);
+    res = STATUS_SUCCESS;
+  } else {
+    PRE_REALCALL
+    res = ::NtQueryAttributesFile(adjustedAttributes.get(), FileInformation);
+    POST_REALCALL
+  }
 
   if (redir.redirected) {
     LOG_CALL()
@@ -1463,9 +1594,14 @@ NTSTATUS WINAPI usvfs::hook_NtQueryFullAttributesFile(
   unique_ptr_deleter<OBJECT_ATTRIBUTES> adjustedAttributes =
       makeObjectAttributes(redir, ObjectAttributes);
 
-  PRE_REALCALL
-  res = ::NtQueryFullAttributesFile(adjustedAttributes.get(), FileInformation);
-  POST_REALCALL
+  if (redir.metadata && FileInformation) {
+    ush::toNetworkOpenInformation(*redir.metadata, *FileInformation);
+    res = STATUS_SUCCESS;
+  } else {
+    PRE_REALCALL
+    res = ::NtQueryFullAttributesFile(adjustedAttributes.get(), FileInformation);
+    POST_REALCALL
+  }
 
   if (redir.redirected) {
     LOG_CALL()
@@ -2,8 +2,40 @@
 
 #include "../hookcontext.h"
 
-typedef std::map<HANDLE, std::wstring> SearchHandleMap;
+#include <map>
+#include <shared_mutex>
 
 // maps handles opened for searching to the original search path, which is
-// necessary if the handle creation was rerouted
-DATA_ID(SearchHandles);
+// necessary if the handle creation was rerouted. Handles are local to the process,
+// so the map has its own lock instead of using the one of the shared context
+class SearchHandleMap
+{
+public:
+  // returns an empty string if the handle wasn't opened for searching
+  std::wstring lookup(HANDLE handle) const
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto find = m_map.find(handle);
+    if (find != m_map.end())
+      return find->second;
+    return std::wstring();
+  }
+
+  void insert(HANDLE handle, const std::wstring& path)
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_map[handle] = path;
+  }
+
+  bool erase(HANDLE handle)
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    return m_map.erase(handle) != 0;
+  }
+
+private:
+  mutable std::shared_mutex m_mutex;
+  std::map<HANDLE, std::wstring> m_map;
+};
+
+extern SearchHandleMap searchHandles;
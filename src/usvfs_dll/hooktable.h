@@ -0,0 +1,199 @@
+/*
+Userspace Virtual Filesystem
+
+Copyright (C) 2015 Sebastian Herbord. All rights reserved.
+
+This file is part of usvfs.
+
+usvfs is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+usvfs is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with usvfs. If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "hooks/kernel32.h"
+#include "hooks/ntdll.h"
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+
+namespace usvfs
+{
+
+/**
+ * @brief module a hooked function is exported from
+ */
+enum class HookModule : uint8_t
+{
+  // kernelbase.dll, kernel32.dll if it isn't exported there
+  KERNEL,
+  NTDLL
+};
+
+enum HookFlags : uint8_t
+{
+  HOOK_DEFAULT  = 0x00,
+  HOOK_WINDOWS8 = 0x01  // only installed on Windows 8 or newer
+};
+
+/**
+ * @brief dense index of a hook in HOOKS
+ */
+using HookId = uint32_t;
+
+struct HookDefinition
+{
+  HookModule module;
+  // name of the exported function
+  const char* name;
+  // returns the address of the hook function
+  LPVOID (*hook)();
+  // receives the address of the original function if the hook calls it through a
+  // function pointer, nullptr otherwise
+  void (*original)(LPVOID);
+  uint8_t flags;
+};
+
+template <auto Hook>
+LPVOID hookAddress()
+{
+  return reinterpret_cast<LPVOID>(Hook);
+}
+
+template <auto& Original>
+void setOriginal(LPVOID address)
+{
+  Original = reinterpret_cast<std::remove_reference_t<decltype(Original)>>(address);
+}
+
+#define USVFS_HOOK(module, name)                                                       \
+  {HookModule::module, #name, &hookAddress<hook_##name>, nullptr, HOOK_DEFAULT}
+
+#define USVFS_HOOK_ORIGINAL(module, name, flags)                                       \
+  {HookModule::module, #name, &hookAddress<hook_##name>, &setOriginal<name>, flags}
+
+/**
+ * @brief all hooked functions, in the order they are installed
+ */
+inline constexpr HookDefinition HOOKS[] = {
+    USVFS_HOOK(KERNEL, GetFileAttributesExA),
+    USVFS_HOOK(KERNEL, GetFileAttributesA),
+    USVFS_HOOK(KERNEL, GetFileAttributesExW),
+    USVFS_HOOK(KERNEL, GetFileAttributesW),
+    USVFS_HOOK(KERNEL, SetFileAttributesW),
+
+    USVFS_HOOK(KERNEL, CreateDirectoryW),
+    USVFS_HOOK(KERNEL, RemoveDirectoryW),
+    USVFS_HOOK(KERNEL, DeleteFileW),
+    USVFS_HOOK(KERNEL, GetCurrentDirectoryA),
+    USVFS_HOOK(KERNEL, GetCurrentDirectoryW),
+    USVFS_HOOK(KERNEL, SetCurrentDirectoryA),
+    USVFS_HOOK(KERNEL, SetCurrentDirectoryW),
+
+    USVFS_HOOK(KERNEL, ExitProcess),
+
+    USVFS_HOOK_ORIGINAL(KERNEL, CreateProcessInternalW, HOOK_DEFAULT),
+
+    USVFS_HOOK(KERNEL, MoveFileA),
+    USVFS_HOOK(KERNEL, MoveFileW),
+    USVFS_HOOK(KERNEL, MoveFileExA),
+    USVFS_HOOK(KERNEL, MoveFileExW),
+    USVFS_HOOK(KERNEL, MoveFileWithProgressA),
+    USVFS_HOOK(KERNEL, MoveFileWithProgressW),
+
+    USVFS_HOOK(KERNEL, CopyFileExW),
+    USVFS_HOOK_ORIGINAL(KERNEL, CopyFile2, HOOK_WINDOWS8),
+
+    USVFS_HOOK(KERNEL, GetPrivateProfileStringA),
+    USVFS_HOOK(KERNEL, GetPrivateProfileStringW),
+    USVFS_HOOK(KERNEL, GetPrivateProfileSectionA),
+    USVFS_HOOK(KERNEL, GetPrivateProfileSectionW),
+    USVFS_HOOK(KERNEL, WritePrivateProfileStringA),
+    USVFS_HOOK(KERNEL, WritePrivateProfileStringW),
+
+    USVFS_HOOK(KERNEL, GetFullPathNameA),
+    USVFS_HOOK(KERNEL, GetFullPathNameW),
+
+    USVFS_HOOK(KERNEL, FindFirstFileExW),
+
+    USVFS_HOOK(NTDLL, NtQueryFullAttributesFile),
+    USVFS_HOOK(NTDLL, NtQueryAttributesFile),
+    USVFS_HOOK(NTDLL, NtQueryDirectoryFile),
+    USVFS_HOOK(NTDLL, NtQueryDirectoryFileEx),
+    USVFS_HOOK(NTDLL, NtQueryObject),
+    USVFS_HOOK(NTDLL, NtQueryInformationFile),
+    USVFS_HOOK(NTDLL, NtQueryInformationByName),
+    USVFS_HOOK(NTDLL, NtOpenFile),
+    USVFS_HOOK(NTDLL, NtCreateFile),
+    USVFS_HOOK(NTDLL, NtClose),
+    USVFS_HOOK(NTDLL, NtTerminateProcess),
+
+    USVFS_HOOK(KERNEL, LoadLibraryExA),
+    USVFS_HOOK(KERNEL, LoadLibraryExW),
+
+    // install this hook late as usvfs is calling it itself for debugging purposes
+    USVFS_HOOK(KERNEL, GetModuleFileNameA),
+    USVFS_HOOK(KERNEL, GetModuleFileNameW),
+};
+
+#undef USVFS_HOOK
+#undef USVFS_HOOK_ORIGINAL
+
+inline constexpr HookId HOOK_COUNT = static_cast<HookId>(std::size(HOOKS));
+
+/**
+ * @return id of the hook on the named function, HOOK_COUNT if it isn't hooked
+ */
+constexpr HookId hookId(std::string_view name)
+{
+  for (HookId id = 0; id < HOOK_COUNT; ++id) {
+    if (name == HOOKS[id].name) {
+      return id;
+    }
+  }
+  return HOOK_COUNT;
+}
+
+namespace details
+{
+
+  constexpr bool hookTableConsistent()
+  {
+    for (HookId id = 0; id < HOOK_COUNT; ++id) {
+      const HookDefinition& hook = HOOKS[id];
+      if ((hook.name == nullptr) || std::string_view(hook.name).empty() ||
+          (hook.hook == nullptr) || ((hook.flags & ~HOOK_WINDOWS8) != 0)) {
+        return false;
+      }
+
+      // every function is hooked once, so its id is its index
+      if (hookId(hook.name) != id) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+}  // namespace details
+
+static_assert(HOOK_COUNT > 0);
+static_assert(details::hookTableConsistent(), "invalid or duplicate hook definition");
+static_assert(hookId("NtCreateFile") < HOOK_COUNT);
+static_assert(hookId("CreateFileW") == HOOK_COUNT);
+static_assert(HOOKS[hookId("CreateProcessInternalW")].original != nullptr,
+              "the hook calls the original function through a pointer");
+static_assert(HOOKS[hookId("CopyFile2")].flags == HOOK_WINDOWS8);
+static_assert(hookId("GetModuleFileNameW") == HOOK_COUNT - 1,
+              "usvfs calls GetModuleFileName itself, it has to be hooked last");
+
+}  // namespace usvfs
@@ -2,8 +2,12 @@
 
 #include "hookcallcontext.h"
 #include "hookcontext.h"
+#include "path_canonicalizer.h"
+#include "path_resolver.h"
 #include "stringcast.h"
 
+#include <optional>
+
 namespace usvfs
 {
 
@@ -71,6 +75,7 @@ public:
       return;
     std::unique_lock<std::shared_mutex> lock(m_mutex);
     m_map[fromPath] = toPath;
+    m_version.fetch_add(1, std::memory_order_release);
   }
 
   bool erase(const std::wstring& fromPath)
@@ -78,17 +83,193 @@ public:
     if (fromPath.empty())
       return false;
     std::unique_lock<std::shared_mutex> lock(m_mutex);
-    return m_map.erase(fromPath);
+    if (m_map.erase(fromPath) == 0)
+      return false;
+    m_version.fetch_add(1, std::memory_order_release);
+    return true;
   }
 
+  /**
+   * @return a number that changes whenever a path is inserted or erased
+   */
+  uint32_t version() const { return m_version.load(std::memory_order_acquire); }
+
 private:
   mutable std::shared_mutex m_mutex;
   std::unordered_map<std::wstring, std::wstring> m_map;
+  std::atomic<uint32_t> m_version{0};
 };
 
 extern MapTracker k32DeleteTracker;
 extern MapTracker k32FakeDirTracker;
 
+/**
+ * @brief the current directory as reported by the GetCurrentDirectoryW hook, kept so
+ *        relative paths can be made absolute without querying it on every call
+ */
+class CurrentDirectoryCache
+{
+public:
+  /**
+   * @brief canonicalize a path passed to a hook, see shared::canonicalizePath
+   */
+  template <size_t InlineSize>
+  void canonicalize(const wchar_t* path,
+                    shared::PathBuffer<wchar_t, InlineSize>& result)
+  {
+    const std::wstring_view view(path);
+    if (!shared::requiresCurrentDirectory(view)) {
+      shared::canonicalizePath(view, std::wstring_view(), result);
+      return;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    while (!m_valid) {
+      lock.unlock();
+      refresh();
+      lock.lock();
+    }
+    shared::canonicalizePath(view, std::wstring_view(m_directory), result);
+  }
+
+  /**
+   * @brief update the cache after the current directory was changed
+   */
+  void set(const std::wstring& directory)
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_directory = directory;
+    m_valid     = true;
+  }
+
+  /**
+   * @brief query the current directory again the next time it's needed
+   */
+  void invalidate()
+  {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_valid = false;
+  }
+
+private:
+  void refresh()
+  {
+    // this goes through the GetCurrentDirectoryW hook
+    std::wstring directory = winapi::wide::getCurrentDirectory();
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (!m_valid) {
+      m_directory = std::move(directory);
+      m_valid     = true;
+    }
+  }
+
+  mutable std::shared_mutex m_mutex;
+  std::wstring m_directory;
+  bool m_valid{false};
+};
+
+extern CurrentDirectoryCache k32CurrentDirectoryCache;
+
+/**
+ * @brief exposes the nodes of a redirection tree to the path resolver
+ */
+class RedirectionTreeView
+{
+public:
+  typedef RedirectionTree::NodePtrT NodeRef;
+
+  explicit RedirectionTreeView(const RedirectionTree& tree) : m_Tree(tree) {}
+
+  NodeRef child(const NodeRef& parent, std::wstring_view name) const
+  {
+    return parent.get() != nullptr ? parent->node(name) : m_Tree.node(name);
+  }
+
+  bool isDirectory(const NodeRef& node) const { return node->isDirectory(); }
+
+  size_t createTargetDistance(const NodeRef& node) const
+  {
+    const uint16_t distance = node->anchorDistance();
+    return distance != RedirectionTree::NO_ANCHOR ? distance
+                                                  : shared::RESOLVER_NO_CREATE_TARGET;
+  }
+
+  NodeRef ancestor(NodeRef node, size_t levels) const
+  {
+    for (; (levels > 0) && (node.get() != nullptr); --levels) {
+      node = node->parent();
+    }
+    return node;
+  }
+
+  std::wstring linkTarget(const NodeRef& node) const
+  {
+    return node->data().linkTarget.c_str();
+  }
+
+  const shared::FileMetadata* metadata(const NodeRef& node) const
+  {
+    return cachedMetadata(node);
+  }
+
+private:
+  const RedirectionTree& m_Tree;
+};
+
+/**
+ * @brief queries the disk for the path resolver, bypassing the hooks
+ */
+class RealFileSystem : public shared::ResolverFileSystem<std::wstring>
+{
+public:
+  uint32_t attributes(const std::wstring& path) const override
+  {
+    FunctionGroupLock lock(MutExHookGroup::FILE_ATTRIBUTES);
+    return GetFileAttributesW(path.c_str());
+  }
+};
+
+/**
+ * @brief resolves paths against a redirection table in a single walk, taking files
+ *        deleted through usvfs into account
+ */
+class Resolver
+{
+public:
+  typedef shared::PathResolver<RedirectionTreeView, std::wstring> EngineT;
+  typedef EngineT::Result Result;
+
+  explicit Resolver(const RedirectionTreeContainer& table)
+      : m_View(*table.get()), m_Engine(m_View, m_FileSystem, &lookupDeleted)
+  {}
+
+  /**
+   * @param path absolute, canonical path
+   */
+  Result resolve(std::wstring_view path) const
+  {
+    shared::TraceSpan span("tree walk");
+    return m_Engine.resolve(path);
+  }
+
+  /**
+   * @return attributes of the file calls on the path go to, as the hooked
+   *         GetFileAttributesW would report them
+   */
+  DWORD attributes(const Result& result) const { return m_Engine.attributes(result); }
+
+private:
+  static bool lookupDeleted(const std::wstring& path, std::wstring& target)
+  {
+    target = k32DeleteTracker.lookup(path);
+    return !target.empty();
+  }
+
+  RedirectionTreeView m_View;
+  RealFileSystem m_FileSystem;
+  EngineT m_Engine;
+};
+
 class RerouteW
 {
   std::wstring m_Buffer{};
@@ -99,6 +280,9 @@ class RerouteW
   bool m_NewReroute{false};
 
   RedirectionTree::NodePtrT m_FileNode;
+  // copied while the tree was locked, the node's metadata may be replaced or freed
+  // by other processes as soon as the lock is released
+  std::optional<shared::FileMetadata> m_Metadata;
 
 public:
   RerouteW() = default;
@@ -107,7 +291,8 @@ public:
       : m_Buffer(std::move(reference.m_Buffer)),
         m_RealPath(std::move(reference.m_RealPath)), m_Rerouted(reference.m_Rerouted),
         m_PathCreated(reference.m_PathCreated), m_NewReroute(reference.m_NewReroute),
-        m_FileNode(std::move(reference.m_FileNode))
+        m_FileNode(std::move(reference.m_FileNode)),
+        m_Metadata(std::move(reference.m_Metadata))
   {
     m_FileName           = reference.m_FileName != nullptr ? m_Buffer.c_str() : nullptr;
     reference.m_FileName = nullptr;
@@ -122,6 +307,7 @@ public:
     m_NewReroute  = reference.m_NewReroute;
     m_FileName    = reference.m_FileName != nullptr ? m_Buffer.c_str() : nullptr;
     m_FileNode    = std::move(reference.m_FileNode);
+    m_Metadata    = std::move(reference.m_Metadata);
     return *this;
   }
 
@@ -136,6 +322,29 @@ public:
 
   bool newReroute() const { return m_NewReroute; }
 
+  /**
+   * @return metadata recorded for the rerouted file when it was linked, as it was
+   *         when the path was rerouted. Empty if the file has to be queried
+   */
+  const std::optional<shared::FileMetadata>& metadata() const { return m_Metadata; }
+
+  /**
+   * @brief stop answering queries from the recorded metadata, called when the file
+   *        is opened in a way that may change it. The flag is stored in the shared
+   *        tree so it's only set under the write lock and only if the node still has
+   *        metadata that isn't stale yet
+   */
+  void invalidateMetadata()
+  {
+    if (m_Metadata) {
+      auto context = WRITE_CONTEXT();
+      if (cachedMetadata(m_FileNode) != nullptr) {
+        m_FileNode->setFlag(shared::FLAG_METADATASTALE);
+      }
+      m_Metadata.reset();
+    }
+  }
+
   void insertMapping(const HookContext::Ptr& context, bool directory = false)
   {
     if (directory) {
@@ -151,19 +360,17 @@ public:
       // addDirectoryMapping(context, fs::path(m_RealPath).parent_path(),
       // fs::path(m_FileName).parent_path());
 
-      spdlog::get("hooks")->info(
-          "mapping file in vfs: {}, {}",
-          shared::string_cast<std::string>(m_RealPath, shared::CodePage::UTF8),
-          shared::string_cast<std::string>(m_FileName, shared::CodePage::UTF8));
+      LOG_HOOKS(info, "mapping file in vfs: {}, {}",
+                shared::string_cast<std::string>(m_RealPath, shared::CodePage::UTF8),
+                shared::string_cast<std::string>(m_FileName, shared::CodePage::UTF8));
       m_FileNode = context->redirectionTable().addFile(
-          m_RealPath, RedirectionDataLocal(shared::string_cast<std::string>(
-                          m_FileName, shared::CodePage::UTF8)));
+          m_RealPath, RedirectionDataLocal(m_FileName));
 
       k32DeleteTracker.erase(m_RealPath);
     }
   }
 
-  void removeMapping(const HookContext::ConstPtr& readContext, bool directory = false)
+  void removeMapping(const HookContext::Ptr& context, bool directory = false)
   {
     bool addToDelete     = false;
     bool dontAddToDelete = false;
@@ -173,14 +380,8 @@ public:
     // Since we don't want to add, *every* file which is deleted we check this:
     bool found = wasRerouted();
     if (!found) {
-      FindCreateTarget visitor;
-      RedirectionTree::VisitorFunction visitorWrapper =
-          [&](const RedirectionTree::NodePtrT& node) {
-            visitor(node);
-          };
-      readContext->redirectionTable()->visitPath(m_RealPath, visitorWrapper);
-      if (visitor.target.get())
-        found = true;
+      const Resolver resolver(context->redirectionTable());
+      found = !resolver.resolve(m_RealPath).createTarget.empty();
     }
     if (found)
       addToDelete = true;
@@ -189,8 +390,8 @@ public:
       if (m_FileNode.get())
         m_FileNode->removeFromTree();
       else
-        spdlog::get("usvfs")->warn("Node not removed: {}",
-                                   shared::string_cast<std::string>(m_FileName));
+        LOG_USVFS(warn, "Node not removed: {}",
+                  shared::string_cast<std::string>(m_FileName));
 
       if (!directory) {
         // check if this file was the last file inside a "fake" directory then remove it
@@ -202,13 +403,12 @@ public:
             dontAddToDelete = true;
             if (RemoveDirectoryW(parent.c_str())) {
               k32FakeDirTracker.erase(parent);
-              spdlog::get("usvfs")->info("removed empty fake directory: {}",
-                                         shared::string_cast<std::string>(parent));
+              LOG_USVFS(info, "removed empty fake directory: {}",
+                        shared::string_cast<std::string>(parent));
             } else if (GetLastError() != ERROR_DIR_NOT_EMPTY) {
               auto error = GetLastError();
-              spdlog::get("usvfs")->warn("removing fake directory failed: {}, error={}",
-                                         shared::string_cast<std::string>(parent),
-                                         error);
+              LOG_USVFS(warn, "removing fake directory failed: {}, error={}",
+                        shared::string_cast<std::string>(parent), error);
               break;
             }
           } else
@@ -264,13 +464,13 @@ public:
                                   const fs::path& reroutedPath)
   {
     if (originalPath.empty() || reroutedPath.empty()) {
-      spdlog::get("hooks")->error("RerouteW::addDirectoryMapping failed: {}, {}",
-                                  shared::string_cast<std::string>(
-                                      originalPath.wstring(), shared::CodePage::UTF8)
-                                      .c_str(),
-                                  shared::string_cast<std::string>(
-                                      reroutedPath.wstring(), shared::CodePage::UTF8)
-                                      .c_str());
+      LOG_HOOKS(err, "RerouteW::addDirectoryMapping failed: {}, {}",
+                shared::string_cast<std::string>(originalPath.wstring(),
+                                                 shared::CodePage::UTF8)
+                    .c_str(),
+                shared::string_cast<std::string>(reroutedPath.wstring(),
+                                                 shared::CodePage::UTF8)
+                    .c_str());
       return false;
     }
 
@@ -279,29 +479,28 @@ public:
     if (!lookupParent.get() || lookupParent->data().linkTarget.empty()) {
       if (!addDirectoryMapping(context, originalPath.parent_path(),
                                reroutedPath.parent_path())) {
-        spdlog::get("hooks")->error("RerouteW::addDirectoryMapping failed: {}, {}",
-                                    shared::string_cast<std::string>(
-                                        originalPath.wstring(), shared::CodePage::UTF8)
-                                        .c_str(),
-                                    shared::string_cast<std::string>(
-                                        reroutedPath.wstring(), shared::CodePage::UTF8)
-                                        .c_str());
+        LOG_HOOKS(err, "RerouteW::addDirectoryMapping failed: {}, {}",
+                  shared::string_cast<std::string>(originalPath.wstring(),
+                                                   shared::CodePage::UTF8)
+                      .c_str(),
+                  shared::string_cast<std::string>(reroutedPath.wstring(),
+                                                   shared::CodePage::UTF8)
+                      .c_str());
         return false;
       }
     }
 
-    std::string reroutedU8 = shared::string_cast<std::string>(reroutedPath.wstring(),
-                                                              shared::CodePage::UTF8);
-    if (reroutedU8.empty() || reroutedU8[reroutedU8.size() - 1] != '\\')
-      reroutedU8 += "\\";
+    std::wstring rerouted = reroutedPath.wstring();
+    if (rerouted.empty() || rerouted[rerouted.size() - 1] != L'\\')
+      rerouted += L"\\";
 
-    spdlog::get("hooks")->info("mapping directory in vfs: {}, {}",
-                               shared::string_cast<std::string>(originalPath.wstring(),
-                                                                shared::CodePage::UTF8),
-                               reroutedU8.c_str());
+    LOG_HOOKS(info, "mapping directory in vfs: {}, {}",
+              shared::string_cast<std::string>(originalPath.wstring(),
+                                               shared::CodePage::UTF8),
+              shared::string_cast<std::string>(rerouted, shared::CodePage::UTF8));
 
     context->redirectionTable().addDirectory(
-        originalPath, RedirectionDataLocal(reroutedU8),
+        originalPath, RedirectionDataLocal(rerouted),
         shared::FLAG_DIRECTORY | shared::FLAG_CREATETARGET);
 
     fs::directory_iterator end_itr;
@@ -310,17 +509,15 @@ public:
     for (fs::directory_iterator itr(reroutedPath); itr != end_itr; ++itr) {
       // If it's not a directory, add it to the VFS, if it is recurse into it
       if (is_regular_file(itr->path())) {
-        std::string fileReroutedU8 = shared::string_cast<std::string>(
-            itr->path().wstring(), shared::CodePage::UTF8);
-        spdlog::get("hooks")->info(
-            "mapping file in vfs: {}, {}",
-            shared::string_cast<std::string>(
-                (originalPath / itr->path().filename()).wstring(),
-                shared::CodePage::UTF8),
-            fileReroutedU8.c_str());
+        LOG_HOOKS(info, "mapping file in vfs: {}, {}",
+                  shared::string_cast<std::string>(
+                      (originalPath / itr->path().filename()).wstring(),
+                      shared::CodePage::UTF8),
+                  shared::string_cast<std::string>(itr->path().wstring(),
+                                                   shared::CodePage::UTF8));
         context->redirectionTable().addFile(
             fs::path(originalPath / itr->path().filename()),
-            RedirectionDataLocal(fileReroutedU8));
+            RedirectionDataLocal(itr->path().wstring()));
       } else {
         addDirectoryMapping(context, originalPath / itr->path().filename(),
                             reroutedPath / itr->path().filename());
@@ -356,88 +553,73 @@ public:
     return interestingPathImpl(inPath);
   }
 
-  static fs::path absolutePath(const wchar_t* inPath)
-  {
-    if (shared::startswith(inPath, LR"(\\?\)") ||
-        shared::startswith(inPath, LR"(\??\)")) {
-      inPath += 4;
-      return inPath;
-    } else if ((shared::startswith(inPath, LR"(\\localhost\)") ||
-                shared::startswith(inPath, LR"(\\127.0.0.1\)")) &&
-               inPath[13] == L'$') {
-      std::wstring newPath;
-      newPath += towupper(inPath[12]);
-      newPath += L':';
-      newPath += &inPath[14];
-      return newPath;
-    } else if (inPath[0] == L'\0' || inPath[1] == L':') {
-      return inPath;
-    } else if (inPath[0] == L'\\' || inPath[0] == L'/') {
-      return fs::path(winapi::wide::getFullPathName(inPath).first);
-    }
-    WCHAR currentDirectory[MAX_PATH];
-    ::GetCurrentDirectoryW(MAX_PATH, currentDirectory);
-    fs::path finalPath = fs::path(currentDirectory) / inPath;
-    return finalPath;
-    // winapi::wide::getFullPathName(inPath).first;
+  /**
+   * @brief the absolute, normalized form of a path passed to a hook, which is how
+   *        the redirection tree is keyed
+   */
+  static std::wstring canonicalPath(const wchar_t* inPath)
+  {
+    shared::PathBuffer<wchar_t> buffer;
+    canonicalPath(inPath, buffer);
+    return buffer.str();
   }
 
-  static fs::path canonizePath(const fs::path& inPath)
+  /**
+   * @brief canonicalPath() into a buffer on the stack, for paths that are only
+   *        resolved and not kept
+   */
+  static void canonicalPath(const wchar_t* inPath, shared::PathBuffer<wchar_t>& buffer)
   {
-    fs::path p = inPath.lexically_normal();
-    if (p.filename_is_dot())
-      p = p.remove_filename();
-    return p.make_preferred();
+    shared::TraceSpan span("canonicalize");
+    k32CurrentDirectoryCache.canonicalize(inPath, buffer);
   }
 
   static RerouteW create(const HookContext::ConstPtr& context,
                          const HookCallContext& callContext, const wchar_t* inPath,
                          bool inverse = false)
+  {
+    if (interestingPath(inPath) && callContext.active()) {
+      Resolver resolver(inverse ? context->inverseTable()
+                                : context->redirectionTable());
+      shared::PathBuffer<wchar_t> path;
+      canonicalPath(inPath, path);
+      RerouteW result = create(resolver.resolve(path.view()), inPath);
+      callContext.recordLookup(result.wasRerouted());
+      return result;
+    }
+
+    return unresolved(inPath);
+  }
+
+  /**
+   * @brief reroute a path that was already resolved, the same as create() without
+   *        walking the tree again
+   */
+  static RerouteW create(const Resolver::Result& resolved, const wchar_t* inPath)
   {
     RerouteW result;
+    result.m_RealPath = resolved.path;
 
-    if (interestingPath(inPath) && callContext.active()) {
-      const auto& lookupPath = canonizePath(absolutePath(inPath));
-      result.m_RealPath      = lookupPath.wstring();
-
-      result.m_Buffer = k32DeleteTracker.lookup(result.m_RealPath);
-      bool found      = !result.m_Buffer.empty();
-      if (found) {
-        spdlog::get("hooks")->info(
-            "Rerouting file open to location of deleted file: {}",
-            shared::string_cast<std::string>(result.m_Buffer));
-        result.m_NewReroute = true;
-      } else {
-        const RedirectionTreeContainer& table =
-            inverse ? context->inverseTable() : context->redirectionTable();
-        result.m_FileNode = table->findNode(lookupPath);
-
-        if (result.m_FileNode.get() && (!result.m_FileNode->data().linkTarget.empty() ||
-                                        result.m_FileNode->isDirectory())) {
-          if (!result.m_FileNode->data().linkTarget.empty()) {
-            result.m_Buffer = shared::string_cast<std::wstring>(
-                result.m_FileNode->data().linkTarget.c_str(), shared::CodePage::UTF8);
-          } else {
-            result.m_Buffer = result.m_FileNode->path().wstring();
-          }
-          found = true;
-        }
+    if (resolved.deleted) {
+      LOG_HOOKS(info, "Rerouting file open to location of deleted file: {}",
+                shared::string_cast<std::string>(resolved.target));
+      result.m_NewReroute = true;
+    } else {
+      result.m_FileNode = resolved.node;
+    }
+
+    if (resolved.rerouted) {
+      result.m_Buffer   = resolved.target;
+      result.m_Rerouted = true;
+      fixTrailingSeparator(result.m_Buffer, inPath);
+      if (const shared::FileMetadata* metadata = cachedMetadata(result.m_FileNode)) {
+        result.m_Metadata = *metadata;
       }
-      if (found) {
-        result.m_Rerouted = true;
-
-        wchar_t inIt                 = inPath[wcslen(inPath) - 1];
-        std::wstring::iterator outIt = result.m_Buffer.end() - 1;
-        if ((*outIt == L'\\' || *outIt == L'/') && !(inIt == L'\\' || inIt == L'/'))
-          result.m_Buffer.erase(outIt);
-        std::replace(result.m_Buffer.begin(), result.m_Buffer.end(), L'/', L'\\');
-      } else
-        result.m_Buffer = inPath;
-    } else if (inPath)
+    } else {
       result.m_Buffer = inPath;
+    }
 
-    if (inPath)
-      result.m_FileName = result.m_Buffer.c_str();
+    result.m_FileName = result.m_Buffer.c_str();
     return result;
   }
 
@@ -445,65 +627,61 @@ public:
                             const HookCallContext& callContext, LPCWSTR inPath,
                             bool createPath                          = true,
                             LPSECURITY_ATTRIBUTES securityAttributes = nullptr)
+  {
+    if (interestingPath(inPath) && callContext.active()) {
+      Resolver resolver(context->redirectionTable());
+      shared::PathBuffer<wchar_t> path;
+      canonicalPath(inPath, path);
+      RerouteW result = createNew(resolver.resolve(path.view()), inPath, createPath,
+                                  securityAttributes);
+      callContext.recordLookup(result.wasRerouted());
+      return result;
+    }
+
+    return unresolved(inPath);
+  }
+
+  /**
+   * @brief reroute the creation of a path that was already resolved, the same as
+   *        createNew() without walking the tree again
+   */
+  static RerouteW createNew(const Resolver::Result& resolved, LPCWSTR inPath,
+                            bool createPath                          = true,
+                            LPSECURITY_ATTRIBUTES securityAttributes = nullptr)
   {
     RerouteW result;
+    result.m_RealPath = resolved.path;
 
-    if (interestingPath(inPath) && callContext.active()) {
-      const auto& lookupPath = canonizePath(absolutePath(inPath));
-      result.m_RealPath      = lookupPath.wstring();
-
-      result.m_Buffer = k32DeleteTracker.lookup(result.m_RealPath);
-      bool found      = !result.m_Buffer.empty();
-      if (found)
-        spdlog::get("hooks")->info(
-            "Rerouting file creation to original location of deleted file: {}",
-            shared::string_cast<std::string>(result.m_Buffer));
-      else {
-        FindCreateTarget visitor;
-        RedirectionTree::VisitorFunction visitorWrapper =
-            [&](const RedirectionTree::NodePtrT& node) {
-              visitor(node);
-            };
-        context->redirectionTable()->visitPath(lookupPath, visitorWrapper);
-        if (visitor.target.get()) {
-          // the visitor has found the last (deepest in the directory hierarchy)
-          // create-target
-          fs::path relativePath =
-              shared::make_relative(visitor.target->path(), lookupPath);
-          result.m_Buffer =
-              (fs::path(visitor.target->data().linkTarget.c_str()) / relativePath)
-                  .wstring();
-          found = true;
-        }
-      }
+    if (resolved.deleted) {
+      LOG_HOOKS(info,
+                "Rerouting file creation to original location of deleted file: {}",
+                shared::string_cast<std::string>(resolved.target));
+      result.m_Buffer = resolved.target;
+    } else {
+      // the last (deepest in the directory hierarchy) create-target
+      result.m_Buffer = resolved.createTarget;
+    }
 
-      if (found) {
-        if (createPath) {
-          try {
-            FunctionGroupLock lock(MutExHookGroup::ALL_GROUPS);
-            result.m_PathCreated = createFakePath(
-                fs::path(result.m_Buffer).parent_path(), securityAttributes);
-          } catch (const std::exception& e) {
-            spdlog::get("hooks")->error(
-                "failed to create {}: {}",
-                shared::string_cast<std::string>(result.m_Buffer), e.what());
-          }
+    if (!result.m_Buffer.empty()) {
+      if (createPath) {
+        try {
+          FunctionGroupLock lock(MutExHookGroup::ALL_GROUPS);
+          result.m_PathCreated = createFakePath(fs::path(result.m_Buffer).parent_path(),
+                                                securityAttributes);
+        } catch (const std::exception& e) {
+          LOG_HOOKS(err, "failed to create {}: {}",
+                    shared::string_cast<std::string>(result.m_Buffer), e.what());
         }
+      }
 
-        wchar_t inIt                 = inPath[wcslen(inPath) - 1];
-        std::wstring::iterator outIt = result.m_Buffer.end() - 1;
-        if ((*outIt == L'\\' || *outIt == L'/') && !(inIt == L'\\' || inIt == L'/'))
-          result.m_Buffer.erase(outIt);
-        std::replace(result.m_Buffer.begin(), result.m_Buffer.end(), L'/', L'\\');
-        result.m_Rerouted   = true;
-        result.m_NewReroute = true;
-      } else
-        result.m_Buffer = inPath;
-    } else if (inPath)
+      fixTrailingSeparator(result.m_Buffer, inPath);
+      result.m_Rerouted   = true;
+      result.m_NewReroute = true;
+    } else {
       result.m_Buffer = inPath;
+    }
 
-    if (inPath)
-      result.m_FileName = result.m_Buffer.c_str();
+    result.m_FileName = result.m_Buffer.c_str();
     return result;
   }
 
@@ -512,13 +690,19 @@ public:
                               bool createPath                          = true,
                               LPSECURITY_ATTRIBUTES securityAttributes = nullptr)
   {
-    {
-      auto res = create(context, callContext, inPath);
-      if (res.wasRerouted() || !interestingPath(inPath) || !callContext.active() ||
-          pathExists(inPath))
-        return std::move(res);
+    if (!interestingPath(inPath) || !callContext.active()) {
+      return unresolved(inPath);
     }
-    return createNew(context, callContext, inPath, createPath, securityAttributes);
+
+    Resolver resolver(context->redirectionTable());
+    shared::PathBuffer<wchar_t> path;
+    canonicalPath(inPath, path);
+    const Resolver::Result resolved = resolver.resolve(path.view());
+    RerouteW result = (resolved.rerouted || pathExists(inPath))
+                          ? create(resolved, inPath)
+                          : createNew(resolved, inPath, createPath, securityAttributes);
+    callContext.recordLookup(result.wasRerouted());
+    return result;
   }
 
   static RerouteW noReroute(LPCWSTR inPath)
@@ -533,16 +717,26 @@ public:
   }
 
 private:
-  struct FindCreateTarget
+  static RerouteW unresolved(LPCWSTR inPath)
   {
-    RedirectionTree::NodePtrT target;
-    void operator()(RedirectionTree::NodePtrT node)
-    {
-      if (node->hasFlag(shared::FLAG_CREATETARGET)) {
-        target = node;
-      }
+    RerouteW result;
+    if (inPath) {
+      result.m_Buffer   = inPath;
+      result.m_FileName = result.m_Buffer.c_str();
     }
-  };
+    return result;
+  }
+
+  // strips a separator the reroute target ends on if the original path doesn't and
+  // makes all separators backslashes
+  static void fixTrailingSeparator(std::wstring& buffer, LPCWSTR inPath)
+  {
+    wchar_t inIt                 = inPath[wcslen(inPath) - 1];
+    std::wstring::iterator outIt = buffer.end() - 1;
+    if ((*outIt == L'\\' || *outIt == L'/') && !(inIt == L'\\' || inIt == L'/'))
+      buffer.erase(outIt);
+    std::replace(buffer.begin(), buffer.end(), L'/', L'\\');
+  }
 };
 
 class CreateRerouter
@@ -561,9 +755,23 @@ public:
     };
     Open open = Open::existing;
 
-    // Notice since we are calling our patched GetFileAttributesW here this will also
-    // check virtualized paths
-    DWORD virtAttr = GetFileAttributesW(lpFileName);
+    // the path is resolved once and the result reused for every decision below,
+    // the attributes are the ones our patched GetFileAttributesW would report
+    const bool resolve = RerouteW::interestingPath(lpFileName) && callContext.active();
+    Resolver::Result resolved;
+    DWORD virtAttr;
+    if (resolve) {
+      Resolver resolver(context->redirectionTable());
+      shared::PathBuffer<wchar_t> path;
+      RerouteW::canonicalPath(lpFileName, path);
+      resolved = resolver.resolve(path.view());
+      virtAttr = resolver.attributes(resolved);
+      callContext.recordLookup(resolved.rerouted);
+    } else {
+      // Notice since we are calling our patched GetFileAttributesW here this will
+      // also check virtualized paths
+      virtAttr = GetFileAttributesW(lpFileName);
+    }
     bool isFile    = virtAttr != INVALID_FILE_ATTRIBUTES &&
                      (virtAttr & FILE_ATTRIBUTE_DIRECTORY) == 0;
     m_isDir =
@@ -604,20 +812,31 @@ public:
       break;
     }
 
-    if (m_isDir && pathIsDirectory(lpFileName))
+    // the attributes of a path that isn't rerouted were taken from the disk already
+    bool realDir = m_isDir;
+    if (m_isDir && (!resolve || resolved.rerouted))
+      realDir = pathIsDirectory(lpFileName);
+
+    if (realDir)
       m_reroute = RerouteW::noReroute(lpFileName);
+    else if (resolve)
+      m_reroute = RerouteW::create(resolved, lpFileName);
     else
       m_reroute = RerouteW::create(context, callContext, lpFileName);
 
-    if (m_reroute.wasRerouted() && open == Open::create &&
-        pathIsDirectory(m_reroute.fileName()))
-      m_reroute = RerouteW::createNew(context, callContext, lpFileName, true,
-                                      lpSecurityAttributes);
+    // only resolved paths are rerouted and their attributes are the ones of the
+    // target
+    if (m_reroute.wasRerouted() && open == Open::create && m_isDir)
+      m_reroute = RerouteW::createNew(resolved, lpFileName, true, lpSecurityAttributes);
 
     if (!m_isDir && !isFile && !m_reroute.wasRerouted() &&
         (open == Open::create || open == Open::empty)) {
-      m_reroute = RerouteW::createNew(context, callContext, lpFileName, true,
-                                      lpSecurityAttributes);
+      if (resolve)
+        m_reroute =
+            RerouteW::createNew(resolved, lpFileName, true, lpSecurityAttributes);
+      else
+        m_reroute = RerouteW::createNew(context, callContext, lpFileName, true,
+                                        lpSecurityAttributes);
 
       bool newFile =
           !m_reroute.wasRerouted() && pathDirectlyAvailable(m_reroute.fileName());
@@ -638,12 +857,12 @@ public:
     DWORD disposition = replaceExisting ? CREATE_ALWAYS : CREATE_NEW;
     if (!rerouteCreate(context, callContext, lpFileName, disposition, GENERIC_WRITE,
                        nullptr)) {
-      spdlog::get("hooks")->info(
-          "{} guaranteed failure, skipping original call: {}, replaceExisting={}, "
-          "error={}",
-          hookName,
-          shared::string_cast<std::string>(lpFileName, shared::CodePage::UTF8),
-          replaceExisting ? "true" : "false", error());
+      LOG_HOOKS(info,
+                "{} guaranteed failure, skipping original call: {}, "
+                "replaceExisting={}, error={}",
+                hookName,
+                shared::string_cast<std::string>(lpFileName, shared::CodePage::UTF8),
+                replaceExisting ? "true" : "false", error());
 
       callContext.updateLastError(error());
       return false;
@@ -680,6 +899,8 @@ public:
     m_reroute.insertMapping(context, directory);
   }
 
+  void invalidateMetadata() { m_reroute.invalidateMetadata(); }
+
 private:
   DWORD m_error            = ERROR_SUCCESS;
   DWORD m_originalError    = ERROR_SUCCESS;
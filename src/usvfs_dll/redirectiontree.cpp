@@ -22,6 +22,7 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 
 std::ostream& usvfs::operator<<(std::ostream& stream, const RedirectionData& data)
 {
-  stream << data.linkTarget;
+  stream << usvfs::shared::string_cast<std::string>(data.linkTarget.c_str(),
+                                                   usvfs::shared::CodePage::UTF8);
   return stream;
 }
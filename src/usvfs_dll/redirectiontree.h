@@ -21,26 +21,44 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include <directory_tree.h>
+#include <file_metadata.h>
 
 namespace usvfs
 {
 
-// typedef boost::interprocess::basic_string<char, std::char_traits<char>,
-// shared::CharAllocatorT> StringT;
-
 namespace shared
 {
-  static const TreeFlags FLAG_CREATETARGET = FLAG_FIRSTUSERFLAG + 0x00;
+  // create targets are the anchors of the tree, so every node knows where new files
+  // below it go
+  static const TreeFlags FLAG_CREATETARGET = FLAG_ANCHOR;
+  // the file was opened for writing through usvfs, so the metadata recorded when it
+  // was linked may be outdated
+  static const TreeFlags FLAG_METADATASTALE = FLAG_FIRSTUSERFLAG << 1;
 }
 
 struct RedirectionDataLocal
 {
 
-  RedirectionDataLocal(const char* target) : linkTarget(target) {}
+  RedirectionDataLocal(const wchar_t* target) : linkTarget(target) {}
+
+  RedirectionDataLocal(const std::wstring& target) : linkTarget(target) {}
+
+  RedirectionDataLocal(const std::wstring& target,
+                       const shared::FileMetadata& targetMetadata)
+      : linkTarget(target), metadata(targetMetadata)
+  {}
+
+  // targets in UTF-8
+  RedirectionDataLocal(const char* target)
+      : linkTarget(shared::string_cast<std::wstring>(target, shared::CodePage::UTF8))
+  {}
 
-  RedirectionDataLocal(const std::string& target) : linkTarget(target) {}
+  RedirectionDataLocal(const std::string& target)
+      : RedirectionDataLocal(target.c_str())
+  {}
 
-  std::string linkTarget;
+  std::wstring linkTarget;
+  shared::FileMetadata metadata;
 };
 
 struct RedirectionData
@@ -49,18 +67,67 @@ struct RedirectionData
   RedirectionData(const RedirectionData& reference,
                   const shared::VoidAllocatorT& allocator)
       : linkTarget(reference.linkTarget.c_str(), allocator)
-  {}
+  {
+    setMetadata(reference.metadata());
+  }
 
   RedirectionData(const RedirectionDataLocal& reference,
                   const shared::VoidAllocatorT& allocator)
       : linkTarget(reference.linkTarget.c_str(), allocator)
-  {}
+  {
+    setMetadata(&reference.metadata);
+  }
 
-  RedirectionData(const char* target, const shared::VoidAllocatorT& allocator)
+  RedirectionData(const wchar_t* target, const shared::VoidAllocatorT& allocator)
       : linkTarget(target, allocator)
   {}
 
-  shared::StringT linkTarget;
+  RedirectionData(const RedirectionData& reference) : linkTarget(reference.linkTarget)
+  {
+    setMetadata(reference.metadata());
+  }
+
+  RedirectionData& operator=(const RedirectionData& reference)
+  {
+    if (this != &reference) {
+      linkTarget.assign(reference.linkTarget.c_str());
+      setMetadata(reference.metadata());
+    }
+    return *this;
+  }
+
+  ~RedirectionData() { setMetadata(nullptr); }
+
+  /**
+   * @return metadata of the link target at the time it was linked, nullptr if it's
+   *         not known
+   */
+  const shared::FileMetadata* metadata() const { return m_Metadata.get(); }
+
+  /**
+   * @brief replace the metadata, which is only allocated for nodes that have any so
+   *        the others don't pay for it
+   */
+  void setMetadata(const shared::FileMetadata* metadata)
+  {
+    auto* manager = linkTarget.get_allocator().get_segment_manager();
+    if ((metadata == nullptr) || !metadata->valid) {
+      if (m_Metadata) {
+        manager->destroy_ptr(m_Metadata.get());
+        m_Metadata = nullptr;
+      }
+    } else if (m_Metadata) {
+      *m_Metadata = *metadata;
+    } else {
+      m_Metadata =
+          manager->construct<shared::FileMetadata>(bi::anonymous_instance)(*metadata);
+    }
+  }
+
+  shared::WStringT linkTarget;
+
+private:
+  bi::offset_ptr<shared::FileMetadata> m_Metadata;
 };
 
 std::ostream& operator<<(std::ostream& stream, const RedirectionData& data);
@@ -70,13 +137,14 @@ inline void shared::dataAssign<RedirectionData>(RedirectionData& destination,
                                                 const RedirectionData& source)
 {
   destination.linkTarget.assign(source.linkTarget.c_str());
+  destination.setMetadata(source.metadata());
 }
 
 template <>
 inline RedirectionData
 shared::createDataEmpty<RedirectionData>(const VoidAllocatorT& allocator)
 {
-  return RedirectionData("", allocator);
+  return RedirectionData(L"", allocator);
 }
 
 template <typename T>
@@ -98,7 +166,33 @@ struct shared::SHMDataCreator<RedirectionData, RedirectionData>
   }
 };
 
-using RedirectionTree          = shared::DirectoryTree<RedirectionData>;
+// the tree uses the character type of the hooked functions, so paths are looked up
+// and rerouted without converting them
+using RedirectionTree          = shared::DirectoryTree<RedirectionData, wchar_t>;
 using RedirectionTreeContainer = shared::TreeContainer<RedirectionTree>;
 
+/**
+ * @return the metadata recorded for the file the node links to or nullptr if it's
+ *         unknown or may be outdated, in which case the file has to be queried
+ */
+inline const shared::FileMetadata* cachedMetadata(const RedirectionTree::NodePtrT& node)
+{
+  if ((node.get() == nullptr) || node->isDirectory() ||
+      node->hasFlag(shared::FLAG_METADATASTALE)) {
+    return nullptr;
+  }
+  return node->data().metadata();
+}
+
+/**
+ * @return true if a handle opened with the specified access may be used to change
+ *         the content or the attributes of the file
+ */
+inline bool mayModifyFile(ACCESS_MASK access)
+{
+  return (access & (FILE_WRITE_DATA | FILE_APPEND_DATA | FILE_WRITE_ATTRIBUTES |
+                    FILE_WRITE_EA | DELETE | GENERIC_WRITE | GENERIC_ALL |
+                    MAXIMUM_ALLOWED)) != 0;
+}
+
 }  // namespace usvfs
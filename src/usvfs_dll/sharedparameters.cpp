@@ -1,3 +1,5 @@
+#include <lock_statistics.h>
+#include <logger_handle.h>
 #include <logging.h>
 #include <sharedparameters.h>
 #include <usvfsparametersprivate.h>
@@ -21,6 +23,41 @@ std::string ForcedLibrary::libraryPath() const
   return {m_libraryPath.begin(), m_libraryPath.end()};
 }
 
+bool ParametersSnapshot::executableBlacklisted(std::string_view app,
+                                               std::string_view cmd) const
+{
+  if (!app.empty() && (m_applicationBlacklist.match(app) != nullptr)) {
+    LOG_USVFS(info, "application {} is blacklisted", app);
+    return true;
+  }
+
+  if (!cmd.empty() && (m_commandLineBlacklist.match(cmd) != nullptr)) {
+    LOG_USVFS(info, "command line {} is blacklisted", cmd);
+    return true;
+  }
+
+  return false;
+}
+
+const std::vector<std::string>&
+ParametersSnapshot::forcedLibraries(std::string_view processName) const
+{
+  static const std::vector<std::string> none;
+
+  auto itor = std::lower_bound(m_forcedLibraries.begin(), m_forcedLibraries.end(),
+                               processName, [](const ForcedLibraries& lhs, auto rhs) {
+                                 return boost::algorithm::ilexicographical_compare(
+                                     lhs.processName, rhs);
+                               });
+
+  if ((itor != m_forcedLibraries.end()) &&
+      boost::algorithm::iequals(itor->processName, processName)) {
+    return itor->libraries;
+  }
+
+  return none;
+}
+
 SharedParameters::SharedParameters(const usvfsParameters& reference,
                                    const shared::VoidAllocatorT& allocator)
     : m_instanceName(reference.instanceName, allocator),
@@ -29,44 +66,114 @@ SharedParameters::SharedParameters(const usvfsParameters& reference,
       m_debugMode(reference.debugMode), m_logLevel(reference.logLevel),
       m_crashDumpsType(reference.crashDumpsType),
       m_crashDumpsPath(reference.crashDumpsPath, allocator),
-      m_delayProcess(reference.delayProcessMs), m_userCount(1),
+      m_delayProcess(reference.delayProcessMs),
+      m_tracePath(reference.tracePath, allocator),
+      m_profileCache(reference.profileCache), m_version(0), m_processListVersion(0),
+      m_userCount(1),
       m_processBlacklist(allocator), m_processList(allocator),
       m_fileSuffixSkipList(allocator), m_directorySkipList(allocator),
       m_forcedLibraries(allocator)
 {}
 
+void SharedParameters::changed()
+{
+  m_version.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t SharedParameters::version() const
+{
+  return m_version.load(std::memory_order_acquire);
+}
+
+uint32_t SharedParameters::processListVersion() const
+{
+  return m_processListVersion.load(std::memory_order_acquire);
+}
+
+ParametersSnapshot SharedParameters::snapshot() const
+{
+  ParametersSnapshot result;
+  std::vector<std::string> blacklist;
+  std::vector<std::string> fileSuffixes;
+  std::vector<std::string> directories;
+
+  {
+    shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
+
+    result.m_version = m_version.load(std::memory_order_relaxed);
+
+    for (const shared::StringT& item : m_processBlacklist) {
+      blacklist.push_back("\\" + std::string(item.begin(), item.end()));
+    }
+
+    fileSuffixes.assign(m_fileSuffixSkipList.begin(), m_fileSuffixSkipList.end());
+    directories.assign(m_directorySkipList.begin(), m_directorySkipList.end());
+
+    for (const ForcedLibrary& lib : m_forcedLibraries) {
+      const std::string processName = lib.processName();
+
+      auto itor = std::find_if(result.m_forcedLibraries.begin(),
+                               result.m_forcedLibraries.end(), [&](const auto& entry) {
+                                 return boost::algorithm::iequals(entry.processName,
+                                                                  processName);
+                               });
+
+      if (itor == result.m_forcedLibraries.end()) {
+        result.m_forcedLibraries.push_back({processName, {}});
+        itor = std::prev(result.m_forcedLibraries.end());
+      }
+
+      itor->libraries.push_back(lib.libraryPath());
+    }
+  }
+
+  std::sort(result.m_forcedLibraries.begin(), result.m_forcedLibraries.end(),
+            [](const auto& lhs, const auto& rhs) {
+              return boost::algorithm::ilexicographical_compare(lhs.processName,
+                                                                rhs.processName);
+            });
+
+  // compiling the rules doesn't need the lock
+  result.m_applicationBlacklist = shared::SuffixRules(blacklist);
+  result.m_commandLineBlacklist = shared::SubstringRules(blacklist);
+  result.m_fileSuffixSkipList   = shared::SuffixRules(fileSuffixes);
+  result.m_directorySkipList    = shared::NameRules(directories);
+
+  return result;
+}
+
 usvfsParameters SharedParameters::makeLocal() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   return usvfsParameters(m_instanceName.c_str(), m_currentSHMName.c_str(),
                          m_currentInverseSHMName.c_str(), m_debugMode, m_logLevel,
                          m_crashDumpsType, m_crashDumpsPath.c_str(),
-                         m_delayProcess.count());
+                         m_delayProcess.count(), m_tracePath.c_str(), m_profileCache);
 }
 
 std::string SharedParameters::instanceName() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_instanceName.begin(), m_instanceName.end()};
 }
 
 std::string SharedParameters::currentSHMName() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_currentSHMName.begin(), m_currentSHMName.end()};
 }
 
 std::string SharedParameters::currentInverseSHMName() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_currentInverseSHMName.begin(), m_currentInverseSHMName.end()};
 }
 
 void SharedParameters::setSHMNames(const std::string& current,
                                    const std::string& inverse)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_currentSHMName.assign(current.begin(), current.end());
   m_currentInverseSHMName.assign(inverse.begin(), inverse.end());
@@ -76,7 +183,7 @@ void SharedParameters::setDebugParameters(LogLevel level, CrashDumpsType dumpTyp
                                           const std::string& dumpPath,
                                           std::chrono::milliseconds delayProcess)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_logLevel       = level;
   m_crashDumpsType = dumpType;
@@ -86,155 +193,134 @@ void SharedParameters::setDebugParameters(LogLevel level, CrashDumpsType dumpTyp
 
 std::size_t SharedParameters::userConnected()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return ++m_userCount;
 }
 
 std::size_t SharedParameters::userDisconnected()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return --m_userCount;
 }
 
 std::size_t SharedParameters::userCount()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return m_userCount;
 }
 
 std::size_t SharedParameters::registeredProcessCount() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return m_processList.size();
 }
 
 std::vector<DWORD> SharedParameters::registeredProcesses() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_processList.begin(), m_processList.end()};
 }
 
 void SharedParameters::registerProcess(DWORD pid)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   m_processList.insert(pid);
+  m_processListVersion.fetch_add(1, std::memory_order_release);
 }
 
 void SharedParameters::unregisterProcess(DWORD pid)
 {
   {
-    bi::scoped_lock lock(m_mutex);
+    shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
     auto itor = m_processList.find(pid);
 
     if (itor != m_processList.end()) {
       m_processList.erase(itor);
+      m_processListVersion.fetch_add(1, std::memory_order_release);
       return;
     }
   }
 
-  spdlog::get("usvfs")->error("cannot unregister process {}, not in list", pid);
+  LOG_USVFS(err, "cannot unregister process {}, not in list", pid);
 }
 
 void SharedParameters::blacklistExecutable(const std::string& name)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_processBlacklist.insert(
       shared::StringT(name.begin(), name.end(), m_processBlacklist.get_allocator()));
+  changed();
 }
 
 void SharedParameters::clearExecutableBlacklist()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   m_processBlacklist.clear();
+  changed();
 }
 
 bool SharedParameters::executableBlacklisted(const std::string& appName,
                                              const std::string& cmdLine) const
 {
-  bool blacklisted = false;
-  std::string log;
-
-  {
-    bi::scoped_lock lock(m_mutex);
-
-    for (const shared::StringT& sitem : m_processBlacklist) {
-      const auto item = "\\" + std::string(sitem.begin(), sitem.end());
-
-      if (!appName.empty()) {
-        if (boost::algorithm::iends_with(appName, item)) {
-          blacklisted = true;
-          log         = std::format("application {} is blacklisted", appName);
-          break;
-        }
-      }
-
-      if (!cmdLine.empty()) {
-        if (boost::algorithm::icontains(cmdLine, item)) {
-          blacklisted = true;
-          log         = std::format("command line {} is blacklisted", cmdLine);
-          break;
-        }
-      }
-    }
-  }
-
-  if (blacklisted) {
-    spdlog::get("usvfs")->info(log);
-    return true;
-  }
-
-  return false;
+  // the proxy asks for every process it starts
+  static ParametersSnapshotCache cache;
+  return cache.get(*this)->executableBlacklisted(appName, cmdLine);
 }
 
 void SharedParameters::addSkipFileSuffix(const std::string& fileSuffix)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_fileSuffixSkipList.insert(shared::StringT(fileSuffix.begin(), fileSuffix.end(),
                                               m_fileSuffixSkipList.get_allocator()));
+  changed();
 }
 
 void SharedParameters::clearSkipFileSuffixes()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   m_fileSuffixSkipList.clear();
+  changed();
 }
 
 std::vector<std::string> SharedParameters::skipFileSuffixes() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_fileSuffixSkipList.begin(), m_fileSuffixSkipList.end()};
 }
 
 void SharedParameters::addSkipDirectory(const std::string& directory)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_directorySkipList.insert(shared::StringT(directory.begin(), directory.end(),
                                              m_directorySkipList.get_allocator()));
+  changed();
 }
 
 void SharedParameters::clearSkipDirectories()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   m_directorySkipList.clear();
+  changed();
 }
 
 std::vector<std::string> SharedParameters::skipDirectories() const
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   return {m_directorySkipList.begin(), m_directorySkipList.end()};
 }
 
 void SharedParameters::addForcedLibrary(const std::string& processName,
                                         const std::string& libraryPath)
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
   m_forcedLibraries.push_front(
       ForcedLibrary(processName, libraryPath, m_forcedLibraries.get_allocator()));
+  changed();
 }
 
 std::vector<std::string>
@@ -243,7 +329,7 @@ SharedParameters::forcedLibraries(const std::string& processName)
   std::vector<std::string> v;
 
   {
-    bi::scoped_lock lock(m_mutex);
+    shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
 
     for (const auto& lib : m_forcedLibraries) {
       if (boost::algorithm::iequals(processName, lib.processName())) {
@@ -257,8 +343,33 @@ SharedParameters::forcedLibraries(const std::string& processName)
 
 void SharedParameters::clearForcedLibraries()
 {
-  bi::scoped_lock lock(m_mutex);
+  shared::ProfiledScopedLock lock(m_mutex, shared::LockId::PARAMETERS, __FUNCTION__);
   m_forcedLibraries.clear();
+  changed();
+}
+
+std::shared_ptr<const ParametersSnapshot>
+ParametersSnapshotCache::get(const SharedParameters& parameters) const
+{
+  std::shared_ptr<const Entry> entry = m_entry.load(std::memory_order_acquire);
+  if (!current(entry.get(), parameters)) {
+    // only one thread copies the parameters, the others wait for it
+    std::lock_guard<std::mutex> lock(m_mutex);
+    entry = m_entry.load(std::memory_order_acquire);
+    if (!current(entry.get(), parameters)) {
+      entry = std::make_shared<const Entry>(Entry{&parameters, parameters.snapshot()});
+      m_entry.store(entry, std::memory_order_release);
+    }
+  }
+
+  return std::shared_ptr<const ParametersSnapshot>(entry, &entry->snapshot);
+}
+
+bool ParametersSnapshotCache::current(const Entry* entry,
+                                      const SharedParameters& parameters) const
+{
+  return (entry != nullptr) && (entry->parameters == &parameters) &&
+         (entry->snapshot.version() == parameters.version());
 }
 
 }  // namespace usvfs
@@ -25,16 +25,22 @@ along with usvfs. If not, see <http://www.gnu.org/licenses/>.
 #include "usvfs_version.h"
 #include "usvfsparametersprivate.h"
 #include <inject.h>
+#include <phase_timer.h>
+#include <profile_cache.h>
+#include <sharedparameters.h>
 #include <shmlogger.h>
 #include <spdlog/sinks/null_sink.h>
 #include <spdlog/sinks/stdout_sinks.h>
 #include <stringcast.h>
+#include <trace_recorder.h>
+#include <tree_cursor.h>
 #include <ttrampolinepool.h>
 #include <winapi.h>
 
 // note that there's a mix of boost and std filesystem stuff in this file and
 // that they're not completely compatible
 #include <filesystem>
+#include <fstream>
 
 namespace bfs = boost::filesystem;
 namespace ush = usvfs::shared;
@@ -49,6 +55,7 @@ HMODULE dllModule              = nullptr;
 PVOID exceptionHandler         = nullptr;
 CrashDumpsType usvfs_dump_type = CrashDumpsType::None;
 std::wstring usvfs_dump_path;
+std::wstring usvfs_trace_path;
 
 // this is called for every single file, so it's a bit long winded, but it's
 // as fast as it gets, probably
@@ -123,14 +130,15 @@ bool shouldAddToInverseTree(std::string_view name)
 // Logging
 //
 
-void InitLoggingInternal(bool toConsole, bool connectExistingSHM)
+void InitLoggingInternal(bool toConsole, bool connectExistingSHM,
+                         uint32_t queueDepth = SHMLogger::RING_CAPACITY)
 {
   try {
     if (!toConsole && !SHMLogger::isInstantiated()) {
       if (connectExistingSHM) {
         SHMLogger::open("usvfs");
       } else {
-        SHMLogger::create("usvfs");
+        SHMLogger::create("usvfs", queueDepth);
       }
     }
 
@@ -165,8 +173,60 @@ void InitLoggingInternal(bool toConsole, bool connectExistingSHM)
     }
   }
 
-  spdlog::get("usvfs")->info("usvfs dll {} initialized in process {}",
-                             USVFS_VERSION_STRING, GetCurrentProcessId());
+  // the loggers have been replaced, the handles may still point to the temporary ones
+  usvfs::log::refreshLoggers();
+
+  LOG_USVFS(info, "usvfs dll {} initialized in process {}", USVFS_VERSION_STRING,
+            GetCurrentProcessId());
+}
+
+//
+// Tracing
+//
+
+void StartTracing(const usvfsParameters& params)
+{
+  usvfs_trace_path =
+      ush::string_cast<std::wstring>(params.tracePath, ush::CodePage::UTF8);
+  ush::TraceRecorder::instance().setEnabled(!usvfs_trace_path.empty());
+}
+
+void WriteTrace()
+{
+  if (usvfs_trace_path.empty()) {
+    return;
+  }
+
+  // the export itself isn't traced
+  ush::TraceRecorder& recorder = ush::TraceRecorder::instance();
+  recorder.setEnabled(false);
+
+  try {
+    const DWORD pid = ::GetCurrentProcessId();
+    const std::wstring exeName =
+        bfs::path(winapi::wide::getModuleFileName(nullptr)).stem().wstring();
+    const bfs::path fileName =
+        bfs::path(usvfs_trace_path) / std::format(L"{}-{}.json", exeName, pid);
+
+    winapi::ex::wide::createPath(usvfs_trace_path.c_str());
+    std::ofstream file(fileName.wstring(), std::ios::out | std::ios::trunc);
+    recorder.writeChromeTrace(file, pid, ush::string_cast<std::string>(exeName));
+    file.close();
+    recorder.clear();
+
+    if (!file) {
+      LOG_USVFS(err, "failed to write trace to {}", fileName.string());
+    } else if (recorder.dropped() > 0) {
+      LOG_USVFS(warn, "trace written to {}, {} spans were dropped", fileName.string(),
+                recorder.dropped());
+    } else {
+      LOG_USVFS(info, "trace written to {}", fileName.string());
+    }
+  } catch (const std::exception& e) {
+    LOG_USVFS(err, "failed to write trace: {}", e.what());
+  }
+
+  usvfs_trace_path.clear();
 }
 
 void WINAPI usvfsInitLogging(bool toConsole)
@@ -174,6 +234,12 @@ void WINAPI usvfsInitLogging(bool toConsole)
   InitLoggingInternal(toConsole, false);
 }
 
+void WINAPI usvfsInitLogging2(bool toConsole, size_t queueDepth)
+{
+  InitLoggingInternal(toConsole, false,
+                      static_cast<uint32_t>(std::min<size_t>(queueDepth, 1 << 20)));
+}
+
 extern "C" DLLEXPORT bool WINAPI usvfsGetLogMessages(LPSTR buffer, size_t size,
                                                      bool blocking)
 {
@@ -192,23 +258,57 @@ extern "C" DLLEXPORT bool WINAPI usvfsGetLogMessages(LPSTR buffer, size_t size,
   }
 }
 
+extern "C" DLLEXPORT bool WINAPI usvfsGetLogMessagesBatch(LPSTR buffer, size_t size,
+                                                          size_t* written,
+                                                          size_t* count,
+                                                          DWORD timeout)
+{
+  *written = 0;
+  *count   = 0;
+  try {
+    if (timeout == INFINITE) {
+      while (*count == 0) {
+        *written = SHMLogger::instance().getBatch(buffer, size, *count,
+                                                  std::chrono::milliseconds(1000));
+      }
+    } else {
+      *written = SHMLogger::instance().getBatch(buffer, size, *count,
+                                                std::chrono::milliseconds(timeout));
+    }
+    return *count > 0;
+  } catch (const std::exception& e) {
+    // reported as the only message in the buffer
+    const std::string message =
+        std::format("Failed to retrieve log messages: {}", e.what());
+    if (size > sizeof(uint32_t)) {
+      const uint32_t length = static_cast<uint32_t>(
+          std::min(message.size(), size - sizeof(uint32_t)));
+      memcpy(buffer, &length, sizeof(length));
+      memcpy(buffer + sizeof(length), message.data(), length);
+      *written = sizeof(length) + length;
+      *count   = 1;
+    }
+    return false;
+  }
+}
+
 void SetLogLevel(LogLevel level)
 {
-  spdlog::get("usvfs")->set_level(ConvertLogLevel(level));
-  spdlog::get("hooks")->set_level(ConvertLogLevel(level));
+  usvfs::log::usvfsLogger->set_level(ConvertLogLevel(level));
+  usvfs::log::hooksLogger->set_level(ConvertLogLevel(level));
 }
 
 void WINAPI usvfsUpdateParameters(usvfsParameters* p)
 {
-  spdlog::get("usvfs")->info("updating parameters:\n"
-                             " . debugMode: {}\n"
-                             " . log level: {}\n"
-                             " . dump type: {}\n"
-                             " . dump path: {}\n"
-                             " . delay process: {}ms",
-                             p->debugMode, usvfsLogLevelToString(p->logLevel),
-                             usvfsCrashDumpTypeToString(p->crashDumpsType),
-                             p->crashDumpsPath, p->delayProcessMs);
+  LOG_USVFS(info, "updating parameters:\n"
+            " . debugMode: {}\n"
+            " . log level: {}\n"
+            " . dump type: {}\n"
+            " . dump path: {}\n"
+            " . delay process: {}ms",
+            p->debugMode, usvfsLogLevelToString(p->logLevel),
+            usvfsCrashDumpTypeToString(p->crashDumpsType),
+            p->crashDumpsPath, p->delayProcessMs);
 
   // update actual values used:
   usvfs_dump_type = p->crashDumpsType;
@@ -397,23 +497,30 @@ void __cdecl InitHooks(LPVOID parameters, size_t)
 
   SetLogLevel(params->logLevel);
 
+  // waiting for a debugger or the delay above are not part of the attach time
+  ush::PhaseTimer attach;
+
   if (exceptionHandler == nullptr) {
     if (usvfs_dump_type != CrashDumpsType::None)
       exceptionHandler = ::AddVectoredExceptionHandler(0, VEHandler);
   } else {
-    spdlog::get("usvfs")->info("vectored exception handler already active");
+    LOG_USVFS(info, "vectored exception handler already active");
     // how did this happen??
   }
 
-  spdlog::get("usvfs")->info(
-      "inithooks called {0} in process {1}:{2} (log level {3}, dump type {4}, dump "
-      "path {5})",
-      params->instanceName, winapi::ansi::getModuleFileName(nullptr),
-      ::GetCurrentProcessId(), static_cast<int>(params->logLevel),
-      static_cast<int>(params->crashDumpsType), params->crashDumpsPath);
+  LOG_USVFS(info,
+            "inithooks called {0} in process {1}:{2} (log level {3}, dump type {4}, "
+            "dump path {5})",
+            params->instanceName, winapi::ansi::getModuleFileName(nullptr),
+            ::GetCurrentProcessId(), static_cast<int>(params->logLevel),
+            static_cast<int>(params->crashDumpsType), params->crashDumpsPath);
 
   try {
-    manager = new usvfs::HookManager(*params, dllModule);
+    attach.lap("setup");
+    manager = new usvfs::HookManager(*params, dllModule, &attach);
+    StartTracing(*params);
+    ush::ProfileCache::instance().setEnabled(params->profileCache);
+    attach.lap("tracing");
 
     auto context   = manager->context();
     auto exePath   = boost::dll::program_location();
@@ -422,21 +529,21 @@ void __cdecl InitHooks(LPVOID parameters, size_t)
       if (std::filesystem::exists(library)) {
         const auto ret = LoadLibraryExW(library.c_str(), NULL, 0);
         if (ret) {
-          spdlog::get("usvfs")->info("inithooks succeeded to force load {0}",
-                                     ush::string_cast<std::string>(library).c_str());
+          LOG_USVFS(info, "inithooks succeeded to force load {0}",
+                    ush::string_cast<std::string>(library).c_str());
         } else {
-          spdlog::get("usvfs")->critical(
-              "inithooks failed to force load {0}",
-              ush::string_cast<std::string>(library).c_str());
+          LOG_USVFS(critical, "inithooks failed to force load {0}",
+                    ush::string_cast<std::string>(library).c_str());
         }
       }
     }
+    attach.lap("force load");
 
-    spdlog::get("usvfs")->info("inithooks in process {0} successful",
-                               ::GetCurrentProcessId());
+    LOG_USVFS(info, "inithooks in process {0} successful: {1}", ::GetCurrentProcessId(),
+              attach.summary());
 
   } catch (const std::exception& e) {
-    spdlog::get("usvfs")->debug("failed to initialise hooks: {0}", e.what());
+    LOG_USVFS(debug, "failed to initialise hooks: {0}", e.what());
   }
 }
 
@@ -456,15 +563,18 @@ BOOL WINAPI usvfsConnectVFS(const usvfsParameters* params)
   if (spdlog::get("usvfs").get() == nullptr) {
     // create temporary logger so we don't get null-pointer exceptions
     spdlog::create<spdlog::sinks::null_sink_mt>("usvfs");
+    // the handle may still point to a logger that has been dropped since
+    usvfs::log::refreshLoggers();
   }
 
   try {
     usvfsDisconnectVFS();
     context = new usvfs::HookContext(*params, dllModule);
+    StartTracing(*params);
 
     return TRUE;
   } catch (const std::exception& e) {
-    spdlog::get("usvfs")->debug("failed to connect to vfs: {}", e.what());
+    LOG_USVFS(debug, "failed to connect to vfs: {}", e.what());
     return FALSE;
   }
 }
@@ -474,9 +584,13 @@ void WINAPI usvfsDisconnectVFS()
   if (spdlog::get("usvfs").get() == nullptr) {
     // create temporary logger so we don't get null-pointer exceptions
     spdlog::create<spdlog::sinks::null_sink_mt>("usvfs");
+    // the handle may still point to a logger that has been dropped since
+    usvfs::log::refreshLoggers();
   }
 
-  spdlog::get("usvfs")->debug("remove from process {}", GetCurrentProcessId());
+  LOG_USVFS(debug, "remove from process {}", GetCurrentProcessId());
+
+  WriteTrace();
 
   if (manager != nullptr) {
     delete manager;
@@ -486,7 +600,7 @@ void WINAPI usvfsDisconnectVFS()
   if (context != nullptr) {
     delete context;
     context = nullptr;
-    spdlog::get("usvfs")->debug("vfs unloaded");
+    LOG_USVFS(debug, "vfs unloaded");
   }
 }
 
@@ -505,8 +619,8 @@ bool processStillActive(DWORD pid)
 
   DWORD exitCode;
   if (!GetExitCodeProcess(proc, &exitCode)) {
-    spdlog::get("usvfs")->warn("failed to query exit code on process {}: {}", pid,
-                               ::GetLastError());
+    LOG_USVFS(warn, "failed to query exit code on process {}: {}", pid,
+              ::GetLastError());
     return false;
   } else {
     return exitCode == STILL_ACTIVE;
@@ -568,10 +682,116 @@ BOOL WINAPI usvfsGetVFSProcessList2(size_t* count, DWORD** buffer)
   return TRUE;
 }
 
+BOOL WINAPI usvfsGetHookStatistics(size_t* count, usvfsHookStatistics** buffer)
+{
+  if (!count || !buffer) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  *count  = 0;
+  *buffer = nullptr;
+
+  const usvfs::shared::HookStatisticsTable* table = usvfs::HookContext::statistics();
+  if (table == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  const std::vector<usvfs::shared::HookStatistics> hooks = table->snapshot();
+  if (hooks.empty()) {
+    return TRUE;
+  }
+
+  *buffer = static_cast<usvfsHookStatistics*>(
+      std::calloc(hooks.size(), sizeof(usvfsHookStatistics)));
+  if (*buffer == nullptr) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+
+  static_assert(sizeof(usvfsHookStatistics::latency) / sizeof(uint64_t) ==
+                usvfs::shared::LatencyBuckets::COUNT);
+  for (size_t i = 0; i < hooks.size(); ++i) {
+    const usvfs::shared::HookStatistics& hook = hooks[i];
+    usvfsHookStatistics& out                  = (*buffer)[i];
+    ush::strncpy_sz(out.name, hook.name.c_str(), std::size(out.name));
+    out.calls       = hook.calls;
+    out.reroutes    = hook.reroutes;
+    out.misses      = hook.misses;
+    out.errors      = hook.errors;
+    out.nanoseconds = hook.nanoseconds;
+    std::copy(hook.latency.begin(), hook.latency.end(), out.latency);
+  }
+  *count = hooks.size();
+
+  return TRUE;
+}
+
+BOOL WINAPI usvfsEnableLockStatistics(BOOL enable)
+{
+  usvfs::shared::LockStatisticsTable* table = usvfs::HookContext::lockStatistics();
+  if (table == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  table->setEnabled(enable != FALSE);
+  return TRUE;
+}
+
+BOOL WINAPI usvfsGetLockStatistics(size_t* count, usvfsLockStatistics** buffer)
+{
+  if (!count || !buffer) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  *count  = 0;
+  *buffer = nullptr;
+
+  const usvfs::shared::LockStatisticsTable* table =
+      usvfs::HookContext::lockStatistics();
+  if (table == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  const std::vector<usvfs::shared::LockStatistics> locks = table->snapshot();
+  if (locks.empty()) {
+    return TRUE;
+  }
+
+  *buffer = static_cast<usvfsLockStatistics*>(
+      std::calloc(locks.size(), sizeof(usvfsLockStatistics)));
+  if (*buffer == nullptr) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+
+  for (size_t i = 0; i < locks.size(); ++i) {
+    const usvfs::shared::LockStatistics& lock = locks[i];
+    usvfsLockStatistics& out                  = (*buffer)[i];
+    ush::strncpy_sz(out.name, lock.name.c_str(), std::size(out.name));
+    ush::strncpy_sz(out.lastHolder, lock.lastHolder.c_str(), std::size(out.lastHolder));
+    ush::strncpy_sz(out.maxWaitHolder, lock.maxWaitHolder.c_str(),
+                    std::size(out.maxWaitHolder));
+    out.acquisitions       = lock.acquisitions;
+    out.contended          = lock.contended;
+    out.waitNanoseconds    = lock.waitNanoseconds;
+    out.maxWaitNanoseconds = lock.maxWaitNanoseconds;
+    out.timeouts           = lock.timeouts;
+  }
+  *count = locks.size();
+
+  return TRUE;
+}
+
 void WINAPI usvfsClearVirtualMappings()
 {
-  context->redirectionTable()->clear();
-  context->inverseTable()->clear();
+  auto access = WRITE_CONTEXT();
+  access->redirectionTable()->clear();
+  access->inverseTable()->clear();
 }
 
 /// ensure the specified path exists. If a physical path of the same name
@@ -588,9 +808,9 @@ bool assertPathExists(usvfs::RedirectionTreeContainer& table, LPCWSTR path)
   usvfs::RedirectionTree::NodeT* current = table.get();
 
   for (auto iter = p.begin(); iter != p.end(); iter = ush::nextIter(iter, p.end())) {
-    if (current->exists(iter->string().c_str())) {
+    if (current->exists(iter->wstring())) {
       // subdirectory exists virtually, all good
-      usvfs::RedirectionTree::NodePtrT found = current->node(iter->string().c_str());
+      usvfs::RedirectionTree::NodePtrT found = current->node(iter->wstring());
       current                                = found.get().get();
     } else {
       // targetPath is relative to the last rerouted "real" path. This means
@@ -609,11 +829,11 @@ bool assertPathExists(usvfs::RedirectionTreeContainer& table, LPCWSTR path)
       if (is_directory(targetPath) || is_symlink(targetPath) ||
           status(targetPath).type() == bfs::file_type::reparse_file) {
         usvfs::RedirectionTree::NodePtrT newNode =
-            table.addDirectory(current->path() / *iter, targetPath.string().c_str(),
+            table.addDirectory(current->path() / *iter, targetPath.wstring().c_str(),
                                ush::FLAG_DUMMY, false);
         current = newNode.get().get();
       } else {
-        spdlog::get("usvfs")->info("{} doesn't exist", targetPath.c_str());
+        LOG_USVFS(info, "{} doesn't exist", targetPath.c_str());
         return false;
       }
     }
@@ -623,28 +843,23 @@ bool assertPathExists(usvfs::RedirectionTreeContainer& table, LPCWSTR path)
 }
 
 static bool fileNameInSkipSuffixes(const std::string& fileNameUtf8,
-                                   const std::vector<std::string>& skipFileSuffixes)
+                                   const usvfs::shared::SuffixRules& skipFileSuffixes)
 {
-  for (const auto& skipFileSuffix : skipFileSuffixes) {
-    if (boost::algorithm::iends_with(fileNameUtf8, skipFileSuffix)) {
-      spdlog::get("usvfs")->debug(
-          "file '{}' should be skipped, matches file suffix '{}'", fileNameUtf8,
-          skipFileSuffix);
-      return true;
-    }
+  const std::string* skipFileSuffix = skipFileSuffixes.match(fileNameUtf8);
+  if (skipFileSuffix != nullptr) {
+    LOG_USVFS(debug, "file '{}' should be skipped, matches file suffix '{}'",
+              fileNameUtf8, *skipFileSuffix);
+    return true;
   }
   return false;
 }
 
 static bool fileNameInSkipDirectories(const std::string& directoryNameUtf8,
-                                      const std::vector<std::string>& skipDirectories)
+                                      const usvfs::shared::NameRules& skipDirectories)
 {
-  for (const auto& skipDir : skipDirectories) {
-    if (boost::algorithm::iequals(directoryNameUtf8, skipDir)) {
-      spdlog::get("usvfs")->debug("directory '{}' should be skipped",
-                                  directoryNameUtf8);
-      return true;
-    }
+  if (skipDirectories.match(directoryNameUtf8) != nullptr) {
+    LOG_USVFS(debug, "directory '{}' should be skipped", directoryNameUtf8);
+    return true;
   }
   return false;
 }
@@ -655,34 +870,33 @@ BOOL WINAPI usvfsVirtualLinkFile(LPCWSTR source, LPCWSTR destination,
   // TODO difference between winapi and ntdll api regarding system32 vs syswow64
   // (and other windows links?)
   try {
-    if (!assertPathExists(context->redirectionTable(), destination)) {
+    auto access = WRITE_CONTEXT();
+
+    if (!assertPathExists(access->redirectionTable(), destination)) {
       SetLastError(ERROR_PATH_NOT_FOUND);
       return FALSE;
     }
 
-    const auto skipFileSuffixes = context->skipFileSuffixes();
+    const auto parameters = access->parameters();
 
     std::string sourceU8 = ush::string_cast<std::string>(source, ush::CodePage::UTF8);
 
     // Check if the file should be skipped
-    if (fileNameInSkipSuffixes(sourceU8, skipFileSuffixes)) {
+    if (fileNameInSkipSuffixes(sourceU8, parameters->skipFileSuffixes())) {
       // return false when we want to fail when the file is skipped
       return (flags & LINKFLAG_FAILIFSKIPPED) ? FALSE : TRUE;
     }
 
-    auto res = context->redirectionTable().addFile(
-        bfs::path(destination), usvfs::RedirectionDataLocal(sourceU8),
+    auto res = access->redirectionTable().addFile(
+        bfs::path(destination), usvfs::RedirectionDataLocal(source),
         !(flags & LINKFLAG_FAILIFEXISTS));
 
     if (shouldAddToInverseTree(sourceU8)) {
-      std::string destinationU8 =
-          ush::string_cast<std::string>(destination, ush::CodePage::UTF8);
-
-      context->inverseTable().addFile(bfs::path(source),
-                                      usvfs::RedirectionDataLocal(destinationU8), true);
+      access->inverseTable().addFile(bfs::path(source),
+                                     usvfs::RedirectionDataLocal(destination), true);
     }
 
-    context->updateParameters();
+    access->updateParameters();
 
     if (res.get() == nullptr) {
       // the tree structure currently doesn't provide useful error codes but
@@ -694,7 +908,7 @@ BOOL WINAPI usvfsVirtualLinkFile(LPCWSTR source, LPCWSTR destination,
       return TRUE;
     }
   } catch (const std::exception& e) {
-    spdlog::get("usvfs")->error("failed to copy file {}", e.what());
+    LOG_USVFS(err, "failed to copy file {}", e.what());
     // TODO: no clue what's wrong
     SetLastError(ERROR_INVALID_DATA);
     return FALSE;
@@ -713,6 +927,88 @@ static usvfs::shared::TreeFlags convertRedirectionFlags(unsigned int flags)
   return result;
 }
 
+// a directory or file below a directory that is linked recursively
+struct LinkEntry
+{
+  // relative to the linked directory
+  std::wstring name;
+  bool directory;
+  usvfs::shared::FileMetadata metadata;
+};
+
+// lists everything below a directory that is linked recursively, parents before their
+// contents, leaving out what is to be skipped. This only reads the disk so it's done
+// before the tree is locked, every hooked process would wait for the scan otherwise
+// @return false if linking has to fail because of the flags
+static bool collectLinkEntries(const std::wstring& source,
+                               const std::wstring& destination,
+                               const std::wstring& relative, unsigned int flags,
+                               const usvfs::shared::NameRules& skipDirectories,
+                               const usvfs::shared::SuffixRules& skipFileSuffixes,
+                               std::vector<LinkEntry>& entries)
+{
+  std::wstring sourceP = source + relative;
+  if (sourceP.length() >= MAX_PATH && !ush::startswith(sourceP.c_str(), LR"(\\?\)"))
+    sourceP = LR"(\\?\)" + sourceP;
+
+  for (winapi::ex::wide::FileResult file :
+       winapi::ex::wide::quickFindFiles(sourceP.c_str(), L"*")) {
+    if (file.attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      if ((file.fileName == L".") || (file.fileName == L"..")) {
+        continue;
+      }
+
+      const auto nameU8 =
+          ush::string_cast<std::string>(file.fileName.c_str(), ush::CodePage::UTF8);
+      // Check if the directory should be skipped
+      if (fileNameInSkipDirectories(nameU8, skipDirectories)) {
+        // Fail if we desire to fail when a dir/file is skipped
+        if (flags & LINKFLAG_FAILIFSKIPPED) {
+          LOG_USVFS(debug, "directory '{}' skipped, failing as defined by link flags",
+                    nameU8);
+          return false;
+        }
+
+        continue;
+      }
+
+      const std::wstring name = relative + file.fileName;
+      if ((flags & LINKFLAG_FAILIFEXISTS) &&
+          winapi::ex::wide::fileExists((destination + name).c_str())) {
+        SetLastError(ERROR_FILE_EXISTS);
+        return false;
+      }
+
+      entries.push_back({name, true, {}});
+      if (!collectLinkEntries(source, destination, name + L"\\", flags,
+                              skipDirectories, skipFileSuffixes, entries)) {
+        return false;
+      }
+    } else {
+      const auto nameU8 =
+          ush::string_cast<std::string>(file.fileName.c_str(), ush::CodePage::UTF8);
+
+      // Check if the file should be skipped
+      if (fileNameInSkipSuffixes(nameU8, skipFileSuffixes)) {
+        // Fail if we desire to fail when a dir/file is skipped
+        if (flags & LINKFLAG_FAILIFSKIPPED) {
+          LOG_USVFS(debug, "file '{}' skipped, failing as defined by link flags",
+                    nameU8);
+          return false;
+        }
+
+        continue;
+      }
+
+      // the metadata from the listing lets attribute queries be answered without
+      // touching the disk
+      entries.push_back({relative + file.fileName, false, file.metadata});
+    }
+  }
+
+  return true;
+}
+
 BOOL WINAPI usvfsVirtualLinkDirectoryStatic(LPCWSTR source, LPCWSTR destination,
                                             unsigned int flags)
 {
@@ -723,91 +1019,63 @@ BOOL WINAPI usvfsVirtualLinkDirectoryStatic(LPCWSTR source, LPCWSTR destination,
       return FALSE;
     }
 
-    if (!assertPathExists(context->redirectionTable(), destination)) {
-      SetLastError(ERROR_PATH_NOT_FOUND);
-      return FALSE;
+    const std::wstring sourceW      = std::wstring(source) + L"\\";
+    const std::wstring destinationW = std::wstring(destination) + L"\\";
+
+    std::vector<LinkEntry> entries;
+    if ((flags & LINKFLAG_RECURSIVE) != 0) {
+      const auto parameters = READ_CONTEXT()->parameters();
+      if (!collectLinkEntries(sourceW, destinationW, std::wstring(), flags,
+                              parameters->skipDirectories(),
+                              parameters->skipFileSuffixes(), entries)) {
+        return FALSE;
+      }
     }
 
-    std::string sourceU8 =
-        ush::string_cast<std::string>(source, ush::CodePage::UTF8) + "\\";
+    auto access = WRITE_CONTEXT();
 
-    context->redirectionTable().addDirectory(
-        destination, usvfs::RedirectionDataLocal(sourceU8),
-        usvfs::shared::FLAG_DIRECTORY | convertRedirectionFlags(flags),
-        (flags & LINKFLAG_CREATETARGET) != 0);
+    if (!assertPathExists(access->redirectionTable(), destination)) {
+      SetLastError(ERROR_PATH_NOT_FOUND);
+      return FALSE;
+    }
 
-    const auto skipDirectories  = context->skipDirectories();
-    const auto skipFileSuffixes = context->skipFileSuffixes();
+    const usvfs::shared::TreeFlags directoryFlags =
+        usvfs::shared::FLAG_DIRECTORY | convertRedirectionFlags(flags);
+    const bool overwriteDirectories = (flags & LINKFLAG_CREATETARGET) != 0;
+
+    access->redirectionTable().addDirectory(destination,
+                                            usvfs::RedirectionDataLocal(sourceW),
+                                            directoryFlags, overwriteDirectories);
+
+    for (const LinkEntry& entry : entries) {
+      if (entry.directory) {
+        access->redirectionTable().addDirectory(
+            destinationW + entry.name,
+            usvfs::RedirectionDataLocal(sourceW + entry.name + L"\\"), directoryFlags,
+            overwriteDirectories);
+        continue;
+      }
 
-    if ((flags & LINKFLAG_RECURSIVE) != 0) {
-      std::wstring sourceP(source);
-      std::wstring sourceW      = sourceP + L"\\";
-      std::wstring destinationW = std::wstring(destination) + L"\\";
-      if (sourceP.length() >= MAX_PATH && !ush::startswith(sourceP.c_str(), LR"(\\?\)"))
-        sourceP = LR"(\\?\)" + sourceP;
-
-      for (winapi::ex::wide::FileResult file :
-           winapi::ex::wide::quickFindFiles(sourceP.c_str(), L"*")) {
-        if (file.attributes & FILE_ATTRIBUTE_DIRECTORY) {
-          if ((file.fileName != L".") && (file.fileName != L"..")) {
-
-            const auto nameU8 = ush::string_cast<std::string>(file.fileName.c_str(),
-                                                              ush::CodePage::UTF8);
-            // Check if the directory should be skipped
-            if (fileNameInSkipDirectories(nameU8, skipDirectories)) {
-              // Fail if we desire to fail when a dir/file is skipped
-              if (flags & LINKFLAG_FAILIFSKIPPED) {
-                spdlog::get("usvfs")->debug(
-                    "directory '{}' skipped, failing as defined by link flags", nameU8);
-                return FALSE;
-              }
-
-              continue;
-            }
-
-            usvfsVirtualLinkDirectoryStatic((sourceW + file.fileName).c_str(),
-                                            (destinationW + file.fileName).c_str(),
-                                            flags);
-          }
-        } else {
-          const auto nameU8 =
-              ush::string_cast<std::string>(file.fileName.c_str(), ush::CodePage::UTF8);
-
-          // Check if the file should be skipped
-          if (fileNameInSkipSuffixes(nameU8, skipFileSuffixes)) {
-            // Fail if we desire to fail when a dir/file is skipped
-            if (flags & LINKFLAG_FAILIFSKIPPED) {
-              spdlog::get("usvfs")->debug(
-                  "file '{}' skipped, failing as defined by link flags", nameU8);
-              return FALSE;
-            }
-
-            continue;
-          }
-
-          // TODO could save memory here by storing only the file name for the
-          // source and constructing the full name using the parent directory
-          context->redirectionTable().addFile(
-              bfs::path(destination) / nameU8,
-              usvfs::RedirectionDataLocal(sourceU8 + nameU8), true);
-
-          if (shouldAddToInverseTree(nameU8)) {
-            std::string destinationU8 =
-                ush::string_cast<std::string>(destination, ush::CodePage::UTF8) + "\\";
-
-            context->inverseTable().addFile(
-                bfs::path(source) / nameU8,
-                usvfs::RedirectionDataLocal(destinationU8 + nameU8), true);
-          }
-        }
+      // TODO could save memory here by storing only the file name for the
+      // source and constructing the full name using the parent directory
+      access->redirectionTable().addFile(
+          bfs::path(destinationW + entry.name),
+          usvfs::RedirectionDataLocal(sourceW + entry.name, entry.metadata), true);
+
+      const auto nameU8 = ush::string_cast<std::string>(
+          bfs::path(entry.name).filename().wstring(), ush::CodePage::UTF8);
+      if (shouldAddToInverseTree(nameU8)) {
+        access->inverseTable().addFile(
+            bfs::path(sourceW + entry.name),
+            usvfs::RedirectionDataLocal(destinationW + entry.name), true);
       }
     }
 
-    context->updateParameters();
+    access->updateParameters();
 
     return TRUE;
   } catch (const std::exception& e) {
-    spdlog::get("usvfs")->error("failed to copy file {}", e.what());
+    LOG_USVFS(err, "failed to copy file {}", e.what());
     // TODO: no clue what's wrong
     SetLastError(ERROR_INVALID_DATA);
     return FALSE;
@@ -831,8 +1099,7 @@ BOOL WINAPI usvfsCreateProcessHooked(LPCWSTR lpApplicationName, LPWSTR lpCommand
                             lpThreadAttributes, bInheritHandles, flags, lpEnvironment,
                             lpCurrentDirectory, lpStartupInfo, lpProcessInformation);
   if (!res) {
-    spdlog::get("usvfs")->error("failed to spawn {}",
-                                ush::string_cast<std::string>(lpCommandLine));
+    LOG_USVFS(err, "failed to spawn {}", ush::string_cast<std::string>(lpCommandLine));
     return FALSE;
   }
 
@@ -843,7 +1110,7 @@ BOOL WINAPI usvfsCreateProcessHooked(LPCWSTR lpApplicationName, LPWSTR lpCommand
       usvfs::injectProcess(p.parent_path().wstring(), context->callParameters(),
                            *lpProcessInformation);
     } catch (const std::exception& e) {
-      spdlog::get("usvfs")->error("failed to inject: {}", e.what());
+      LOG_USVFS(err, "failed to inject: {}", e.what());
       logExtInfo(e, LogLevel::Error);
       ::TerminateProcess(lpProcessInformation->hProcess, 1);
       ::SetLastError(ERROR_INVALID_PARAMETER);
@@ -872,6 +1139,135 @@ BOOL WINAPI usvfsCreateVFSDump(LPSTR buffer, size_t* size)
   return success ? TRUE : FALSE;
 }
 
+struct usvfsTreeCursor
+{
+  usvfs::shared::TreeCursor<usvfs::RedirectionTree> cursor;
+};
+
+static unsigned int convertTreeFlags(usvfs::shared::TreeFlags flags)
+{
+  unsigned int result = 0;
+  if (flags & usvfs::shared::FLAG_DIRECTORY) {
+    result |= TREEFLAG_DIRECTORY;
+  }
+  if (flags & usvfs::shared::FLAG_DUMMY) {
+    result |= TREEFLAG_DUMMY;
+  }
+  if (flags & usvfs::shared::FLAG_CREATETARGET) {
+    result |= TREEFLAG_CREATETARGET;
+  }
+  if (flags & usvfs::shared::FLAG_METADATASTALE) {
+    result |= TREEFLAG_METADATASTALE;
+  }
+  return result;
+}
+
+BOOL WINAPI usvfsWriteVFSDump(HANDLE file)
+{
+  if ((file == nullptr) || (file == INVALID_HANDLE_VALUE)) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  if (context == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  // nodes per page, the tree isn't locked while a page is written
+  const size_t pageSize = 1024;
+
+  usvfs::shared::TreeCursor<usvfs::RedirectionTree> cursor;
+  std::string page;
+  for (;;) {
+    page.clear();
+    {
+      auto access = READ_CONTEXT();
+      cursor.read(*access->redirectionTable().get(), pageSize,
+                  [&page](const usvfs::RedirectionTree& node, const auto& position) {
+                    page.append(position.depth, ' ');
+                    page += ush::TreeChars<wchar_t>::toUTF8(node.name().c_str());
+                    page += " -> ";
+                    page += ush::string_cast<std::string>(
+                        node.data().linkTarget.c_str(), ush::CodePage::UTF8);
+                    page += "\n";
+                  });
+    }
+
+    if (page.empty()) {
+      return TRUE;
+    }
+
+    DWORD written = 0;
+    if (!::WriteFile(file, page.data(), static_cast<DWORD>(page.size()), &written,
+                     nullptr)) {
+      return FALSE;
+    }
+  }
+}
+
+BOOL WINAPI usvfsOpenTreeCursor(usvfsTreeCursor** cursor)
+{
+  if (!cursor) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  *cursor = nullptr;
+
+  if (context == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  *cursor = new (std::nothrow) usvfsTreeCursor();
+  if (*cursor == nullptr) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+BOOL WINAPI usvfsReadTreeCursor(usvfsTreeCursor* cursor, usvfsTreeRecord* records,
+                                size_t count, size_t* read)
+{
+  if (!cursor || !read || (!records && (count > 0))) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  *read = 0;
+
+  if (context == nullptr) {
+    SetLastError(ERROR_INVALID_STATE);
+    return FALSE;
+  }
+
+  auto access = READ_CONTEXT();
+  cursor->cursor.read(
+      *access->redirectionTable().get(), count,
+      [records, read](const usvfs::RedirectionTree& node, const auto& position) {
+        usvfsTreeRecord& out = records[(*read)++];
+        out.id               = position.id;
+        out.parentId         = position.parentId;
+        out.depth            = position.depth;
+        out.flags            = convertTreeFlags(node.flags());
+
+        const auto& linkTarget = node.data().linkTarget;
+        out.linkTargetLength   = static_cast<uint32_t>(linkTarget.size());
+        wcsncpy_s(out.name, node.name().c_str(), _TRUNCATE);
+        wcsncpy_s(out.linkTarget, linkTarget.c_str(), _TRUNCATE);
+      });
+
+  return TRUE;
+}
+
+VOID WINAPI usvfsCloseTreeCursor(usvfsTreeCursor* cursor)
+{
+  delete cursor;
+}
+
 VOID WINAPI usvfsBlacklistExecutable(LPCWSTR executableName)
 {
   context->blacklistExecutable(executableName);
@@ -914,8 +1310,7 @@ VOID WINAPI usvfsClearLibraryForceLoads()
 
 VOID WINAPI usvfsPrintDebugInfo()
 {
-  spdlog::get("usvfs")->warn("===== debug {} =====",
-                             context->redirectionTable().shmName());
+  LOG_USVFS(warn, "===== debug {} =====", context->redirectionTable().shmName());
   void* buffer      = nullptr;
   size_t bufferSize = 0;
   context->redirectionTable().getBuffer(buffer, bufferSize);
@@ -924,16 +1319,28 @@ VOID WINAPI usvfsPrintDebugInfo()
     temp << std::hex << std::setfill('0') << std::setw(2)
          << (unsigned)reinterpret_cast<char*>(buffer)[i] << " ";
     if ((i % 16) == 15) {
-      spdlog::get("usvfs")->info("{}", temp.str());
+      LOG_USVFS(info, "{}", temp.str());
       temp.str("");
       temp.clear();
     }
   }
   if (!temp.str().empty()) {
-    spdlog::get("usvfs")->info("{}", temp.str());
+    LOG_USVFS(info, "{}", temp.str());
+  }
+
+  const usvfs::shared::LockStatisticsTable* locks =
+      usvfs::HookContext::lockStatistics();
+  if (locks != nullptr) {
+    for (const usvfs::shared::LockStatistics& lock : locks->snapshot()) {
+      LOG_USVFS(info,
+                "lock {}: {} acquisitions, {} contended, {} ns waiting, longest {} ns "
+                "behind {}, {} timeouts, last held by {}",
+                lock.name, lock.acquisitions, lock.contended, lock.waitNanoseconds,
+                lock.maxWaitNanoseconds, lock.maxWaitHolder, lock.timeouts,
+                lock.lastHolder);
+    }
   }
-  spdlog::get("usvfs")->warn("===== / debug {} =====",
-                             context->redirectionTable().shmName());
+  LOG_USVFS(warn, "===== / debug {} =====", context->redirectionTable().shmName());
 }
 
 const char* WINAPI usvfsVersionString()
@@ -952,6 +1359,9 @@ BOOL APIENTRY DllMain(HMODULE module, DWORD reasonForCall, LPVOID)
     dllModule = module;
   } break;
   case DLL_PROCESS_DETACH: {
+    // the trace is written by usvfsDisconnectVFS, which hooked processes reach
+    // through the ExitProcess hook. Nothing that creates files or takes locks may
+    // run here under the loader lock
     if (exceptionHandler)
       ::RemoveVectoredExceptionHandler(exceptionHandler);
   } break;
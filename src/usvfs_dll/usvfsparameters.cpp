@@ -3,18 +3,20 @@
 
 usvfsParameters::usvfsParameters()
     : debugMode(false), logLevel(LogLevel::Debug), crashDumpsType(CrashDumpsType::None),
-      delayProcessMs(0)
+      delayProcessMs(0), profileCache(false)
 {
   std::fill(std::begin(instanceName), std::end(instanceName), 0);
   std::fill(std::begin(currentSHMName), std::end(currentSHMName), 0);
   std::fill(std::begin(currentInverseSHMName), std::end(currentInverseSHMName), 0);
   std::fill(std::begin(crashDumpsPath), std::end(crashDumpsPath), 0);
+  std::fill(std::begin(tracePath), std::end(tracePath), 0);
 }
 
 usvfsParameters::usvfsParameters(const char* instanceName, const char* currentSHMName,
                                  const char* currentInverseSHMName, bool debugMode,
                                  LogLevel logLevel, CrashDumpsType crashDumpsType,
-                                 const char* crashDumpsPath, int delayProcessMs)
+                                 const char* crashDumpsPath, int delayProcessMs,
+                                 const char* tracePath, bool profileCache)
     : usvfsParameters()
 {
   strncpy_s(this->instanceName, instanceName, _TRUNCATE);
@@ -25,13 +27,15 @@ usvfsParameters::usvfsParameters(const char* instanceName, const char* currentSH
   this->crashDumpsType = crashDumpsType;
   strncpy_s(this->crashDumpsPath, crashDumpsPath, _TRUNCATE);
   this->delayProcessMs = delayProcessMs;
+  strncpy_s(this->tracePath, tracePath, _TRUNCATE);
+  this->profileCache = profileCache;
 }
 
 usvfsParameters::usvfsParameters(const USVFSParameters& oldParams)
     : usvfsParameters(oldParams.instanceName, oldParams.currentSHMName,
                       oldParams.currentInverseSHMName, oldParams.debugMode,
                       oldParams.logLevel, oldParams.crashDumpsType,
-                      oldParams.crashDumpsPath, 0)
+                      oldParams.crashDumpsPath, 0, "", false)
 {}
 
 void usvfsParameters::setInstanceName(const char* name)
@@ -74,6 +78,21 @@ void usvfsParameters::setProcessDelay(int milliseconds)
   delayProcessMs = milliseconds;
 }
 
+void usvfsParameters::setTracePath(const char* path)
+{
+  if (path && strlen(path) < _countof(tracePath)) {
+    memcpy(tracePath, path, strlen(path) + 1);
+  } else {
+    // tracing writes to this directory, don't write somewhere else
+    tracePath[0] = 0;
+  }
+}
+
+void usvfsParameters::setProfileCache(bool enable)
+{
+  profileCache = enable;
+}
+
 extern "C"
 {
 
@@ -190,4 +209,18 @@ extern "C"
     }
   }
 
+  void usvfsSetTracePath(usvfsParameters* p, const char* path)
+  {
+    if (p) {
+      p->setTracePath(path);
+    }
+  }
+
+  void usvfsSetProfileCache(usvfsParameters* p, BOOL enable)
+  {
+    if (p) {
+      p->setProfileCache(enable);
+    }
+  }
+
 }  // extern "C"
@@ -84,9 +84,8 @@ void usvfs::injectProcess(const std::wstring& applicationPath,
     }
   }
   boost::filesystem::path binPath = boost::filesystem::path(applicationPath);
-  spdlog::get("usvfs")->info("injecting to process {} with {} bitness",
-                             ::GetProcessId(processHandle),
-                             sameBitness ? "same" : "different");
+  LOG_USVFS(info, "injecting to process {} with {} bitness",
+            ::GetProcessId(processHandle), sameBitness ? "same" : "different");
 
   if (sameBitness) {
     static constexpr auto USVFS_DLL =
@@ -110,13 +109,13 @@ void usvfs::injectProcess(const std::wstring& applicationPath,
                     ush::string_cast<std::string>(preferedDll.wstring()).c_str()));
     }
 
-    spdlog::get("usvfs")->info("dll path: {}", dllPath.wstring());
+    LOG_USVFS(info, "dll path: {}", dllPath.wstring());
 
     InjectLib::InjectDLL(processHandle, threadHandle, dllPath.c_str(), "InitHooks",
                          &parameters, sizeof(parameters));
 
-    spdlog::get("usvfs")->info("injection to same bitness process {} successful",
-                               ::GetProcessId(processHandle));
+    LOG_USVFS(info, "injection to same bitness process {} successful",
+              ::GetProcessId(processHandle));
   } else {
     // first try platform specific proxy exe:
     static constexpr auto USVFS_PREFERED_EXE =
@@ -146,8 +145,8 @@ void usvfs::injectProcess(const std::wstring& applicationPath,
                                 std::string("usvfs proxy not found: ") +
                                 ush::string_cast<std::string>(preferedExe.wstring())));
     } else
-      spdlog::get("usvfs")->info("using usvfs proxy: {}",
-                                 ush::string_cast<std::string>(preferedExe.wstring()));
+      LOG_USVFS(info, "using usvfs proxy: {}",
+                ush::string_cast<std::string>(preferedExe.wstring()));
     // need to use proxy aplication to inject
     auto proxyProcess =
         std::move(wide::createProcess(exePath.wstring())
@@ -170,13 +169,13 @@ void usvfs::injectProcess(const std::wstring& applicationPath,
       // generous
       switch (WaitForSingleObject(result.processInfo.hProcess, 15000)) {
       case WAIT_TIMEOUT: {
-        spdlog::get("usvfs")->debug("proxy timeout");
+        LOG_USVFS(debug, "proxy timeout");
         TerminateProcess(result.processInfo.hProcess, 1);
         USVFS_THROW_EXCEPTION(timeout_error()
                               << ex_msg(std::string("proxy didn't complete in time")));
       } break;
       case WAIT_FAILED: {
-        spdlog::get("usvfs")->debug("proxy wait failed");
+        LOG_USVFS(debug, "proxy wait failed");
         TerminateProcess(result.processInfo.hProcess, 1);
         USVFS_THROW_EXCEPTION(unknown_error()
                               << ex_msg(
@@ -184,7 +183,7 @@ void usvfs::injectProcess(const std::wstring& applicationPath,
                               << ex_win_errcode(result.errorCode));
       } break;
       default: {
-        spdlog::get("usvfs")->debug("proxy run successful");
+        LOG_USVFS(debug, "proxy run successful");
         // nop
       } break;
       }
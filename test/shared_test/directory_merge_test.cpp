@@ -0,0 +1,287 @@
+#include <gtest/gtest.h>
+
+#include <directory_merge.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+// record layout used by the mock producers, the merge only cares about the
+// leading offset to the next record
+struct MockRecord
+{
+  uint32_t nextEntryOffset;
+  uint32_t origin;
+  uint32_t nameLength;
+  char name[1];
+};
+
+/**
+ * produces the names from a generator function, simulating a directory listing that
+ * is fetched lazily. counts how many entries were actually produced
+ */
+class MockSource : public DirectoryEntrySource<std::string>
+{
+public:
+  typedef std::function<bool(size_t, std::string&)> GeneratorT;
+
+  MockSource(uint32_t origin, GeneratorT generator)
+      : m_Origin(origin), m_Generator(generator)
+  {}
+
+  MockSource(uint32_t origin, std::vector<std::string> names)
+      : MockSource(origin, [names](size_t index, std::string& name) {
+          if (index >= names.size()) {
+            return false;
+          }
+          name = names[index];
+          return true;
+        })
+  {}
+
+  bool valid() override
+  {
+    if (!m_HasCurrent && !m_Complete) {
+      m_HasCurrent = m_Generator(m_Index, m_Current);
+      m_Complete   = !m_HasCurrent;
+      if (m_HasCurrent) {
+        ++m_Produced;
+      }
+    }
+    return m_HasCurrent;
+  }
+
+  const std::string& key() const override { return m_Current; }
+
+  size_t recordSize() const override
+  {
+    return offsetof(MockRecord, name) + m_Current.size();
+  }
+
+  void copyRecord(void* destination) const override
+  {
+    MockRecord* record      = static_cast<MockRecord*>(destination);
+    record->nextEntryOffset = 0xFFFFFFFF;
+    record->origin          = m_Origin;
+    record->nameLength      = static_cast<uint32_t>(m_Current.size());
+    memcpy(record->name, m_Current.data(), m_Current.size());
+  }
+
+  void next() override
+  {
+    m_HasCurrent = false;
+    ++m_Index;
+  }
+
+  size_t produced() const { return m_Produced; }
+
+private:
+  uint32_t m_Origin;
+  GeneratorT m_Generator;
+  size_t m_Index{0};
+  size_t m_Produced{0};
+  std::string m_Current;
+  bool m_HasCurrent{false};
+  bool m_Complete{false};
+};
+
+struct Entry
+{
+  std::string name;
+  uint32_t origin;
+
+  bool operator==(const Entry& other) const
+  {
+    return (name == other.name) && (origin == other.origin);
+  }
+};
+
+// walks the chained records in the buffer
+std::vector<Entry> parse(const std::vector<uint8_t>& buffer, const MergeResult& result)
+{
+  std::vector<Entry> entries;
+  if (result.entries == 0) {
+    return entries;
+  }
+
+  size_t offset = 0;
+  for (;;) {
+    EXPECT_EQ(0, offset % 8);
+    const MockRecord* record = reinterpret_cast<const MockRecord*>(&buffer[offset]);
+    entries.push_back({std::string(record->name, record->nameLength), record->origin});
+    if (record->nextEntryOffset == 0) {
+      EXPECT_EQ(result.bytesWritten,
+                offset + offsetof(MockRecord, name) + record->nameLength);
+      break;
+    }
+    offset += record->nextEntryOffset;
+    EXPECT_LT(offset, result.bytesWritten);
+  }
+
+  EXPECT_EQ(result.entries, entries.size());
+  return entries;
+}
+
+// drains the merge with the given buffer size
+std::vector<Entry> drain(DirectoryMerge<std::string>& merge, size_t bufferSize,
+                         bool singleEntry)
+{
+  std::vector<Entry> entries;
+  std::vector<uint8_t> buffer(bufferSize);
+  for (;;) {
+    MergeResult result = merge.fill(buffer.data(), buffer.size(), singleEntry);
+    if (result.status != MergeStatus::Success) {
+      EXPECT_EQ(MergeStatus::NoMoreEntries, result.status);
+      break;
+    }
+    if (singleEntry) {
+      EXPECT_EQ(1, result.entries);
+    }
+    for (const auto& entry : parse(buffer, result)) {
+      entries.push_back(entry);
+    }
+  }
+  return entries;
+}
+
+}  // namespace
+
+TEST(DirectoryMergeTest, MergesInOrder)
+{
+  DirectoryMerge<std::string> merge;
+  merge.addSource(std::make_unique<MockSource>(
+      1, std::vector<std::string>{"b", "d", "f"}));
+  merge.addSource(std::make_unique<MockSource>(
+      2, std::vector<std::string>{".", "..", "a", "c", "e", "g"}));
+
+  const std::vector<Entry> expected{{".", 2}, {"..", 2}, {"a", 2}, {"b", 1}, {"c", 2},
+                                    {"d", 1}, {"e", 2},  {"f", 1}, {"g", 2}};
+  EXPECT_EQ(expected, drain(merge, 4096, false));
+}
+
+TEST(DirectoryMergeTest, EarlierSourceTakesPrecedence)
+{
+  DirectoryMerge<std::string> merge;
+  merge.addSource(
+      std::make_unique<MockSource>(1, std::vector<std::string>{"a", "c", "x"}));
+  merge.addSource(
+      std::make_unique<MockSource>(2, std::vector<std::string>{"a", "b", "c", "d"}));
+  merge.addSource(std::make_unique<MockSource>(3, std::vector<std::string>{"c", "d"}));
+
+  const std::vector<Entry> expected{{"a", 1}, {"b", 2}, {"c", 1}, {"d", 2}, {"x", 1}};
+  EXPECT_EQ(expected, drain(merge, 4096, false));
+}
+
+TEST(DirectoryMergeTest, SingleEntry)
+{
+  DirectoryMerge<std::string> merge;
+  merge.addSource(std::make_unique<MockSource>(1, std::vector<std::string>{"b"}));
+  merge.addSource(std::make_unique<MockSource>(2, std::vector<std::string>{"a", "c"}));
+
+  const std::vector<Entry> expected{{"a", 2}, {"b", 1}, {"c", 2}};
+  EXPECT_EQ(expected, drain(merge, 4096, true));
+}
+
+TEST(DirectoryMergeTest, ResumesAcrossSmallBuffers)
+{
+  std::vector<std::string> virtualNames;
+  std::vector<std::string> realNames;
+  for (int i = 0; i < 1000; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "file%04d", i);
+    if (i % 3 == 0) {
+      virtualNames.push_back(name);
+      if (i % 7 == 0) {
+        // also exists in the real directory
+        realNames.push_back(name);
+      }
+    } else {
+      realNames.push_back(name);
+    }
+  }
+
+  DirectoryMerge<std::string> merge;
+  merge.addSource(std::make_unique<MockSource>(1, virtualNames));
+  merge.addSource(std::make_unique<MockSource>(2, realNames));
+
+  // room for a handful of records per call
+  const std::vector<Entry> entries = drain(merge, 100, false);
+  ASSERT_EQ(1000, entries.size());
+  for (int i = 0; i < 1000; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "file%04d", i);
+    EXPECT_EQ(name, entries[i].name);
+    EXPECT_EQ(i % 3 == 0 ? 1 : 2, entries[i].origin);
+  }
+}
+
+TEST(DirectoryMergeTest, BufferTooSmall)
+{
+  DirectoryMerge<std::string> merge;
+  merge.addSource(std::make_unique<MockSource>(
+      1, std::vector<std::string>{"a_rather_long_file_name.txt", "b"}));
+
+  std::vector<uint8_t> buffer(16);
+  MergeResult result = merge.fill(buffer.data(), buffer.size(), false);
+  EXPECT_EQ(MergeStatus::BufferTooSmall, result.status);
+  EXPECT_EQ(0, result.entries);
+
+  // the entry must not have been consumed
+  const std::vector<Entry> expected{{"a_rather_long_file_name.txt", 1}, {"b", 1}};
+  EXPECT_EQ(expected, drain(merge, 64, false));
+}
+
+TEST(DirectoryMergeTest, NoSources)
+{
+  DirectoryMerge<std::string> merge;
+  std::vector<uint8_t> buffer(64);
+  MergeResult result = merge.fill(buffer.data(), buffer.size(), false);
+  EXPECT_EQ(MergeStatus::NoMoreEntries, result.status);
+  EXPECT_EQ(0, result.bytesWritten);
+}
+
+TEST(DirectoryMergeTest, ProducesLazily)
+{
+  // a huge listing where entries are generated on demand, only as many as fit into
+  // the buffer may be produced
+  auto generator = [](size_t index, std::string& name) {
+    if (index >= 10000000) {
+      return false;
+    }
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%08zu", index);
+    name = buffer;
+    return true;
+  };
+
+  auto realSource    = std::make_unique<MockSource>(2, generator);
+  auto virtualSource = std::make_unique<MockSource>(
+      1, std::vector<std::string>{"00000001", "00000005"});
+  const MockSource* real = realSource.get();
+
+  DirectoryMerge<std::string> merge;
+  merge.addSource(std::move(virtualSource));
+  merge.addSource(std::move(realSource));
+
+  std::vector<uint8_t> buffer(4096);
+  MergeResult result = merge.fill(buffer.data(), buffer.size(), false);
+  ASSERT_EQ(MergeStatus::Success, result.status);
+
+  const std::vector<Entry> entries = parse(buffer, result);
+  EXPECT_EQ(Entry({"00000001", 1}), entries[1]);
+  EXPECT_EQ(Entry({"00000005", 1}), entries[5]);
+
+  // one entry is looked at but doesn't fit anymore
+  EXPECT_EQ(result.entries + 1, real->produced());
+
+  result = merge.fill(buffer.data(), buffer.size(), true);
+  ASSERT_EQ(MergeStatus::Success, result.status);
+  EXPECT_EQ(entries.size(), std::stoul(parse(buffer, result)[0].name));
+  // the entry that didn't fit before is returned without producing another one
+  EXPECT_EQ(entries.size() + 1, real->produced());
+}
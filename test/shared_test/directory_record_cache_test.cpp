@@ -0,0 +1,312 @@
+#include <gtest/gtest.h>
+
+#include <directory_record_cache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+// waits for the given time, standing in for the cost of a system call
+void simulateCost(std::chrono::nanoseconds cost)
+{
+  const auto until = std::chrono::steady_clock::now() + cost;
+  while (std::chrono::steady_clock::now() < until) {
+  }
+}
+
+std::string toLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(), [](char c) {
+    return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  });
+  return s;
+}
+
+// simulated cost of the system calls made by MockFileSystem
+struct SyscallCosts
+{
+  std::chrono::nanoseconds open{0};
+  std::chrono::nanoseconds read{0};
+};
+
+/**
+ * in-memory file system, the "record" of a file is its name prefixed with the
+ * directory. every open and every read counts as one system call
+ */
+class MockFileSystem
+{
+public:
+  class Listing : public DirectoryListing<std::string>
+  {
+  public:
+    Listing(MockFileSystem& fs, const std::vector<std::string>& names,
+            std::string directory)
+        : m_FS(fs), m_Names(names), m_Directory(std::move(directory))
+    {}
+
+    bool read(const VisitorT& visitor) override
+    {
+      m_FS.syscall(m_FS.m_Costs.read);
+      if (m_Position >= m_Names.size()) {
+        return false;
+      }
+
+      const size_t end = std::min(m_Position + m_FS.m_BatchSize, m_Names.size());
+      for (; m_Position < end; ++m_Position) {
+        const std::string record = m_Directory + "/" + m_Names[m_Position];
+        visitor(m_Names[m_Position], record.data(), record.size());
+      }
+      return true;
+    }
+
+  private:
+    MockFileSystem& m_FS;
+    const std::vector<std::string>& m_Names;
+    std::string m_Directory;
+    size_t m_Position{0};
+  };
+
+  MockFileSystem(size_t batchSize, SyscallCosts costs = SyscallCosts())
+      : m_BatchSize(batchSize), m_Costs(costs)
+  {}
+
+  void addFile(const std::string& directory, const std::string& name)
+  {
+    auto& names = m_Directories[directory];
+    names.insert(std::lower_bound(names.begin(), names.end(), name), name);
+  }
+
+  std::unique_ptr<DirectoryListing<std::string>> open(const std::string& directory)
+  {
+    syscall(m_Costs.open);
+    auto iter = m_Directories.find(directory);
+    if (iter == m_Directories.end()) {
+      return nullptr;
+    }
+    return std::make_unique<Listing>(*this, iter->second, directory);
+  }
+
+  // what usvfs used to do: open the parent and query a single name
+  bool querySingle(const std::string& directory, const std::string& name,
+                   std::vector<uint8_t>& record)
+  {
+    syscall(m_Costs.open);
+    auto iter = m_Directories.find(directory);
+    if (iter == m_Directories.end()) {
+      return false;
+    }
+    syscall(m_Costs.read);
+    if (!std::binary_search(iter->second.begin(), iter->second.end(), name)) {
+      return false;
+    }
+    const std::string data = directory + "/" + name;
+    record.assign(data.begin(), data.end());
+    return true;
+  }
+
+  DirectoryRecordCache<std::string> cache(size_t maxOpen    = 16,
+                                          size_t maxPending = 1024)
+  {
+    return DirectoryRecordCache<std::string>(
+        [this](const std::string& directory) {
+          return open(directory);
+        },
+        &toLower, maxOpen, maxPending);
+  }
+
+  size_t syscalls() const { return m_Syscalls; }
+
+private:
+  void syscall(std::chrono::nanoseconds cost)
+  {
+    ++m_Syscalls;
+    if (cost.count() > 0) {
+      simulateCost(cost);
+    }
+  }
+
+  size_t m_BatchSize;
+  SyscallCosts m_Costs;
+  std::map<std::string, std::vector<std::string>> m_Directories;
+  size_t m_Syscalls{0};
+};
+
+std::string asString(const std::vector<uint8_t>& record)
+{
+  return std::string(record.begin(), record.end());
+}
+
+}  // namespace
+
+TEST(DirectoryRecordCacheTest, FindsRecords)
+{
+  MockFileSystem fs(2);
+  fs.addFile("mod1", "a.txt");
+  fs.addFile("mod1", "b.txt");
+  fs.addFile("mod1", "c.txt");
+  fs.addFile("mod2", "d.txt");
+
+  auto cache = fs.cache();
+  std::vector<uint8_t> record;
+
+  ASSERT_TRUE(cache.lookup("mod1", "c.txt", record));
+  EXPECT_EQ("mod1/c.txt", asString(record));
+  ASSERT_TRUE(cache.lookup("MOD1", "A.TXT", record));
+  EXPECT_EQ("mod1/a.txt", asString(record));
+  ASSERT_TRUE(cache.lookup("mod2", "d.txt", record));
+  EXPECT_EQ("mod2/d.txt", asString(record));
+  ASSERT_TRUE(cache.lookup("mod1", "b.txt", record));
+  EXPECT_EQ("mod1/b.txt", asString(record));
+
+  EXPECT_FALSE(cache.lookup("mod1", "missing.txt", record));
+  EXPECT_FALSE(cache.lookup("mod3", "a.txt", record));
+
+  // mod1, mod2 and the failed attempt on mod3
+  EXPECT_EQ(3, cache.numOpened());
+}
+
+TEST(DirectoryRecordCacheTest, EvictedListingsKeepTheirRecords)
+{
+  MockFileSystem fs(1);
+  for (int dir = 0; dir < 4; ++dir) {
+    for (int file = 0; file < 10; ++file) {
+      fs.addFile("dir" + std::to_string(dir), "file" + std::to_string(file));
+    }
+  }
+
+  // only two listings may be open at a time, look up in interleaved order
+  auto cache = fs.cache(2);
+  std::vector<uint8_t> record;
+  for (int file = 0; file < 10; ++file) {
+    for (int dir = 0; dir < 4; ++dir) {
+      const std::string dirName  = "dir" + std::to_string(dir);
+      const std::string fileName = "file" + std::to_string(file);
+      ASSERT_TRUE(cache.lookup(dirName, fileName, record));
+      EXPECT_EQ(dirName + "/" + fileName, asString(record));
+    }
+  }
+
+  EXPECT_EQ(4, cache.numOpened());
+}
+
+TEST(DirectoryRecordCacheTest, LimitsRecordsReadAhead)
+{
+  MockFileSystem fs(4);
+  for (int file = 0; file < 20; ++file) {
+    fs.addFile("dir", "file" + std::to_string(100 + file));
+  }
+
+  auto cache = fs.cache(16, 4);
+  std::vector<uint8_t> record;
+
+  // the whole listing is read, only the first few records are kept
+  ASSERT_TRUE(cache.lookup("dir", "file119", record));
+  EXPECT_EQ("dir/file119", asString(record));
+  EXPECT_EQ(4, cache.numPending());
+  EXPECT_EQ(1, cache.numOpened());
+
+  // consumed records are released
+  ASSERT_TRUE(cache.lookup("dir", "file100", record));
+  EXPECT_EQ("dir/file100", asString(record));
+  EXPECT_EQ(3, cache.numPending());
+
+  // dropped records are read again
+  ASSERT_TRUE(cache.lookup("dir", "file110", record));
+  EXPECT_EQ("dir/file110", asString(record));
+  EXPECT_EQ(2, cache.numOpened());
+  EXPECT_LE(cache.numPending(), 4);
+
+  EXPECT_FALSE(cache.lookup("dir", "missing", record));
+}
+
+TEST(DirectoryRecordCacheTest, ForgetsFinishedDirectories)
+{
+  MockFileSystem fs(2);
+  for (int dir = 0; dir < 10; ++dir) {
+    for (int file = 0; file < 3; ++file) {
+      fs.addFile("dir" + std::to_string(dir), "file" + std::to_string(file));
+    }
+  }
+
+  auto cache = fs.cache(2);
+  std::vector<uint8_t> record;
+  for (int dir = 0; dir < 10; ++dir) {
+    for (int file = 0; file < 3; ++file) {
+      ASSERT_TRUE(cache.lookup("dir" + std::to_string(dir),
+                               "file" + std::to_string(file), record));
+      // only the open listings are remembered, all of their records were used up
+      EXPECT_LE(cache.numDirectories(), 2);
+    }
+  }
+  EXPECT_EQ(0, cache.numPending());
+
+  EXPECT_FALSE(cache.lookup("missing", "file0", record));
+  EXPECT_LE(cache.numDirectories(), 2);
+}
+
+TEST(DirectoryRecordCacheTest, Benchmark)
+{
+  // a virtual directory with 30000 files spread over 200 mods, listed in name order
+  // so consecutive entries come from different mods
+  const int numMods  = 200;
+  const int numFiles = 30000;
+
+  SyscallCosts costs;
+  costs.open = std::chrono::microseconds(4);
+  costs.read = std::chrono::microseconds(2);
+
+  MockFileSystem fs(512, costs);
+  std::vector<std::pair<std::string, std::string>> listing;
+  for (int i = 0; i < numFiles; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "texture%05d.dds", i);
+    const std::string mod = "mod" + std::to_string((i * 7919) % numMods);
+    fs.addFile(mod, name);
+    listing.emplace_back(mod, name);
+  }
+
+  std::vector<uint8_t> record;
+
+  const size_t singleBefore = fs.syscalls();
+  auto singleStart          = std::chrono::steady_clock::now();
+  for (const auto& entry : listing) {
+    ASSERT_TRUE(fs.querySingle(entry.first, entry.second, record));
+  }
+  auto singleTime          = std::chrono::steady_clock::now() - singleStart;
+  const size_t singleCalls = fs.syscalls() - singleBefore;
+
+  using ms = std::chrono::duration<double, std::milli>;
+  printf("single-name queries: %zu calls, %.1f ms\n", singleCalls,
+         ms(singleTime).count());
+
+  // returns the number of calls for looking up the whole listing
+  auto batched = [&](const char* label, DirectoryRecordCache<std::string> cache) {
+    const size_t before = fs.syscalls();
+    auto start          = std::chrono::steady_clock::now();
+    for (const auto& entry : listing) {
+      EXPECT_TRUE(cache.lookup(entry.first, entry.second, record));
+    }
+    auto time          = std::chrono::steady_clock::now() - start;
+    const size_t calls = fs.syscalls() - before;
+    printf("%s %zu calls, %.1f ms\n", label, calls, ms(time).count());
+    return std::make_pair(calls, cache.numOpened());
+  };
+
+  // enough room for every record read ahead, each mod is listed once
+  const auto unbounded = batched("batched listings:   ", fs.cache(16, numFiles));
+  EXPECT_EQ(numMods, unbounded.second);
+  EXPECT_LT(unbounded.first * 10, singleCalls);
+
+  // the default limit only holds a few records of each mod at a time, so the mods
+  // are listed again and again, but far less often than files are looked up
+  const auto bounded = batched("default limit:      ", fs.cache());
+  EXPECT_LT(bounded.first * 4, singleCalls);
+}
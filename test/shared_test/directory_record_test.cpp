@@ -0,0 +1,333 @@
+#include <gtest/gtest.h>
+
+#include <directory_record.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+// layouts of the structures of every FILE_INFORMATION_CLASS handled in
+// file_information_utils.h, using portable types of the same size
+
+typedef char16_t MockWChar;
+
+struct MockLargeInteger
+{
+  int64_t QuadPart;
+};
+
+struct MockFileId128
+{
+  uint8_t Identifier[16];
+};
+
+#define MOCK_DIR_HEADER                                                                \
+  uint32_t NextEntryOffset;                                                            \
+  uint32_t FileIndex;                                                                  \
+  MockLargeInteger CreationTime;                                                       \
+  MockLargeInteger LastAccessTime;                                                     \
+  MockLargeInteger LastWriteTime;                                                      \
+  MockLargeInteger ChangeTime;                                                         \
+  MockLargeInteger EndOfFile;                                                          \
+  MockLargeInteger AllocationSize;                                                     \
+  uint32_t FileAttributes;                                                             \
+  uint32_t FileNameLength;
+
+// FileDirectoryInformation
+struct MockDirectoryInformation
+{
+  MOCK_DIR_HEADER
+  MockWChar FileName[1];
+};
+
+// FileFullDirectoryInformation
+struct MockFullDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  MockWChar FileName[1];
+};
+
+// FileIdFullDirectoryInformation
+struct MockIdFullDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  MockLargeInteger FileId;
+  MockWChar FileName[1];
+};
+
+// FileBothDirectoryInformation
+struct MockBothDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  char ShortNameLength;
+  MockWChar ShortName[12];
+  MockWChar FileName[1];
+};
+
+// FileIdBothDirectoryInformation
+struct MockIdBothDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  char ShortNameLength;
+  MockWChar ShortName[12];
+  MockLargeInteger FileId;
+  MockWChar FileName[1];
+};
+
+// FileIdExtdDirectoryInformation
+struct MockIdExtdDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockFileId128 FileId;
+  MockWChar FileName[1];
+};
+
+// FileIdExtdBothDirectoryInformation
+struct MockIdExtdBothDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockFileId128 FileId;
+  char ShortNameLength;
+  MockWChar ShortName[12];
+  MockWChar FileName[1];
+};
+
+// FileId64ExtdDirectoryInformation
+struct MockId64ExtdDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockLargeInteger FileId;
+  MockWChar FileName[1];
+};
+
+// FileId64ExtdBothDirectoryInformation
+struct MockId64ExtdBothDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockLargeInteger FileId;
+  char ShortNameLength;
+  MockWChar ShortName[12];
+  MockWChar FileName[1];
+};
+
+// FileIdAllExtdDirectoryInformation
+struct MockIdAllExtdDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockLargeInteger FileId;
+  MockFileId128 FileId128;
+  MockWChar FileName[1];
+};
+
+// FileIdAllExtdBothDirectoryInformation
+struct MockIdAllExtdBothDirInformation
+{
+  MOCK_DIR_HEADER
+  uint32_t EaSize;
+  uint32_t ReparsePointTag;
+  MockLargeInteger FileId;
+  MockFileId128 FileId128;
+  char ShortNameLength;
+  MockWChar ShortName[12];
+  MockWChar FileName[1];
+};
+
+#undef MOCK_DIR_HEADER
+
+// FileNamesInformation
+struct MockNamesInformation
+{
+  uint32_t NextEntryOffset;
+  uint32_t FileIndex;
+  uint32_t FileNameLength;
+  MockWChar FileName[1];
+};
+
+// FileStandardInformation
+struct MockStandardInformation
+{
+  MockLargeInteger AllocationSize;
+  MockLargeInteger EndOfFile;
+  uint32_t NumberOfLinks;
+  bool DeletePending;
+  bool Directory;
+};
+
+// FileNameInformation and FileNormalizedNameInformation
+struct MockNameInformation
+{
+  uint32_t FileNameLength;
+  MockWChar FileName[1];
+};
+
+// FileRenameInformation
+struct MockRenameInformation
+{
+  uint32_t Flags;
+  void* RootDirectory;
+  uint32_t FileNameLength;
+  MockWChar FileName[1];
+};
+
+// FileObjectIdInformation
+struct MockObjectIdInformation
+{
+  int64_t FileReference;
+  uint8_t ObjectId[16];
+  uint8_t ExtendedInfo[48];
+};
+
+// FileReparsePointInformation
+struct MockReparsePointInformation
+{
+  int64_t FileReference;
+  uint32_t Tag;
+};
+
+// FileAllInformation, abbreviated
+struct MockAllInformation
+{
+  MockStandardInformation StandardInformation;
+  MockNameInformation NameInformation;
+};
+
+FileMetadata sampleMetadata()
+{
+  FileMetadata metadata;
+  metadata.attributes     = 0x21;
+  metadata.size           = 0x123456789ALL;
+  metadata.allocationSize = 0x12345679000LL;
+  metadata.creationTime   = 132000000000000000LL;
+  metadata.lastAccessTime = 132000000000000001LL;
+  metadata.lastWriteTime  = 132000000000000002LL;
+  metadata.changeTime     = 132000000000000003LL;
+  metadata.valid          = true;
+  return metadata;
+}
+
+const std::u16string sampleName = u"Textures_Armor.dds";
+
+template <typename InfoT>
+class DirectoryRecordTest : public ::testing::Test
+{};
+
+typedef ::testing::Types<MockDirectoryInformation, MockFullDirInformation,
+                         MockBothDirInformation, MockNamesInformation>
+    ListingTypes;
+
+TYPED_TEST_SUITE(DirectoryRecordTest, ListingTypes);
+
+template <typename InfoT>
+class UnsupportedRecordTest : public ::testing::Test
+{};
+
+// the file id isn't recorded, so listings carrying one are always queried
+typedef ::testing::Types<
+    MockIdFullDirInformation, MockIdBothDirInformation, MockIdExtdDirInformation,
+    MockIdExtdBothDirInformation, MockId64ExtdDirInformation,
+    MockId64ExtdBothDirInformation, MockIdAllExtdDirInformation,
+    MockIdAllExtdBothDirInformation, MockStandardInformation, MockNameInformation,
+    MockRenameInformation, MockObjectIdInformation, MockReparsePointInformation,
+    MockAllInformation>
+    UnsupportedTypes;
+
+TYPED_TEST_SUITE(UnsupportedRecordTest, UnsupportedTypes);
+
+}  // namespace
+
+TYPED_TEST(DirectoryRecordTest, MatchesMetadata)
+{
+  ASSERT_TRUE(canSynthesizeRecord<TypeParam>());
+
+  // garbage in the buffer must not leak into the record
+  std::vector<uint8_t> buffer(512, 0xCD);
+  const FileMetadata metadata = sampleMetadata();
+
+  const size_t length = synthesizeRecord<TypeParam>(
+      metadata, sampleName.data(), sampleName.size(), buffer.data(), buffer.size());
+  ASSERT_EQ(offsetof(TypeParam, FileName) + sampleName.size() * sizeof(MockWChar),
+            length);
+  EXPECT_EQ(length, synthesizedRecordSize<TypeParam>(sampleName.size()));
+
+  const TypeParam* info = reinterpret_cast<const TypeParam*>(buffer.data());
+  EXPECT_EQ(0u, info->NextEntryOffset);
+  EXPECT_EQ(0u, info->FileIndex);
+  EXPECT_EQ(sampleName.size() * sizeof(MockWChar), info->FileNameLength);
+  EXPECT_EQ(sampleName, std::u16string(info->FileName, sampleName.size()));
+
+  if constexpr (requires { info->CreationTime; }) {
+    EXPECT_EQ(metadata.creationTime, info->CreationTime.QuadPart);
+    EXPECT_EQ(metadata.lastAccessTime, info->LastAccessTime.QuadPart);
+    EXPECT_EQ(metadata.lastWriteTime, info->LastWriteTime.QuadPart);
+    EXPECT_EQ(metadata.changeTime, info->ChangeTime.QuadPart);
+    EXPECT_EQ(static_cast<int64_t>(metadata.size), info->EndOfFile.QuadPart);
+    EXPECT_EQ(static_cast<int64_t>(metadata.allocationSize),
+              info->AllocationSize.QuadPart);
+    EXPECT_EQ(metadata.attributes, info->FileAttributes);
+  }
+  if constexpr (requires { info->EaSize; }) {
+    EXPECT_EQ(0u, info->EaSize);
+  }
+  if constexpr (requires { info->ShortNameLength; }) {
+    EXPECT_EQ(0, info->ShortNameLength);
+  }
+
+  // nothing is written past the record
+  EXPECT_EQ(0xCD, buffer[length]);
+}
+
+TYPED_TEST(DirectoryRecordTest, BufferTooSmall)
+{
+  const size_t required = synthesizedRecordSize<TypeParam>(sampleName.size());
+  std::vector<uint8_t> buffer(required - 1, 0xCD);
+
+  EXPECT_EQ(0u, synthesizeRecord<TypeParam>(sampleMetadata(), sampleName.data(),
+                                            sampleName.size(), buffer.data(),
+                                            buffer.size()));
+  EXPECT_EQ(std::vector<uint8_t>(required - 1, 0xCD), buffer);
+
+  buffer.resize(required);
+  EXPECT_EQ(required, synthesizeRecord<TypeParam>(sampleMetadata(), sampleName.data(),
+                                                  sampleName.size(), buffer.data(),
+                                                  buffer.size()));
+}
+
+TYPED_TEST(UnsupportedRecordTest, IsRejected)
+{
+  EXPECT_FALSE(canSynthesizeRecord<TypeParam>());
+
+  std::vector<uint8_t> buffer(512, 0xCD);
+  EXPECT_EQ(0u, synthesizeRecord<TypeParam>(sampleMetadata(), sampleName.data(),
+                                            sampleName.size(), buffer.data(),
+                                            buffer.size()));
+  EXPECT_EQ(std::vector<uint8_t>(512, 0xCD), buffer);
+}
+
+TEST(DirectoryRecordSynthesisTest, EmptyName)
+{
+  std::vector<uint8_t> buffer(512);
+  const size_t length = synthesizeRecord<MockBothDirInformation>(
+      sampleMetadata(), u"", 0, buffer.data(), buffer.size());
+  EXPECT_EQ(offsetof(MockBothDirInformation, FileName), length);
+  EXPECT_EQ(0u, reinterpret_cast<const MockBothDirInformation*>(buffer.data())
+                    ->FileNameLength);
+}
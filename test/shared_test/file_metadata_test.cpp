@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+
+#include <file_metadata.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace usvfs::shared;
+namespace fs = std::filesystem;
+
+namespace
+{
+
+const uint32_t ATTRIBUTE_READONLY  = 0x01;
+const uint32_t ATTRIBUTE_DIRECTORY = 0x10;
+const uint32_t ATTRIBUTE_NORMAL    = 0x80;
+
+// stand-ins for the windows structures, the conversions only rely on the member
+// names
+struct MockLargeInteger
+{
+  int64_t QuadPart;
+};
+
+struct MockFileTime
+{
+  uint32_t dwLowDateTime;
+  uint32_t dwHighDateTime;
+};
+
+struct MockFullDirInformation
+{
+  MockLargeInteger CreationTime;
+  MockLargeInteger LastAccessTime;
+  MockLargeInteger LastWriteTime;
+  MockLargeInteger ChangeTime;
+  MockLargeInteger EndOfFile;
+  MockLargeInteger AllocationSize;
+  uint32_t FileAttributes;
+};
+
+struct MockBasicInformation
+{
+  MockLargeInteger CreationTime;
+  MockLargeInteger LastAccessTime;
+  MockLargeInteger LastWriteTime;
+  MockLargeInteger ChangeTime;
+  uint32_t FileAttributes;
+};
+
+struct MockNetworkOpenInformation
+{
+  MockLargeInteger CreationTime;
+  MockLargeInteger LastAccessTime;
+  MockLargeInteger LastWriteTime;
+  MockLargeInteger ChangeTime;
+  MockLargeInteger AllocationSize;
+  MockLargeInteger EndOfFile;
+  uint32_t FileAttributes;
+};
+
+struct MockAttributeData
+{
+  uint32_t dwFileAttributes;
+  MockFileTime ftCreationTime;
+  MockFileTime ftLastAccessTime;
+  MockFileTime ftLastWriteTime;
+  uint32_t nFileSizeHigh;
+  uint32_t nFileSizeLow;
+};
+
+int64_t fromUnixSeconds(int64_t seconds)
+{
+  return toFileTime(std::chrono::system_clock::time_point(std::chrono::seconds(seconds)));
+}
+
+// produces the record a directory scan would have returned for the path, based on
+// stat()
+MockFullDirInformation scan(const fs::path& path)
+{
+  struct stat st;
+  EXPECT_EQ(0, stat(path.string().c_str(), &st));
+
+  MockFullDirInformation info{};
+  info.LastWriteTime.QuadPart  = fromUnixSeconds(st.st_mtime);
+  info.LastAccessTime.QuadPart = fromUnixSeconds(st.st_atime);
+  info.ChangeTime.QuadPart     = fromUnixSeconds(st.st_ctime);
+  info.CreationTime.QuadPart   = info.ChangeTime.QuadPart;
+  info.EndOfFile.QuadPart      = static_cast<int64_t>(st.st_size);
+  info.AllocationSize.QuadPart = (info.EndOfFile.QuadPart + 4095) & ~4095LL;
+
+  if ((st.st_mode & S_IFMT) == S_IFDIR) {
+    info.FileAttributes = ATTRIBUTE_DIRECTORY;
+  } else {
+    info.FileAttributes = ATTRIBUTE_NORMAL;
+  }
+  if ((st.st_mode & S_IWRITE) == 0) {
+    info.FileAttributes |= ATTRIBUTE_READONLY;
+  }
+
+  return info;
+}
+
+// last write time according to std::filesystem, truncated to seconds like stat()
+int64_t lastWriteTime(const fs::path& path)
+{
+  const auto time = std::chrono::file_clock::to_sys(fs::last_write_time(path));
+  return toFileTime(std::chrono::floor<std::chrono::seconds>(time));
+}
+
+int64_t join(const MockFileTime& time)
+{
+  return static_cast<int64_t>((static_cast<uint64_t>(time.dwHighDateTime) << 32) |
+                              time.dwLowDateTime);
+}
+
+class FileMetadataTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    m_Directory = fs::temp_directory_path() /
+                  ("usvfs_file_metadata_test_" +
+                   std::to_string(std::chrono::steady_clock::now()
+                                      .time_since_epoch()
+                                      .count()));
+    fs::create_directories(m_Directory);
+  }
+
+  void TearDown() override
+  {
+    std::error_code ec;
+    fs::permissions(m_Directory / "file.bin", fs::perms::owner_write,
+                    fs::perm_options::add, ec);
+    fs::remove_all(m_Directory, ec);
+  }
+
+  fs::path createFile(size_t size)
+  {
+    const fs::path path = m_Directory / "file.bin";
+    std::ofstream file(path, std::ios::binary);
+    file << std::string(size, 'x');
+    return path;
+  }
+
+  fs::path m_Directory;
+};
+
+}  // namespace
+
+TEST(FileMetadataConversionTest, FileTimeEpoch)
+{
+  EXPECT_EQ(FILETIME_UNIX_EPOCH, toFileTime(std::chrono::system_clock::time_point()));
+  EXPECT_EQ(FILETIME_UNIX_EPOCH + 10000000, fromUnixSeconds(1));
+}
+
+TEST(FileMetadataConversionTest, DefaultIsInvalid)
+{
+  FileMetadata metadata;
+  EXPECT_FALSE(metadata.valid);
+}
+
+TEST(FileMetadataConversionTest, LargeSizesAreSplit)
+{
+  MockFullDirInformation info{};
+  info.EndOfFile.QuadPart     = 0x123456789ALL;
+  info.LastWriteTime.QuadPart = 0x01D6E2A1B2C3D4E5LL;
+
+  MockAttributeData data{};
+  toAttributeData(metadataFromDirectoryInfo(info), data);
+  EXPECT_EQ(0x12u, data.nFileSizeHigh);
+  EXPECT_EQ(0x3456789Au, data.nFileSizeLow);
+  EXPECT_EQ(info.LastWriteTime.QuadPart, join(data.ftLastWriteTime));
+}
+
+TEST_F(FileMetadataTest, MatchesStat)
+{
+  const fs::path path = createFile(123457);
+  fs::last_write_time(path, fs::last_write_time(path) - std::chrono::hours(24 * 400));
+
+  const FileMetadata metadata = metadataFromDirectoryInfo(scan(path));
+  ASSERT_TRUE(metadata.valid);
+
+  MockAttributeData data{};
+  toAttributeData(metadata, data);
+  EXPECT_EQ(fs::file_size(path),
+            (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+  EXPECT_EQ(lastWriteTime(path), join(data.ftLastWriteTime));
+  EXPECT_EQ(0u, data.dwFileAttributes & ATTRIBUTE_DIRECTORY);
+  EXPECT_EQ(0u, data.dwFileAttributes & ATTRIBUTE_READONLY);
+
+  MockNetworkOpenInformation network{};
+  toNetworkOpenInformation(metadata, network);
+  EXPECT_EQ(static_cast<int64_t>(fs::file_size(path)), network.EndOfFile.QuadPart);
+  EXPECT_LE(network.EndOfFile.QuadPart, network.AllocationSize.QuadPart);
+  EXPECT_EQ(lastWriteTime(path), network.LastWriteTime.QuadPart);
+  EXPECT_EQ(data.dwFileAttributes, network.FileAttributes);
+
+  MockBasicInformation basic{};
+  toBasicInformation(metadata, basic);
+  EXPECT_EQ(lastWriteTime(path), basic.LastWriteTime.QuadPart);
+  EXPECT_EQ(network.CreationTime.QuadPart, basic.CreationTime.QuadPart);
+  EXPECT_EQ(data.dwFileAttributes, basic.FileAttributes);
+}
+
+TEST_F(FileMetadataTest, MatchesStatOfReadOnlyFile)
+{
+  const fs::path path = createFile(10);
+  fs::permissions(path, fs::perms::owner_write | fs::perms::group_write |
+                            fs::perms::others_write,
+                  fs::perm_options::remove);
+
+  MockAttributeData data{};
+  toAttributeData(metadataFromDirectoryInfo(scan(path)), data);
+  EXPECT_NE(0u, data.dwFileAttributes & ATTRIBUTE_READONLY);
+  EXPECT_EQ(10u, data.nFileSizeLow);
+}
+
+TEST_F(FileMetadataTest, MatchesStatOfDirectory)
+{
+  MockBasicInformation basic{};
+  toBasicInformation(metadataFromDirectoryInfo(scan(m_Directory)), basic);
+  EXPECT_NE(0u, basic.FileAttributes & ATTRIBUTE_DIRECTORY);
+  EXPECT_EQ(lastWriteTime(m_Directory), basic.LastWriteTime.QuadPart);
+}
+
+TEST_F(FileMetadataTest, WritesAreNotReflected)
+{
+  // the recorded metadata is a snapshot, which is why usvfs stops using it once a
+  // file is opened for writing
+  const fs::path path = createFile(100);
+  fs::last_write_time(path, fs::last_write_time(path) - std::chrono::hours(1));
+  const FileMetadata before = metadataFromDirectoryInfo(scan(path));
+
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    file << std::string(50, 'y');
+  }
+
+  const FileMetadata after = metadataFromDirectoryInfo(scan(path));
+  EXPECT_EQ(100u, before.size);
+  EXPECT_EQ(150u, after.size);
+  EXPECT_EQ(fs::file_size(path), after.size);
+  EXPECT_LT(before.lastWriteTime, after.lastWriteTime);
+}
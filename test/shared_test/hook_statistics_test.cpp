@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include <hook_statistics.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace usvfs::shared;
+
+TEST(HookStatisticsTest, Buckets)
+{
+  EXPECT_EQ(0u, LatencyBuckets::bucket(0));
+  EXPECT_EQ(1u, LatencyBuckets::bucket(1));
+  EXPECT_EQ(2u, LatencyBuckets::bucket(2));
+  EXPECT_EQ(2u, LatencyBuckets::bucket(3));
+  EXPECT_EQ(10u, LatencyBuckets::bucket(1023));
+  EXPECT_EQ(11u, LatencyBuckets::bucket(1024));
+  EXPECT_EQ(LatencyBuckets::COUNT - 1, LatencyBuckets::bucket(UINT64_MAX));
+
+  for (uint64_t ns : {1ull, 5ull, 100ull, 4096ull, 123456ull}) {
+    const uint32_t bucket = LatencyBuckets::bucket(ns);
+    EXPECT_LT(ns, LatencyBuckets::upperBound(bucket));
+    EXPECT_GE(ns, LatencyBuckets::upperBound(bucket - 1));
+  }
+}
+
+TEST(HookStatisticsTest, Percentile)
+{
+  HookStatistics stats;
+  EXPECT_EQ(0u, stats.percentile(0.5));
+
+  // 90 fast calls, 9 slower ones and one very slow one
+  stats.latency[LatencyBuckets::bucket(500)]     = 90;
+  stats.latency[LatencyBuckets::bucket(5000)]    = 9;
+  stats.latency[LatencyBuckets::bucket(5000000)] = 1;
+
+  EXPECT_EQ(512u, stats.percentile(0.0));
+  EXPECT_EQ(512u, stats.percentile(0.5));
+  EXPECT_EQ(512u, stats.percentile(0.9));
+  EXPECT_EQ(8192u, stats.percentile(0.95));
+  EXPECT_EQ(8192u, stats.percentile(0.99));
+  EXPECT_EQ(8388608u, stats.percentile(1.0));
+}
+
+TEST(HookStatisticsTest, Counters)
+{
+  auto table = std::make_unique<HookStatisticsTable>();
+  EXPECT_TRUE(table->snapshot().empty());
+
+  HookCounters* open = table->counters("hook_NtOpenFile");
+  ASSERT_NE(nullptr, open);
+  EXPECT_EQ(open, table->counters("hook_NtOpenFile"));
+  HookCounters* query = table->counters("hook_NtQueryAttributesFile");
+  ASSERT_NE(nullptr, query);
+  EXPECT_NE(open, query);
+
+  open->recordCall(100);
+  open->recordCall(3000);
+  open->recordLookup(true);
+  open->recordLookup(false);
+  open->recordLookup(false);
+  query->recordCall(10);
+  query->recordError();
+
+  const auto stats = table->snapshot();
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ("hook_NtOpenFile", stats[0].name);
+  EXPECT_EQ(2u, stats[0].calls);
+  EXPECT_EQ(1u, stats[0].reroutes);
+  EXPECT_EQ(2u, stats[0].misses);
+  EXPECT_EQ(0u, stats[0].errors);
+  EXPECT_EQ(3100u, stats[0].nanoseconds);
+  EXPECT_EQ(1u, stats[0].latency[LatencyBuckets::bucket(100)]);
+  EXPECT_EQ(1u, stats[0].latency[LatencyBuckets::bucket(3000)]);
+  EXPECT_EQ("hook_NtQueryAttributesFile", stats[1].name);
+  EXPECT_EQ(1u, stats[1].calls);
+  EXPECT_EQ(1u, stats[1].errors);
+
+  // names are truncated to fit the slot
+  const std::string longName(200, 'x');
+  EXPECT_EQ(table->counters(longName.c_str()),
+            table->counters(longName.substr(0, 63).c_str()));
+}
+
+TEST(HookStatisticsTest, Full)
+{
+  auto table = std::make_unique<HookStatisticsTable>();
+  for (uint32_t i = 0; i < HookStatisticsTable::SLOT_COUNT; ++i) {
+    const std::string name = "hook_" + std::to_string(i);
+    ASSERT_NE(nullptr, table->counters(name.c_str()));
+  }
+  EXPECT_EQ(nullptr, table->counters("one_too_many"));
+  EXPECT_NE(nullptr, table->counters("hook_17"));
+  EXPECT_EQ(HookStatisticsTable::SLOT_COUNT, table->snapshot().size());
+}
+
+TEST(HookStatisticsTest, ConcurrentClaims)
+{
+  const int numThreads = 8;
+  const int numHooks   = 40;
+  const int numCalls   = 1000;
+
+  auto table = std::make_unique<HookStatisticsTable>();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&table]() {
+      for (int i = 0; i < numCalls; ++i) {
+        const std::string name = "hook_" + std::to_string(i % numHooks);
+        table->counters(name.c_str())->recordCall(i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const auto stats = table->snapshot();
+  ASSERT_EQ(numHooks, static_cast<int>(stats.size()));
+  for (const HookStatistics& hook : stats) {
+    EXPECT_EQ(numThreads * numCalls / numHooks, static_cast<int>(hook.calls));
+  }
+}
+
+#ifdef __linux__
+
+TEST(HookStatisticsTest, MultiProcess)
+{
+  // processes of an instance count into the same shared table, claiming slots
+  // concurrently
+  const int numProcesses = 4;
+  const int numHooks     = 20;
+  const int numCalls     = 10000;
+
+  const size_t size = sizeof(HookStatisticsTable);
+  void* memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, memory);
+  HookStatisticsTable* table = new (memory) HookStatisticsTable;
+
+  std::vector<pid_t> children;
+  for (int p = 0; p < numProcesses; ++p) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      for (int i = 0; i < numCalls; ++i) {
+        const std::string name = "hook_" + std::to_string((i + p) % numHooks);
+        HookCounters* counters = table->counters(name.c_str());
+        counters->recordCall(1000);
+        counters->recordLookup(i % 4 == 0);
+      }
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+  for (pid_t pid : children) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+  }
+
+  const auto stats = table->snapshot();
+  ASSERT_EQ(numHooks, static_cast<int>(stats.size()));
+  uint64_t calls = 0, reroutes = 0, misses = 0;
+  for (const HookStatistics& hook : stats) {
+    EXPECT_EQ(numProcesses * numCalls / numHooks, static_cast<int>(hook.calls));
+    EXPECT_EQ(hook.calls, hook.latency[LatencyBuckets::bucket(1000)]);
+    EXPECT_EQ(1024u, hook.percentile(0.99));
+    calls += hook.calls;
+    reroutes += hook.reroutes;
+    misses += hook.misses;
+  }
+  EXPECT_EQ(uint64_t(numProcesses * numCalls), calls);
+  EXPECT_EQ(calls / 4, reroutes);
+  EXPECT_EQ(calls, reroutes + misses);
+
+  munmap(memory, size);
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+
+#include <hook_thread_state.h>
+
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+using usvfs::shared::BarrierTable;
+using usvfs::shared::HookGroupSet;
+
+namespace
+{
+
+// fake function addresses, spaced like real functions
+const void* function(int index)
+{
+  return reinterpret_cast<const void*>(0x7ff800010000ull + index * 0x1a0ull);
+}
+
+thread_local HookGroupSet t_Groups;
+thread_local BarrierTable t_Barriers;
+
+// what every hook entry used to do: fetch a lazily allocated per-thread object from
+// a TLS slot, keeping the last error intact, then use a bitset and a std::map
+class LegacyState
+{
+public:
+  static LegacyState& instance()
+  {
+#ifdef _WIN32
+    static const DWORD slot = TlsAlloc();
+    const DWORD lastError   = GetLastError();
+    auto* state             = static_cast<LegacyState*>(TlsGetValue(slot));
+    if (state == nullptr) {
+      state = new LegacyState();
+      TlsSetValue(slot, state);
+    }
+    SetLastError(lastError);
+#else
+    static const pthread_key_t key = []() {
+      pthread_key_t result;
+      pthread_key_create(&result, [](void* state) {
+        delete static_cast<LegacyState*>(state);
+      });
+      return result;
+    }();
+    auto* state = static_cast<LegacyState*>(pthread_getspecific(key));
+    if (state == nullptr) {
+      state = new LegacyState();
+      pthread_setspecific(key, state);
+    }
+#endif
+    return *state;
+  }
+
+  std::bitset<12> groups;
+  std::map<const void*, void*> barriers;
+};
+
+}  // namespace
+
+TEST(HookThreadStateTest, Groups)
+{
+  HookGroupSet groups{};
+
+  EXPECT_TRUE(groups.enter(3));
+  EXPECT_FALSE(groups.enter(3));
+  EXPECT_TRUE(groups.enter(5));
+  EXPECT_TRUE(groups.isActive(3));
+
+  // group 0 can be entered while others are active but then blocks all of them
+  EXPECT_TRUE(groups.enter(0));
+  EXPECT_FALSE(groups.enter(7));
+  groups.leave(0);
+  EXPECT_TRUE(groups.enter(7));
+
+  groups.leave(3);
+  EXPECT_FALSE(groups.isActive(3));
+  EXPECT_TRUE(groups.enter(3));
+}
+
+TEST(HookThreadStateTest, Barriers)
+{
+  BarrierTable barriers{};
+  bool found = true;
+
+  EXPECT_EQ(nullptr, barriers.release(function(1), found));
+  EXPECT_FALSE(found);
+
+  void** slot = barriers.lock(function(1));
+  ASSERT_NE(nullptr, slot);
+  *slot = reinterpret_cast<void*>(0x1234);
+
+  // recursive calls are let through to the original function
+  EXPECT_EQ(nullptr, barriers.lock(function(1)));
+  EXPECT_NE(nullptr, barriers.lock(function(2)));
+
+  EXPECT_EQ(reinterpret_cast<void*>(0x1234), barriers.release(function(1), found));
+  EXPECT_TRUE(found);
+  EXPECT_EQ(slot, barriers.lock(function(1)));
+
+  barriers.releaseAll();
+  EXPECT_NE(nullptr, barriers.lock(function(1)));
+  EXPECT_NE(nullptr, barriers.lock(function(2)));
+}
+
+TEST(HookThreadStateTest, Full)
+{
+  BarrierTable barriers{};
+  bool found = false;
+
+  for (uint32_t i = 0; i < BarrierTable::CAPACITY; ++i) {
+    void** slot = barriers.lock(function(i));
+    ASSERT_NE(nullptr, slot);
+    *slot = const_cast<void*>(function(i));
+  }
+  EXPECT_EQ(nullptr, barriers.lock(function(BarrierTable::CAPACITY)));
+
+  for (uint32_t i = 0; i < BarrierTable::CAPACITY; ++i) {
+    EXPECT_EQ(function(i), barriers.release(function(i), found));
+  }
+}
+
+TEST(HookThreadStateTest, PerThread)
+{
+  ASSERT_TRUE(t_Groups.enter(4));
+  ASSERT_NE(nullptr, t_Barriers.lock(function(1)));
+
+  bool otherGroup   = false;
+  bool otherBarrier = false;
+  std::thread([&]() {
+    otherGroup   = t_Groups.enter(4);
+    otherBarrier = t_Barriers.lock(function(1)) != nullptr;
+  }).join();
+
+  EXPECT_TRUE(otherGroup);
+  EXPECT_TRUE(otherBarrier);
+
+  bool found = false;
+  t_Barriers.release(function(1), found);
+  t_Groups.leave(4);
+  EXPECT_TRUE(found);
+}
+
+TEST(HookThreadStateTest, Benchmark)
+{
+  // a hook entry and exit: pass the barrier of the function, enter the group of the
+  // hook, leave both again. Cycles through the functions of a typical hook set
+  const int numIterations = 10000000;
+  const int numFunctions  = 48;
+  size_t checksum         = 0;
+
+  auto legacyStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    const void* func = function(i % numFunctions);
+    const size_t grp = i % 11 + 1;
+
+    auto& barriers = LegacyState::instance().barriers;
+    auto iter      = barriers.find(func);
+    if ((iter == barriers.end()) || (iter->second == nullptr)) {
+      barriers[func] = reinterpret_cast<void*>(1);
+    }
+    auto& groups = LegacyState::instance().groups;
+    if (!groups.test(grp) && !groups.test(0)) {
+      groups.set(grp, true);
+      ++checksum;
+    }
+    LegacyState::instance().groups.set(grp, false);
+    LegacyState::instance().barriers[func] = nullptr;
+  }
+  auto legacyTime = std::chrono::steady_clock::now() - legacyStart;
+
+  bool found    = false;
+  auto tlsStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    const void* func   = function(i % numFunctions);
+    const uint32_t grp = i % 11 + 1;
+
+    t_Barriers.lock(func);
+    if (t_Groups.enter(grp)) {
+      --checksum;
+    }
+    t_Groups.leave(grp);
+    t_Barriers.release(func, found);
+  }
+  auto tlsTime = std::chrono::steady_clock::now() - tlsStart;
+
+  using ns = std::chrono::duration<double, std::nano>;
+  printf("tls slot + map: %.1f ns per hook entry\n",
+         ns(legacyTime).count() / numIterations);
+  printf("thread_local:   %.1f ns per hook entry\n",
+         ns(tlsTime).count() / numIterations);
+
+  EXPECT_EQ(0u, checksum);
+  EXPECT_LT(tlsTime, legacyTime);
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <lock_statistics.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+class LockStatisticsTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    m_Table = std::make_unique<LockStatisticsTable>();
+    LockStatisticsTable::setCurrent(m_Table.get());
+  }
+
+  void TearDown() override { LockStatisticsTable::setCurrent(nullptr); }
+
+  std::unique_ptr<LockStatisticsTable> m_Table;
+  std::mutex m_Mutex;
+};
+
+}  // namespace
+
+TEST_F(LockStatisticsTest, Disabled)
+{
+  {
+    ProfiledScopedLock lock(m_Mutex, LockId::PARAMETERS, "first");
+  }
+  EXPECT_TRUE(m_Table->snapshot().empty());
+
+  // no table at all
+  LockStatisticsTable::setCurrent(nullptr);
+  m_Table->setEnabled(true);
+  {
+    ProfiledScopedLock lock(m_Mutex, LockId::PARAMETERS, "first");
+  }
+  EXPECT_TRUE(m_Table->snapshot().empty());
+}
+
+TEST_F(LockStatisticsTest, Uncontended)
+{
+  m_Table->setEnabled(true);
+  for (int i = 0; i < 3; ++i) {
+    ProfiledScopedLock lock(m_Mutex, LockId::PARAMETERS, "first");
+  }
+  profiledLock(
+      LockId::CONTEXT, false, "reader",
+      []() {
+        return true;
+      },
+      []() {});
+
+  const auto locks = m_Table->snapshot();
+  ASSERT_EQ(2u, locks.size());
+  EXPECT_EQ("context read", locks[0].name);
+  EXPECT_EQ(1u, locks[0].acquisitions);
+  EXPECT_EQ("reader", locks[0].lastHolder);
+
+  EXPECT_EQ("parameters", locks[1].name);
+  EXPECT_EQ(3u, locks[1].acquisitions);
+  EXPECT_EQ(0u, locks[1].contended);
+  EXPECT_EQ(0u, locks[1].waitNanoseconds);
+  EXPECT_EQ("first", locks[1].lastHolder);
+  EXPECT_EQ("", locks[1].maxWaitHolder);
+}
+
+TEST_F(LockStatisticsTest, Contended)
+{
+  m_Table->setEnabled(true);
+
+  std::unique_ptr<ProfiledScopedLock<std::mutex>> held =
+      std::make_unique<ProfiledScopedLock<std::mutex>>(m_Mutex, LockId::TREE_META,
+                                                       "hook_NtCreateFile");
+  std::thread waiter([&]() {
+    ProfiledScopedLock lock(m_Mutex, LockId::TREE_META, "hook_NtClose");
+  });
+  std::this_thread::sleep_for(LockStatisticsTable::TIMEOUT +
+                              std::chrono::milliseconds(50));
+  held.reset();
+  waiter.join();
+
+  const auto locks = m_Table->snapshot();
+  ASSERT_EQ(1u, locks.size());
+  EXPECT_EQ("tree meta", locks[0].name);
+  EXPECT_EQ(2u, locks[0].acquisitions);
+  EXPECT_EQ(1u, locks[0].contended);
+  EXPECT_EQ(1u, locks[0].timeouts);
+  EXPECT_GE(locks[0].maxWaitNanoseconds, 200000000u);
+  EXPECT_EQ(locks[0].maxWaitNanoseconds, locks[0].waitNanoseconds);
+  EXPECT_EQ("hook_NtCreateFile", locks[0].maxWaitHolder);
+  EXPECT_EQ("hook_NtClose", locks[0].lastHolder);
+}
+
+TEST_F(LockStatisticsTest, LongNames)
+{
+  m_Table->setEnabled(true);
+  const std::string name(100, 'x');
+  {
+    ProfiledScopedLock lock(m_Mutex, LockId::PARAMETERS, name.c_str());
+  }
+
+  EXPECT_EQ(name.substr(0, SharedName::LENGTH - 1),
+            m_Table->snapshot().front().lastHolder);
+}
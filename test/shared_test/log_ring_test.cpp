@@ -0,0 +1,365 @@
+#include <gtest/gtest.h>
+
+#include <log_ring.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <boost/interprocess/ipc/message_queue.hpp>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+struct AlignedDelete
+{
+  void operator()(void* memory) const
+  {
+    ::operator delete(memory, std::align_val_t(64));
+  }
+};
+
+class RingMemory
+{
+public:
+  explicit RingMemory(uint32_t capacity)
+      : m_Memory(::operator new(LogRing::requiredSize(LogRing::roundCapacity(capacity)),
+                                std::align_val_t(64))),
+        m_Ring(LogRing::create(m_Memory.get(), capacity))
+  {}
+
+  LogRing* operator->() const { return m_Ring; }
+  void* memory() const { return m_Memory.get(); }
+
+private:
+  std::unique_ptr<void, AlignedDelete> m_Memory;
+  LogRing* m_Ring;
+};
+
+std::string makeText(size_t length, char seed)
+{
+  std::string result(length, ' ');
+  for (size_t i = 0; i < length; ++i) {
+    result[i] = static_cast<char>('a' + (seed + i) % 26);
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(LogRingTest, RoundTrip)
+{
+  RingMemory ring(64);
+  EXPECT_EQ(ring.memory(), LogRing::open(ring.memory()));
+  EXPECT_EQ(64u, ring->capacity());
+
+  uint8_t level;
+  std::string text;
+  EXPECT_FALSE(ring->tryPop(level, text));
+
+  EXPECT_TRUE(ring->tryPush(2, "hello", 5));
+  EXPECT_TRUE(ring->tryPush(4, "", 0));
+  EXPECT_TRUE(ring->tryPop(level, text));
+  EXPECT_EQ(2, level);
+  EXPECT_EQ("hello", text);
+  EXPECT_TRUE(ring->tryPop(level, text));
+  EXPECT_EQ(4, level);
+  EXPECT_EQ("", text);
+  EXPECT_FALSE(ring->tryPop(level, text));
+}
+
+TEST(LogRingTest, Capacity)
+{
+  EXPECT_EQ(LogRing::MIN_CAPACITY, LogRing::roundCapacity(0));
+  EXPECT_EQ(1024u, LogRing::roundCapacity(1000));
+  EXPECT_EQ(1024u, LogRing::roundCapacity(1024));
+
+  std::vector<char> memory(LogRing::requiredSize(LogRing::MIN_CAPACITY));
+  EXPECT_EQ(nullptr, LogRing::open(memory.data()));
+}
+
+TEST(LogRingTest, WakesWaitingReader)
+{
+  RingMemory ring(64);
+
+  // nobody is waiting
+  EXPECT_FALSE(ring->hasRecord());
+  EXPECT_TRUE(ring->tryPush(1, "a", 1));
+  EXPECT_FALSE(ring->takeReaderWaiting());
+  EXPECT_TRUE(ring->hasRecord());
+
+  uint8_t level;
+  std::string text;
+  EXPECT_TRUE(ring->tryPop(level, text));
+  EXPECT_FALSE(ring->hasRecord());
+
+  // only the first writer after the announcement wakes the reader
+  ring->setReaderWaiting();
+  EXPECT_TRUE(ring->tryPush(1, "b", 1));
+  EXPECT_TRUE(ring->takeReaderWaiting());
+  EXPECT_TRUE(ring->tryPush(1, "c", 1));
+  EXPECT_FALSE(ring->takeReaderWaiting());
+}
+
+TEST(LogRingTest, LongRecords)
+{
+  RingMemory ring(64);
+  uint8_t level;
+  std::string text;
+
+  // every length around the slot boundaries, many times around the ring
+  for (size_t length = 0; length < 1000; ++length) {
+    const std::string expected = makeText(length, static_cast<char>(length));
+    ASSERT_TRUE(ring->tryPush(1, expected.data(), expected.size()));
+    ASSERT_TRUE(ring->tryPop(level, text));
+    ASSERT_EQ(expected, text);
+  }
+
+  const std::string tooLong = makeText(LogRing::maxRecordLength() + 100, 0);
+  EXPECT_TRUE(ring->tryPush(3, tooLong.data(), tooLong.size()));
+  EXPECT_TRUE(ring->tryPop(level, text));
+  EXPECT_EQ(tooLong.substr(0, LogRing::maxRecordLength()), text);
+}
+
+TEST(LogRingTest, Full)
+{
+  RingMemory ring(64);
+  const std::string message = makeText(200, 0);
+
+  // two slots per record
+  int written = 0;
+  while (ring->tryPush(1, message.data(), message.size())) {
+    ++written;
+  }
+  EXPECT_EQ(32, written);
+
+  ring->recordDropped(1);
+  ring->recordDropped(1);
+  ring->recordDropped(200);
+  EXPECT_EQ(2u, ring->takeDropped(1));
+  EXPECT_EQ(0u, ring->takeDropped(1));
+  EXPECT_EQ(1u, ring->takeDropped(LogRing::LEVEL_COUNT - 1));
+
+  // a record fits again once the reader made room for all of its slots
+  uint8_t level;
+  std::string text;
+  EXPECT_TRUE(ring->tryPop(level, text));
+  EXPECT_FALSE(ring->tryPush(1, makeText(300, 0).data(), 300));
+  EXPECT_TRUE(ring->tryPush(1, message.data(), message.size()));
+}
+
+TEST(LogRingTest, ConcurrentWriters)
+{
+  const int numThreads  = 8;
+  const int numMessages = 20000;
+
+  RingMemory ring(256);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < numThreads; ++t) {
+    writers.emplace_back([&ring, t]() {
+      for (int i = 0; i < numMessages; ++i) {
+        // a different length for each message so records span varying numbers of
+        // slots
+        std::string message = std::to_string(t) + ":" + std::to_string(i) + ":";
+        message += makeText(i % 300, static_cast<char>(i));
+        while (!ring->tryPush(static_cast<uint8_t>(t), message.data(),
+                              message.size())) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> next(numThreads, 0);
+  uint8_t level;
+  std::string text;
+  for (int received = 0; received < numThreads * numMessages;) {
+    if (!ring->tryPop(level, text)) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    ASSERT_LT(level, numThreads);
+    const int i = next[level]++;
+    std::string expected = std::to_string(level) + ":" + std::to_string(i) + ":";
+    expected += makeText(i % 300, static_cast<char>(i));
+    ASSERT_EQ(expected, text);
+    ++received;
+  }
+
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  EXPECT_FALSE(ring->tryPop(level, text));
+}
+
+TEST(LogRingTest, BurstDropRate)
+{
+  // a burst of info messages as during startup, written with the policy of the shm
+  // sink (dropped if the ring is full) while the reader drains it concurrently
+  const int numThreads  = 8;
+  const int numMessages = 2000;
+  const std::string message =
+      "NtQueryAttributesFile C:\\Games\\Skyrim Special Edition\\Data\\meshes";
+
+  auto burst = [&](uint32_t capacity) {
+    RingMemory ring(capacity);
+    std::atomic<int> finished{0};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < numThreads; ++t) {
+      writers.emplace_back([&]() {
+        for (int i = 0; i < numMessages; ++i) {
+          if (!ring->tryPush(2, message.data(), message.size())) {
+            ring->recordDropped(2);
+          }
+        }
+        ++finished;
+      });
+    }
+
+    int received = 0;
+    uint8_t level;
+    std::string text;
+    for (;;) {
+      const bool done = (finished == numThreads);
+      while (ring->tryPop(level, text)) {
+        ++received;
+      }
+      if (done) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+
+    const uint32_t dropped = ring->takeDropped(2);
+    EXPECT_EQ(numThreads * numMessages, received + static_cast<int>(dropped));
+    return static_cast<double>(dropped) / (numThreads * numMessages);
+  };
+
+  const double small  = burst(LogRing::MIN_CAPACITY);
+  const double normal = burst(4096);
+  // enough slots for the whole burst
+  const double large = burst(numThreads * numMessages);
+
+  printf("drop rate with %u slots: %.1f%%\n", LogRing::MIN_CAPACITY, small * 100);
+  printf("drop rate with 4096 slots: %.1f%%\n", normal * 100);
+  printf("drop rate with %u slots: %.1f%%\n",
+         LogRing::roundCapacity(numThreads * numMessages), large * 100);
+
+  EXPECT_EQ(0.0, large);
+}
+
+#ifdef __linux__
+
+TEST(LogRingTest, MultiProcessBenchmark)
+{
+  // several processes logging to one reader, as hooked processes do. The comparison
+  // sends the same messages through the message queue the shm sink used before,
+  // which takes an interprocess mutex for every message
+  namespace bi              = boost::interprocess;
+  const int numProcesses    = 4;
+  const int numMessages     = 50000;
+  const std::string message =
+      "NtCreateFile C:\\Games\\Skyrim Special Edition\\Data\\meshes\\armor\\piece.nif "
+      "-> C:\\mods\\armor\\piece.nif";
+
+  auto runWriters = [&](auto write) {
+    std::vector<pid_t> children;
+    for (int p = 0; p < numProcesses; ++p) {
+      const pid_t pid = fork();
+      if (pid == 0) {
+        for (int i = 0; i < numMessages; ++i) {
+          write();
+        }
+        _exit(0);
+      }
+      children.push_back(pid);
+    }
+    return children;
+  };
+
+  auto waitWriters = [](const std::vector<pid_t>& children) {
+    for (pid_t pid : children) {
+      int status = 0;
+      waitpid(pid, &status, 0);
+      EXPECT_TRUE(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+  };
+
+  const int total = numProcesses * numMessages;
+
+  // message queue
+  const char* queueName = "usvfs_log_ring_benchmark";
+  bi::message_queue::remove(queueName);
+  std::chrono::steady_clock::duration queueTime;
+  {
+    bi::message_queue queue(bi::create_only, queueName, 1024, 512);
+    std::vector<char> buffer(512);
+
+    const auto start    = std::chrono::steady_clock::now();
+    const auto children = runWriters([&]() {
+      queue.send(message.data(), static_cast<unsigned int>(message.size()), 0);
+    });
+    bi::message_queue::size_type size;
+    unsigned int priority;
+    for (int received = 0; received < total; ++received) {
+      queue.receive(buffer.data(), buffer.size(), size, priority);
+    }
+    queueTime = std::chrono::steady_clock::now() - start;
+    waitWriters(children);
+  }
+  bi::message_queue::remove(queueName);
+
+  // ring
+  const size_t size = LogRing::requiredSize(4096);
+  void* memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, memory);
+  LogRing* ring = LogRing::create(memory, 4096);
+  std::chrono::steady_clock::duration ringTime;
+  {
+    const auto start    = std::chrono::steady_clock::now();
+    const auto children = runWriters([&]() {
+      while (!ring->tryPush(2, message.data(), message.size())) {
+        sched_yield();
+      }
+    });
+    uint8_t level;
+    std::string text;
+    for (int received = 0; received < total;) {
+      if (ring->tryPop(level, text)) {
+        ++received;
+      } else {
+        sched_yield();
+      }
+    }
+    ringTime = std::chrono::steady_clock::now() - start;
+    waitWriters(children);
+    EXPECT_EQ(message, text);
+  }
+  munmap(memory, size);
+
+  using ns = std::chrono::duration<double, std::nano>;
+  printf("message queue: %.0f ns per message\n", ns(queueTime).count() / total);
+  printf("ring:          %.0f ns per message\n", ns(ringTime).count() / total);
+
+  EXPECT_LT(ringTime, queueTime);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include <logger_handle.h>
+#include <spdlog/sinks/null_sink.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using usvfs::log::LoggerHandle;
+
+namespace
+{
+
+class LoggerHandleTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    m_Logger = spdlog::create<spdlog::sinks::null_sink_mt>("handle_test");
+    m_Logger->set_level(spdlog::level::info);
+  }
+
+  void TearDown() override { spdlog::drop("handle_test"); }
+
+  std::shared_ptr<spdlog::logger> m_Logger;
+};
+
+int g_Evaluated = 0;
+
+int expensive()
+{
+  ++g_Evaluated;
+  return 42;
+}
+
+}  // namespace
+
+TEST_F(LoggerHandleTest, Resolves)
+{
+  LoggerHandle handle("handle_test");
+  EXPECT_EQ(m_Logger.get(), handle.get());
+  EXPECT_EQ(m_Logger.get(), handle.enabled(spdlog::level::info));
+  EXPECT_EQ(nullptr, handle.enabled(spdlog::level::debug));
+
+  LoggerHandle missing("no_such_logger");
+  EXPECT_EQ(nullptr, missing.get());
+  EXPECT_EQ(nullptr, missing.enabled(spdlog::level::critical));
+  // nothing to log to is not an error
+  USVFS_LOG(missing, critical, "{}", expensive());
+  EXPECT_EQ(0, g_Evaluated);
+}
+
+TEST_F(LoggerHandleTest, FollowsLevelChanges)
+{
+  LoggerHandle handle("handle_test");
+  g_Evaluated = 0;
+
+  USVFS_LOG(handle, debug, "{}", expensive());
+  EXPECT_EQ(0, g_Evaluated);
+  USVFS_LOG(handle, info, "{}", expensive());
+  EXPECT_EQ(1, g_Evaluated);
+
+  m_Logger->set_level(spdlog::level::debug);
+  USVFS_LOG(handle, debug, "{}", expensive());
+  EXPECT_EQ(2, g_Evaluated);
+
+  m_Logger->set_level(spdlog::level::off);
+  USVFS_LOG(handle, critical, "{}", expensive());
+  EXPECT_EQ(2, g_Evaluated);
+}
+
+TEST_F(LoggerHandleTest, Refresh)
+{
+  LoggerHandle handle("handle_test");
+  spdlog::logger* first = handle.get();
+
+  spdlog::drop("handle_test");
+  auto replacement = spdlog::create<spdlog::sinks::null_sink_mt>("handle_test");
+  EXPECT_EQ(first, handle.get());
+
+  handle.refresh();
+  EXPECT_EQ(replacement.get(), handle.get());
+  // the old logger is kept alive for threads that may still use it
+  EXPECT_EQ(spdlog::level::info, first->level());
+}
+
+TEST_F(LoggerHandleTest, Benchmark)
+{
+  // a disabled debug message with an argument that has to be converted, as in most
+  // hooks: the registry lookup of spdlog::get() against the cached handle
+  const int numIterations = 1000000;
+  const std::wstring path = L"C:\\Games\\Skyrim Special Edition\\Data\\meshes";
+  auto convert            = [](const std::wstring& value) {
+    return std::string(value.begin(), value.end());
+  };
+
+  LoggerHandle handle("handle_test");
+  size_t checksum = 0;
+
+  auto registryStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    spdlog::get("handle_test")->debug("{}", convert(path));
+    checksum += i;
+  }
+  auto registryTime = std::chrono::steady_clock::now() - registryStart;
+
+  auto handleStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    USVFS_LOG(handle, debug, "{}", convert(path));
+    checksum -= i;
+  }
+  auto handleTime = std::chrono::steady_clock::now() - handleStart;
+
+  using ns = std::chrono::duration<double, std::nano>;
+  printf("spdlog::get: %.1f ns per disabled message\n",
+         ns(registryTime).count() / numIterations);
+  printf("handle:      %.1f ns per disabled message\n",
+         ns(handleTime).count() / numIterations);
+
+  EXPECT_EQ(0u, checksum);
+  EXPECT_LT(handleTime, registryTime);
+}
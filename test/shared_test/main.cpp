@@ -63,6 +63,18 @@ inline void usvfs::shared::dataAssign<SHMString>(SHMString& destination,
   destination.assign(source.c_str());
 }
 
+// counts the nodes of a subtree by walking it and checks the count every node in it
+// keeps
+static size_t checkNodeCount(const TreeType& node)
+{
+  size_t count = 1;
+  for (auto iter = node.filesBegin(); iter != node.filesEnd(); ++iter) {
+    count += checkNodeCount(*iter->second);
+  }
+  EXPECT_EQ(count, node.numNodesRecursive()) << node.name();
+  return count;
+}
+
 static std::shared_ptr<spdlog::logger> logger()
 {
   std::shared_ptr<spdlog::logger> result = spdlog::get("test");
@@ -112,6 +124,24 @@ TEST(DirectoryTreeTest, FindNode)
   EXPECT_EQ(nullptr, tree->findNode(R"(C:\temp\bla\blubb)").get());
 }
 
+TEST(DirectoryTreeTest, UpperCaseOrder)
+{
+  shared_memory_object::remove(g_SHMName);
+  ContainerType tree(g_SHMName, 64 * 1024);
+  for (const char* name : {"ab", "a_b", "AC"}) {
+    EXPECT_NE(nullptr, tree.addFile(std::string(R"(C:\temp\)") + name, 0, false));
+  }
+
+  // '_' sorts after the letters once they are upper-cased, like in NTFS listings
+  auto node = tree->findNode(R"(C:\temp)");
+  std::vector<std::string> names;
+  for (auto iter = node->filesBegin(); iter != node->filesEnd(); ++iter) {
+    names.push_back(iter->second->name());
+  }
+  EXPECT_EQ((std::vector<std::string>{"ab", "AC", "a_b"}), names);
+  EXPECT_NE(nullptr, tree->findNode(R"(C:\temp\A_B)").get());
+}
+
 struct TestVisitor
 {
   TreeType::NodePtrT lastNode;
@@ -239,6 +269,129 @@ TEST(DirectoryTreeTest, SHMAllocationErrorComplex)
   });
 }
 
+TEST(DirectoryTreeTest, NodeCountAdd)
+{
+  shared_memory_object::remove(g_SHMName);
+  ContainerType tree(g_SHMName, 64 * 1024);
+  EXPECT_EQ(1, checkNodeCount(*tree.get()));
+  uint32_t changes = tree->changeCount();
+
+  tree.addFile(R"(C:\temp\abc)", 1, 0, false);
+  EXPECT_EQ(4, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+
+  // intermediate directories are added as dummies
+  tree.addFile(R"(C:\temp\sub\deep\file)", 2, 0, false);
+  EXPECT_TRUE(tree->findNode(R"(C:\temp\sub\deep)")->hasFlag(FLAG_DUMMY));
+  EXPECT_EQ(7, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+
+  const uint32_t tempChanges = tree->findNode(R"(C:\temp)")->changeCount();
+  tree.addDirectory(R"(D:\data)", 3, 0, false);
+  EXPECT_EQ(9, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+  // other subtrees don't change
+  EXPECT_EQ(tempChanges, tree->findNode(R"(C:\temp)")->changeCount());
+
+  // adding existing nodes without overwriting adds nothing
+  EXPECT_EQ(nullptr, tree.addFile(R"(C:\temp\abc)", 4, 0, false));
+  EXPECT_EQ(nullptr, tree.addDirectory(R"(C:\temp\sub)", 4, 0, false));
+  EXPECT_EQ(9, checkNodeCount(*tree.get()));
+  EXPECT_EQ(changes, tree->changeCount());
+  EXPECT_EQ(3, tree->findNode(R"(C:\temp\sub)")->numNodesRecursive());
+}
+
+TEST(DirectoryTreeTest, NodeCountOverwrite)
+{
+  shared_memory_object::remove(g_SHMName);
+  ContainerType tree(g_SHMName, 64 * 1024);
+  tree.addFile(R"(C:\temp\abc)", 1, 0, false);
+  tree.addFile(R"(C:\temp\sub\file)", 2, 0, false);
+  uint32_t changes = tree->changeCount();
+  const uint32_t fileChanges = tree->findNode(R"(C:\temp\abc)")->changeCount();
+
+  // the node count stays the same, but results derived from the tree may not
+  EXPECT_NE(nullptr, tree.addFile(R"(C:\temp\abc)", 3, 0, true));
+  EXPECT_EQ(3, tree->findNode(R"(C:\temp\abc)")->data());
+  EXPECT_EQ(6, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  EXPECT_NE(fileChanges, tree->findNode(R"(C:\temp\abc)")->changeCount());
+  changes = tree->changeCount();
+
+  // replacing a dummy directory keeps the nodes below it
+  EXPECT_NE(nullptr, tree.addDirectory(R"(C:\temp\sub)", 4, 0, true));
+  EXPECT_FALSE(tree->findNode(R"(C:\temp\sub)")->hasFlag(FLAG_DUMMY));
+  EXPECT_EQ(6, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  EXPECT_EQ(2, tree->findNode(R"(C:\temp\sub)")->numNodesRecursive());
+}
+
+TEST(DirectoryTreeTest, NodeCountRemove)
+{
+  shared_memory_object::remove(g_SHMName);
+  ContainerType tree(g_SHMName, 64 * 1024);
+  tree.addFile(R"(C:\temp\abc)", 1, 0, false);
+  tree.addFile(R"(C:\temp\abd)", 2, 0, false);
+  tree.addFile(R"(C:\temp\sub\deep\file)", 3, 0, false);
+  tree.addFile(R"(D:\data\file)", 4, 0, false);
+  EXPECT_EQ(11, checkNodeCount(*tree.get()));
+  uint32_t changes = tree->changeCount();
+
+  TreeType::NodePtrT temp = tree->findNode(R"(C:\temp)");
+  temp->erase(temp->filesBegin());
+  EXPECT_EQ(nullptr, tree->findNode(R"(C:\temp\abc)"));
+  EXPECT_EQ(10, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+
+  // removes the subtree below the node as well
+  TreeType::NodePtrT sub = tree->findNode(R"(C:\temp\sub)");
+  sub->removeFromTree();
+  EXPECT_EQ(7, checkNodeCount(*tree.get()));
+  EXPECT_EQ(3, tree->findNode("C:")->numNodesRecursive());
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+
+  // a removed node doesn't belong to the tree anymore
+  sub->clear();
+  EXPECT_EQ(7, checkNodeCount(*tree.get()));
+  EXPECT_EQ(changes, tree->changeCount());
+
+  tree->findNode("D:")->clear();
+  EXPECT_EQ(5, checkNodeCount(*tree.get()));
+  EXPECT_EQ(1, tree->findNode("D:")->numNodesRecursive());
+  EXPECT_NE(changes, tree->changeCount());
+  changes = tree->changeCount();
+
+  tree->clear();
+  EXPECT_EQ(1, checkNodeCount(*tree.get()));
+  EXPECT_NE(changes, tree->changeCount());
+}
+
+TEST(DirectoryTreeTest, NodeCountReallocation)
+{
+  shared_memory_object::remove(g_SHMName);
+  ContainerType tree(g_SHMName, 4096);
+  const TreeType* initial = tree.get();
+  uint32_t changes        = tree->changeCount();
+  for (char i = 'a'; i <= 'z'; ++i) {
+    for (char j = 'a'; j <= 'z'; ++j) {
+      tree.addFile(std::string(R"(C:\temp\)") + i + R"(\)" + j, 1, 0, false);
+      // the copy must not count from scratch
+      EXPECT_LT(changes, tree->changeCount());
+      changes = tree->changeCount();
+    }
+  }
+  EXPECT_NE(initial, tree.get());
+
+  // the tree was copied to larger blocks of shared memory along the way
+  EXPECT_EQ(3 + 26 * 27, checkNodeCount(*tree.get()));
+  EXPECT_EQ(27, tree->findNode(R"(C:\temp\q)")->numNodesRecursive());
+}
+
 int main(int argc, char** argv)
 {
   auto logger = spdlog::stdout_logger_mt("usvfs");
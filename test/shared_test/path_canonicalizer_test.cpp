@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+
+#include <path_canonicalizer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cwctype>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+bool isSeparator(char16_t c)
+{
+  return (c == u'\\') || (c == u'/');
+}
+
+bool startsWith(const std::u16string& s, const std::u16string& prefix)
+{
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+std::vector<std::u16string> splitNames(const std::u16string& path)
+{
+  std::vector<std::u16string> result;
+  std::u16string name;
+  for (char16_t c : path) {
+    if (isSeparator(c)) {
+      if (!name.empty()) {
+        result.push_back(name);
+      }
+      name.clear();
+    } else {
+      name += c;
+    }
+  }
+  if (!name.empty()) {
+    result.push_back(name);
+  }
+  return result;
+}
+
+// "X:" or "\\server\share"
+std::u16string rootName(const std::u16string& path, size_t& length)
+{
+  length = 0;
+  if ((path.size() >= 2) && (path[1] == u':')) {
+    length = 2;
+  } else if ((path.size() >= 2) && isSeparator(path[0]) && isSeparator(path[1])) {
+    length = 2;
+    for (int components = 0; components < 2; ++components) {
+      if (components > 0) {
+        if (length == path.size()) {
+          break;
+        }
+        ++length;
+      }
+      while ((length < path.size()) && !isSeparator(path[length])) {
+        ++length;
+      }
+    }
+  }
+
+  std::u16string result = path.substr(0, length);
+  for (auto& c : result) {
+    if (c == u'/') {
+      c = u'\\';
+    }
+  }
+  return result;
+}
+
+/**
+ * model of what the hooks did before, RerouteW::canonizePath(absolutePath()):
+ * prefix handling and the current directory in absolutePath, GetFullPathNameW for
+ * rooted and UNC paths, then fs::path::lexically_normal(), dropping the trailing "."
+ * and make_preferred()
+ */
+std::u16string legacyCanonicalize(const std::u16string& path,
+                                  const std::u16string& currentDirectory)
+{
+  std::u16string absolute;
+  if (startsWith(path, u"\\\\?\\") || startsWith(path, u"\\??\\")) {
+    absolute = path.substr(4);
+  } else if ((startsWith(path, u"\\\\localhost\\") ||
+              startsWith(path, u"\\\\127.0.0.1\\")) &&
+             (path.size() > 13) && (path[13] == u'$')) {
+    absolute = std::u16string(1, static_cast<char16_t>(towupper(path[12]))) + u":" +
+               path.substr(14);
+  } else if (path.empty() || ((path.size() >= 2) && (path[1] == u':'))) {
+    absolute = path;
+  } else if ((path.size() >= 2) && isSeparator(path[0]) && isSeparator(path[1])) {
+    absolute = path;
+  } else if (isSeparator(path[0])) {
+    size_t length;
+    absolute = rootName(currentDirectory, length) + path;
+  } else {
+    absolute = currentDirectory;
+    if (!isSeparator(absolute.back())) {
+      absolute += u'\\';
+    }
+    absolute += path;
+  }
+
+  size_t length;
+  std::u16string result = rootName(absolute, length);
+  const bool unc        = length > 2;
+  const bool rootDirectory =
+      (length < absolute.size()) && isSeparator(absolute[length]) && !unc;
+  if (rootDirectory) {
+    result += u'\\';
+  }
+
+  std::vector<std::u16string> names;
+  for (const auto& name : splitNames(absolute.substr(length))) {
+    if (name == u".") {
+      continue;
+    } else if (name == u"..") {
+      if (!names.empty() && (names.back() != u"..")) {
+        names.pop_back();
+      } else if (result.empty()) {
+        names.push_back(name);
+      }
+    } else {
+      names.push_back(name);
+    }
+  }
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (unc || (i > 0)) {
+      result += u'\\';
+    }
+    result += names[i];
+  }
+  return result;
+}
+
+std::u16string canonicalize(const std::u16string& path,
+                            const std::u16string& currentDirectory = u"C:\\work\\dir")
+{
+  PathBuffer<char16_t> buffer;
+  canonicalizePath<char16_t>(path, currentDirectory, buffer);
+  return buffer.str();
+}
+
+}  // namespace
+
+TEST(PathCanonicalizerTest, Absolute)
+{
+  EXPECT_EQ(u"C:\\a\\b", canonicalize(u"C:\\a\\b"));
+  EXPECT_EQ(u"C:\\a\\b", canonicalize(u"C:/a//b\\"));
+  EXPECT_EQ(u"C:\\b", canonicalize(u"C:\\a\\.\\..\\b\\."));
+  EXPECT_EQ(u"C:\\", canonicalize(u"C:\\"));
+  EXPECT_EQ(u"C:\\", canonicalize(u"C:\\a\\.."));
+  EXPECT_EQ(u"C:\\a", canonicalize(u"C:\\..\\..\\a"));
+  EXPECT_EQ(u"", canonicalize(u""));
+}
+
+TEST(PathCanonicalizerTest, Prefixes)
+{
+  EXPECT_EQ(u"C:\\a\\b", canonicalize(u"\\\\?\\C:\\a\\b"));
+  EXPECT_EQ(u"C:\\b", canonicalize(u"\\??\\C:\\a\\..\\b"));
+  EXPECT_EQ(u"C:\\a", canonicalize(u"\\\\localhost\\c$\\a"));
+  EXPECT_EQ(u"D:\\a", canonicalize(u"\\\\127.0.0.1\\D$/a/"));
+  EXPECT_EQ(u"C:", canonicalize(u"\\\\localhost\\C$"));
+}
+
+TEST(PathCanonicalizerTest, Relative)
+{
+  EXPECT_TRUE(requiresCurrentDirectory<char16_t>(u"a"));
+  EXPECT_TRUE(requiresCurrentDirectory<char16_t>(u"\\a"));
+  EXPECT_FALSE(requiresCurrentDirectory<char16_t>(u"C:\\a"));
+  EXPECT_FALSE(requiresCurrentDirectory<char16_t>(u"\\\\server\\share"));
+
+  EXPECT_EQ(u"C:\\work\\dir\\a", canonicalize(u"a"));
+  EXPECT_EQ(u"C:\\work\\a", canonicalize(u"..\\a"));
+  EXPECT_EQ(u"C:\\work\\dir", canonicalize(u"."));
+  EXPECT_EQ(u"C:\\a", canonicalize(u"a", u"C:\\"));
+  // relative to the root of the current drive
+  EXPECT_EQ(u"C:\\a", canonicalize(u"\\a"));
+  EXPECT_EQ(u"C:\\", canonicalize(u"/"));
+  EXPECT_EQ(u"\\\\server\\share\\a", canonicalize(u"\\a", u"\\\\server\\share\\dir"));
+  // drive relative paths are left alone
+  EXPECT_EQ(u"D:a\\b", canonicalize(u"D:a\\.\\b"));
+}
+
+TEST(PathCanonicalizerTest, UNC)
+{
+  EXPECT_EQ(u"\\\\server\\share\\a", canonicalize(u"\\\\server\\share\\a\\"));
+  EXPECT_EQ(u"\\\\server\\share", canonicalize(u"//server/share/a/.."));
+  EXPECT_EQ(u"\\\\server\\share\\b", canonicalize(u"\\\\server\\share\\..\\b"));
+}
+
+TEST(PathCanonicalizerTest, LongPath)
+{
+  std::u16string path = u"C:";
+  for (int i = 0; i < 200; ++i) {
+    path += u"\\directory";
+  }
+
+  PathBuffer<char16_t, 16> buffer;
+  canonicalizePath<char16_t>(path + u"\\.\\file\\..", u"", buffer);
+  EXPECT_EQ(path, buffer.str());
+  EXPECT_EQ(path.size(), std::char_traits<char16_t>::length(buffer.c_str()));
+}
+
+TEST(PathCanonicalizerTest, MatchesLegacy)
+{
+  const std::vector<std::u16string> prefixes = {u"C:\\",
+                                                u"c:/",
+                                                u"\\\\?\\C:\\",
+                                                u"\\??\\D:\\",
+                                                u"\\\\localhost\\c$\\",
+                                                u"\\\\srv\\sh\\",
+                                                u"\\",
+                                                u"/",
+                                                u"",
+                                                u"E:"};
+  const std::vector<std::u16string> names = {u"a", u"bb",  u"c.d", u"...",
+                                             u".", u"..",  u"",    u"longer name"};
+  const std::vector<std::u16string> separators = {u"\\", u"/", u"\\\\", u"/\\"};
+  const std::vector<std::u16string> directories = {u"C:\\work\\dir", u"C:\\",
+                                                   u"\\\\srv\\sh\\dir"};
+
+  std::mt19937 random(42);
+  for (int i = 0; i < 100000; ++i) {
+    std::u16string path = prefixes[random() % prefixes.size()];
+    const size_t count  = random() % 8;
+    for (size_t j = 0; j < count; ++j) {
+      if (j > 0) {
+        path += separators[random() % separators.size()];
+      }
+      path += names[random() % names.size()];
+    }
+    if (random() % 4 == 0) {
+      path += separators[random() % separators.size()];
+    }
+    const std::u16string& directory = directories[random() % directories.size()];
+
+    ASSERT_EQ(legacyCanonicalize(path, directory), canonicalize(path, directory))
+        << std::string(path.begin(), path.end());
+  }
+}
+
+TEST(PathCanonicalizerTest, Benchmark)
+{
+  // the legacy model stands in for the fs::path based implementation, it allocates
+  // in the same places: the absolute path, the list of names and the result
+  const int numIterations = 200000;
+  const std::vector<std::u16string> paths = {
+      u"C:\\Games\\Skyrim Special Edition\\Data\\meshes\\armor\\piece.nif",
+      u"\\\\?\\C:\\Games\\Skyrim Special Edition\\Data\\textures\\armor.dds",
+      u"Data/scripts/../scripts/source/quest.psc",
+      u"C:\\Games\\Skyrim Special Edition\\Data\\meshes\\"};
+  const std::u16string directory = u"C:\\Games\\Skyrim Special Edition";
+
+  size_t checksum = 0;
+
+  auto legacyStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    checksum += legacyCanonicalize(paths[i % paths.size()], directory).size();
+  }
+  auto legacyTime = std::chrono::steady_clock::now() - legacyStart;
+
+  auto singlePassStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    PathBuffer<char16_t> buffer;
+    canonicalizePath<char16_t>(paths[i % paths.size()], directory, buffer);
+    checksum -= buffer.size();
+  }
+  auto singlePassTime = std::chrono::steady_clock::now() - singlePassStart;
+
+  using ns = std::chrono::duration<double, std::nano>;
+  printf("legacy:      %.0f ns per path\n", ns(legacyTime).count() / numIterations);
+  printf("single pass: %.0f ns per path\n",
+         ns(singlePassTime).count() / numIterations);
+
+  EXPECT_EQ(0u, checksum);
+  EXPECT_LT(singlePassTime, legacyTime);
+}
@@ -0,0 +1,374 @@
+#include <gtest/gtest.h>
+
+#include <path_resolver.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+const uint32_t ATTRIBUTE_DIRECTORY = 0x10;
+const uint32_t ATTRIBUTE_NORMAL    = 0x80;
+
+// waits for the given time, standing in for the cost of a system call
+void simulateCost(std::chrono::nanoseconds cost)
+{
+  const auto until = std::chrono::steady_clock::now() + cost;
+  while (std::chrono::steady_clock::now() < until) {
+  }
+}
+
+std::string toLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(), [](char c) {
+    return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  });
+  return s;
+}
+
+struct MockNode
+{
+  MockNode* parent{nullptr};
+  bool directory{false};
+  bool createTarget{false};
+  std::string linkTarget;
+  FileMetadata metadata;
+  std::map<std::string, std::unique_ptr<MockNode>> children;
+};
+
+/**
+ * in-memory redirection tree, names are case insensitive. counts the number of
+ * nodes visited
+ */
+class MockTree
+{
+public:
+  typedef const MockNode* NodeRef;
+
+  MockTree() { m_Root.directory = true; }
+
+  MockNode& add(const std::string& path, bool directory,
+                const std::string& linkTarget = std::string())
+  {
+    MockNode* node = &m_Root;
+    size_t begin   = 0;
+    while (begin < path.size()) {
+      // the server of a UNC path is one component
+      const bool server = (begin == 0) && (path.compare(0, 2, "\\\\") == 0);
+      size_t end        = path.find('\\', server ? 2 : begin);
+      if (end == std::string::npos) {
+        end = path.size();
+      }
+      auto& child = node->children[toLower(path.substr(begin, end - begin))];
+      if (!child) {
+        child            = std::make_unique<MockNode>();
+        child->parent    = node;
+        child->directory = true;
+      }
+      node  = child.get();
+      begin = end + 1;
+    }
+    node->directory  = directory;
+    node->linkTarget = linkTarget;
+    return *node;
+  }
+
+  NodeRef child(const NodeRef& parent, std::string_view name) const
+  {
+    ++m_Visits;
+    const MockNode* node = parent != nullptr ? parent : &m_Root;
+    auto iter            = node->children.find(toLower(std::string(name)));
+    return iter != node->children.end() ? iter->second.get() : nullptr;
+  }
+
+  bool isDirectory(const NodeRef& node) const { return node->directory; }
+
+  size_t createTargetDistance(NodeRef node) const
+  {
+    for (size_t distance = 0; node != &m_Root; ++distance, node = node->parent) {
+      if (node->createTarget) {
+        return distance;
+      }
+    }
+    return RESOLVER_NO_CREATE_TARGET;
+  }
+
+  NodeRef ancestor(NodeRef node, size_t levels) const
+  {
+    for (; levels > 0; --levels) {
+      node = node->parent;
+    }
+    return node;
+  }
+
+  std::string linkTarget(const NodeRef& node) const { return node->linkTarget; }
+
+  const FileMetadata* metadata(const NodeRef& node) const
+  {
+    return node->metadata.valid ? &node->metadata : nullptr;
+  }
+
+  size_t visits() const { return m_Visits; }
+
+private:
+  MockNode m_Root;
+  mutable size_t m_Visits{0};
+};
+
+/**
+ * in-memory disk, every attribute query counts as one system call
+ */
+class MockFileSystem : public ResolverFileSystem<std::string>
+{
+public:
+  explicit MockFileSystem(std::chrono::nanoseconds cost = {}) : m_Cost(cost) {}
+
+  void addFile(const std::string& path, uint32_t attributes)
+  {
+    m_Files[toLower(path)] = attributes;
+  }
+
+  uint32_t attributes(const std::string& path) const override
+  {
+    ++m_Calls;
+    simulateCost(m_Cost);
+    auto iter = m_Files.find(toLower(path));
+    return iter != m_Files.end() ? iter->second : RESOLVER_INVALID_ATTRIBUTES;
+  }
+
+  size_t calls() const { return m_Calls; }
+
+private:
+  std::chrono::nanoseconds m_Cost;
+  std::map<std::string, uint32_t> m_Files;
+  mutable size_t m_Calls{0};
+};
+
+typedef PathResolver<MockTree, std::string> Resolver;
+
+}  // namespace
+
+TEST(PathResolverTest, ReroutesFile)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data\\textures\\armor.dds", false,
+           "C:\\mods\\armor\\textures\\armor.dds");
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  const auto result = resolver.resolve("C:\\game\\data\\Textures\\Armor.dds");
+  EXPECT_TRUE(result.rerouted);
+  EXPECT_TRUE(result.isVirtual);
+  EXPECT_FALSE(result.isDirectory);
+  EXPECT_TRUE(result.parentVirtual);
+  EXPECT_FALSE(result.deleted);
+  EXPECT_EQ("C:\\mods\\armor\\textures\\armor.dds", result.target);
+  EXPECT_TRUE(result.createTarget.empty());
+  EXPECT_EQ(5u, tree.visits());
+}
+
+TEST(PathResolverTest, IgnoresRedundantSeparators)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data\\a.esp", false, "C:\\mods\\a\\a.esp");
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  const auto result = resolver.resolve("C:/game\\\\data\\.\\a.esp");
+  EXPECT_TRUE(result.rerouted);
+  EXPECT_EQ("C:\\mods\\a\\a.esp", result.target);
+}
+
+TEST(PathResolverTest, UncPath)
+{
+  MockTree tree;
+  tree.add("\\\\server\\share", true, "C:\\mods\\share");
+
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  auto result = resolver.resolve("\\\\server\\share");
+  EXPECT_TRUE(result.rerouted);
+  EXPECT_EQ("C:\\mods\\share", result.target);
+
+  result = resolver.resolve("\\\\server\\share\\file.txt");
+  EXPECT_FALSE(result.isVirtual);
+  EXPECT_TRUE(result.parentVirtual);
+}
+
+TEST(PathResolverTest, VirtualDirectory)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data\\meshes\\a.nif", false, "C:\\mods\\a\\meshes\\a.nif");
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  const auto result = resolver.resolve("C:\\game\\data\\meshes");
+  EXPECT_TRUE(result.rerouted);
+  EXPECT_TRUE(result.isVirtual);
+  EXPECT_TRUE(result.isDirectory);
+  EXPECT_EQ("C:\\game\\data\\meshes", result.target);
+}
+
+TEST(PathResolverTest, NotInTree)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data\\a.esp", false, "C:\\mods\\a\\a.esp");
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  auto result = resolver.resolve("C:\\game\\data\\b.esp");
+  EXPECT_FALSE(result.rerouted);
+  EXPECT_FALSE(result.isVirtual);
+  EXPECT_TRUE(result.parentVirtual);
+  EXPECT_FALSE(result.node);
+  EXPECT_EQ("C:\\game\\data\\b.esp", result.target);
+
+  result = resolver.resolve("D:\\other\\file.txt");
+  EXPECT_FALSE(result.rerouted);
+  EXPECT_FALSE(result.parentVirtual);
+  EXPECT_EQ("D:\\other\\file.txt", result.target);
+}
+
+TEST(PathResolverTest, NearestCreateTarget)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data", true, "C:\\overwrite").createTarget = true;
+  tree.add("C:\\game\\data\\skse", true, "C:\\mods\\skse\\skse").createTarget = true;
+  MockFileSystem fs;
+  Resolver resolver(tree, fs);
+
+  auto result = resolver.resolve("C:\\game\\data\\new\\file.txt");
+  EXPECT_FALSE(result.rerouted);
+  EXPECT_EQ("C:\\overwrite\\new\\file.txt", result.createTarget);
+
+  result = resolver.resolve("C:\\game\\data\\skse\\plugins\\new.ini");
+  EXPECT_EQ("C:\\mods\\skse\\skse\\plugins\\new.ini", result.createTarget);
+
+  result = resolver.resolve("C:\\game\\data\\skse");
+  EXPECT_EQ("C:\\mods\\skse\\skse", result.createTarget);
+
+  result = resolver.resolve("C:\\game\\other.txt");
+  EXPECT_TRUE(result.createTarget.empty());
+}
+
+TEST(PathResolverTest, DeletedFile)
+{
+  MockTree tree;
+  tree.add("C:\\game\\data\\a.esp", false, "C:\\mods\\a\\a.esp");
+  MockFileSystem fs;
+  Resolver resolver(tree, fs, [](const std::string& path, std::string& target) {
+    if (toLower(path) == "c:\\game\\data\\a.esp") {
+      target = "C:\\mods\\a\\a.esp";
+      return true;
+    }
+    return false;
+  });
+
+  const auto result = resolver.resolve("C:\\game\\data\\a.esp");
+  EXPECT_TRUE(result.deleted);
+  EXPECT_TRUE(result.rerouted);
+  EXPECT_EQ("C:\\mods\\a\\a.esp", result.target);
+
+  // the metadata of a deleted file is never used
+  tree.add("C:\\game\\data\\a.esp", false, "C:\\mods\\a\\a.esp").metadata.valid = true;
+  EXPECT_EQ(RESOLVER_INVALID_ATTRIBUTES, resolver.attributes(result));
+  EXPECT_EQ(1u, fs.calls());
+}
+
+TEST(PathResolverTest, AttributesFromMetadata)
+{
+  MockTree tree;
+  MockNode& node = tree.add("C:\\game\\data\\a.esp", false, "C:\\mods\\a\\a.esp");
+  MockFileSystem fs;
+  fs.addFile("C:\\mods\\a\\a.esp", ATTRIBUTE_NORMAL);
+  fs.addFile("C:\\game\\data", ATTRIBUTE_DIRECTORY);
+  Resolver resolver(tree, fs);
+
+  auto result = resolver.resolve("C:\\game\\data\\a.esp");
+  EXPECT_EQ(ATTRIBUTE_NORMAL, resolver.attributes(result));
+  EXPECT_EQ(1u, fs.calls());
+
+  node.metadata.attributes = ATTRIBUTE_NORMAL | 0x01;
+  node.metadata.valid      = true;
+  EXPECT_EQ(ATTRIBUTE_NORMAL | 0x01, resolver.attributes(result));
+  EXPECT_EQ(1u, fs.calls());
+
+  result = resolver.resolve("C:\\game\\data\\missing.esp");
+  EXPECT_EQ(RESOLVER_INVALID_ATTRIBUTES, resolver.attributes(result));
+  EXPECT_EQ(2u, fs.calls());
+}
+
+TEST(PathResolverTest, Benchmark)
+{
+  // opening files for writing in a deep tree with an overwrite directory, the way a
+  // game writes its logs and caches
+  const int numFiles = 20000;
+
+  MockTree tree;
+  tree.add("C:\\games\\steam\\steamapps\\common\\game\\data", true, "C:\\overwrite")
+      .createTarget = true;
+  std::vector<std::string> paths;
+  for (int i = 0; i < numFiles; ++i) {
+    char name[96];
+    snprintf(name, sizeof(name), "interface\\translations\\mod%03d\\strings%05d.txt",
+             i % 100, i);
+    const std::string path =
+        std::string("C:\\games\\steam\\steamapps\\common\\game\\data\\") + name;
+    MockNode& node = tree.add(path, false, std::string("C:\\mods\\m\\") + name);
+    node.metadata.attributes = ATTRIBUTE_NORMAL;
+    node.metadata.valid      = true;
+    paths.push_back(path);
+  }
+
+  MockFileSystem fs(std::chrono::microseconds(2));
+  Resolver resolver(tree, fs);
+
+  // the lookups CreateFileW used to make: the attribute query of the path, the
+  // reroute and the create target, each walking the tree from the root, and the disk
+  // queried for the attributes of the target
+  const size_t legacyVisits = tree.visits();
+  const size_t legacyCalls  = fs.calls();
+  auto legacyStart          = std::chrono::steady_clock::now();
+  for (const auto& path : paths) {
+    const auto attributes = resolver.resolve(path);
+    fs.attributes(attributes.target);
+    const auto reroute = resolver.resolve(path);
+    ASSERT_TRUE(reroute.rerouted);
+    const auto create = resolver.resolve(path);
+    ASSERT_FALSE(create.createTarget.empty());
+  }
+  auto legacyTime            = std::chrono::steady_clock::now() - legacyStart;
+  const size_t legacyWalked  = tree.visits() - legacyVisits;
+  const size_t legacyQueries = fs.calls() - legacyCalls;
+
+  const size_t singleVisits = tree.visits();
+  const size_t singleCalls  = fs.calls();
+  auto singleStart          = std::chrono::steady_clock::now();
+  for (const auto& path : paths) {
+    const auto result = resolver.resolve(path);
+    ASSERT_EQ(ATTRIBUTE_NORMAL, resolver.attributes(result));
+    ASSERT_TRUE(result.rerouted);
+    ASSERT_FALSE(result.createTarget.empty());
+  }
+  auto singleTime            = std::chrono::steady_clock::now() - singleStart;
+  const size_t singleWalked  = tree.visits() - singleVisits;
+  const size_t singleQueries = fs.calls() - singleCalls;
+
+  using ms = std::chrono::duration<double, std::milli>;
+  printf("separate lookups: %zu nodes, %zu calls, %.1f ms\n", legacyWalked,
+         legacyQueries, ms(legacyTime).count());
+  printf("single lookup:    %zu nodes, %zu calls, %.1f ms\n", singleWalked,
+         singleQueries, ms(singleTime).count());
+
+  EXPECT_EQ(legacyWalked, singleWalked * 3);
+  EXPECT_EQ(0u, singleQueries);
+}
@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+
+#include <phase_timer.h>
+
+#include <thread>
+
+using usvfs::shared::PhaseTimer;
+
+TEST(PhaseTimerTest, Phases)
+{
+  PhaseTimer timer;
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  timer.lap("first");
+  timer.lap("second");
+
+  ASSERT_EQ(2u, timer.phases().size());
+  EXPECT_STREQ("first", timer.phases()[0].name);
+  EXPECT_STREQ("second", timer.phases()[1].name);
+  EXPECT_GE(timer.phases()[0].duration, std::chrono::milliseconds(5));
+  EXPECT_EQ(timer.total(), timer.phases()[0].duration + timer.phases()[1].duration);
+}
+
+TEST(PhaseTimerTest, Summary)
+{
+  PhaseTimer timer;
+  EXPECT_EQ("(total 0.00 ms)", timer.summary());
+
+  timer.lap("context");
+  timer.lap("hooks");
+
+  const std::string summary = timer.summary();
+  EXPECT_EQ(0u, summary.find("context ")) << summary;
+  EXPECT_NE(std::string::npos, summary.find(" ms, hooks ")) << summary;
+  EXPECT_NE(std::string::npos, summary.find(" ms (total ")) << summary;
+  EXPECT_EQ(')', summary.back());
+}
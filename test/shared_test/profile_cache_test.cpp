@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+
+#include <profile_cache.h>
+
+#include <string>
+
+using usvfs::shared::ProfileCache;
+using usvfs::shared::ProfileData;
+
+namespace
+{
+
+const char* const INI = "; comment before the first section\r\n"
+                        "[General]\r\n"
+                        "sLanguage=ENGLISH\r\n"
+                        "  bEnabled = 1  \r\n"
+                        "sQuoted=\"quoted value\"\r\n"
+                        "sSingle='x'\r\n"
+                        "sHalf=\"open\r\n"
+                        "sEmpty=\r\n"
+                        "sLanguage=GERMAN\r\n"
+                        "\r\n"
+                        "[Display]\r\n"
+                        "iSize W=1920\r\n"
+                        "iSize H=1080\r\n"
+                        "[Archive]\r\n"
+                        "; the list is read by the engine\r\n"
+                        "sResourceArchiveList=a.bsa, b.bsa\r\n";
+
+std::string stringList(const char* buffer, uint32_t length)
+{
+  std::string result(buffer, length);
+  for (char& c : result) {
+    if (c == '\0') {
+      c = '|';
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(ProfileCacheTest, Values)
+{
+  auto data = ProfileData::parse(INI);
+  ASSERT_NE(nullptr, data);
+
+  char buffer[64];
+  auto result = data->getString("General", "sLanguage", "", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_TRUE(result->found);
+  EXPECT_EQ(7u, result->length);
+  EXPECT_STREQ("ENGLISH", buffer);
+
+  // names are case insensitive, blanks around names and values are ignored
+  result = data->getString("GENERAL", "benabled", "", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_STREQ("1", buffer);
+
+  // matching quotes are removed
+  data->getString("General", "sQuoted", "", buffer, 64);
+  EXPECT_STREQ("quoted value", buffer);
+  data->getString("General", "sSingle", "", buffer, 64);
+  EXPECT_STREQ("x", buffer);
+  data->getString("General", "sHalf", "", buffer, 64);
+  EXPECT_STREQ("\"open", buffer);
+
+  result = data->getString("General", "sEmpty", "default", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_TRUE(result->found);
+  EXPECT_EQ(0u, result->length);
+
+  // blanks in key names are kept
+  data->getString("Display", "iSize H", "", buffer, 64);
+  EXPECT_STREQ("1080", buffer);
+
+  wchar_t wide[64];
+  auto wideResult = data->getString(L"display", L"isize w", L"", wide, 64);
+  ASSERT_TRUE(wideResult.has_value());
+  EXPECT_EQ(4u, wideResult->length);
+  EXPECT_EQ(std::wstring(L"1920"), wide);
+}
+
+TEST(ProfileCacheTest, Defaults)
+{
+  auto data = ProfileData::parse(INI);
+  ASSERT_NE(nullptr, data);
+
+  char buffer[64];
+  auto result = data->getString("General", "sMissing", "fallback  ", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_FALSE(result->found);
+  EXPECT_EQ(8u, result->length);
+  EXPECT_STREQ("fallback", buffer);
+
+  result = data->getString<char>("Missing", "sLanguage", nullptr, buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_FALSE(result->found);
+  EXPECT_EQ(0u, result->length);
+  EXPECT_STREQ("", buffer);
+
+  // quoted defaults are handled inconsistently by the real api
+  EXPECT_FALSE(data->getString("General", "sMissing", "\"x\"", buffer, 64));
+}
+
+TEST(ProfileCacheTest, Lists)
+{
+  auto data = ProfileData::parse(INI);
+  ASSERT_NE(nullptr, data);
+
+  char buffer[64];
+  auto result = data->getString<char>(nullptr, nullptr, "", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ("General|Display|Archive|", stringList(buffer, result->length));
+  EXPECT_EQ('\0', buffer[result->length]);
+
+  result = data->getString<char>("Display", nullptr, "", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ("iSize W|iSize H|", stringList(buffer, result->length));
+
+  result = data->getSection("display", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_TRUE(result->found);
+  EXPECT_EQ("iSize W=1920|iSize H=1080|", stringList(buffer, result->length));
+  EXPECT_EQ('\0', buffer[result->length]);
+
+  result = data->getSection("Missing", buffer, 64);
+  ASSERT_TRUE(result.has_value());
+  EXPECT_FALSE(result->found);
+  EXPECT_EQ(0u, result->length);
+  EXPECT_EQ('\0', buffer[0]);
+  EXPECT_EQ('\0', buffer[1]);
+
+  // sections with comments, blanks around = or repeated keys
+  EXPECT_FALSE(data->getSection("Archive", buffer, 64));
+  EXPECT_FALSE(data->getSection("General", buffer, 64));
+  EXPECT_FALSE(data->getString<char>("General", nullptr, "", buffer, 64));
+}
+
+TEST(ProfileCacheTest, Fallbacks)
+{
+  auto data = ProfileData::parse(INI);
+  ASSERT_NE(nullptr, data);
+
+  char buffer[64];
+
+  // truncated results
+  EXPECT_FALSE(data->getString("General", "sLanguage", "", buffer, 7));
+  EXPECT_TRUE(data->getString("General", "sLanguage", "", buffer, 8));
+  EXPECT_FALSE(data->getString("General", "sMissing", "fallback", buffer, 8));
+  EXPECT_FALSE(data->getSection("Display", buffer, 26));
+  EXPECT_TRUE(data->getSection("Display", buffer, 28));
+  EXPECT_FALSE(data->getString<char>(nullptr, nullptr, "", buffer, 25));
+  EXPECT_FALSE(data->getString("General", "sLanguage", "", buffer, 0));
+  EXPECT_FALSE(data->getString<char>("General", "sLanguage", "", nullptr, 64));
+
+  // names that aren't plain ascii or have blanks the api might trim
+  EXPECT_FALSE(data->getString("G\xC3\xA9neral", "sLanguage", "", buffer, 64));
+  EXPECT_FALSE(data->getString(" General", "sLanguage", "", buffer, 64));
+  EXPECT_FALSE(data->getString("General", "sLanguage ", "", buffer, 64));
+  EXPECT_FALSE(data->getString("", "sLanguage", "", buffer, 64));
+  EXPECT_FALSE(data->getString("General", "sMissing", "d\xC3\xA9", buffer, 64));
+  wchar_t wide[64];
+  EXPECT_FALSE(data->getString(L"General", L"s\x00e9", L"", wide, 64));
+
+  // sections that appear twice
+  auto duplicates = ProfileData::parse("[A]\nx=1\n[B]\ny=2\n[a]\nz=3\n");
+  ASSERT_NE(nullptr, duplicates);
+  EXPECT_FALSE(duplicates->getString("A", "x", "", buffer, 64));
+  EXPECT_FALSE(duplicates->getString("a", "z", "", buffer, 64));
+  EXPECT_FALSE(duplicates->getString<char>(nullptr, nullptr, "", buffer, 64));
+  EXPECT_FALSE(duplicates->getSection("A", buffer, 64));
+  EXPECT_TRUE(duplicates->getString("B", "y", "", buffer, 64));
+
+  // lines without =
+  auto bare = ProfileData::parse("[A]\nflag\nx=1\n");
+  ASSERT_NE(nullptr, bare);
+  EXPECT_FALSE(bare->getString("A", "flag", "", buffer, 64));
+  EXPECT_FALSE(bare->getSection("A", buffer, 64));
+  EXPECT_TRUE(bare->getString("A", "x", "", buffer, 64));
+}
+
+TEST(ProfileCacheTest, RejectedFiles)
+{
+  EXPECT_NE(nullptr, ProfileData::parse(""));
+  EXPECT_NE(nullptr, ProfileData::parse("[A]\nx=1"));
+  EXPECT_NE(nullptr, ProfileData::parse("[A]\r\nx=\t1\r\n"));
+
+  // encodings, byte order marks and control characters
+  EXPECT_EQ(nullptr, ProfileData::parse("\xEF\xBB\xBF[A]\nx=1\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[A]\nx=\xE9\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse(std::string("[A]\nx=1\0\n", 9)));
+  EXPECT_EQ(nullptr, ProfileData::parse("[A]\nx=1\x1A"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[A]\rx=1\n"));
+
+  // malformed section headers
+  EXPECT_EQ(nullptr, ProfileData::parse("[A\nx=1\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[A] ; comment\nx=1\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[A]]\nx=1\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[]\nx=1\n"));
+  EXPECT_EQ(nullptr, ProfileData::parse("[ A ]\nx=1\n"));
+}
+
+TEST(ProfileCacheTest, Cache)
+{
+  ProfileCache cache;
+  auto data = ProfileData::parse("[A]\nx=1\n");
+
+  EXPECT_FALSE(cache.find(L"C:\\Game\\Skyrim.ini", 8, 100));
+
+  cache.insert(L"C:\\Game\\Skyrim.ini", 8, 100, data);
+  auto found = cache.find(L"c:\\game\\SKYRIM.INI", 8, 100);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(data, *found);
+
+  // the file changed
+  EXPECT_FALSE(cache.find(L"C:\\Game\\Skyrim.ini", 9, 100));
+  EXPECT_FALSE(cache.find(L"C:\\Game\\Skyrim.ini", 8, 101));
+
+  // files that can't be parsed are remembered too
+  cache.insert(L"C:\\Game\\Prefs.ini", 3, 100, nullptr);
+  found = cache.find(L"C:\\Game\\Prefs.ini", 3, 100);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(nullptr, *found);
+  EXPECT_EQ(2u, cache.size());
+
+  cache.invalidate(L"C:\\GAME\\skyrim.ini");
+  EXPECT_FALSE(cache.find(L"C:\\Game\\Skyrim.ini", 8, 100));
+  EXPECT_EQ(1u, cache.size());
+
+  for (size_t i = 0; i < ProfileCache::MAX_FILES + 1; ++i) {
+    cache.insert(L"C:\\" + std::to_wstring(i) + L".ini", i, 0, data);
+  }
+  EXPECT_LE(cache.size(), ProfileCache::MAX_FILES);
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.size());
+}
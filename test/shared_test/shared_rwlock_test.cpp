@@ -0,0 +1,373 @@
+#include <gtest/gtest.h>
+
+#include <shared_rwlock.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using usvfs::shared::SharedRWLock;
+using usvfs::shared::SharedRWLockState;
+
+namespace
+{
+
+class SharedRWLockTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    m_State = std::make_unique<SharedRWLockState>();
+    m_Lock  = std::make_unique<SharedRWLock>(m_State.get(), "usvfs_rwlock_test");
+  }
+
+  // true once the flag has been set, gives up after a second
+  static bool waitFor(const std::atomic<bool>& flag)
+  {
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!flag && (std::chrono::steady_clock::now() < timeout)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return flag;
+  }
+
+  static void settle() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); }
+
+  std::unique_ptr<SharedRWLockState> m_State;
+  std::unique_ptr<SharedRWLock> m_Lock;
+};
+
+}  // namespace
+
+TEST_F(SharedRWLockTest, ReadersShare)
+{
+  m_Lock->lockShared();
+
+  std::atomic<bool> reading{false};
+  std::thread reader([&]() {
+    m_Lock->lockShared();
+    reading = true;
+    m_Lock->unlockShared();
+  });
+
+  EXPECT_TRUE(waitFor(reading));
+  reader.join();
+  m_Lock->unlockShared();
+}
+
+TEST_F(SharedRWLockTest, WritersExclude)
+{
+  const int numThreads    = 4;
+  const int numIterations = 20000;
+  int counter             = 0;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < numIterations; ++i) {
+        m_Lock->lock();
+        ++counter;
+        m_Lock->unlock();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(numThreads * numIterations, counter);
+  EXPECT_EQ(0u, m_State->word.load());
+}
+
+TEST_F(SharedRWLockTest, WriterPreference)
+{
+  m_Lock->lockShared();
+
+  std::atomic<bool> writing{false};
+  std::atomic<bool> reading{false};
+  std::thread writer([&]() {
+    m_Lock->lock();
+    writing = true;
+    settle();
+    m_Lock->unlock();
+  });
+  settle();
+
+  // a new reader queues behind the waiting writer
+  std::thread reader([&]() {
+    m_Lock->lockShared();
+    reading = true;
+    EXPECT_TRUE(writing);
+    m_Lock->unlockShared();
+  });
+  settle();
+  EXPECT_FALSE(reading);
+  EXPECT_FALSE(writing);
+
+  // while this thread, which already reads, gets in again
+  m_Lock->lockShared();
+  m_Lock->unlockShared();
+
+  m_Lock->unlockShared();
+  writer.join();
+  reader.join();
+  EXPECT_TRUE(reading);
+}
+
+TEST_F(SharedRWLockTest, Reentrant)
+{
+  m_Lock->lock();
+  m_Lock->lock();
+  m_Lock->lockShared();
+  m_Lock->unlockShared();
+  m_Lock->unlock();
+
+  std::atomic<bool> reading{false};
+  std::thread reader([&]() {
+    m_Lock->lockShared();
+    reading = true;
+    m_Lock->unlockShared();
+  });
+  settle();
+  EXPECT_FALSE(reading);
+
+  m_Lock->unlock();
+  reader.join();
+  EXPECT_TRUE(reading);
+  EXPECT_EQ(0u, m_State->word.load());
+}
+
+TEST_F(SharedRWLockTest, Upgrade)
+{
+  // two readers asking for the write lock at the same time must not deadlock
+  std::atomic<int> reading{0};
+  std::atomic<int> written{0};
+  auto upgrade = [&]() {
+    m_Lock->lockShared();
+    ++reading;
+    while (reading < 2) {
+      std::this_thread::yield();
+    }
+    m_Lock->lock();
+    ++written;
+    m_Lock->unlock();
+    m_Lock->unlockShared();
+  };
+
+  std::thread first(upgrade);
+  std::thread second(upgrade);
+  first.join();
+  second.join();
+
+  EXPECT_EQ(2, written);
+  EXPECT_EQ(0u, m_State->word.load());
+
+  // the reads are back after the write lock is released
+  m_Lock->lockShared();
+  m_Lock->lock();
+  m_Lock->unlock();
+
+  std::atomic<bool> writing{false};
+  std::thread writer([&]() {
+    m_Lock->lock();
+    writing = true;
+    m_Lock->unlock();
+  });
+  settle();
+  EXPECT_FALSE(writing);
+
+  m_Lock->unlockShared();
+  writer.join();
+  EXPECT_TRUE(writing);
+}
+
+TEST_F(SharedRWLockTest, TryLock)
+{
+  EXPECT_TRUE(m_Lock->tryLockShared());
+
+  bool written = true;
+  bool read    = false;
+  std::thread([&]() {
+    written = m_Lock->tryLock();
+    read    = m_Lock->tryLockShared();
+    if (read) {
+      m_Lock->unlockShared();
+    }
+  }).join();
+  EXPECT_FALSE(written);
+  EXPECT_TRUE(read);
+
+  // upgrading has to wait for the lock
+  EXPECT_FALSE(m_Lock->tryLock());
+  m_Lock->unlockShared();
+
+  EXPECT_TRUE(m_Lock->tryLock());
+  EXPECT_TRUE(m_Lock->tryLock());
+  EXPECT_TRUE(m_Lock->tryLockShared());
+  std::thread([&]() {
+    read = m_Lock->tryLockShared();
+  }).join();
+  EXPECT_FALSE(read);
+
+  m_Lock->unlockShared();
+  m_Lock->unlock();
+  m_Lock->unlock();
+  EXPECT_EQ(0u, m_State->word.load());
+}
+
+#ifdef __linux__
+
+namespace
+{
+
+template <typename T>
+T* mapShared()
+{
+  void* memory = mmap(nullptr, sizeof(T), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  return memory != MAP_FAILED ? static_cast<T*>(memory) : nullptr;
+}
+
+// the exclusive lock the hook context used before: a counter and a semaphore, the
+// owner and recursion aren't needed for this
+struct Benaphore
+{
+  std::atomic<int32_t> counter;
+  sem_t semaphore;
+
+  void init() { sem_init(&semaphore, 1, 0); }
+
+  void wait()
+  {
+    if (counter.fetch_add(1) > 0) {
+      while (sem_wait(&semaphore) != 0) {
+      }
+    }
+  }
+
+  void signal()
+  {
+    if (counter.fetch_sub(1) > 1) {
+      sem_post(&semaphore);
+    }
+  }
+};
+
+void waitChildren(const std::vector<pid_t>& children)
+{
+  for (pid_t pid : children) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+  }
+}
+
+}  // namespace
+
+TEST(SharedRWLockProcessTest, OwnerDeath)
+{
+  SharedRWLockState* state = mapShared<SharedRWLockState>();
+  ASSERT_NE(nullptr, state);
+  SharedRWLock lock(state, "usvfs_rwlock_death");
+
+  // a process exiting while it writes
+  pid_t pid = fork();
+  if (pid == 0) {
+    lock.lock();
+    _exit(0);
+  }
+  waitChildren({pid});
+
+  lock.lockShared();
+  lock.unlockShared();
+  EXPECT_EQ(1u, lock.recovered());
+
+  // and one exiting while it reads
+  pid = fork();
+  if (pid == 0) {
+    lock.lockShared();
+    lock.lockShared();
+    _exit(0);
+  }
+  waitChildren({pid});
+
+  lock.lock();
+  lock.unlock();
+  EXPECT_EQ(2u, lock.recovered());
+  EXPECT_EQ(0u, state->word.load());
+
+  munmap(state, sizeof(SharedRWLockState));
+}
+
+TEST(SharedRWLockProcessTest, MultiProcessBenchmark)
+{
+  // hooked processes reading the tree at the same time, each read holds the lock for
+  // about as long as a short tree lookup
+  const int numProcesses  = 4;
+  const int numIterations = 200000;
+
+  auto lookup = []() {
+    volatile uint32_t hash = 2166136261u;
+    for (int i = 0; i < 64; ++i) {
+      hash = (hash ^ i) * 16777619u;
+    }
+  };
+
+  auto run = [&](auto read) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    for (int p = 0; p < numProcesses; ++p) {
+      const pid_t pid = fork();
+      if (pid == 0) {
+        for (int i = 0; i < numIterations; ++i) {
+          read();
+        }
+        _exit(0);
+      }
+      children.push_back(pid);
+    }
+    waitChildren(children);
+    return std::chrono::steady_clock::now() - start;
+  };
+
+  Benaphore* benaphore = mapShared<Benaphore>();
+  ASSERT_NE(nullptr, benaphore);
+  benaphore->init();
+  const auto benaphoreTime = run([&]() {
+    benaphore->wait();
+    lookup();
+    benaphore->signal();
+  });
+  sem_destroy(&benaphore->semaphore);
+  munmap(benaphore, sizeof(Benaphore));
+
+  SharedRWLockState* state = mapShared<SharedRWLockState>();
+  ASSERT_NE(nullptr, state);
+  SharedRWLock lock(state, "usvfs_rwlock_benchmark");
+  const auto rwlockTime = run([&]() {
+    lock.lockShared();
+    lookup();
+    lock.unlockShared();
+  });
+  EXPECT_EQ(0u, state->word.load());
+  munmap(state, sizeof(SharedRWLockState));
+
+  const int total = numProcesses * numIterations;
+  using ns        = std::chrono::duration<double, std::nano>;
+  printf("benaphore: %.1f ns per read\n", ns(benaphoreTime).count() / total);
+  printf("rwlock:    %.1f ns per read\n", ns(rwlockTime).count() / total);
+
+  EXPECT_LT(rwlockTime, benaphoreTime);
+}
+
+#endif
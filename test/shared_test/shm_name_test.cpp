@@ -0,0 +1,30 @@
+#include <gtest/gtest.h>
+
+#include <shm_name.h>
+
+using usvfs::shared::parseSHMName;
+
+TEST(SHMNameTest, Parse)
+{
+  const auto name = parseSHMName("mod_organizer_3");
+  ASSERT_TRUE(name.has_value());
+  EXPECT_EQ("mod_organizer_", name->prefix);
+  EXPECT_EQ(3u, name->number);
+
+  EXPECT_EQ(42u, parseSHMName("_42")->number);
+  EXPECT_EQ("a_1_", parseSHMName("a_1_007")->prefix);
+  EXPECT_EQ(7u, parseSHMName("a_1_007")->number);
+  EXPECT_EQ(4294967295u, parseSHMName("x_4294967295")->number);
+}
+
+TEST(SHMNameTest, Invalid)
+{
+  EXPECT_FALSE(parseSHMName(""));
+  EXPECT_FALSE(parseSHMName("mod_organizer"));
+  EXPECT_FALSE(parseSHMName("mod_organizer_"));
+  EXPECT_FALSE(parseSHMName("mod_organizer3"));
+  EXPECT_FALSE(parseSHMName("123"));
+  EXPECT_FALSE(parseSHMName("mod_organizer_3a"));
+  EXPECT_FALSE(parseSHMName("mod_organizer_-3"));
+  EXPECT_FALSE(parseSHMName("x_4294967296"));
+}
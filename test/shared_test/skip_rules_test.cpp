@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+
+#include <skip_rules.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+std::string randomName(std::mt19937& random, size_t minLength, size_t maxLength)
+{
+  static const char characters[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-. ";
+  std::uniform_int_distribution<size_t> length(minLength, maxLength);
+  std::uniform_int_distribution<size_t> character(0, sizeof(characters) - 2);
+
+  std::string result(length(random), ' ');
+  for (char& c : result) {
+    c = characters[character(random)];
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(SkipRulesTest, Glob)
+{
+  EXPECT_TRUE(globMatch("*.TMP", "backup.tmp"));
+  EXPECT_TRUE(globMatch("file?.txt", "FILE1.txt"));
+  EXPECT_FALSE(globMatch("file?.txt", "file.txt"));
+  EXPECT_TRUE(globMatch("*", ""));
+  EXPECT_TRUE(globMatch("a*b*c", "aXXbYYbc"));
+  EXPECT_FALSE(globMatch("a*b*c", "aXXbYYb"));
+  EXPECT_TRUE(globMatch("**x", "x"));
+  EXPECT_FALSE(globMatch("", "x"));
+}
+
+TEST(SkipRulesTest, Suffixes)
+{
+  const SuffixRules rules({".mohidden", ".bak", "~*.tmp", "k"});
+
+  ASSERT_NE(nullptr, rules.match("meshes\\armor.nif.MOHIDDEN"));
+  EXPECT_EQ(".mohidden", *rules.match("meshes\\armor.nif.MOHIDDEN"));
+  // the shortest rule wins
+  EXPECT_EQ("k", *rules.match("save.bak"));
+  EXPECT_EQ("~*.tmp", *rules.match("data\\~lock.tmp"));
+  EXPECT_EQ(nullptr, rules.match("data\\lock.tmp"));
+  EXPECT_EQ(nullptr, rules.match("mohidden"));
+  EXPECT_EQ(nullptr, rules.match(""));
+
+  EXPECT_TRUE(SuffixRules().empty());
+  EXPECT_EQ(nullptr, SuffixRules().match("anything"));
+  EXPECT_NE(nullptr, SuffixRules({""}).match("anything"));
+}
+
+TEST(SkipRulesTest, Names)
+{
+  const NameRules rules({".git", "__pycache__", "backup-*"});
+
+  EXPECT_EQ(".git", *rules.match(".GIT"));
+  EXPECT_EQ("__pycache__", *rules.match("__pycache__"));
+  EXPECT_EQ("backup-*", *rules.match("Backup-2024"));
+  EXPECT_EQ(nullptr, rules.match(".gitignore"));
+  EXPECT_EQ(nullptr, rules.match("git"));
+}
+
+TEST(SkipRulesTest, Substrings)
+{
+  const SubstringRules rules({"\\he.exe", "\\she.exe", "\\hers.exe", "\\a?c.exe"});
+
+  EXPECT_EQ("\\she.exe", *rules.match("C:\\Windows\\SHE.exe -flag"));
+  EXPECT_EQ("\\he.exe", *rules.match("\"C:\\he.exe\""));
+  EXPECT_EQ("\\hers.exe", *rules.match("C:\\x\\hers.exe"));
+  EXPECT_EQ("\\a?c.exe", *rules.match("C:\\x\\abc.exe"));
+  EXPECT_EQ(nullptr, rules.match("C:\\x\\he.ex"));
+  EXPECT_EQ(nullptr, rules.match("she.exe"));
+}
+
+TEST(SkipRulesTest, MatchesLinearScan)
+{
+  // compiled rules have to agree with checking every rule on its own
+  std::mt19937 random(42);
+
+  std::vector<std::string> rules;
+  for (int i = 0; i < 200; ++i) {
+    rules.push_back(randomName(random, 1, 4));
+  }
+
+  const SuffixRules suffixes(rules);
+  const NameRules names(rules);
+  const SubstringRules substrings(rules);
+
+  for (int i = 0; i < 20000; ++i) {
+    std::string name = randomName(random, 0, 12);
+    if (i % 10 == 0) {
+      name = rules[i % rules.size()];
+    }
+
+    bool endsWith = false;
+    bool equals   = false;
+    bool contains = false;
+    for (const std::string& rule : rules) {
+      endsWith = endsWith || boost::algorithm::iends_with(name, rule);
+      equals   = equals || boost::algorithm::iequals(name, rule);
+      contains = contains || boost::algorithm::icontains(name, rule);
+    }
+
+    const std::string* suffix = suffixes.match(name);
+    EXPECT_EQ(endsWith, suffix != nullptr) << name;
+    if (suffix != nullptr) {
+      EXPECT_TRUE(boost::algorithm::iends_with(name, *suffix));
+    }
+
+    EXPECT_EQ(equals, names.match(name) != nullptr) << name;
+
+    const std::string* substring = substrings.match(name);
+    EXPECT_EQ(contains, substring != nullptr) << name;
+    if (substring != nullptr) {
+      EXPECT_TRUE(boost::algorithm::icontains(name, *substring));
+    }
+  }
+}
+
+TEST(SkipRulesTest, Benchmark)
+{
+  // the skip lists of a large setup checked against every file while linking
+  const size_t numRules = 500;
+  const size_t numNames = 200000;
+
+  std::mt19937 random(7);
+  std::vector<std::string> rules;
+  for (size_t i = 0; i < numRules; ++i) {
+    rules.push_back("." + randomName(random, 3, 10));
+  }
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < numNames; ++i) {
+    names.push_back(randomName(random, 8, 40));
+    if (i % 100 == 0) {
+      names.back() += rules[i % numRules];
+    }
+  }
+
+  size_t linearMatches = 0;
+  auto linearStart     = std::chrono::steady_clock::now();
+  for (const std::string& name : names) {
+    for (const std::string& rule : rules) {
+      if (boost::algorithm::iends_with(name, rule)) {
+        ++linearMatches;
+        break;
+      }
+    }
+  }
+  auto linearTime = std::chrono::steady_clock::now() - linearStart;
+
+  size_t compiledMatches = 0;
+  auto compiledStart     = std::chrono::steady_clock::now();
+  const SuffixRules compiled(rules);
+  for (const std::string& name : names) {
+    if (compiled.match(name) != nullptr) {
+      ++compiledMatches;
+    }
+  }
+  auto compiledTime = std::chrono::steady_clock::now() - compiledStart;
+
+  using ms = std::chrono::duration<double, std::milli>;
+  printf("linear:   %.1f ms for %zu names\n", ms(linearTime).count(), numNames);
+  printf("compiled: %.1f ms for %zu names\n", ms(compiledTime).count(), numNames);
+
+  EXPECT_EQ(linearMatches, compiledMatches);
+  EXPECT_LT(compiledTime, linearTime);
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include <stub_template.h>
+
+#include <random>
+#include <vector>
+
+using usvfs::shared::StubTemplate;
+
+namespace
+{
+
+enum Value
+{
+  RETURN_ADDRESS,
+  DLL_NAME,
+  LOAD_LIBRARY,
+  USER_DATA_SIZE,
+
+  VALUE_COUNT
+};
+
+using Values = std::array<uint64_t, VALUE_COUNT>;
+
+// encodes the x64 instructions of a loader stub the way the injection stub does,
+// with every immediate at its full width
+class Encoder
+{
+public:
+  void movImm(uint8_t reg, uint64_t value)
+  {
+    m_Code.push_back(0x48);
+    m_Code.push_back(static_cast<uint8_t>(0xB8 + reg));
+    append(value);
+  }
+
+  void pushRax() { m_Code.push_back(0x50); }
+  void callRax() { m_Code.insert(m_Code.end(), {0xFF, 0xD0}); }
+  void ret() { m_Code.push_back(0xC3); }
+
+  // mov ecx, imm32 if the value fits, as an assembler picking the shortest form would
+  void movShortest(uint64_t value)
+  {
+    if (value <= 0xFFFFFFFFull) {
+      m_Code.push_back(0xB9);
+      const uint32_t imm = static_cast<uint32_t>(value);
+      m_Code.insert(m_Code.end(), reinterpret_cast<const uint8_t*>(&imm),
+                    reinterpret_cast<const uint8_t*>(&imm) + sizeof(imm));
+    } else {
+      movImm(1, value);
+    }
+  }
+
+  void append(uint64_t value)
+  {
+    m_Code.insert(m_Code.end(), reinterpret_cast<const uint8_t*>(&value),
+                  reinterpret_cast<const uint8_t*>(&value) + sizeof(value));
+  }
+
+  std::vector<uint8_t> code() const { return m_Code; }
+
+private:
+  std::vector<uint8_t> m_Code;
+};
+
+std::vector<uint8_t> assembleStub(const Values& values, bool withReturnAddress)
+{
+  Encoder encoder;
+  if (withReturnAddress) {
+    encoder.movImm(0, values[RETURN_ADDRESS]);
+    encoder.pushRax();
+  }
+  encoder.movImm(1, values[DLL_NAME]);
+  encoder.movImm(0, values[LOAD_LIBRARY]);
+  encoder.callRax();
+  encoder.movImm(2, values[USER_DATA_SIZE]);
+  encoder.ret();
+  return encoder.code();
+}
+
+Values randomValues(std::mt19937_64& random)
+{
+  Values result;
+  for (uint64_t& value : result) {
+    value = random();
+  }
+  // small values are what make assemblers pick shorter encodings
+  result[USER_DATA_SIZE] = random() % 0x100;
+  return result;
+}
+
+}  // namespace
+
+TEST(StubTemplateTest, MatchesAssembledStub)
+{
+  std::mt19937_64 random(11);
+
+  for (bool withReturnAddress : {false, true}) {
+    const auto stub = StubTemplate<uint64_t, VALUE_COUNT>::create([&](const Values& v) {
+      return assembleStub(v, withReturnAddress);
+    });
+    ASSERT_TRUE(stub.valid());
+
+    for (int i = 0; i < 100; ++i) {
+      const Values values = randomValues(random);
+      EXPECT_EQ(assembleStub(values, withReturnAddress), stub.patch(values));
+    }
+  }
+}
+
+TEST(StubTemplateTest, RejectsVariableEncoding)
+{
+  const auto stub = StubTemplate<uint64_t, 1>::create([](const auto& values) {
+    Encoder encoder;
+    encoder.movShortest(values[0] & 0xFFFFFFFFull);
+    encoder.ret();
+    return encoder.code();
+  });
+  EXPECT_FALSE(stub.valid());
+
+  // a value that leaks into another instruction
+  const auto leaky = StubTemplate<uint64_t, 1>::create([](const auto& values) {
+    Encoder encoder;
+    encoder.movImm(0, values[0]);
+    encoder.movImm(1, values[0] + 1);
+    return encoder.code();
+  });
+  EXPECT_FALSE(leaky.valid());
+}
+
+TEST(StubTemplateTest, NarrowValues)
+{
+  const auto stub = StubTemplate<uint32_t, 2>::create([](const auto& values) {
+    std::vector<uint8_t> code{0x68};
+    code.insert(code.end(), reinterpret_cast<const uint8_t*>(&values[1]),
+                reinterpret_cast<const uint8_t*>(&values[1]) + 4);
+    code.push_back(0xC3);
+    return code;
+  });
+  ASSERT_TRUE(stub.valid());
+  EXPECT_EQ(6u, stub.size());
+  EXPECT_EQ((std::vector<uint8_t>{0x68, 0x78, 0x56, 0x34, 0x12, 0xC3}),
+            stub.patch({0, 0x12345678}));
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <trace_recorder.h>
+
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+size_t countEvents(const TraceRecorder& recorder)
+{
+  size_t result = 0;
+  for (const auto& [tid, events] : recorder.events()) {
+    result += events.size();
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(TraceRecorderTest, Disabled)
+{
+  TraceRecorder recorder;
+  EXPECT_FALSE(recorder.enabled());
+  {
+    TraceSpan span("disabled", recorder);
+  }
+  EXPECT_EQ(0u, countEvents(recorder));
+
+  recorder.setEnabled(true);
+  {
+    TraceSpan span("enabled", recorder);
+    // a span only depends on the state when it was started
+    recorder.setEnabled(false);
+  }
+  {
+    TraceSpan span("disabled again", recorder);
+  }
+
+  const auto events = recorder.events();
+  ASSERT_EQ(1u, events.size());
+  ASSERT_EQ(1u, events[0].second.size());
+  EXPECT_STREQ("enabled", events[0].second[0].name);
+}
+
+TEST(TraceRecorderTest, NestedSpans)
+{
+  TraceRecorder recorder;
+  recorder.setEnabled(true);
+  {
+    TraceSpan outer("hook", recorder);
+    {
+      TraceSpan inner("tree walk", recorder);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  const auto events = recorder.events();
+  ASSERT_EQ(1u, events.size());
+  const auto& spans = events[0].second;
+  ASSERT_EQ(2u, spans.size());
+  // inner spans end first
+  EXPECT_STREQ("tree walk", spans[0].name);
+  EXPECT_STREQ("hook", spans[1].name);
+  EXPECT_LE(spans[1].start, spans[0].start);
+  EXPECT_GE(spans[1].start + spans[1].duration, spans[0].start + spans[0].duration);
+  EXPECT_GE(spans[0].duration, 1000000u);
+}
+
+TEST(TraceRecorderTest, ThreadBuffers)
+{
+  const int numThreads = 8;
+  const int numSpans   = 5000;
+
+  TraceRecorder recorder;
+  recorder.setEnabled(true);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&recorder]() {
+      for (int i = 0; i < numSpans; ++i) {
+        TraceSpan span("span", recorder);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const auto events = recorder.events();
+  std::set<uint32_t> tids;
+  for (const auto& [tid, spans] : events) {
+    tids.insert(tid);
+    EXPECT_EQ(numSpans, static_cast<int>(spans.size()));
+  }
+  EXPECT_EQ(numThreads, static_cast<int>(tids.size()));
+
+  recorder.clear();
+  EXPECT_EQ(0u, countEvents(recorder));
+}
+
+TEST(TraceRecorderTest, Limit)
+{
+  TraceRecorder recorder(10);
+  recorder.setEnabled(true);
+  for (int i = 0; i < 25; ++i) {
+    recorder.record("span", 0, 1);
+  }
+  EXPECT_EQ(10u, countEvents(recorder));
+  EXPECT_EQ(15u, recorder.dropped());
+
+  // clearing makes room again
+  recorder.clear();
+  recorder.record("span", 0, 1);
+  EXPECT_EQ(1u, countEvents(recorder));
+}
+
+TEST(TraceRecorderTest, ChromeTrace)
+{
+  TraceRecorder recorder;
+  recorder.record("hook_NtCreateFile", 1234567, 1236000);
+  recorder.record("say \"hi\"\\\n", 2000, 2001);
+
+  std::ostringstream out;
+  recorder.writeChromeTrace(out, 42, "game.exe");
+  const std::string json = out.str();
+
+  EXPECT_EQ(0u, json.find("{\"traceEvents\":["));
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":42,"
+                      "\"args\":{\"name\":\"game.exe\"}}"));
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"hook_NtCreateFile\",\"cat\":\"usvfs\",\"ph\":\"X\","
+                      "\"ts\":1234.567,\"dur\":1.433,\"pid\":42,\"tid\":"));
+  EXPECT_NE(std::string::npos,
+            json.find("\"name\":\"say \\\"hi\\\"\\\\\\u000a\",\"cat\":\"usvfs\","
+                      "\"ph\":\"X\",\"ts\":2.000,\"dur\":0.001,"));
+  EXPECT_EQ(json.size() - 2, json.rfind("}\n"));
+
+  // an empty trace is still a valid document
+  std::ostringstream empty;
+  TraceRecorder().writeChromeTrace(empty, 1);
+  EXPECT_EQ("{\"traceEvents\":[\n],\"displayTimeUnit\":\"ns\"}\n", empty.str());
+}
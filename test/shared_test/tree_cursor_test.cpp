@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+
+#include <tree_cursor.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using usvfs::shared::TreeCursor;
+
+namespace
+{
+
+// stands in for DirectoryTree, children are ordered by name
+class Node
+{
+public:
+  using NameT   = std::string;
+  using NodePtr = std::shared_ptr<Node>;
+  using NodeMap = std::map<std::string, NodePtr, std::less<>>;
+
+  explicit Node(std::string name) : m_Name(std::move(name)) {}
+
+  NameT name() const { return m_Name; }
+
+  NodePtr node(std::string_view name) const
+  {
+    auto iter = m_Nodes.find(name);
+    return iter != m_Nodes.end() ? iter->second : NodePtr();
+  }
+
+  NodeMap::const_iterator filesBegin() const { return m_Nodes.begin(); }
+  NodeMap::const_iterator filesEnd() const { return m_Nodes.end(); }
+
+  NodeMap::const_iterator filesAfter(std::string_view name) const
+  {
+    return m_Nodes.upper_bound(name);
+  }
+
+  Node& add(const std::string& name)
+  {
+    NodePtr& node = m_Nodes[name];
+    if (!node) {
+      node = std::make_shared<Node>(name);
+    }
+    return *node;
+  }
+
+  void remove(const std::string& name) { m_Nodes.erase(name); }
+
+private:
+  std::string m_Name;
+  NodeMap m_Nodes;
+};
+
+struct Visited
+{
+  std::string path;
+  uint32_t id;
+  uint32_t parentId;
+  uint32_t depth;
+};
+
+// reads the whole tree in pages, paths are reconstructed from the parent ids
+std::vector<Visited> readAll(TreeCursor<Node>& cursor, const Node& root,
+                             size_t pageSize)
+{
+  std::vector<Visited> result;
+  std::map<uint32_t, std::string> paths;
+  while (cursor.read(root, pageSize, [&](const Node& node, const auto& position) {
+    const std::string path =
+        position.parentId == 0 ? "" : paths.at(position.parentId) + "/" + node.name();
+    paths[position.id] = path;
+    result.push_back({path, position.id, position.parentId, position.depth});
+  }) > 0) {
+  }
+  return result;
+}
+
+void collect(const Node& node, const std::string& path, std::vector<std::string>& out)
+{
+  out.push_back(path);
+  for (auto iter = node.filesBegin(); iter != node.filesEnd(); ++iter) {
+    collect(*iter->second, path + "/" + iter->first, out);
+  }
+}
+
+Node randomTree(std::mt19937& random, size_t count)
+{
+  Node root("");
+  std::vector<Node*> nodes{&root};
+  for (size_t i = 0; i < count; ++i) {
+    Node* parent = nodes[random() % nodes.size()];
+    nodes.push_back(&parent->add("n" + std::to_string(random() % 1000)));
+  }
+  return root;
+}
+
+}  // namespace
+
+TEST(TreeCursorTest, EnumeratesDepthFirst)
+{
+  std::mt19937 random(3);
+  const Node root = randomTree(random, 2000);
+
+  std::vector<std::string> expected;
+  collect(root, "", expected);
+
+  for (size_t pageSize : {1, 7, 100, 100000}) {
+    TreeCursor<Node> cursor;
+    const std::vector<Visited> visited = readAll(cursor, root, pageSize);
+    EXPECT_TRUE(cursor.done());
+
+    ASSERT_EQ(expected.size(), visited.size());
+    for (size_t i = 0; i < visited.size(); ++i) {
+      EXPECT_EQ(expected[i], visited[i].path);
+      EXPECT_EQ(i + 1, visited[i].id);
+      EXPECT_LT(visited[i].parentId, visited[i].id);
+    }
+    EXPECT_EQ(0u, visited[0].parentId);
+    EXPECT_EQ(0u, visited[0].depth);
+
+    EXPECT_EQ(0u, cursor.read(root, pageSize, [](const Node&, const auto&) {}));
+  }
+}
+
+TEST(TreeCursorTest, EmptyTree)
+{
+  const Node root("");
+  TreeCursor<Node> cursor;
+  const std::vector<Visited> visited = readAll(cursor, root, 10);
+  ASSERT_EQ(1u, visited.size());
+  EXPECT_EQ(1u, visited[0].id);
+}
+
+TEST(TreeCursorTest, ContinuesAfterChanges)
+{
+  Node root("");
+  root.add("a").add("1");
+  root.add("b").add("1");
+  root.add("b").add("2");
+  root.add("c");
+
+  TreeCursor<Node> cursor;
+  std::vector<std::string> paths;
+  auto visitor = [&](const Node& node, const auto& position) {
+    paths.push_back(std::to_string(position.depth) + node.name());
+  };
+
+  // root, a, a/1, b, b/1
+  EXPECT_EQ(5u, cursor.read(root, 5, visitor));
+
+  // the node visited last is gone, nodes before the position are ignored and the
+  // ones after it are found
+  root.add("b").remove("1");
+  root.add("a").add("2");
+  root.add("b").add("0");
+  root.add("b").add("3");
+  root.add("d");
+
+  while (cursor.read(root, 2, visitor) > 0) {
+  }
+
+  EXPECT_EQ((std::vector<std::string>{"0", "1a", "21", "1b", "21", "22", "23", "1c",
+                                      "1d"}),
+            paths);
+}
+
+TEST(TreeCursorTest, RemovedAncestor)
+{
+  Node root("");
+  root.add("a").add("1").add("x");
+  root.add("b");
+
+  TreeCursor<Node> cursor;
+  std::vector<std::string> names;
+  auto visitor = [&](const Node& node, const auto&) {
+    names.push_back(node.name());
+  };
+
+  // root, a, a/1, a/1/x
+  EXPECT_EQ(4u, cursor.read(root, 4, visitor));
+  root.remove("a");
+  EXPECT_EQ(1u, cursor.read(root, 10, visitor));
+  EXPECT_EQ((std::vector<std::string>{"", "a", "1", "x", "b"}), names);
+  EXPECT_TRUE(cursor.done());
+}
@@ -0,0 +1,280 @@
+// Windows only: the trees are the real TreeContainer and PathResolver, which need
+// Windows shared memory and Windows.h
+#include <gtest/gtest.h>
+
+#include <path_resolver.h>
+#include <tree_container.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+class NullFileSystem : public ResolverFileSystem<std::u16string>
+{
+public:
+  uint32_t attributes(const std::u16string&) const override
+  {
+    return RESOLVER_INVALID_ATTRIBUTES;
+  }
+};
+
+std::string toUTF8(std::u16string_view source)
+{
+  std::string result;
+  result.reserve(source.size());
+  for (size_t i = 0; i < source.size(); ++i) {
+    uint32_t c = source[i];
+    if ((c >= 0xD800) && (c < 0xDC00) && (i + 1 < source.size())) {
+      c = 0x10000 + ((c - 0xD800) << 10) + (source[++i] - 0xDC00);
+    }
+
+    if (c < 0x80) {
+      result += static_cast<char>(c);
+    } else if (c < 0x800) {
+      result += static_cast<char>(0xC0 | (c >> 6));
+      result += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      result += static_cast<char>(0xE0 | (c >> 12));
+      result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      result += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+      result += static_cast<char>(0xF0 | (c >> 18));
+      result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+      result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      result += static_cast<char>(0x80 | (c & 0x3F));
+    }
+  }
+  return result;
+}
+
+std::u16string toUTF16(const std::string& source)
+{
+  std::u16string result;
+  result.reserve(source.size());
+  for (size_t i = 0; i < source.size();) {
+    const uint8_t lead = static_cast<uint8_t>(source[i]);
+    size_t length      = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+    uint32_t c         = length == 1   ? lead
+                         : length == 2 ? lead & 0x1F
+                         : length == 3 ? lead & 0x0F
+                                       : lead & 0x07;
+    for (size_t j = 1; j < length; ++j) {
+      c = (c << 6) | (static_cast<uint8_t>(source[i + j]) & 0x3F);
+    }
+    i += length;
+
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      result += static_cast<char16_t>(0xD800 + (c >> 10));
+      result += static_cast<char16_t>(0xDC00 + (c & 0x3FF));
+    } else {
+      result += static_cast<char16_t>(c);
+    }
+  }
+  return result;
+}
+
+// the nodes store an index into the targets of the test, so the data doesn't need
+// strings in shared memory
+struct TargetIndex
+{
+  uint32_t index{0};
+};
+
+}  // namespace
+
+template <>
+struct usvfs::shared::SHMDataCreator<TargetIndex, TargetIndex>
+{
+  static TargetIndex create(TargetIndex source, const VoidAllocatorT&)
+  {
+    return source;
+  }
+};
+
+template <>
+inline TargetIndex usvfs::shared::createDataEmpty<TargetIndex>(const VoidAllocatorT&)
+{
+  return TargetIndex();
+}
+
+template <>
+inline void usvfs::shared::dataAssign<TargetIndex>(TargetIndex& destination,
+                                                   const TargetIndex& source)
+{
+  destination = source;
+}
+
+namespace
+{
+
+void toTreeName(std::u16string_view source, std::string& destination)
+{
+  destination = toUTF8(source);
+}
+
+void toTreeName(std::u16string_view source, std::wstring& destination)
+{
+  destination.assign(source.begin(), source.end());
+}
+
+std::u16string fromTreeName(const std::string& source)
+{
+  return toUTF16(source);
+}
+
+std::u16string fromTreeName(const std::wstring& source)
+{
+  return std::u16string(source.begin(), source.end());
+}
+
+/**
+ * redirection tree storing its names as CharT, the hooks look up UTF-16 paths. A tree
+ * storing UTF-8 converts every name looked up and every target returned, the way the
+ * redirection tree did before it stored UTF-16
+ */
+template <typename CharT>
+class EncodingTree
+{
+public:
+  typedef DirectoryTree<TargetIndex, CharT> TreeT;
+  typedef typename TreeT::NameT NameT;
+  typedef typename TreeT::NodePtrT NodeRef;
+
+  explicit EncodingTree(const std::string& SHMName) : m_Container(SHMName) {}
+
+  void add(const std::u16string& path, const std::u16string& linkTarget)
+  {
+    NameT name;
+    toTreeName(path, name);
+    NameT target;
+    toTreeName(linkTarget, target);
+
+    m_Container.addFile(fs::path(name),
+                        TargetIndex{static_cast<uint32_t>(m_Targets.size())});
+    m_Targets.push_back(target);
+  }
+
+  NodeRef child(const NodeRef& parent, std::u16string_view name) const
+  {
+    NameT converted;
+    toTreeName(name, converted);
+    if (parent.get() == nullptr) {
+      return m_Container->node(converted);
+    }
+    return parent->node(converted);
+  }
+
+  bool isDirectory(const NodeRef& node) const { return node->isDirectory(); }
+  size_t createTargetDistance(const NodeRef&) const
+  {
+    return RESOLVER_NO_CREATE_TARGET;
+  }
+  NodeRef ancestor(const NodeRef& node, size_t) const { return node; }
+
+  std::u16string linkTarget(const NodeRef& node) const
+  {
+    if (node->isDirectory()) {
+      return std::u16string();
+    }
+    return fromTreeName(m_Targets[node->data().index]);
+  }
+
+  const FileMetadata* metadata(const NodeRef&) const { return nullptr; }
+
+private:
+  TreeContainer<TreeT> m_Container;
+  std::vector<NameT> m_Targets;
+};
+
+typedef EncodingTree<char> UTF8Tree;
+typedef EncodingTree<wchar_t> UTF16Tree;
+
+template <typename TreeT>
+std::u16string resolve(const TreeT& tree, const std::u16string& path)
+{
+  NullFileSystem fs;
+  PathResolver<TreeT, std::u16string> resolver(tree, fs);
+  return resolver.resolve(path).target;
+}
+
+}  // namespace
+
+TEST(TreeEncodingTest, Conversion)
+{
+  const std::u16string name = u"Textures\\\u00c4rmor_\u4e2d\U0001F600.dds";
+  EXPECT_EQ(name, toUTF16(toUTF8(name)));
+  EXPECT_EQ(std::string("Textures\\\xc3\x84rmor_\xe4\xb8\xad\xf0\x9f\x98\x80.dds"),
+            toUTF8(name));
+}
+
+TEST(TreeEncodingTest, SameResults)
+{
+  const std::u16string path   = u"C:\\Game\\Data\\\u00c4rmor\\\u4e2d.dds";
+  const std::u16string target = u"C:\\Mods\\\U0001F600\\\u00c4rmor\\\u4e2d.dds";
+
+  UTF8Tree utf8("treetest_encoding_utf8");
+  UTF16Tree utf16("treetest_encoding_utf16");
+  utf8.add(path, target);
+  utf16.add(path, target);
+
+  EXPECT_EQ(target, resolve(utf8, u"c:\\game\\DATA\\\u00c4rmor\\\u4e2d.dds"));
+  EXPECT_EQ(target, resolve(utf16, u"c:\\game\\DATA\\\u00c4rmor\\\u4e2d.dds"));
+  EXPECT_EQ(u"C:\\Game\\Data\\missing.dds",
+            resolve(utf8, u"C:\\Game\\Data\\missing.dds"));
+  EXPECT_EQ(u"C:\\Game\\Data\\missing.dds",
+            resolve(utf16, u"C:\\Game\\Data\\missing.dds"));
+}
+
+TEST(TreeEncodingTest, Benchmark)
+{
+  const int numFiles   = 20000;
+  const int numLookups = 200000;
+
+  UTF8Tree utf8("treetest_encoding_utf8");
+  UTF16Tree utf16("treetest_encoding_utf16");
+  std::vector<std::u16string> paths;
+  for (int i = 0; i < numFiles; ++i) {
+    char name[96];
+    snprintf(name, sizeof(name), "meshes\\armor\\set%03d\\piece%05d.nif", i % 250, i);
+    const std::u16string relative = toUTF16(name);
+    const std::u16string path =
+        u"C:\\Games\\Steam\\steamapps\\common\\Skyrim Special Edition\\Data\\" +
+        relative;
+    const std::u16string target = u"D:\\Modding\\mods\\Armor Pack\\" + relative;
+    utf8.add(path, target);
+    utf16.add(path, target);
+    paths.push_back(path);
+  }
+
+  NullFileSystem fs;
+  PathResolver<UTF8Tree, std::u16string> utf8Resolver(utf8, fs);
+  PathResolver<UTF16Tree, std::u16string> utf16Resolver(utf16, fs);
+
+  size_t checksum = 0;
+
+  auto utf8Start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numLookups; ++i) {
+    checksum += utf8Resolver.resolve(paths[i % numFiles]).target.size();
+  }
+  auto utf8Time = std::chrono::steady_clock::now() - utf8Start;
+
+  auto utf16Start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numLookups; ++i) {
+    checksum -= utf16Resolver.resolve(paths[i % numFiles]).target.size();
+  }
+  auto utf16Time = std::chrono::steady_clock::now() - utf16Start;
+
+  using ns = std::chrono::duration<double, std::nano>;
+  printf("utf-8 keys:  %.0f ns per lookup\n", ns(utf8Time).count() / numLookups);
+  printf("utf-16 keys: %.0f ns per lookup\n", ns(utf16Time).count() / numLookups);
+
+  // only the results are compared, timings are too noisy on shared machines
+  EXPECT_EQ(0u, checksum);
+}
@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <utf_transcoder.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace usvfs::shared;
+
+namespace
+{
+
+// straightforward reference encoders, one code point at a time
+
+void referenceUTF16(char32_t c, std::u16string& out)
+{
+  if (c >= 0x10000) {
+    out += static_cast<char16_t>(0xD800 + ((c - 0x10000) >> 10));
+    out += static_cast<char16_t>(0xDC00 + ((c - 0x10000) & 0x3FF));
+  } else {
+    out += static_cast<char16_t>(c);
+  }
+}
+
+void referenceUTF8(char32_t c, std::string& out)
+{
+  if (c < 0x80) {
+    out += static_cast<char>(c);
+  } else if (c < 0x800) {
+    out += static_cast<char>(0xC0 | (c >> 6));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    out += static_cast<char>(0xE0 | (c >> 12));
+    out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (c >> 18));
+    out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  }
+}
+
+std::string toUTF8(const std::u16string& source)
+{
+  std::string result;
+  utf::appendUTF8(result, source.data(), source.size());
+  return result;
+}
+
+std::u16string toUTF16(const std::string& source)
+{
+  std::u16string result;
+  utf::appendUTF16(result, source.data(), source.size());
+  return result;
+}
+
+bool isSurrogate(char32_t c)
+{
+  return (c >= 0xD800) && (c < 0xE000);
+}
+
+}  // namespace
+
+TEST(UTFTranscoderTest, EveryCodePoint)
+{
+  std::u16string utf16;
+  std::string utf8;
+  for (char32_t c = 0; c <= 0x10FFFF; ++c) {
+    if (isSurrogate(c)) {
+      continue;
+    }
+
+    utf16.clear();
+    utf8.clear();
+    referenceUTF16(c, utf16);
+    referenceUTF8(c, utf8);
+
+    ASSERT_EQ(utf8, toUTF8(utf16)) << "code point " << static_cast<uint32_t>(c);
+    ASSERT_EQ(utf16, toUTF16(utf8)) << "code point " << static_cast<uint32_t>(c);
+  }
+}
+
+TEST(UTFTranscoderTest, AllCodePointsAtOnce)
+{
+  // the same, as one long text so the conversion keeps switching between the ascii
+  // and the general path
+  std::u16string utf16;
+  std::string utf8;
+  for (char32_t c = 0; c <= 0x10FFFF; ++c) {
+    if (!isSurrogate(c)) {
+      referenceUTF16(c, utf16);
+      referenceUTF8(c, utf8);
+      if (c % 7 == 0) {
+        for (char32_t ascii = 'a'; ascii < 'a' + (c % 41); ++ascii) {
+          referenceUTF16(ascii, utf16);
+          referenceUTF8(ascii, utf8);
+        }
+      }
+    }
+  }
+
+  EXPECT_EQ(utf8, toUTF8(utf16));
+  EXPECT_EQ(utf16, toUTF16(utf8));
+}
+
+TEST(UTFTranscoderTest, AsciiBlockBoundaries)
+{
+  // non-ascii characters at every position around the 16 and 32 character blocks
+  for (size_t length = 0; length < 100; ++length) {
+    for (size_t position = 0; position <= length; ++position) {
+      std::u16string utf16(length, u'x');
+      std::string utf8(length, 'x');
+      if (position < length) {
+        utf16[position] = u'\u00e9';
+        utf8.replace(position, 1, "\xc3\xa9");
+      }
+
+      ASSERT_EQ(utf8, toUTF8(utf16)) << length << " " << position;
+      ASSERT_EQ(utf16, toUTF16(utf8)) << length << " " << position;
+    }
+  }
+}
+
+TEST(UTFTranscoderTest, EmbeddedNull)
+{
+  const std::u16string utf16(u"a\0b\0", 4);
+  const std::string utf8("a\0b\0", 4);
+  EXPECT_EQ(utf8, toUTF8(utf16));
+  EXPECT_EQ(utf16, toUTF16(utf8));
+}
+
+TEST(UTFTranscoderTest, Appends)
+{
+  std::string utf8 = "prefix ";
+  utf::appendUTF8(utf8, u"\u00e4bc", 3);
+  EXPECT_EQ("prefix \xc3\xa4" "bc", utf8);
+
+  std::u16string utf16 = u"prefix ";
+  utf::appendUTF16(utf16, "\xc3\xa4" "bc", 4);
+  EXPECT_EQ(u"prefix \u00e4bc", utf16);
+}
+
+TEST(UTFTranscoderTest, UnpairedSurrogates)
+{
+  const std::string replacement = "\xef\xbf\xbd";
+
+  // lone high surrogate, at the end and followed by something else
+  EXPECT_EQ("a" + replacement, toUTF8(u"a\xd800"));
+  EXPECT_EQ("a" + replacement + "b", toUTF8(u"a\xd800" u"b"));
+  // lone low surrogate
+  EXPECT_EQ(replacement + "b", toUTF8(u"\xdc00" u"b"));
+  // two high surrogates, only the second one is part of a pair
+  EXPECT_EQ(replacement + "\xf0\x90\x80\x80", toUTF8(u"\xd800\xd800\xdc00"));
+  // reversed pair
+  EXPECT_EQ(replacement + replacement, toUTF8(u"\xdc00\xd800"));
+  // a pair split by the length
+  EXPECT_EQ(replacement, toUTF8(std::u16string(u"\xd800\xdc00", 1)));
+}
+
+TEST(UTFTranscoderTest, InvalidUTF8)
+{
+  const std::u16string r = u"\ufffd";
+
+  // stray continuation bytes and bytes that never appear in UTF-8
+  EXPECT_EQ(u"a" + r + u"b", toUTF16("a\x80" "b"));
+  EXPECT_EQ(r + r, toUTF16("\xfe\xff"));
+  // overlong encodings
+  EXPECT_EQ(r + r, toUTF16("\xc0\x80"));
+  EXPECT_EQ(r + r + r, toUTF16("\xe0\x80\x80"));
+  EXPECT_EQ(r + r + r + r, toUTF16("\xf0\x80\x80\x80"));
+  // encoded surrogate
+  EXPECT_EQ(r + r + r, toUTF16("\xed\xa0\x80"));
+  // past U+10FFFF
+  EXPECT_EQ(r + r + r + r, toUTF16("\xf4\x90\x80\x80"));
+  // truncated sequences are replaced as a whole
+  EXPECT_EQ(r + u"a", toUTF16("\xe2\x82" "a"));
+  EXPECT_EQ(r, toUTF16("\xf0\x9f\x98"));
+}
+
+TEST(UTFTranscoderTest, Benchmark)
+{
+  // converting hook parameters and log lines, mostly ascii paths with the odd
+  // non-ascii name. The comparison converts the way string_cast did with
+  // WideCharToMultiByte: one pass to determine the size, one to convert into a newly
+  // allocated string
+  const int numPaths      = 1000;
+  const int numIterations = 200;
+
+  std::vector<std::u16string> paths;
+  for (int i = 0; i < numPaths; ++i) {
+    char relative[64];
+    snprintf(relative, sizeof(relative), "meshes\\armor\\set%03d\\piece%05d.nif",
+             i % 250, i);
+    std::u16string path =
+        u"C:\\Games\\Steam\\steamapps\\common\\Skyrim Special Edition\\Data\\";
+    for (const char* c = relative; *c != '\0'; ++c) {
+      path += static_cast<char16_t>(*c);
+    }
+    if (i % 10 == 0) {
+      path += u"\\\u00c4rmor \u4e2d.dds";
+    }
+    paths.push_back(path);
+  }
+
+  auto twoPass = [](const std::u16string& source) {
+    size_t length = 0;
+    for (size_t i = 0; i < source.size(); ++i) {
+      const char32_t c = source[i];
+      length += c < 0x80 ? 1 : c < 0x800 ? 2 : isSurrogate(c) ? 2 : 3;
+    }
+    std::string result;
+    result.reserve(length);
+    for (size_t i = 0; i < source.size(); ++i) {
+      char32_t c = source[i];
+      if ((c >= 0xD800) && (c < 0xDC00) && (i + 1 < source.size())) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (source[++i] - 0xDC00);
+      }
+      referenceUTF8(c, result);
+    }
+    return result;
+  };
+
+  size_t checksum = 0;
+
+  auto twoPassStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    for (const auto& path : paths) {
+      checksum += twoPass(path).size();
+    }
+  }
+  auto twoPassTime = std::chrono::steady_clock::now() - twoPassStart;
+
+  std::string buffer;
+  auto singlePassStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < numIterations; ++i) {
+    for (const auto& path : paths) {
+      buffer.clear();
+      utf::appendUTF8(buffer, path.data(), path.size());
+      checksum -= buffer.size();
+    }
+  }
+  auto singlePassTime = std::chrono::steady_clock::now() - singlePassStart;
+
+  using ns        = std::chrono::duration<double, std::nano>;
+  const int count = numPaths * numIterations;
+  printf("two passes:  %.0f ns per path\n", ns(twoPassTime).count() / count);
+  printf("single pass: %.0f ns per path\n", ns(singlePassTime).count() / count);
+
+  EXPECT_EQ(0u, checksum);
+  EXPECT_LT(singlePassTime, twoPassTime);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <versioned_cache.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using usvfs::shared::VersionedCache;
+
+TEST(VersionedCacheTest, FindAndInsert)
+{
+  VersionedCache<std::wstring, std::wstring> cache;
+
+  EXPECT_FALSE(cache.find(L"a.dll", 0));
+
+  cache.insert(L"a.dll", 1, L"C:\\mods\\a.dll");
+  cache.insert(L"b.dll", 1, L"");
+  ASSERT_TRUE(cache.find(L"a.dll", 1).has_value());
+  EXPECT_EQ(L"C:\\mods\\a.dll", *cache.find(L"a.dll", 1));
+  // empty results are results too
+  ASSERT_TRUE(cache.find(L"b.dll", 1).has_value());
+  EXPECT_EQ(L"", *cache.find(L"b.dll", 1));
+  EXPECT_FALSE(cache.find(L"c.dll", 1));
+
+  cache.insert(L"a.dll", 1, L"C:\\other\\a.dll");
+  EXPECT_EQ(L"C:\\other\\a.dll", *cache.find(L"a.dll", 1));
+  EXPECT_EQ(2u, cache.size());
+
+  cache.erase(L"a.dll");
+  EXPECT_FALSE(cache.find(L"a.dll", 1));
+  EXPECT_EQ(1u, cache.size());
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(VersionedCacheTest, Versions)
+{
+  VersionedCache<int, int> cache;
+
+  cache.insert(1, 5, 10);
+  cache.insert(2, 5, 20);
+
+  // lookups for other versions miss, older or newer
+  EXPECT_FALSE(cache.find(1, 4));
+  EXPECT_FALSE(cache.find(1, 6));
+  EXPECT_EQ(10, *cache.find(1, 5));
+
+  // a new version replaces all entries
+  cache.insert(1, 6, 11);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(11, *cache.find(1, 6));
+  EXPECT_FALSE(cache.find(2, 6));
+  EXPECT_FALSE(cache.find(1, 5));
+}
+
+TEST(VersionedCacheTest, MaxSize)
+{
+  VersionedCache<int, int> cache(4);
+
+  for (int i = 0; i < 4; ++i) {
+    cache.insert(i, 0, i);
+  }
+  EXPECT_EQ(4u, cache.size());
+
+  // replacing an entry doesn't need room
+  cache.insert(3, 0, 30);
+  EXPECT_EQ(4u, cache.size());
+
+  cache.insert(4, 0, 4);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(4, *cache.find(4, 0));
+}
+
+TEST(VersionedCacheTest, Concurrent)
+{
+  VersionedCache<int, int> cache(64);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        const uint64_t version = i / 1000;
+        const int key          = (i * 7 + t) % 100;
+        if (auto value = cache.find(key, version)) {
+          // values are only ever stored for their own key and version
+          EXPECT_EQ(key * 1000 + static_cast<int>(version), *value);
+        } else {
+          cache.insert(key, version, key * 1000 + static_cast<int>(version));
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_LE(cache.size(), 64u);
+}
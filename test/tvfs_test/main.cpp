@@ -174,19 +174,119 @@ TEST_F(USVFSTest, CanResizeRedirectiontree)
       }
     }
 
-    ASSERT_EQ("gaga", container->node("C:")
-                          ->node("temp")
-                          ->node("aa", MissingThrow)
-                          ->data()
-                          .linkTarget);
-    ASSERT_EQ("gaga", container->node("C:")
-                          ->node("temp")
-                          ->node("az", MissingThrow)
-                          ->data()
-                          .linkTarget);
+    ASSERT_EQ(L"gaga", std::wstring(container->node(L"C:")
+                                        ->node(L"temp")
+                                        ->node(L"aa", MissingThrow)
+                                        ->data()
+                                        .linkTarget.c_str()));
+    ASSERT_EQ(L"gaga", std::wstring(container->node(L"C:")
+                                        ->node(L"temp")
+                                        ->node(L"az", MissingThrow)
+                                        ->data()
+                                        .linkTarget.c_str()));
   });
 }
 
+TEST_F(USVFSTest, RedirectionTreeTracksCreateTargets)
+{
+  using usvfs::RedirectionTree;
+  using usvfs::shared::FLAG_CREATETARGET;
+
+  usvfs::RedirectionTreeContainer container("createtargettest_shm", 64 * 1024);
+  container.addDirectory(R"(C:\game\data)",
+                         usvfs::RedirectionDataLocal("C:\\overwrite"),
+                         FLAG_CREATETARGET);
+  auto file = container.addFile(R"(C:\game\data\meshes\a.nif)",
+                                usvfs::RedirectionDataLocal("C:\\mods\\a.nif"));
+  auto game = container->node(L"C:")->node(L"game");
+  auto data = game->node(L"data");
+
+  EXPECT_EQ(2, file->anchorDistance());
+  EXPECT_TRUE(file->anchor().get() == data.get());
+  EXPECT_EQ(0, data->anchorDistance());
+  EXPECT_EQ(RedirectionTree::NO_ANCHOR, game->anchorDistance());
+  EXPECT_TRUE(game->anchor().get() == nullptr);
+
+  // moving the create target up updates the nodes below it
+  data->setFlag(FLAG_CREATETARGET, false);
+  EXPECT_EQ(RedirectionTree::NO_ANCHOR, file->anchorDistance());
+  game->setFlag(FLAG_CREATETARGET);
+  EXPECT_EQ(3, file->anchorDistance());
+  EXPECT_TRUE(file->anchor().get() == game.get());
+
+  // a create target added below takes over
+  container.addDirectory(R"(C:\game\data\meshes)",
+                         usvfs::RedirectionDataLocal("C:\\mods\\meshes"),
+                         FLAG_CREATETARGET);
+  EXPECT_EQ(1, file->anchorDistance());
+}
+
+TEST_F(USVFSTest, RedirectionTreeStoresMetadataOfLinkedFiles)
+{
+  using usvfs::cachedMetadata;
+  using usvfs::shared::FLAG_METADATASTALE;
+
+  ush::FileMetadata metadata;
+  metadata.size  = 42;
+  metadata.valid = true;
+
+  // small enough to be reallocated while adding files
+  usvfs::RedirectionTreeContainer container("metadatatest_shm", 4 * 1024);
+  const usvfs::RedirectionDataLocal linked(L"C:\\mods\\a.esp", metadata);
+  auto file  = container.addFile(R"(C:\game\data\a.esp)", linked);
+  auto plain = container.addFile(R"(C:\game\data\b.esp)",
+                                 usvfs::RedirectionDataLocal("C:\\mods\\b.esp"));
+
+  ASSERT_NE(nullptr, cachedMetadata(file));
+  EXPECT_EQ(42u, cachedMetadata(file)->size);
+  // nothing is stored for files linked without metadata
+  EXPECT_EQ(nullptr, plain->data().metadata());
+  EXPECT_EQ(nullptr, cachedMetadata(plain));
+  EXPECT_EQ(nullptr, cachedMetadata(container->findNode(R"(C:\game\data)")));
+
+  // nodes mustn't be kept across the reallocation
+  file.reset();
+  plain.reset();
+  for (int i = 0; i < 100; ++i) {
+    container.addFile(R"(C:\game\data\)" + std::to_string(i) + ".dds",
+                      usvfs::RedirectionDataLocal(L"C:\\mods\\texture.dds", metadata));
+  }
+
+  // the metadata is copied to the new shared memory
+  file = container->findNode(R"(C:\game\data\a.esp)");
+  ASSERT_NE(nullptr, cachedMetadata(file));
+  EXPECT_EQ(42u, cachedMetadata(file)->size);
+  EXPECT_EQ(nullptr, container->findNode(R"(C:\game\data\b.esp)")->data().metadata());
+
+  // files that may have been written don't report it
+  file->setFlag(FLAG_METADATASTALE);
+  EXPECT_EQ(nullptr, cachedMetadata(file));
+  EXPECT_NE(nullptr, file->data().metadata());
+
+  // relinking replaces it
+  file = container.addFile(R"(C:\game\data\a.esp)",
+                           usvfs::RedirectionDataLocal("C:\\mods\\other\\a.esp"));
+  EXPECT_EQ(nullptr, file->data().metadata());
+}
+
+TEST_F(USVFSTest, OpeningForWritingMayModifyFiles)
+{
+  using usvfs::mayModifyFile;
+
+  EXPECT_FALSE(mayModifyFile(FILE_READ_DATA | FILE_READ_ATTRIBUTES | SYNCHRONIZE));
+  EXPECT_FALSE(mayModifyFile(GENERIC_READ | GENERIC_EXECUTE));
+  EXPECT_FALSE(mayModifyFile(FILE_LIST_DIRECTORY | READ_CONTROL));
+
+  EXPECT_TRUE(mayModifyFile(FILE_WRITE_DATA));
+  EXPECT_TRUE(mayModifyFile(FILE_APPEND_DATA));
+  EXPECT_TRUE(mayModifyFile(FILE_WRITE_ATTRIBUTES));
+  EXPECT_TRUE(mayModifyFile(FILE_WRITE_EA));
+  EXPECT_TRUE(mayModifyFile(DELETE));
+  EXPECT_TRUE(mayModifyFile(GENERIC_READ | GENERIC_WRITE));
+  EXPECT_TRUE(mayModifyFile(GENERIC_ALL));
+  EXPECT_TRUE(mayModifyFile(MAXIMUM_ALLOWED));
+}
+
 /*
 TEST_F(USVFSTest, CreateFileHookReportsCorrectErrorOnMissingFile)
 {
@@ -539,6 +639,74 @@ TEST_F(USVFSTest, NtQueryObjectVirtualFile)
   usvfs::hook_NtClose(hdl);
 }
 
+TEST_F(USVFSTest, ParametersSnapshotBlacklist)
+{
+  ush::SharedMemoryT shm(bi::create_only, "parameterstest_shm", 64 * 1024);
+  auto params = defaultUsvfsParams();
+  usvfs::SharedParameters* parameters = shm.construct<usvfs::SharedParameters>(
+      "parameters")(*params, ush::VoidAllocatorT(shm.get_segment_manager()));
+  ASSERT_NE(nullptr, parameters);
+
+  parameters->blacklistExecutable("Launcher.exe");
+  parameters->blacklistExecutable("crashreporter.exe");
+
+  usvfs::ParametersSnapshotCache cache;
+  auto snapshot = cache.get(*parameters);
+  EXPECT_TRUE(snapshot->executableBlacklisted(R"(C:\Game\launcher.EXE)", {}));
+  EXPECT_TRUE(snapshot->executableBlacklisted(
+      {}, R"("C:\Game\CrashReporter.exe" --minidump)"));
+  // names have to match whole
+  EXPECT_FALSE(snapshot->executableBlacklisted(R"(C:\Game\MyLauncher.exe)", {}));
+  EXPECT_FALSE(snapshot->executableBlacklisted(R"(C:\Game\Game.exe)",
+                                               R"("C:\Game\Game.exe" -launcher)"));
+  EXPECT_FALSE(snapshot->executableBlacklisted({}, {}));
+
+  // process lists change all the time and don't need a new copy
+  parameters->registerProcess(1234);
+  EXPECT_EQ(snapshot, cache.get(*parameters));
+  parameters->unregisterProcess(1234);
+  EXPECT_EQ(snapshot, cache.get(*parameters));
+
+  parameters->clearExecutableBlacklist();
+  auto cleared = cache.get(*parameters);
+  EXPECT_NE(snapshot, cleared);
+  EXPECT_FALSE(cleared->executableBlacklisted(R"(C:\Game\Launcher.exe)", {}));
+  EXPECT_FALSE(parameters->executableBlacklisted(R"(C:\Game\Launcher.exe)", {}));
+
+  shm.destroy_ptr(parameters);
+}
+
+TEST_F(USVFSTest, ParametersSnapshotForcedLibraries)
+{
+  ush::SharedMemoryT shm(bi::create_only, "parameterstest_shm", 64 * 1024);
+  auto params = defaultUsvfsParams();
+  usvfs::SharedParameters* parameters = shm.construct<usvfs::SharedParameters>(
+      "parameters")(*params, ush::VoidAllocatorT(shm.get_segment_manager()));
+  ASSERT_NE(nullptr, parameters);
+
+  parameters->addForcedLibrary("Game.exe", R"(C:\mods\a.dll)");
+  parameters->addForcedLibrary("other.exe", R"(C:\mods\c.dll)");
+  parameters->addForcedLibrary("game.EXE", R"(C:\mods\b.dll)");
+
+  usvfs::ParametersSnapshotCache cache;
+  auto snapshot = cache.get(*parameters);
+
+  // process names are case insensitive
+  const auto& libraries = snapshot->forcedLibraries("GAME.exe");
+  ASSERT_EQ(2u, libraries.size());
+  EXPECT_THAT(libraries, ::testing::UnorderedElementsAre(R"(C:\mods\a.dll)",
+                                                         R"(C:\mods\b.dll)"));
+  EXPECT_THAT(snapshot->forcedLibraries("other.exe"),
+              ::testing::ElementsAre(R"(C:\mods\c.dll)"));
+  EXPECT_TRUE(snapshot->forcedLibraries("Game").empty());
+  EXPECT_TRUE(snapshot->forcedLibraries("missing.exe").empty());
+
+  parameters->clearForcedLibraries();
+  EXPECT_TRUE(cache.get(*parameters)->forcedLibraries("Game.exe").empty());
+
+  shm.destroy_ptr(parameters);
+}
+
 TEST_F(USVFSTestAuto, CannotCreateLinkToFileInNonexistantDirectory)
 {
   ASSERT_EQ(FALSE, usvfsVirtualLinkFile(
@@ -562,6 +730,60 @@ TEST_F(USVFSTestAuto, CanCreateMultipleLinks)
                      FILE_ATTRIBUTE_DIRECTORY);
 }
 
+TEST_F(USVFSTestAuto, WritesInvalidateRecordedMetadata)
+{
+  namespace fs = std::filesystem;
+
+  const fs::path base = fs::temp_directory_path() / "usvfs_metadata_test";
+  const fs::path real = base / "real";
+  const fs::path virt = base / "virtual";
+  std::error_code ec;
+  fs::remove_all(base, ec);
+  fs::create_directories(real);
+  fs::create_directories(virt);
+  {
+    std::ofstream file(real / "a.txt", std::ios::binary);
+    file << std::string(10, 'x');
+  }
+
+  ASSERT_EQ(TRUE, usvfsVirtualLinkDirectoryStatic(real.c_str(), virt.c_str(),
+                                                   LINKFLAG_RECURSIVE));
+  const std::wstring virtFile = (virt / "a.txt").wstring();
+
+  auto size = [&virtFile]() {
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    EXPECT_TRUE(usvfs::hook_GetFileAttributesExW(virtFile.c_str(),
+                                                 GetFileExInfoStandard, &data));
+    return data.nFileSizeLow;
+  };
+
+  EXPECT_EQ(10u, size());
+
+  // changes made behind the back of usvfs aren't noticed, the size is the one
+  // recorded when the directory was linked
+  {
+    std::ofstream file(real / "a.txt", std::ios::binary | std::ios::app);
+    file << std::string(5, 'y');
+  }
+  EXPECT_EQ(10u, size());
+
+  const ULONG options = FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE;
+  HANDLE handle       = hooked_NtOpenFile(
+      virtFile.c_str(), FILE_READ_DATA | SYNCHRONIZE, FILE_SHARE_READ, options);
+  ASSERT_NE(INVALID_HANDLE_VALUE, handle);
+  usvfs::hook_NtClose(handle);
+  EXPECT_EQ(10u, size());
+
+  // opening it for writing through usvfs does
+  handle = hooked_NtOpenFile(virtFile.c_str(), FILE_WRITE_DATA | SYNCHRONIZE,
+                             FILE_SHARE_READ, options);
+  ASSERT_NE(INVALID_HANDLE_VALUE, handle);
+  usvfs::hook_NtClose(handle);
+  EXPECT_EQ(15u, size());
+
+  fs::remove_all(base, ec);
+}
+
 int main(int argc, char** argv)
 {
   using namespace test;